@@ -1,10 +1,28 @@
-#include <math.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
 #include "bitpack.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BITPACK_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+/* bitpack object flags */
+#define BITPACK_FLAG_VIEW      0x01 /* data is borrowed from the caller */
+#define BITPACK_FLAG_READ_ONLY 0x02 /* modifications fail with BITPACK_ERR_READ_ONLY */
+
+/* number of bits in an unsigned long, the word of the wide field functions */
+#define BITPACK_WORD_BITS (sizeof(unsigned long) * 8)
+
 /* round up to the nearest multiple of 8 */
 static unsigned long round8(unsigned long v)
 {
@@ -15,469 +33,5186 @@ static unsigned long round8(unsigned long v)
     return v;
 }
 
-/* clear any previous errors on a bitpack object */
-static void _bitpack_err_clear(bitpack_t bp)
-{
-    if (bp->error != BITPACK_ERR_CLEAR) {
-        bp->error = BITPACK_ERR_CLEAR;
-        memset(bp->error_str, '\0', BITPACK_ERR_BUF_SIZE);
-    }
-}
-
-/* increase the size of a bitpack object, allocating more memory if necessary */
-static int _bitpack_resize(bitpack_t bp, unsigned long new_size)
-{
-   unsigned long new_data_size = round8(new_size) / 8;
-
-   if (new_data_size > bp->data_size) {
-        bp->data = realloc(bp->data, new_data_size);
+/*
+ * Lookup tables for the text dumpers.  _bitpack_bin_table[b] holds the 8
+ * characters "0"/"1" of byte b, stored MSB first as a big-endian word, and
+ * _bitpack_hex_table[b] holds the 2 hex digits of byte b.
+ */
+#define BITPACK_BIN1(b) (0x3030303030303030ULL | \
+        ((uint64_t)(((b) >> 7) & 1) << 56) | ((uint64_t)(((b) >> 6) & 1) << 48) | \
+        ((uint64_t)(((b) >> 5) & 1) << 40) | ((uint64_t)(((b) >> 4) & 1) << 32) | \
+        ((uint64_t)(((b) >> 3) & 1) << 24) | ((uint64_t)(((b) >> 2) & 1) << 16) | \
+        ((uint64_t)(((b) >> 1) & 1) << 8)  |  (uint64_t)((b) & 1))
+#define BITPACK_BIN1_LSB(b) (0x3030303030303030ULL | \
+        ((uint64_t)((b) & 1) << 56)        | ((uint64_t)(((b) >> 1) & 1) << 48) | \
+        ((uint64_t)(((b) >> 2) & 1) << 40) | ((uint64_t)(((b) >> 3) & 1) << 32) | \
+        ((uint64_t)(((b) >> 4) & 1) << 24) | ((uint64_t)(((b) >> 5) & 1) << 16) | \
+        ((uint64_t)(((b) >> 6) & 1) << 8)  |  (uint64_t)(((b) >> 7) & 1))
+#define BITPACK_BIN4(M, b)  M(b), M((b) + 1), M((b) + 2), M((b) + 3)
+#define BITPACK_BIN16(M, b) BITPACK_BIN4(M, b),  BITPACK_BIN4(M, (b) + 4),  BITPACK_BIN4(M, (b) + 8),  BITPACK_BIN4(M, (b) + 12)
+#define BITPACK_BIN64(M, b) BITPACK_BIN16(M, b), BITPACK_BIN16(M, (b) + 16), BITPACK_BIN16(M, (b) + 32), BITPACK_BIN16(M, (b) + 48)
 
-        if (bp->data == NULL) {
-            bp->error = BITPACK_ERR_MALLOC_FAILED;
-            strncpy(bp->error_str, "memory allocation failed", BITPACK_ERR_BUF_SIZE);
-            return BITPACK_RV_ERROR;
-        }
+static const uint64_t _bitpack_bin_table[256] = {
+    BITPACK_BIN64(BITPACK_BIN1, 0),   BITPACK_BIN64(BITPACK_BIN1, 64),
+    BITPACK_BIN64(BITPACK_BIN1, 128), BITPACK_BIN64(BITPACK_BIN1, 192)
+};
 
-        memset(bp->data + bp->data_size, 0, new_data_size - bp->data_size);
+/* the same for LSB first bitpacks, where the first character is the low bit */
+static const uint64_t _bitpack_bin_table_lsb[256] = {
+    BITPACK_BIN64(BITPACK_BIN1_LSB, 0),   BITPACK_BIN64(BITPACK_BIN1_LSB, 64),
+    BITPACK_BIN64(BITPACK_BIN1_LSB, 128), BITPACK_BIN64(BITPACK_BIN1_LSB, 192)
+};
 
-        bp->data_size = new_data_size;
-   }
+#define BITPACK_HEX_DIGIT(n) ((n) < 10 ? '0' + (n) : 'a' - 10 + (n))
+#define BITPACK_HEX1(b)  (unsigned short)((BITPACK_HEX_DIGIT(((b) >> 4) & 0xf) << 8) | BITPACK_HEX_DIGIT((b) & 0xf))
+#define BITPACK_HEX4(b)  BITPACK_HEX1(b),  BITPACK_HEX1((b) + 1),  BITPACK_HEX1((b) + 2),  BITPACK_HEX1((b) + 3)
+#define BITPACK_HEX16(b) BITPACK_HEX4(b),  BITPACK_HEX4((b) + 4),  BITPACK_HEX4((b) + 8),  BITPACK_HEX4((b) + 12)
+#define BITPACK_HEX64(b) BITPACK_HEX16(b), BITPACK_HEX16((b) + 16), BITPACK_HEX16((b) + 32), BITPACK_HEX16((b) + 48)
 
-   bp->size = new_size;
+static const unsigned short _bitpack_hex_table[256] = {
+    BITPACK_HEX64(0), BITPACK_HEX64(64), BITPACK_HEX64(128), BITPACK_HEX64(192)
+};
 
-   return BITPACK_RV_SUCCESS;
-}
+static const char _bitpack_base64_alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
-bitpack_t bitpack_init(unsigned long num_bytes)
+/* load 8 bytes starting at p as a big-endian 64 bit word */
+static uint64_t _bitpack_load_be64(const unsigned char *p)
 {
-    bitpack_t      bp;
-    unsigned char *data;
-
-    bp = malloc(sizeof(struct _bitpack_t));
-    if (bp == NULL) return NULL;
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint64_t w;
 
-    data = malloc(num_bytes);
+    memcpy(&w, p, 8);
 
-    if (data == NULL) {
-        free(bp);
-        return NULL;
-    }
+    return __builtin_bswap64(w);
+#elif defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    uint64_t w;
 
-    memset(data, 0, num_bytes);
+    memcpy(&w, p, 8);
 
-    bp->size      = 0;
-    bp->read_pos  = 0;
-    bp->data_size = num_bytes;
-    bp->data      = data;
-    bp->error     = BITPACK_ERR_CLEAR;
-    memset(bp->error_str, '\0', BITPACK_ERR_BUF_SIZE);
+    return w;
+#else
+    return ((uint64_t)p[0] << 56) | ((uint64_t)p[1] << 48) |
+           ((uint64_t)p[2] << 40) | ((uint64_t)p[3] << 32) |
+           ((uint64_t)p[4] << 24) | ((uint64_t)p[5] << 16) |
+           ((uint64_t)p[6] << 8)  |  (uint64_t)p[7];
+#endif
+}
 
-    return bp;
+/* store a 64 bit word into the 8 bytes starting at p in big-endian order */
+static void _bitpack_store_be64(unsigned char *p, uint64_t w)
+{
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    w = __builtin_bswap64(w);
+    memcpy(p, &w, 8);
+#elif defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    memcpy(p, &w, 8);
+#else
+    p[0] = w >> 56; p[1] = w >> 48; p[2] = w >> 40; p[3] = w >> 32;
+    p[4] = w >> 24; p[5] = w >> 16; p[6] = w >> 8;  p[7] = w;
+#endif
 }
 
-bitpack_t bitpack_init_from_bytes(unsigned char *bytes, unsigned long num_bytes)
+/* load 4 bytes starting at p as a big-endian 32 bit word */
+static uint32_t _bitpack_load_be32(const unsigned char *p)
 {
-    bitpack_t bp;
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint32_t w;
 
-    bp = bitpack_init(num_bytes);
+    memcpy(&w, p, 4);
 
-    if (bp == NULL) {
-        return NULL;
-    }
+    return __builtin_bswap32(w);
+#elif defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    uint32_t w;
 
-    memcpy(bp->data, bytes, num_bytes);
-    bp->size = num_bytes * 8;
+    memcpy(&w, p, 4);
 
-    return bp;
+    return w;
+#else
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8)  |  (uint32_t)p[3];
+#endif
 }
 
-void bitpack_destroy(bitpack_t bp)
+/* store a 32 bit word into the 4 bytes starting at p in big-endian order */
+static void _bitpack_store_be32(unsigned char *p, uint32_t w)
 {
-    free(bp->data);
-    free(bp);
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    w = __builtin_bswap32(w);
+    memcpy(p, &w, 4);
+#elif defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    memcpy(p, &w, 4);
+#else
+    p[0] = w >> 24; p[1] = w >> 16; p[2] = w >> 8; p[3] = w;
+#endif
 }
 
-unsigned long bitpack_size(bitpack_t bp)
+/* load 8 bytes starting at p as a little-endian 64 bit word */
+static uint64_t _bitpack_load_le64(const unsigned char *p)
 {
-    return bp->size;
-}
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint64_t w;
 
-unsigned long bitpack_data_size(bitpack_t bp)
-{
-    return bp->data_size;
+    memcpy(&w, p, 8);
+
+    return w;
+#elif defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    uint64_t w;
+
+    memcpy(&w, p, 8);
+
+    return __builtin_bswap64(w);
+#else
+    return ((uint64_t)p[7] << 56) | ((uint64_t)p[6] << 48) |
+           ((uint64_t)p[5] << 40) | ((uint64_t)p[4] << 32) |
+           ((uint64_t)p[3] << 24) | ((uint64_t)p[2] << 16) |
+           ((uint64_t)p[1] << 8)  |  (uint64_t)p[0];
+#endif
 }
 
-unsigned long bitpack_read_pos(bitpack_t bp)
+/* store a 64 bit word into the 8 bytes starting at p in little-endian order */
+static void _bitpack_store_le64(unsigned char *p, uint64_t w)
 {
-    return bp->read_pos;
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    memcpy(p, &w, 8);
+#elif defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    w = __builtin_bswap64(w);
+    memcpy(p, &w, 8);
+#else
+    p[7] = w >> 56; p[6] = w >> 48; p[5] = w >> 40; p[4] = w >> 32;
+    p[3] = w >> 24; p[2] = w >> 16; p[1] = w >> 8;  p[0] = w;
+#endif
 }
 
-void bitpack_reset_read_pos(bitpack_t bp)
+/* load 4 bytes starting at p as a little-endian 32 bit word */
+static uint32_t _bitpack_load_le32(const unsigned char *p)
 {
-    bp->read_pos = 0;
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint32_t w;
+
+    memcpy(&w, p, 4);
+
+    return w;
+#elif defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    uint32_t w;
+
+    memcpy(&w, p, 4);
+
+    return __builtin_bswap32(w);
+#else
+    return ((uint32_t)p[3] << 24) | ((uint32_t)p[2] << 16) |
+           ((uint32_t)p[1] << 8)  |  (uint32_t)p[0];
+#endif
 }
 
-bitpack_err_t bitpack_get_error(bitpack_t bp)
+/* store a 32 bit word into the 4 bytes starting at p in little-endian order */
+static void _bitpack_store_le32(unsigned char *p, uint32_t w)
 {
-    return bp->error;
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    memcpy(p, &w, 4);
+#elif defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    w = __builtin_bswap32(w);
+    memcpy(p, &w, 4);
+#else
+    p[3] = w >> 24; p[2] = w >> 16; p[1] = w >> 8; p[0] = w;
+#endif
 }
 
-char *bitpack_get_error_str(bitpack_t bp)
+/* reverse the order of the bits of a 64 bit word */
+static uint64_t _bitpack_reverse64(uint64_t w)
 {
-    return bp->error_str;
+    w = ((w >> 1) & 0x5555555555555555ULL) | ((w & 0x5555555555555555ULL) << 1);
+    w = ((w >> 2) & 0x3333333333333333ULL) | ((w & 0x3333333333333333ULL) << 2);
+    w = ((w >> 4) & 0x0f0f0f0f0f0f0f0fULL) | ((w & 0x0f0f0f0f0f0f0f0fULL) << 4);
+#if defined(__GNUC__)
+    return __builtin_bswap64(w);
+#else
+    w = ((w >> 8)  & 0x00ff00ff00ff00ffULL) | ((w & 0x00ff00ff00ff00ffULL) << 8);
+    w = ((w >> 16) & 0x0000ffff0000ffffULL) | ((w & 0x0000ffff0000ffffULL) << 16);
+    return (w >> 32) | (w << 32);
+#endif
 }
 
-int bitpack_on(bitpack_t bp, unsigned long index)
+/*
+ * Read num_bits (1 to 64) bits starting at bit index from a byte array of
+ * data_size bytes, MSB first.  A field spans at most 9 bytes, so this is a
+ * single 64 bit load plus one extra byte when the field straddles the end of
+ * the word.  Near the end of the array the bytes are staged through a zero
+ * padded buffer so we never load past data_size.
+ */
+static uint64_t _bitpack_read_field(const unsigned char *data, unsigned long data_size,
+        unsigned long index, unsigned long num_bits)
 {
-    unsigned long byte_offset;
-    unsigned long bit_offset;
-
-    _bitpack_err_clear(bp);
+    const unsigned char *p    = data + index / 8;
+    unsigned long        off  = index % 8;
+    unsigned long        left = data_size - index / 8;
+    unsigned char        tmp[9];
+    uint64_t             w;
 
-    if (bitpack_size(bp) == 0 || index > bitpack_size(bp) - 1) {
-        if (!_bitpack_resize(bp, index + 1)) {
-            return BITPACK_RV_ERROR;
-        }
+    if (left < 9) {
+        memset(tmp, 0, sizeof(tmp));
+        memcpy(tmp, p, left);
+        p = tmp;
     }
 
-    byte_offset = index / 8;
-    bit_offset  = index % 8;
+    w = _bitpack_load_be64(p) << off;
 
-    bp->data[byte_offset] |= (0x80 >> bit_offset);
+    if (off + num_bits > 64) {
+        w |= p[8] >> (8 - off);
+    }
 
-    return BITPACK_RV_SUCCESS;
+    return w >> (64 - num_bits);
 }
 
-int bitpack_off(bitpack_t bp, unsigned long index)
+/*
+ * Write the low num_bits (1 to 64) bits of value starting at bit index, MSB
+ * first, leaving the surrounding bits untouched.  The counterpart of
+ * _bitpack_read_field().
+ */
+static void _bitpack_write_field(unsigned char *data, unsigned long data_size,
+        unsigned long index, unsigned long num_bits, uint64_t value)
 {
-    unsigned long byte_offset;
-    unsigned long bit_offset;
-
-    _bitpack_err_clear(bp);
+    unsigned char *p    = data + index / 8;
+    unsigned long  off  = index % 8;
+    unsigned long  left = data_size - index / 8;
+    unsigned char  tmp[9];
+    uint64_t       mask = ~(uint64_t)0 << (64 - num_bits);
+    uint64_t       v    = value << (64 - num_bits);
+    uint64_t       w;
 
-    if (bitpack_size(bp) == 0 || index > bitpack_size(bp) - 1) {
-        if (!_bitpack_resize(bp, index + 1)) {
-            return BITPACK_RV_ERROR;
-        }
+    if (left < 9) {
+        memset(tmp, 0, sizeof(tmp));
+        memcpy(tmp, p, left);
+        p = tmp;
     }
 
-    byte_offset = index / 8;
-    bit_offset  = index % 8;
+    w = _bitpack_load_be64(p);
+    w = (w & ~(mask >> off)) | (v >> off);
+    _bitpack_store_be64(p, w);
 
-    bp->data[byte_offset] &= ~(0x80 >> bit_offset);
+    if (off + num_bits > 64) {
+        p[8] = (p[8] & ~(unsigned char)((mask << (64 - off)) >> 56)) |
+               (unsigned char)((v << (64 - off)) >> 56);
+    }
 
-    return BITPACK_RV_SUCCESS;
+    if (p == tmp) {
+        memcpy(data + index / 8, tmp, left);
+    }
 }
 
-int bitpack_get(bitpack_t bp, unsigned long index, unsigned char *bit)
-{
-    unsigned long byte_offset;
-    unsigned long bit_offset;
+/*
+ * Shifted byte copy, the building block for unaligned byte runs:
+ *
+ *   dst[k] = (src[k - 1] << (8 - r)) | (src[k] >> r)   for 0 <= k < n
+ *
+ * i.e. the bytes of src shifted right by r (1 to 7) bits, with the r bits
+ * shifted in at the front taken from src[-1], which must be readable.  There
+ * is a portable 64 bit funnel shift version plus SSE2 and AVX2 versions that
+ * are picked at runtime on x86.
+ */
+typedef void (*_bitpack_funnel_fn)(unsigned char *dst, const unsigned char *src,
+        unsigned long n, unsigned int r);
 
-    _bitpack_err_clear(bp);
+static void _bitpack_funnel_scalar(unsigned char *dst, const unsigned char *src,
+        unsigned long n, unsigned int r)
+{
+    unsigned long k = 0;
+    uint64_t      w;
 
-    if (bitpack_size(bp) == 0) {
-        bp->error = BITPACK_ERR_EMPTY;
-        strncpy(bp->error_str, "bitpack is empty", BITPACK_ERR_BUF_SIZE);
-        return BITPACK_RV_ERROR;
+    for (; k + 8 <= n; k += 8) {
+        w = _bitpack_load_be64(src + k - 1);
+        _bitpack_store_be64(dst + k, (w << (8 - r)) | (src[k + 7] >> r));
     }
 
-    if (index > bitpack_size(bp) - 1) {
-        bp->error = BITPACK_ERR_INVALID_INDEX;
-        snprintf(bp->error_str, BITPACK_ERR_BUF_SIZE,
-                "invalid index (%lu), max index is %lu",
-                index, bitpack_size(bp) - 1);
-        return BITPACK_RV_ERROR;
+    for (; k < n; k++) {
+        dst[k] = (src[k - 1] << (8 - r)) | (src[k] >> r);
     }
+}
 
-    byte_offset = index / 8;
-    bit_offset  = index % 8;
+#ifdef BITPACK_X86_SIMD
+/*
+ * x86 has no 8 bit shifts, so shift 16 bit lanes and mask off the bits that
+ * crossed over from the neighbouring byte
+ */
+__attribute__((target("sse2")))
+static void _bitpack_funnel_sse2(unsigned char *dst, const unsigned char *src,
+        unsigned long n, unsigned int r)
+{
+    unsigned long k       = 0;
+    __m128i       lshift  = _mm_cvtsi32_si128(8 - r);
+    __m128i       rshift  = _mm_cvtsi32_si128(r);
+    __m128i       hi_mask = _mm_set1_epi8((char)(0xff << (8 - r)));
+    __m128i       lo_mask = _mm_set1_epi8((char)(0xff >> r));
+    __m128i       hi, lo;
 
-    if (bp->data[byte_offset] & (0x80 >> bit_offset)) {
-        *bit = 1;
-    }
-    else {
-        *bit = 0;
+    for (; k + 16 <= n; k += 16) {
+        hi = _mm_loadu_si128((const __m128i *)(src + k - 1));
+        lo = _mm_loadu_si128((const __m128i *)(src + k));
+        hi = _mm_and_si128(_mm_sll_epi16(hi, lshift), hi_mask);
+        lo = _mm_and_si128(_mm_srl_epi16(lo, rshift), lo_mask);
+        _mm_storeu_si128((__m128i *)(dst + k), _mm_or_si128(hi, lo));
     }
 
-    return BITPACK_RV_SUCCESS;
+    _bitpack_funnel_scalar(dst + k, src + k, n - k, r);
 }
 
-int bitpack_set_bits(bitpack_t bp, unsigned long value, unsigned long num_bits, unsigned long index)
+__attribute__((target("avx2")))
+static void _bitpack_funnel_avx2(unsigned char *dst, const unsigned char *src,
+        unsigned long n, unsigned int r)
 {
-    unsigned long i;
-    unsigned long mask;
-
-    _bitpack_err_clear(bp);
+    unsigned long k       = 0;
+    __m128i       lshift  = _mm_cvtsi32_si128(8 - r);
+    __m128i       rshift  = _mm_cvtsi32_si128(r);
+    __m256i       hi_mask = _mm256_set1_epi8((char)(0xff << (8 - r)));
+    __m256i       lo_mask = _mm256_set1_epi8((char)(0xff >> r));
+    __m256i       hi, lo;
 
-    /* make sure the range isn't bigger than the size of an unsigned long */
-    if (num_bits > sizeof(unsigned long) * 8) {
-        bp->error = BITPACK_ERR_RANGE_TOO_BIG;
-        snprintf(bp->error_str, BITPACK_ERR_BUF_SIZE,
-                "range size %lu bits is too large (maximum size is %lu bits)",
-                num_bits, sizeof(unsigned long) * 8);
-        return BITPACK_RV_ERROR;
+    for (; k + 32 <= n; k += 32) {
+        hi = _mm256_loadu_si256((const __m256i *)(src + k - 1));
+        lo = _mm256_loadu_si256((const __m256i *)(src + k));
+        hi = _mm256_and_si256(_mm256_sll_epi16(hi, lshift), hi_mask);
+        lo = _mm256_and_si256(_mm256_srl_epi16(lo, rshift), lo_mask);
+        _mm256_storeu_si256((__m256i *)(dst + k), _mm256_or_si256(hi, lo));
     }
 
-    /* make sure that the range is large enough to pack value */
-    if (value > pow(2, num_bits) - 1) {
-        bp->error = BITPACK_ERR_VALUE_TOO_BIG;
-        snprintf(bp->error_str, BITPACK_ERR_BUF_SIZE,
-                "value %lu does not fit in %lu bits",
-                value, num_bits);
-        return BITPACK_RV_ERROR;
-    }
+    _bitpack_funnel_scalar(dst + k, src + k, n - k, r);
+}
+#endif
 
-    if (bitpack_size(bp) < index + num_bits) {
-        if (!_bitpack_resize(bp, index + num_bits)) {
-            return BITPACK_RV_ERROR;
-        }
+/* pick the best shifted copy for this CPU */
+static _bitpack_funnel_fn _bitpack_funnel_select(void)
+{
+#ifdef BITPACK_X86_SIMD
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")) {
+        return _bitpack_funnel_avx2;
     }
 
-    for (i = num_bits; i != 0; i--) {
-        mask = 1 << (i - 1);
-        if (value & mask) {
-            if (!bitpack_on(bp, index)) {
-                return BITPACK_RV_ERROR;
-            }
-        }
-        else {
-            if (!bitpack_off(bp, index)) {
-                return BITPACK_RV_ERROR;
-            }
-        }
-        index++;
+    if (__builtin_cpu_supports("sse2")) {
+        return _bitpack_funnel_sse2;
     }
+#endif
 
-    return BITPACK_RV_SUCCESS;
+    return _bitpack_funnel_scalar;
 }
 
-int bitpack_set_bytes(bitpack_t bp, unsigned char *value, unsigned long num_bytes, unsigned long index)
+static void _bitpack_funnel(unsigned char *dst, const unsigned char *src,
+        unsigned long n, unsigned int r)
 {
-    unsigned long i;
-
-    _bitpack_err_clear(bp);
+    static _bitpack_funnel_fn funnel = NULL;
 
-    if (bitpack_size(bp) < index + num_bytes * 8) {
-        if (!_bitpack_resize(bp, index + num_bytes * 8)) {
-            return BITPACK_RV_ERROR;
-        }
+    if (funnel == NULL) {
+        funnel = _bitpack_funnel_select();
     }
 
+    funnel(dst, src, n, r);
+}
+
+/*
+ * Copy num_bytes bytes from value into data starting at bit index.  The
+ * bits on either side of the run are left untouched.
+ */
+static void _bitpack_put_bytes(unsigned char *data, unsigned long index,
+        const unsigned char *value, unsigned long num_bytes)
+{
+    unsigned char *dst;
+    unsigned int   off;
+
     if (index % 8 == 0) {
         /* index is at the beginning of a byte, so just do a memcpy */
-        memcpy(bp->data + index / 8, value, num_bytes);
-    }
-    else {
-        /* need to set each bit individually */
-        for (i = 0; i < num_bytes; i++) {
-            if (!bitpack_set_bits(bp, value[i], 8, index + i * 8)) {
-                return BITPACK_RV_ERROR;
-            }
-        }
+        memcpy(data + index / 8, value, num_bytes);
     }
+    else if (num_bytes > 0) {
+        /*
+         * the run straddles num_bytes + 1 bytes: merge the partial first and
+         * last bytes and do a shifted copy of everything in between
+         */
+        dst = data + index / 8;
+        off = index % 8;
 
-    return BITPACK_RV_SUCCESS;
+        dst[0] = (dst[0] & ~(0xff >> off)) | (value[0] >> off);
+        _bitpack_funnel(dst + 1, value + 1, num_bytes - 1, off);
+        dst[num_bytes] = (dst[num_bytes] & (0xff >> off)) |
+                         (unsigned char)(value[num_bytes - 1] << (8 - off));
+    }
 }
 
-int bitpack_get_bits(bitpack_t bp, unsigned long num_bits, unsigned long index, unsigned long *value)
+/* copy num_bytes bytes starting at bit index of data into value */
+static void _bitpack_take_bytes(const unsigned char *data, unsigned long index,
+        unsigned char *value, unsigned long num_bytes)
 {
-    unsigned long i, v = 0;
-    unsigned char bit;
-
-    _bitpack_err_clear(bp);
-
-    if (index >= bitpack_size(bp)) {
-        bp->error = BITPACK_ERR_INVALID_INDEX;
-        snprintf(bp->error_str, BITPACK_ERR_BUF_SIZE,
-                "invalid index (%lu), max index is %lu",
-                index, bitpack_size(bp) - 1);
-        return BITPACK_RV_ERROR;
+    if (index % 8 == 0) {
+        /* index is the start of a byte, so just do a memcpy */
+        memcpy(value, data + index / 8, num_bytes);
     }
-
-    if (index + num_bits > bitpack_size(bp)) {
-        bp->error = BITPACK_ERR_READ_PAST_END;
-        snprintf(bp->error_str, BITPACK_ERR_BUF_SIZE,
-                "attempted to read past end of bitpack (last index is %lu)",
-                bitpack_size(bp) - 1);
-        return BITPACK_RV_ERROR;
+    else if (num_bytes > 0) {
+        /* shifted copy, each byte is the tail of one byte plus the head of the next */
+        _bitpack_funnel(value, data + index / 8 + 1, num_bytes, 8 - index % 8);
     }
+}
 
-    if (num_bits > sizeof(unsigned long) * 8) {
-        bp->error = BITPACK_ERR_RANGE_TOO_BIG;
-        snprintf(bp->error_str, BITPACK_ERR_BUF_SIZE,
-                "range size %lu bits is too large (maximum size is %lu bits)",
-                num_bits, sizeof(unsigned long) * 8);
-        return BITPACK_RV_ERROR;
+/*
+ * LSB first counterparts of the primitives above, for bitpacks in
+ * BITPACK_LSB_FIRST order.  Bit index i is the bit of value 1 << (i % 8) of
+ * byte i / 8 and fields are stored least significant bit first, so a field
+ * is a little-endian load shifted down by index % 8.
+ */
+static uint64_t _bitpack_read_field_lsb(const unsigned char *data, unsigned long data_size,
+        unsigned long index, unsigned long num_bits)
+{
+    const unsigned char *p    = data + index / 8;
+    unsigned long        off  = index % 8;
+    unsigned long        left = data_size - index / 8;
+    unsigned char        tmp[9];
+    uint64_t             w;
+
+    if (left < 9) {
+        memset(tmp, 0, sizeof(tmp));
+        memcpy(tmp, p, left);
+        p = tmp;
     }
 
-    for (i = 0; i < num_bits; i++) {
-        bitpack_get(bp, index + i, &bit);
+    w = _bitpack_load_le64(p) >> off;
 
-        if (bit == 1) {
-            v |= bit << (num_bits - i - 1);
-        }
+    if (off + num_bits > 64) {
+        w |= (uint64_t)p[8] << (64 - off);
     }
 
-    *value = v;
-
-    return BITPACK_RV_SUCCESS;
+    return w & (~(uint64_t)0 >> (64 - num_bits));
 }
 
-int bitpack_get_bytes(bitpack_t bp, unsigned long num_bytes, unsigned long index, unsigned char **value)
+static void _bitpack_write_field_lsb(unsigned char *data, unsigned long data_size,
+        unsigned long index, unsigned long num_bits, uint64_t value)
 {
-    unsigned long  i;
-    unsigned long  byte;
-    unsigned char *unpacked;
-
-    _bitpack_err_clear(bp);
+    unsigned char *p    = data + index / 8;
+    unsigned long  off  = index % 8;
+    unsigned long  left = data_size - index / 8;
+    unsigned char  tmp[9];
+    uint64_t       mask = ~(uint64_t)0 >> (64 - num_bits);
+    uint64_t       v    = value & mask;
+    uint64_t       w;
 
-    if (index >= bitpack_size(bp)) {
-        bp->error = BITPACK_ERR_INVALID_INDEX;
-        snprintf(bp->error_str, BITPACK_ERR_BUF_SIZE,
-                "invalid index (%lu), max index is %lu",
-                index, bitpack_size(bp) - 1);
-        return BITPACK_RV_ERROR;
+    if (left < 9) {
+        memset(tmp, 0, sizeof(tmp));
+        memcpy(tmp, p, left);
+        p = tmp;
     }
 
-    if (index + num_bytes * 8 > bitpack_size(bp)) {
-        bp->error = BITPACK_ERR_READ_PAST_END;
-        snprintf(bp->error_str, BITPACK_ERR_BUF_SIZE,
-                "attempted to read past end of bitpack (last index is %lu)",
-                bitpack_size(bp) - 1);
-        return BITPACK_RV_ERROR;
-    }
+    w = _bitpack_load_le64(p);
+    w = (w & ~(mask << off)) | (v << off);
+    _bitpack_store_le64(p, w);
 
-    unpacked = malloc(num_bytes);
-    if (unpacked == NULL) {
-        bp->error = BITPACK_ERR_MALLOC_FAILED;
-        strncpy(bp->error_str, "memory allocation failed", BITPACK_ERR_BUF_SIZE);
-        return BITPACK_RV_ERROR;
+    if (off + num_bits > 64) {
+        p[8] = (p[8] & ~(unsigned char)(mask >> (64 - off))) |
+               (unsigned char)(v >> (64 - off));
     }
 
-    if (index % 8 == 0) {
-        /* index is the start of a byte, so just do a memcpy */
-        memcpy(unpacked, bp->data + index / 8, num_bytes);
-    }
-    else {
-        /* need to unpack a byte at a time */
-        for (i = 0; i < num_bytes; i++) {
-            bitpack_get_bits(bp, 8, index + i * 8, &byte);
-            unpacked[i] = byte;
-        }
+    if (p == tmp) {
+        memcpy(data + index / 8, tmp, left);
     }
+}
 
-    *value = unpacked;
+/*
+ * Codes, i.e. bit strings such as the variable length integer codes, are
+ * handled as num_bits bit numbers whose most significant bit is the first bit
+ * of the string, whatever the bit order.  In MSB first order that is just a
+ * field, in LSB first order the field is reversed.
+ */
+static uint64_t _bitpack_read_code_lsb(const unsigned char *data, unsigned long data_size,
+        unsigned long index, unsigned long num_bits)
+{
+    return _bitpack_reverse64(_bitpack_read_field_lsb(data, data_size, index, num_bits)) >> (64 - num_bits);
+}
 
-    return BITPACK_RV_SUCCESS;
+static void _bitpack_write_code_lsb(unsigned char *data, unsigned long data_size,
+        unsigned long index, unsigned long num_bits, uint64_t value)
+{
+    _bitpack_write_field_lsb(data, data_size, index, num_bits, _bitpack_reverse64(value) >> (64 - num_bits));
 }
 
-int bitpack_read_bits(bitpack_t bp, unsigned long num_bits, unsigned long *value)
+/* dst[k] = (src[k] << r) | (src[k - 1] >> (8 - r)), the LSB first funnel */
+static void _bitpack_funnel_lsb(unsigned char *dst, const unsigned char *src,
+        unsigned long n, unsigned int r)
 {
-    int rv;
+    unsigned long k = 0;
+    uint64_t      w;
 
-    _bitpack_err_clear(bp);
+    for (; k + 8 <= n; k += 8) {
+        w = _bitpack_load_le64(src + k);
+        _bitpack_store_le64(dst + k, (w << r) | (src[k - 1] >> (8 - r)));
+    }
 
-    if (bp->read_pos + num_bits > bitpack_size(bp)) {
-        bp->error = BITPACK_ERR_READ_PAST_END;
-        snprintf(bp->error_str, BITPACK_ERR_BUF_SIZE,
-                "attempted to read past end of bitpack (last index is %lu)",
-                bitpack_size(bp) - 1);
-        return BITPACK_RV_ERROR;
+    for (; k < n; k++) {
+        dst[k] = (src[k] << r) | (src[k - 1] >> (8 - r));
     }
+}
 
-    rv = bitpack_get_bits(bp, num_bits, bp->read_pos, value);
+static void _bitpack_put_bytes_lsb(unsigned char *data, unsigned long index,
+        const unsigned char *value, unsigned long num_bytes)
+{
+    unsigned char *dst;
+    unsigned int   off;
 
-    if (rv == BITPACK_RV_SUCCESS) {
-        bp->read_pos += num_bits;
-    }
-    else {
-        return rv;
+    if (index % 8 == 0) {
+        memcpy(data + index / 8, value, num_bytes);
     }
+    else if (num_bytes > 0) {
+        dst = data + index / 8;
+        off = index % 8;
 
-    return BITPACK_RV_SUCCESS;
+        dst[0] = (dst[0] & (0xff >> (8 - off))) | (unsigned char)(value[0] << off);
+        _bitpack_funnel_lsb(dst + 1, value + 1, num_bytes - 1, off);
+        dst[num_bytes] = (dst[num_bytes] & (0xff << off)) |
+                         (value[num_bytes - 1] >> (8 - off));
+    }
 }
 
-int bitpack_read_bytes(bitpack_t bp, unsigned long num_bytes, unsigned char **value)
+static void _bitpack_take_bytes_lsb(const unsigned char *data, unsigned long index,
+        unsigned char *value, unsigned long num_bytes)
 {
-    int rv;
-
-    _bitpack_err_clear(bp);
-
-    if (bp->read_pos + num_bytes * 8 > bitpack_size(bp)) {
-        bp->error = BITPACK_ERR_READ_PAST_END;
-        snprintf(bp->error_str, BITPACK_ERR_BUF_SIZE,
-                "attempted to read past end of bitpack (last index is %lu)",
-                bitpack_size(bp) - 1);
-        return BITPACK_RV_ERROR;
+    if (index % 8 == 0) {
+        memcpy(value, data + index / 8, num_bytes);
+    }
+    else if (num_bytes > 0) {
+        _bitpack_funnel_lsb(value, data + index / 8 + 1, num_bytes, 8 - index % 8);
     }
+}
 
-    rv = bitpack_get_bytes(bp, num_bytes, bp->read_pos, value);
+/*
+ * The bit order specific primitives of a bitpack object.  Every access goes
+ * through bp->ops, which is picked once when the bit order is set, rather
+ * than testing the bit order on each access.
+ */
+struct _bitpack_ops
+{
+    bitpack_order_t  order;
+    unsigned char    bit_mask[8];   /* mask of bit index % 8 within its byte */
+    unsigned char    head_mask[8];  /* mask of the first n bits of a byte */
+    const uint64_t  *bin_table;     /* the 8 characters of each byte for bitpack_to_bin() */
+    uint64_t       (*read_field)(const unsigned char *data, unsigned long data_size,
+                                 unsigned long index, unsigned long num_bits);
+    void           (*write_field)(unsigned char *data, unsigned long data_size,
+                                  unsigned long index, unsigned long num_bits, uint64_t value);
+    uint64_t       (*read_code)(const unsigned char *data, unsigned long data_size,
+                                unsigned long index, unsigned long num_bits);
+    void           (*write_code)(unsigned char *data, unsigned long data_size,
+                                 unsigned long index, unsigned long num_bits, uint64_t value);
+    void           (*put_bytes)(unsigned char *data, unsigned long index,
+                                const unsigned char *value, unsigned long num_bytes);
+    void           (*take_bytes)(const unsigned char *data, unsigned long index,
+                                 unsigned char *value, unsigned long num_bytes);
+};
 
-    if (rv == BITPACK_RV_SUCCESS) {
-        bp->read_pos += num_bytes * 8;
-    }
-    else {
-        return rv;
+static const struct _bitpack_ops _bitpack_ops[2] = {
+    {
+        BITPACK_MSB_FIRST,
+        {0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01},
+        {0x00, 0x80, 0xc0, 0xe0, 0xf0, 0xf8, 0xfc, 0xfe},
+        _bitpack_bin_table,
+        _bitpack_read_field,
+        _bitpack_write_field,
+        _bitpack_read_field,
+        _bitpack_write_field,
+        _bitpack_put_bytes,
+        _bitpack_take_bytes
+    },
+    {
+        BITPACK_LSB_FIRST,
+        {0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80},
+        {0x00, 0x01, 0x03, 0x07, 0x0f, 0x1f, 0x3f, 0x7f},
+        _bitpack_bin_table_lsb,
+        _bitpack_read_field_lsb,
+        _bitpack_write_field_lsb,
+        _bitpack_read_code_lsb,
+        _bitpack_write_code_lsb,
+        _bitpack_put_bytes_lsb,
+        _bitpack_take_bytes_lsb
     }
+};
 
-    return BITPACK_RV_SUCCESS;
+/*
+ * Error messages, indexed by bitpack_err_t.  Only the error type and its
+ * integer arguments are recorded when an operation fails, the message is
+ * formatted on demand by bitpack_get_error_str().
+ */
+static const char *_bitpack_err_fmt[] = {
+    "",                                                             /* BITPACK_ERR_CLEAR */
+    "memory allocation failed",                                     /* BITPACK_ERR_MALLOC_FAILED */
+    "invalid index (%lu), max index is %lu",                        /* BITPACK_ERR_INVALID_INDEX */
+    "value %lu does not fit in %lu bits",                           /* BITPACK_ERR_VALUE_TOO_BIG */
+    "range size %lu bits is too large (maximum size is %lu bits)",  /* BITPACK_ERR_RANGE_TOO_BIG */
+    "attempted to read past end of bitpack (last index is %lu)",    /* BITPACK_ERR_READ_PAST_END */
+    "bitpack is empty",                                             /* BITPACK_ERR_EMPTY */
+    "bitpack is read-only",                                         /* BITPACK_ERR_READ_ONLY */
+    "byte run of %lu bytes does not fit in a %lu byte buffer",      /* BITPACK_ERR_BUFFER_TOO_SMALL */
+    "value of %lu bits does not fit in %lu bits",                   /* BITPACK_ERR_WIDE_VALUE_TOO_BIG */
+    "value %ld does not fit in %lu bits",                           /* BITPACK_ERR_SIGNED_VALUE_TOO_BIG */
+    "value %lu cannot be encoded with this code",                   /* BITPACK_ERR_NOT_ENCODABLE */
+    "invalid code at index %lu",                                    /* BITPACK_ERR_INVALID_CODE */
+    "I/O failed with errno %lu"                                     /* BITPACK_ERR_IO_FAILED */
+};
+
+/* clear any previous errors on a bitpack object */
+static void _bitpack_err_clear(bitpack_t bp)
+{
+    bp->error = BITPACK_ERR_CLEAR;
 }
 
-int bitpack_to_bin(bitpack_t bp, char **str)
+/* record an error and its arguments on a bitpack object */
+static void _bitpack_err_set(bitpack_t bp, bitpack_err_t error, unsigned long arg0, unsigned long arg1)
 {
-    unsigned long  i;
-    char          *string;
-    char           tmp[3];
-    unsigned char  bit;
+    bp->error         = error;
+    bp->error_args[0] = arg0;
+    bp->error_args[1] = arg1;
+}
 
-    _bitpack_err_clear(bp);
+/*
+ * The rank/select index of a bitpack object.  The bits are split into blocks
+ * of BITPACK_RANK_BLOCK_BITS bits, and each block into 4 sub-blocks.  Each
+ * block has two counts: the number of set bits before the block, and the
+ * number before its 2nd, 3rd and 4th sub-block, 11 bits each.  The rest of
+ * a rank is a popcount of at most 8 words.  Every BITPACK_SELECT_SAMPLE-th
+ * set bit has the index of the block it is in, to narrow the search for
+ * select.
+ */
+#define BITPACK_RANK_BLOCK_BITS 2048
+#define BITPACK_RANK_SUB_BITS   512
+#define BITPACK_SELECT_SAMPLE   8192
 
-    string = malloc(bitpack_size(bp) + 1);
+struct _bitpack_rank_t
+{
+    unsigned long  num_blocks;      /* blocks, including the one holding index == size */
+    uint64_t      *counts;          /* two counts per block, see above */
+    unsigned long  num_ones;        /* number of set bits */
+    unsigned long  num_samples;     /* number of select samples */
+    unsigned long *samples;         /* block of every BITPACK_SELECT_SAMPLE-th set bit */
+};
 
-    if (string == NULL) {
-        *str = NULL;
-        bp->error = BITPACK_ERR_MALLOC_FAILED;
-        strncpy(bp->error_str, "memory allocation failed", BITPACK_ERR_BUF_SIZE);
+/* drop the rank/select index of a bitpack object that is about to change */
+static void _bitpack_rank_drop(bitpack_t bp)
+{
+    if (bp->rank != NULL) {
+        free(bp->rank->counts);
+        free(bp->rank->samples);
+        free(bp->rank);
+        bp->rank = NULL;
+    }
+}
+
+/* make sure a range of num_bits bits at index doesn't run past ULONG_MAX */
+static int _bitpack_range_fits(bitpack_t bp, unsigned long index, unsigned long num_bits)
+{
+    if (num_bits > ULONG_MAX - index) {
+        _bitpack_err_set(bp, BITPACK_ERR_RANGE_TOO_BIG, num_bits, ULONG_MAX - index);
         return BITPACK_RV_ERROR;
     }
 
-    string[0] = '\0';
+    return BITPACK_RV_SUCCESS;
+}
 
-    for (i = 0; i < bitpack_size(bp); i++) {
-        bitpack_get(bp, i, &bit);
-        sprintf(tmp, "%d", bit);
-        strncat(string, tmp, 1); 
+/*
+ * make sure a bitpack object may be modified, failing if it is a view.  Every
+ * modification goes through here, so it also drops the rank/select index.
+ */
+static int _bitpack_writable(bitpack_t bp)
+{
+    if (bp->flags & BITPACK_FLAG_READ_ONLY) {
+        _bitpack_err_set(bp, BITPACK_ERR_READ_ONLY, 0, 0);
+        return BITPACK_RV_ERROR;
     }
 
-    *str = string;
+    _bitpack_rank_drop(bp);
+
+    return BITPACK_RV_SUCCESS;
+}
+
+/*
+ * Arenas.  Memory is bumped off the current block, with every allocation
+ * rounded to BITPACK_ARENA_ALIGN bytes.  The blocks stay on the list when the
+ * arena is reset and are reused in order, a new block is only inserted when
+ * the next one is too small.
+ */
+#define BITPACK_ARENA_ALIGN 16
+
+#define BITPACK_ARENA_ROUND(n) (((n) + BITPACK_ARENA_ALIGN - 1) / BITPACK_ARENA_ALIGN * BITPACK_ARENA_ALIGN)
+
+/* the bitpack object, padded so that its data after it is aligned */
+#define BITPACK_ARENA_OBJECT_SIZE BITPACK_ARENA_ROUND(sizeof(struct _bitpack_t))
+
+struct _bitpack_arena_block
+{
+    struct _bitpack_arena_block *next;
+    unsigned long                size;          /* usable bytes after the header */
+};
+
+#define BITPACK_ARENA_HEADER_SIZE BITPACK_ARENA_ROUND(sizeof(struct _bitpack_arena_block))
+
+struct _bitpack_arena_t
+{
+    struct _bitpack_arena_block *first;         /* all of the blocks */
+    struct _bitpack_arena_block *cur;           /* block being allocated from, NULL after a reset */
+    unsigned long                used;          /* bytes used in cur */
+    unsigned long                block_size;    /* size of a new block */
+};
+
+static unsigned char *_bitpack_arena_block_data(struct _bitpack_arena_block *b)
+{
+    return (unsigned char *)b + BITPACK_ARENA_HEADER_SIZE;
+}
+
+static void *_bitpack_arena_alloc(struct _bitpack_arena_t *a, unsigned long num_bytes)
+{
+    struct _bitpack_arena_block *b;
+    unsigned long                n = BITPACK_ARENA_ROUND(num_bytes);
+
+    if (a->cur != NULL && a->used + n <= a->cur->size) {
+        a->used += n;
+        return _bitpack_arena_block_data(a->cur) + a->used - n;
+    }
+
+    b = a->cur != NULL ? a->cur->next : a->first;
+
+    if (b == NULL || b->size < n) {
+        b = malloc(BITPACK_ARENA_HEADER_SIZE + (n > a->block_size ? n : a->block_size));
+
+        if (b == NULL) {
+            return NULL;
+        }
+
+        b->size = n > a->block_size ? n : a->block_size;
+        b->next = a->cur != NULL ? a->cur->next : a->first;
+
+        if (a->cur != NULL) {
+            a->cur->next = b;
+        }
+        else {
+            a->first = b;
+        }
+    }
+
+    a->cur  = b;
+    a->used = n;
+
+    return _bitpack_arena_block_data(b);
+}
+
+/* grow the last allocation from num_bytes to new_num_bytes in place if there is room */
+static int _bitpack_arena_extend(struct _bitpack_arena_t *a, const unsigned char *p,
+        unsigned long num_bytes, unsigned long new_num_bytes)
+{
+    unsigned long n     = BITPACK_ARENA_ROUND(num_bytes);
+    unsigned long new_n = BITPACK_ARENA_ROUND(new_num_bytes);
+
+    if (a->cur == NULL || p + n != _bitpack_arena_block_data(a->cur) + a->used ||
+            a->used - n + new_n > a->cur->size) {
+        return BITPACK_RV_ERROR;
+    }
+
+    a->used = a->used - n + new_n;
+
+    return BITPACK_RV_SUCCESS;
+}
+
+bitpack_arena_t bitpack_arena_init(unsigned long block_size)
+{
+    bitpack_arena_t a;
+
+    a = malloc(sizeof(struct _bitpack_arena_t));
+    if (a == NULL) return NULL;
+
+    a->first      = NULL;
+    a->cur        = NULL;
+    a->used       = 0;
+    a->block_size = block_size;
+
+    return a;
+}
+
+void bitpack_arena_reset(bitpack_arena_t arena)
+{
+    arena->cur  = NULL;
+    arena->used = 0;
+}
+
+void bitpack_arena_destroy(bitpack_arena_t arena)
+{
+    struct _bitpack_arena_block *b, *next;
+
+    for (b = arena->first; b != NULL; b = next) {
+        next = b->next;
+        free(b);
+    }
+
+    free(arena);
+}
+
+/* make sure at least num_bytes bytes are allocated, zeroing any new memory */
+static int _bitpack_grow(bitpack_t bp, unsigned long num_bytes)
+{
+    unsigned char *data;
+
+    if (num_bytes <= bp->data_size) {
+        return BITPACK_RV_SUCCESS;
+    }
+
+    if (bp->data == bp->inline_data) {
+        /* spill to the heap, or the arena, once the inline data is too small */
+        if (num_bytes <= BITPACK_INLINE_DATA_SIZE) {
+            data = bp->data;
+        }
+        else if ((data = bp->arena ? _bitpack_arena_alloc(bp->arena, num_bytes) : malloc(num_bytes)) != NULL) {
+            memcpy(data, bp->data, bp->data_size);
+        }
+    }
+    else if (bp->arena == NULL) {
+        data = realloc(bp->data, num_bytes);
+    }
+    else if (_bitpack_arena_extend(bp->arena, bp->data, bp->data_size, num_bytes)) {
+        data = bp->data;
+    }
+    else if ((data = _bitpack_arena_alloc(bp->arena, num_bytes)) != NULL) {
+        memcpy(data, bp->data, bp->data_size);
+    }
+
+    if (data == NULL) {
+        _bitpack_err_set(bp, BITPACK_ERR_MALLOC_FAILED, 0, 0);
+        return BITPACK_RV_ERROR;
+    }
+
+    memset(data + bp->data_size, 0, num_bytes - bp->data_size);
+
+    bp->data      = data;
+    bp->data_size = num_bytes;
+
+    return BITPACK_RV_SUCCESS;
+}
+
+/*
+ * change the size of a bitpack object, allocating more memory if necessary.
+ * The allocation is at least doubled each time it grows so that a long run of
+ * appends only reallocs O(log n) times.  The bits past the end are always 0,
+ * so the writers can open a gap just by growing, and bits dropped by a
+ * shrink are cleared to keep it that way.
+ */
+static int _bitpack_resize(bitpack_t bp, unsigned long new_size)
+{
+    unsigned long new_data_size = round8(new_size) / 8;
+
+    if (new_size < bp->size) {
+        if (new_size % 8 != 0) {
+            bp->data[new_size / 8] &= bp->ops->head_mask[new_size % 8];
+        }
+
+        memset(bp->data + new_data_size, 0, round8(bp->size) / 8 - new_data_size);
+    }
+    else if (new_data_size > bp->data_size) {
+        if (new_data_size < bp->data_size * 2) {
+            new_data_size = bp->data_size * 2;
+        }
+
+        if (!_bitpack_grow(bp, new_data_size)) {
+            return BITPACK_RV_ERROR;
+        }
+    }
+
+    bp->size = new_size;
+
+    return BITPACK_RV_SUCCESS;
+}
+
+bitpack_t bitpack_init(unsigned long num_bytes)
+{
+    return bitpack_init_order(num_bytes, BITPACK_MSB_FIRST);
+}
+
+bitpack_t bitpack_init_order(unsigned long num_bytes, bitpack_order_t order)
+{
+    bitpack_t      bp;
+    unsigned char *data;
+
+    bp = malloc(sizeof(struct _bitpack_t));
+    if (bp == NULL) return NULL;
+
+    if (num_bytes <= BITPACK_INLINE_DATA_SIZE) {
+        data = bp->inline_data;
+    }
+    else if ((data = malloc(num_bytes)) == NULL) {
+        free(bp);
+        return NULL;
+    }
+
+    memset(data, 0, num_bytes);
+
+    bp->size      = 0;
+    bp->read_pos  = 0;
+    bp->data_size = num_bytes;
+    bp->data      = data;
+    bp->flags     = 0;
+    bp->error     = BITPACK_ERR_CLEAR;
+    bp->error_str = NULL;
+    bp->ops       = &_bitpack_ops[order == BITPACK_LSB_FIRST];
+    bp->rank      = NULL;
+    bp->arena     = NULL;
+
+    return bp;
+}
+
+bitpack_t bitpack_init_in(bitpack_arena_t arena, unsigned long num_bytes)
+{
+    bitpack_t bp;
+
+    /* the object and its data are one allocation */
+    if (num_bytes <= BITPACK_INLINE_DATA_SIZE) {
+        bp = _bitpack_arena_alloc(arena, BITPACK_ARENA_OBJECT_SIZE);
+        if (bp == NULL) return NULL;
+
+        bp->data = bp->inline_data;
+    }
+    else {
+        bp = _bitpack_arena_alloc(arena, BITPACK_ARENA_OBJECT_SIZE + num_bytes);
+        if (bp == NULL) return NULL;
+
+        bp->data = (unsigned char *)bp + BITPACK_ARENA_OBJECT_SIZE;
+    }
+
+    bp->size      = 0;
+    bp->read_pos  = 0;
+    bp->data_size = num_bytes;
+    bp->flags     = 0;
+    bp->error     = BITPACK_ERR_CLEAR;
+    bp->error_str = NULL;
+    bp->ops       = &_bitpack_ops[BITPACK_MSB_FIRST];
+    bp->rank      = NULL;
+    bp->arena     = arena;
+
+    memset(bp->data, 0, num_bytes);
+
+    return bp;
+}
+
+bitpack_t bitpack_init_from_bytes(unsigned char *bytes, unsigned long num_bytes)
+{
+    bitpack_t bp;
+
+    bp = bitpack_init(num_bytes);
+
+    if (bp == NULL) {
+        return NULL;
+    }
+
+    memcpy(bp->data, bytes, num_bytes);
+    bp->size = num_bytes * 8;
+
+    return bp;
+}
+
+bitpack_t bitpack_view_init(const unsigned char *bytes, unsigned long num_bits)
+{
+    bitpack_t bp;
+
+    bp = malloc(sizeof(struct _bitpack_t));
+    if (bp == NULL) return NULL;
+
+    bp->size      = num_bits;
+    bp->read_pos  = 0;
+    bp->data_size = round8(num_bits) / 8;
+    bp->data      = (unsigned char *)bytes;
+    bp->flags     = BITPACK_FLAG_VIEW | BITPACK_FLAG_READ_ONLY;
+    bp->error     = BITPACK_ERR_CLEAR;
+    bp->error_str = NULL;
+    bp->ops       = &_bitpack_ops[BITPACK_MSB_FIRST];
+    bp->rank      = NULL;
+    bp->arena     = NULL;
+
+    return bp;
+}
+
+bitpack_t bitpack_init_from_bin(const char *str)
+{
+    bitpack_t      bp;
+    unsigned long  len = strlen(str);
+    unsigned long  i;
+    uint64_t       w;
+    unsigned char *data;
+
+    bp = bitpack_init(len / 8 + 1);
+
+    if (bp == NULL) {
+        return NULL;
+    }
+
+    data = bp->data;
+
+    /* 8 characters at a time: check they are all '0'/'1', then gather the low bits */
+    for (i = 0; i + 8 <= len; i += 8) {
+        w = _bitpack_load_be64((const unsigned char *)str + i);
+
+        if ((w & 0xfefefefefefefefeULL) != 0x3030303030303030ULL) {
+            bitpack_destroy(bp);
+            return NULL;
+        }
+
+        *data++ = ((w & 0x0101010101010101ULL) * 0x0102040810204080ULL) >> 56;
+    }
+
+    for (; i < len; i++) {
+        if (str[i] != '0' && str[i] != '1') {
+            bitpack_destroy(bp);
+            return NULL;
+        }
+
+        *data |= (str[i] - '0') << (7 - i % 8);
+    }
+
+    bp->size = len;
+
+    return bp;
+}
+
+/* value of a hex digit, or -1 if c is not one */
+static int _bitpack_hex_value(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+
+    return -1;
+}
+
+bitpack_t bitpack_init_from_hex(const char *str)
+{
+    bitpack_t     bp;
+    unsigned long len = strlen(str);
+    unsigned long i;
+    int           hi, lo;
+
+    bp = bitpack_init(len / 2 + 1);
+
+    if (bp == NULL) {
+        return NULL;
+    }
+
+    for (i = 0; i < len; i += 2) {
+        hi = _bitpack_hex_value(str[i]);
+        lo = (i + 1 < len) ? _bitpack_hex_value(str[i + 1]) : 0;
+
+        if (hi < 0 || lo < 0) {
+            bitpack_destroy(bp);
+            return NULL;
+        }
+
+        bp->data[i / 2] = (hi << 4) | lo;
+    }
+
+    bp->size = len * 4;
+
+    return bp;
+}
+
+void bitpack_destroy(bitpack_t bp)
+{
+    _bitpack_rank_drop(bp);
+    free(bp->error_str);
+
+    /* the arena owns the object and its data */
+    if (bp->arena != NULL) {
+        return;
+    }
+
+    if (!(bp->flags & BITPACK_FLAG_VIEW) && bp->data != bp->inline_data) {
+        free(bp->data);
+    }
+
+    free(bp);
+}
+
+unsigned long bitpack_size(bitpack_t bp)
+{
+    return bp->size;
+}
+
+unsigned long bitpack_data_size(bitpack_t bp)
+{
+    return bp->data_size;
+}
+
+int bitpack_read_only(bitpack_t bp)
+{
+    return (bp->flags & BITPACK_FLAG_READ_ONLY) != 0;
+}
+
+void bitpack_set_read_only(bitpack_t bp)
+{
+    bp->flags |= BITPACK_FLAG_READ_ONLY;
+}
+
+bitpack_order_t bitpack_get_order(bitpack_t bp)
+{
+    return bp->ops->order;
+}
+
+void bitpack_set_order(bitpack_t bp, bitpack_order_t order)
+{
+    /* the same bytes hold the bits in a different order */
+    if (order != bp->ops->order) {
+        _bitpack_rank_drop(bp);
+    }
+
+    bp->ops = &_bitpack_ops[order == BITPACK_LSB_FIRST];
+}
+
+unsigned long bitpack_read_pos(bitpack_t bp)
+{
+    return bp->read_pos;
+}
+
+void bitpack_reset_read_pos(bitpack_t bp)
+{
+    bp->read_pos = 0;
+}
+
+int bitpack_reserve(bitpack_t bp, unsigned long num_bits)
+{
+    _bitpack_err_clear(bp);
+
+    if (!_bitpack_writable(bp)) {
+        return BITPACK_RV_ERROR;
+    }
+
+    return _bitpack_grow(bp, round8(num_bits) / 8);
+}
+
+int bitpack_shrink_to_fit(bitpack_t bp)
+{
+    unsigned char *data;
+    unsigned long  num_bytes = round8(bp->size) / 8;
+
+    _bitpack_err_clear(bp);
+
+    if (!_bitpack_writable(bp)) {
+        return BITPACK_RV_ERROR;
+    }
+
+    /* always keep at least one byte around so data is never NULL */
+    if (num_bytes == 0) {
+        num_bytes = 1;
+    }
+
+    if (bp->data == bp->inline_data) {
+        if (num_bytes < bp->data_size) {
+            bp->data_size = num_bytes;
+        }
+    }
+    else if (num_bytes <= BITPACK_INLINE_DATA_SIZE && bp->arena == NULL) {
+        /* small enough to move back into the object */
+        memcpy(bp->inline_data, bp->data, num_bytes);
+        free(bp->data);
+
+        bp->data      = bp->inline_data;
+        bp->data_size = num_bytes;
+    }
+    /* arena memory can only be given back by the last allocation */
+    else if (bp->arena != NULL) {
+        if (num_bytes < bp->data_size &&
+                _bitpack_arena_extend(bp->arena, bp->data, bp->data_size, num_bytes)) {
+            bp->data_size = num_bytes;
+        }
+    }
+    else if (num_bytes < bp->data_size) {
+        data = realloc(bp->data, num_bytes);
+
+        if (data == NULL) {
+            _bitpack_err_set(bp, BITPACK_ERR_MALLOC_FAILED, 0, 0);
+            return BITPACK_RV_ERROR;
+        }
+
+        bp->data      = data;
+        bp->data_size = num_bytes;
+    }
+
+    return BITPACK_RV_SUCCESS;
+}
+
+bitpack_err_t bitpack_get_error(bitpack_t bp)
+{
+    return bp->error;
+}
+
+char *bitpack_get_error_str(bitpack_t bp)
+{
+    if (bp->error == BITPACK_ERR_CLEAR) {
+        return (char *)_bitpack_err_fmt[BITPACK_ERR_CLEAR];
+    }
+
+    if (bp->error_str == NULL) {
+        bp->error_str = malloc(BITPACK_ERR_BUF_SIZE);
+
+        if (bp->error_str == NULL) {
+            return (char *)_bitpack_err_fmt[BITPACK_ERR_MALLOC_FAILED];
+        }
+    }
+
+    if (bp->error == BITPACK_ERR_SIGNED_VALUE_TOO_BIG) {
+        /* the only message with a signed argument */
+        snprintf(bp->error_str, BITPACK_ERR_BUF_SIZE, _bitpack_err_fmt[bp->error],
+                (long)bp->error_args[0], bp->error_args[1]);
+    }
+    else {
+        snprintf(bp->error_str, BITPACK_ERR_BUF_SIZE, _bitpack_err_fmt[bp->error],
+                bp->error_args[0], bp->error_args[1]);
+    }
+
+    return bp->error_str;
+}
+
+int bitpack_on(bitpack_t bp, unsigned long index)
+{
+    unsigned long byte_offset;
+    unsigned long bit_offset;
+
+    _bitpack_err_clear(bp);
+
+    if (!_bitpack_writable(bp)) {
+        return BITPACK_RV_ERROR;
+    }
+
+    if (bitpack_size(bp) == 0 || index > bitpack_size(bp) - 1) {
+        if (!_bitpack_resize(bp, index + 1)) {
+            return BITPACK_RV_ERROR;
+        }
+    }
+
+    byte_offset = index / 8;
+    bit_offset  = index % 8;
+
+    bp->data[byte_offset] |= bp->ops->bit_mask[bit_offset];
+
+    return BITPACK_RV_SUCCESS;
+}
+
+int bitpack_off(bitpack_t bp, unsigned long index)
+{
+    unsigned long byte_offset;
+    unsigned long bit_offset;
+
+    _bitpack_err_clear(bp);
+
+    if (!_bitpack_writable(bp)) {
+        return BITPACK_RV_ERROR;
+    }
+
+    if (bitpack_size(bp) == 0 || index > bitpack_size(bp) - 1) {
+        if (!_bitpack_resize(bp, index + 1)) {
+            return BITPACK_RV_ERROR;
+        }
+    }
+
+    byte_offset = index / 8;
+    bit_offset  = index % 8;
+
+    bp->data[byte_offset] &= ~bp->ops->bit_mask[bit_offset];
+
+    return BITPACK_RV_SUCCESS;
+}
+
+int bitpack_get(bitpack_t bp, unsigned long index, unsigned char *bit)
+{
+    unsigned long byte_offset;
+    unsigned long bit_offset;
+
+    _bitpack_err_clear(bp);
+
+    if (bitpack_size(bp) == 0) {
+        _bitpack_err_set(bp, BITPACK_ERR_EMPTY, 0, 0);
+        return BITPACK_RV_ERROR;
+    }
+
+    if (index > bitpack_size(bp) - 1) {
+        _bitpack_err_set(bp, BITPACK_ERR_INVALID_INDEX, index, bitpack_size(bp) - 1);
+        return BITPACK_RV_ERROR;
+    }
+
+    byte_offset = index / 8;
+    bit_offset  = index % 8;
+
+    if (bp->data[byte_offset] & bp->ops->bit_mask[bit_offset]) {
+        *bit = 1;
+    }
+    else {
+        *bit = 0;
+    }
+
+    return BITPACK_RV_SUCCESS;
+}
+
+int bitpack_set_bits(bitpack_t bp, unsigned long value, unsigned long num_bits, unsigned long index)
+{
+    _bitpack_err_clear(bp);
+
+    if (!_bitpack_writable(bp)) {
+        return BITPACK_RV_ERROR;
+    }
+
+    /* make sure the range isn't bigger than the size of an unsigned long */
+    if (num_bits > sizeof(unsigned long) * 8) {
+        _bitpack_err_set(bp, BITPACK_ERR_RANGE_TOO_BIG, num_bits, sizeof(unsigned long) * 8);
+        return BITPACK_RV_ERROR;
+    }
+
+    /* make sure that the range is large enough to pack value */
+    if (num_bits < sizeof(unsigned long) * 8 && (value >> num_bits) != 0) {
+        _bitpack_err_set(bp, BITPACK_ERR_VALUE_TOO_BIG, value, num_bits);
+        return BITPACK_RV_ERROR;
+    }
+
+    if (bitpack_size(bp) < index + num_bits) {
+        if (!_bitpack_resize(bp, index + num_bits)) {
+            return BITPACK_RV_ERROR;
+        }
+    }
+
+    if (num_bits > 0) {
+        bp->ops->write_field(bp->data, bp->data_size, index, num_bits, value);
+    }
+
+    return BITPACK_RV_SUCCESS;
+}
+
+int bitpack_set_bits_unchecked(bitpack_t bp, unsigned long value, unsigned long num_bits, unsigned long index)
+{
+    _bitpack_err_clear(bp);
+
+    if (!_bitpack_writable(bp)) {
+        return BITPACK_RV_ERROR;
+    }
+
+    if (bitpack_size(bp) < index + num_bits) {
+        if (!_bitpack_resize(bp, index + num_bits)) {
+            return BITPACK_RV_ERROR;
+        }
+    }
+
+    bp->ops->write_field(bp->data, bp->data_size, index, num_bits, value);
+
+    return BITPACK_RV_SUCCESS;
+}
+
+int bitpack_set_bytes(bitpack_t bp, unsigned char *value, unsigned long num_bytes, unsigned long index)
+{
+    _bitpack_err_clear(bp);
+
+    if (!_bitpack_writable(bp)) {
+        return BITPACK_RV_ERROR;
+    }
+
+    if (bitpack_size(bp) < index + num_bytes * 8) {
+        if (!_bitpack_resize(bp, index + num_bytes * 8)) {
+            return BITPACK_RV_ERROR;
+        }
+    }
+
+    bp->ops->put_bytes(bp->data, index, value, num_bytes);
+
+    return BITPACK_RV_SUCCESS;
+}
+
+int bitpack_get_bits(bitpack_t bp, unsigned long num_bits, unsigned long index, unsigned long *value)
+{
+    _bitpack_err_clear(bp);
+
+    if (index >= bitpack_size(bp)) {
+        _bitpack_err_set(bp, BITPACK_ERR_INVALID_INDEX, index, bitpack_size(bp) - 1);
+        return BITPACK_RV_ERROR;
+    }
+
+    if (index + num_bits > bitpack_size(bp)) {
+        _bitpack_err_set(bp, BITPACK_ERR_READ_PAST_END, bitpack_size(bp) - 1, 0);
+        return BITPACK_RV_ERROR;
+    }
+
+    if (num_bits > sizeof(unsigned long) * 8) {
+        _bitpack_err_set(bp, BITPACK_ERR_RANGE_TOO_BIG, num_bits, sizeof(unsigned long) * 8);
+        return BITPACK_RV_ERROR;
+    }
+
+    if (num_bits > 0) {
+        *value = bp->ops->read_field(bp->data, bp->data_size, index, num_bits);
+    }
+    else {
+        *value = 0;
+    }
+
+    return BITPACK_RV_SUCCESS;
+}
+
+int bitpack_get_bytes(bitpack_t bp, unsigned long num_bytes, unsigned long index, unsigned char **value)
+{
+    unsigned char *unpacked;
+
+    _bitpack_err_clear(bp);
+
+    unpacked = malloc(num_bytes);
+    if (unpacked == NULL) {
+        _bitpack_err_set(bp, BITPACK_ERR_MALLOC_FAILED, 0, 0);
+        return BITPACK_RV_ERROR;
+    }
+
+    if (!bitpack_get_bytes_into(bp, num_bytes, index, unpacked)) {
+        free(unpacked);
+        return BITPACK_RV_ERROR;
+    }
+
+    *value = unpacked;
+
+    return BITPACK_RV_SUCCESS;
+}
+
+int bitpack_get_bytes_into(bitpack_t bp, unsigned long num_bytes, unsigned long index, unsigned char *value)
+{
+    _bitpack_err_clear(bp);
+
+    if (index >= bitpack_size(bp)) {
+        _bitpack_err_set(bp, BITPACK_ERR_INVALID_INDEX, index, bitpack_size(bp) - 1);
+        return BITPACK_RV_ERROR;
+    }
+
+    if (num_bytes > (bitpack_size(bp) - index) / 8) {
+        _bitpack_err_set(bp, BITPACK_ERR_READ_PAST_END, bitpack_size(bp) - 1, 0);
+        return BITPACK_RV_ERROR;
+    }
+
+    bp->ops->take_bytes(bp->data, index, value, num_bytes);
+
+    return BITPACK_RV_SUCCESS;
+}
+
+int bitpack_read_bits(bitpack_t bp, unsigned long num_bits, unsigned long *value)
+{
+    int rv;
+
+    _bitpack_err_clear(bp);
+
+    if (bp->read_pos + num_bits > bitpack_size(bp)) {
+        _bitpack_err_set(bp, BITPACK_ERR_READ_PAST_END, bitpack_size(bp) - 1, 0);
+        return BITPACK_RV_ERROR;
+    }
+
+    rv = bitpack_get_bits(bp, num_bits, bp->read_pos, value);
+
+    if (rv == BITPACK_RV_SUCCESS) {
+        bp->read_pos += num_bits;
+    }
+    else {
+        return rv;
+    }
+
+    return BITPACK_RV_SUCCESS;
+}
+
+int bitpack_read_bytes(bitpack_t bp, unsigned long num_bytes, unsigned char **value)
+{
+    int rv;
+
+    _bitpack_err_clear(bp);
+
+    if (bp->read_pos + num_bytes * 8 > bitpack_size(bp)) {
+        _bitpack_err_set(bp, BITPACK_ERR_READ_PAST_END, bitpack_size(bp) - 1, 0);
+        return BITPACK_RV_ERROR;
+    }
+
+    rv = bitpack_get_bytes(bp, num_bytes, bp->read_pos, value);
+
+    if (rv == BITPACK_RV_SUCCESS) {
+        bp->read_pos += num_bytes * 8;
+    }
+    else {
+        return rv;
+    }
+
+    return BITPACK_RV_SUCCESS;
+}
+
+int bitpack_read_bytes_into(bitpack_t bp, unsigned long num_bytes, unsigned char *value)
+{
+    int rv;
+
+    _bitpack_err_clear(bp);
+
+    if (bp->read_pos > bitpack_size(bp) || num_bytes > (bitpack_size(bp) - bp->read_pos) / 8) {
+        _bitpack_err_set(bp, BITPACK_ERR_READ_PAST_END, bitpack_size(bp) - 1, 0);
+        return BITPACK_RV_ERROR;
+    }
+
+    rv = bitpack_get_bytes_into(bp, num_bytes, bp->read_pos, value);
+
+    if (rv == BITPACK_RV_SUCCESS) {
+        bp->read_pos += num_bytes * 8;
+    }
+    else {
+        return rv;
+    }
+
+    return BITPACK_RV_SUCCESS;
+}
+
+/*
+ * Signed fields.  Two's complement values are stored in their low num_bits
+ * bits and sign extended with (v ^ m) - m, where m is the sign bit, and
+ * zigzag values map 0, -1, 1, -2, ... to 0, 1, 2, 3, ... so that small
+ * magnitudes of either sign need few bits.
+ */
+static unsigned long _bitpack_sign_extend(unsigned long value, unsigned long num_bits)
+{
+    /* for num_bits == 0, value is 0 and m can be anything */
+    unsigned long m = 1UL << ((num_bits - 1) % BITPACK_WORD_BITS);
+
+    return (value ^ m) - m;
+}
+
+static unsigned long _bitpack_zigzag_encode(long value)
+{
+    return ((unsigned long)value << 1) ^ (unsigned long)(value >> (BITPACK_WORD_BITS - 1));
+}
+
+static long _bitpack_zigzag_decode(unsigned long value)
+{
+    return (long)((value >> 1) ^ (0UL - (value & 1)));
+}
+
+/* make sure an encoded signed value fits in num_bits bits */
+static int _bitpack_check_signed(bitpack_t bp, long value, unsigned long encoded, unsigned long num_bits)
+{
+    if (num_bits > BITPACK_WORD_BITS) {
+        _bitpack_err_set(bp, BITPACK_ERR_RANGE_TOO_BIG, num_bits, BITPACK_WORD_BITS);
+        return BITPACK_RV_ERROR;
+    }
+
+    if (num_bits < BITPACK_WORD_BITS && (encoded >> num_bits) != 0) {
+        _bitpack_err_set(bp, BITPACK_ERR_SIGNED_VALUE_TOO_BIG, (unsigned long)value, num_bits);
+        return BITPACK_RV_ERROR;
+    }
+
+    return BITPACK_RV_SUCCESS;
+}
+
+int bitpack_set_sbits(bitpack_t bp, long value, unsigned long num_bits, unsigned long index)
+{
+    unsigned long mask = num_bits ? ~0UL >> ((BITPACK_WORD_BITS - num_bits) % BITPACK_WORD_BITS) : 0;
+    unsigned long bias = num_bits ? 1UL << ((num_bits - 1) % BITPACK_WORD_BITS) : 0;
+
+    _bitpack_err_clear(bp);
+
+    /* value + 2^(num_bits - 1) must be in [0, 2^num_bits) */
+    if (!_bitpack_check_signed(bp, value, (unsigned long)value + bias, num_bits)) {
+        return BITPACK_RV_ERROR;
+    }
+
+    return bitpack_set_bits(bp, (unsigned long)value & mask, num_bits, index);
+}
+
+int bitpack_get_sbits(bitpack_t bp, unsigned long num_bits, unsigned long index, long *value)
+{
+    unsigned long v;
+
+    if (!bitpack_get_bits(bp, num_bits, index, &v)) {
+        return BITPACK_RV_ERROR;
+    }
+
+    *value = (long)_bitpack_sign_extend(v, num_bits);
+
+    return BITPACK_RV_SUCCESS;
+}
+
+int bitpack_read_sbits(bitpack_t bp, unsigned long num_bits, long *value)
+{
+    unsigned long v;
+
+    if (!bitpack_read_bits(bp, num_bits, &v)) {
+        return BITPACK_RV_ERROR;
+    }
+
+    *value = (long)_bitpack_sign_extend(v, num_bits);
+
+    return BITPACK_RV_SUCCESS;
+}
+
+int bitpack_set_zigzag_bits(bitpack_t bp, long value, unsigned long num_bits, unsigned long index)
+{
+    unsigned long z = _bitpack_zigzag_encode(value);
+
+    _bitpack_err_clear(bp);
+
+    if (!_bitpack_check_signed(bp, value, z, num_bits)) {
+        return BITPACK_RV_ERROR;
+    }
+
+    return bitpack_set_bits(bp, z, num_bits, index);
+}
+
+int bitpack_get_zigzag_bits(bitpack_t bp, unsigned long num_bits, unsigned long index, long *value)
+{
+    unsigned long z;
+
+    if (!bitpack_get_bits(bp, num_bits, index, &z)) {
+        return BITPACK_RV_ERROR;
+    }
+
+    *value = _bitpack_zigzag_decode(z);
+
+    return BITPACK_RV_SUCCESS;
+}
+
+int bitpack_read_zigzag_bits(bitpack_t bp, unsigned long num_bits, long *value)
+{
+    unsigned long z;
+
+    if (!bitpack_read_bits(bp, num_bits, &z)) {
+        return BITPACK_RV_ERROR;
+    }
+
+    *value = _bitpack_zigzag_decode(z);
+
+    return BITPACK_RV_SUCCESS;
+}
+
+/*
+ * Multi-byte integers.  Each byte is stored like a byte run, so a big-endian
+ * integer is a plain field in MSB first order and a little-endian one is a
+ * plain field in LSB first order.  The other byte order is the field with
+ * its bytes swapped.
+ */
+static unsigned long _bitpack_bswap(unsigned long value, unsigned long num_bytes)
+{
+#if defined(__GNUC__)
+    return num_bytes ? __builtin_bswap64(value) >> (64 - 8 * num_bytes) : 0;
+#else
+    unsigned long w = 0;
+    unsigned long i;
+
+    for (i = 0; i < num_bytes; i++, value >>= 8) {
+        w = (w << 8) | (value & 0xff);
+    }
+
+    return w;
+#endif
+}
+
+static int _bitpack_set_endian(bitpack_t bp, unsigned long value, unsigned long num_bytes,
+        unsigned long index, bitpack_order_t order)
+{
+    _bitpack_err_clear(bp);
+
+    if (num_bytes > sizeof(unsigned long)) {
+        _bitpack_err_set(bp, BITPACK_ERR_RANGE_TOO_BIG, num_bytes * 8, sizeof(unsigned long) * 8);
+        return BITPACK_RV_ERROR;
+    }
+
+    /* check before swapping so the error shows the caller's value */
+    if (num_bytes < sizeof(unsigned long) && (value >> (num_bytes * 8)) != 0) {
+        _bitpack_err_set(bp, BITPACK_ERR_VALUE_TOO_BIG, value, num_bytes * 8);
+        return BITPACK_RV_ERROR;
+    }
+
+    if (bp->ops->order != order) {
+        value = _bitpack_bswap(value, num_bytes);
+    }
+
+    return bitpack_set_bits(bp, value, num_bytes * 8, index);
+}
+
+static int _bitpack_get_endian(bitpack_t bp, unsigned long num_bytes, unsigned long index,
+        unsigned long *value, bitpack_order_t order)
+{
+    if (num_bytes > sizeof(unsigned long)) {
+        _bitpack_err_clear(bp);
+        _bitpack_err_set(bp, BITPACK_ERR_RANGE_TOO_BIG, num_bytes * 8, sizeof(unsigned long) * 8);
+        return BITPACK_RV_ERROR;
+    }
+
+    if (!bitpack_get_bits(bp, num_bytes * 8, index, value)) {
+        return BITPACK_RV_ERROR;
+    }
+
+    if (bp->ops->order != order) {
+        *value = _bitpack_bswap(*value, num_bytes);
+    }
+
+    return BITPACK_RV_SUCCESS;
+}
+
+static int _bitpack_read_endian(bitpack_t bp, unsigned long num_bytes, unsigned long *value,
+        bitpack_order_t order)
+{
+    _bitpack_err_clear(bp);
+
+    if (bp->read_pos + num_bytes * 8 > bitpack_size(bp)) {
+        _bitpack_err_set(bp, BITPACK_ERR_READ_PAST_END, bitpack_size(bp) - 1, 0);
+        return BITPACK_RV_ERROR;
+    }
+
+    if (!_bitpack_get_endian(bp, num_bytes, bp->read_pos, value, order)) {
+        return BITPACK_RV_ERROR;
+    }
+
+    bp->read_pos += num_bytes * 8;
+
+    return BITPACK_RV_SUCCESS;
+}
+
+int bitpack_set_le(bitpack_t bp, unsigned long value, unsigned long num_bytes, unsigned long index)
+{
+    return _bitpack_set_endian(bp, value, num_bytes, index, BITPACK_LSB_FIRST);
+}
+
+int bitpack_get_le(bitpack_t bp, unsigned long num_bytes, unsigned long index, unsigned long *value)
+{
+    return _bitpack_get_endian(bp, num_bytes, index, value, BITPACK_LSB_FIRST);
+}
+
+int bitpack_read_le(bitpack_t bp, unsigned long num_bytes, unsigned long *value)
+{
+    return _bitpack_read_endian(bp, num_bytes, value, BITPACK_LSB_FIRST);
+}
+
+int bitpack_set_be(bitpack_t bp, unsigned long value, unsigned long num_bytes, unsigned long index)
+{
+    return _bitpack_set_endian(bp, value, num_bytes, index, BITPACK_MSB_FIRST);
+}
+
+int bitpack_get_be(bitpack_t bp, unsigned long num_bytes, unsigned long index, unsigned long *value)
+{
+    return _bitpack_get_endian(bp, num_bytes, index, value, BITPACK_MSB_FIRST);
+}
+
+int bitpack_read_be(bitpack_t bp, unsigned long num_bytes, unsigned long *value)
+{
+    return _bitpack_read_endian(bp, num_bytes, value, BITPACK_MSB_FIRST);
+}
+
+/* number of significant bits in a little-endian array of words */
+static unsigned long _bitpack_wide_bit_length(const unsigned long *words, unsigned long num_words)
+{
+    unsigned long i = num_words;
+    unsigned long bits;
+
+    while (i > 0 && words[i - 1] == 0) {
+        i--;
+    }
+
+    if (i == 0) {
+        return 0;
+    }
+
+    for (bits = 0; bits < BITPACK_WORD_BITS && (words[i - 1] >> bits) != 0; bits++)
+        ;
+
+    return (i - 1) * BITPACK_WORD_BITS + bits;
+}
+
+/*
+ * Wide fields are stored like any other field, so in MSB first order the
+ * most significant word goes first, holding the num_bits % BITPACK_WORD_BITS
+ * leftover bits when num_bits is not a multiple of the word size, and in LSB
+ * first order the least significant word goes first.  This gives the bit
+ * index of value bits lo to hi - 1 of a num_bits bit field at index.
+ */
+static unsigned long _bitpack_chunk_index(bitpack_t bp, unsigned long index,
+        unsigned long num_bits, unsigned long lo, unsigned long hi)
+{
+    return bp->ops->order == BITPACK_LSB_FIRST ? index + lo : index + num_bits - hi;
+}
+
+int bitpack_set_wide_bits(bitpack_t bp, const unsigned long *words, unsigned long num_words,
+        unsigned long num_bits, unsigned long index)
+{
+    unsigned long value_bits;
+    unsigned long bits;
+    unsigned long i;
+
+    _bitpack_err_clear(bp);
+
+    if (!_bitpack_writable(bp)) {
+        return BITPACK_RV_ERROR;
+    }
+
+    if (num_bits > ULONG_MAX - index) {
+        _bitpack_err_set(bp, BITPACK_ERR_RANGE_TOO_BIG, num_bits, ULONG_MAX - index);
+        return BITPACK_RV_ERROR;
+    }
+
+    value_bits = _bitpack_wide_bit_length(words, num_words);
+
+    if (value_bits > num_bits) {
+        _bitpack_err_set(bp, BITPACK_ERR_WIDE_VALUE_TOO_BIG, value_bits, num_bits);
+        return BITPACK_RV_ERROR;
+    }
+
+    if (bitpack_size(bp) < index + num_bits) {
+        if (!_bitpack_resize(bp, index + num_bits)) {
+            return BITPACK_RV_ERROR;
+        }
+    }
+
+    for (i = 0; i * BITPACK_WORD_BITS < num_bits; i++) {
+        bits = num_bits - i * BITPACK_WORD_BITS;
+        if (bits > BITPACK_WORD_BITS) {
+            bits = BITPACK_WORD_BITS;
+        }
+
+        bp->ops->write_field(bp->data, bp->data_size,
+                             _bitpack_chunk_index(bp, index, num_bits, i * BITPACK_WORD_BITS,
+                                                  i * BITPACK_WORD_BITS + bits),
+                             bits, i < num_words ? words[i] : 0);
+    }
+
+    return BITPACK_RV_SUCCESS;
+}
+
+int bitpack_get_wide_bits(bitpack_t bp, unsigned long num_bits, unsigned long index,
+        unsigned long *words, unsigned long num_words)
+{
+    unsigned long bits;
+    unsigned long i;
+
+    _bitpack_err_clear(bp);
+
+    if (index >= bitpack_size(bp)) {
+        _bitpack_err_set(bp, BITPACK_ERR_INVALID_INDEX, index, bitpack_size(bp) - 1);
+        return BITPACK_RV_ERROR;
+    }
+
+    if (num_bits > bitpack_size(bp) - index) {
+        _bitpack_err_set(bp, BITPACK_ERR_READ_PAST_END, bitpack_size(bp) - 1, 0);
+        return BITPACK_RV_ERROR;
+    }
+
+    if (num_bits > num_words * BITPACK_WORD_BITS) {
+        _bitpack_err_set(bp, BITPACK_ERR_RANGE_TOO_BIG, num_bits, num_words * BITPACK_WORD_BITS);
+        return BITPACK_RV_ERROR;
+    }
+
+    memset(words, 0, num_words * sizeof(unsigned long));
+
+    for (i = 0; i * BITPACK_WORD_BITS < num_bits; i++) {
+        bits = num_bits - i * BITPACK_WORD_BITS;
+        if (bits > BITPACK_WORD_BITS) {
+            bits = BITPACK_WORD_BITS;
+        }
+
+        words[i] = bp->ops->read_field(bp->data, bp->data_size,
+                                       _bitpack_chunk_index(bp, index, num_bits, i * BITPACK_WORD_BITS,
+                                                            i * BITPACK_WORD_BITS + bits),
+                                       bits);
+    }
+
+    return BITPACK_RV_SUCCESS;
+}
+
+int bitpack_read_wide_bits(bitpack_t bp, unsigned long num_bits, unsigned long *words, unsigned long num_words)
+{
+    _bitpack_err_clear(bp);
+
+    if (bp->read_pos > bitpack_size(bp) || num_bits > bitpack_size(bp) - bp->read_pos) {
+        _bitpack_err_set(bp, BITPACK_ERR_READ_PAST_END, bitpack_size(bp) - 1, 0);
+        return BITPACK_RV_ERROR;
+    }
+
+    if (!bitpack_get_wide_bits(bp, num_bits, bp->read_pos, words, num_words)) {
+        return BITPACK_RV_ERROR;
+    }
+
+    bp->read_pos += num_bits;
+
+    return BITPACK_RV_SUCCESS;
+}
+
+#ifdef BITPACK_HAVE_INT128
+int bitpack_set_bits128(bitpack_t bp, unsigned __int128 value, unsigned long num_bits, unsigned long index)
+{
+    _bitpack_err_clear(bp);
+
+    if (!_bitpack_writable(bp)) {
+        return BITPACK_RV_ERROR;
+    }
+
+    if (num_bits > 128) {
+        _bitpack_err_set(bp, BITPACK_ERR_RANGE_TOO_BIG, num_bits, 128);
+        return BITPACK_RV_ERROR;
+    }
+
+    if (num_bits < 128 && (value >> num_bits) != 0) {
+        _bitpack_err_set(bp, BITPACK_ERR_WIDE_VALUE_TOO_BIG,
+                         128 - (value >> 64 ? __builtin_clzll((uint64_t)(value >> 64))
+                                            : 64 + __builtin_clzll((uint64_t)value)),
+                         num_bits);
+        return BITPACK_RV_ERROR;
+    }
+
+    if (bitpack_size(bp) < index + num_bits) {
+        if (!_bitpack_resize(bp, index + num_bits)) {
+            return BITPACK_RV_ERROR;
+        }
+    }
+
+    if (num_bits > 64) {
+        bp->ops->write_field(bp->data, bp->data_size, _bitpack_chunk_index(bp, index, num_bits, 64, num_bits),
+                             num_bits - 64, (uint64_t)(value >> 64));
+        bp->ops->write_field(bp->data, bp->data_size, _bitpack_chunk_index(bp, index, num_bits, 0, 64),
+                             64, (uint64_t)value);
+    }
+    else if (num_bits > 0) {
+        bp->ops->write_field(bp->data, bp->data_size, index, num_bits, (uint64_t)value);
+    }
+
+    return BITPACK_RV_SUCCESS;
+}
+
+int bitpack_get_bits128(bitpack_t bp, unsigned long num_bits, unsigned long index, unsigned __int128 *value)
+{
+    _bitpack_err_clear(bp);
+
+    if (index >= bitpack_size(bp)) {
+        _bitpack_err_set(bp, BITPACK_ERR_INVALID_INDEX, index, bitpack_size(bp) - 1);
+        return BITPACK_RV_ERROR;
+    }
+
+    if (index + num_bits > bitpack_size(bp)) {
+        _bitpack_err_set(bp, BITPACK_ERR_READ_PAST_END, bitpack_size(bp) - 1, 0);
+        return BITPACK_RV_ERROR;
+    }
+
+    if (num_bits > 128) {
+        _bitpack_err_set(bp, BITPACK_ERR_RANGE_TOO_BIG, num_bits, 128);
+        return BITPACK_RV_ERROR;
+    }
+
+    if (num_bits > 64) {
+        *value = ((unsigned __int128)bp->ops->read_field(bp->data, bp->data_size,
+                                                         _bitpack_chunk_index(bp, index, num_bits, 64, num_bits),
+                                                         num_bits - 64) << 64) |
+                 bp->ops->read_field(bp->data, bp->data_size,
+                                     _bitpack_chunk_index(bp, index, num_bits, 0, 64), 64);
+    }
+    else if (num_bits > 0) {
+        *value = bp->ops->read_field(bp->data, bp->data_size, index, num_bits);
+    }
+    else {
+        *value = 0;
+    }
+
+    return BITPACK_RV_SUCCESS;
+}
+#endif
+
+int bitpack_to_bin(bitpack_t bp, char **str)
+{
+    unsigned long  i;
+    unsigned long  full = bp->size / 8;
+    char          *string;
+    unsigned char  tmp[8];
+
+    _bitpack_err_clear(bp);
+
+    string = malloc(bitpack_size(bp) + 1);
+
+    if (string == NULL) {
+        *str = NULL;
+        _bitpack_err_set(bp, BITPACK_ERR_MALLOC_FAILED, 0, 0);
+        return BITPACK_RV_ERROR;
+    }
+
+    /* 8 characters per table lookup */
+    for (i = 0; i < full; i++) {
+        _bitpack_store_be64((unsigned char *)string + i * 8, bp->ops->bin_table[bp->data[i]]);
+    }
+
+    if (bp->size % 8 != 0) {
+        _bitpack_store_be64(tmp, bp->ops->bin_table[bp->data[full]]);
+        memcpy(string + full * 8, tmp, bp->size % 8);
+    }
+
+    string[bp->size] = '\0';
+
+    *str = string;
+
+    return BITPACK_RV_SUCCESS;
+}
+
+int bitpack_to_hex(bitpack_t bp, char **str)
+{
+    unsigned long  i;
+    unsigned long  num_digits = (bp->size + 3) / 4;
+    unsigned char  byte;
+    char          *string;
+
+    _bitpack_err_clear(bp);
+
+    /* round up to whole bytes so the loop can always emit digit pairs */
+    string = malloc(num_digits + 2);
+
+    if (string == NULL) {
+        *str = NULL;
+        _bitpack_err_set(bp, BITPACK_ERR_MALLOC_FAILED, 0, 0);
+        return BITPACK_RV_ERROR;
+    }
+
+    for (i = 0; i < (num_digits + 1) / 2; i++) {
+        byte = bp->data[i];
+
+        /* a view may have stray bits after the end, but the padding must be 0s */
+        if (i == bp->size / 8) {
+            byte &= bp->ops->head_mask[bp->size % 8];
+        }
+
+        /* each digit is the next 4 bits in bit order, as bitpack_to_bin() prints them */
+        if (bp->ops->order == BITPACK_LSB_FIRST) {
+            byte = _bitpack_reverse64(byte) >> 56;
+        }
+
+        string[i * 2]     = _bitpack_hex_table[byte] >> 8;
+        string[i * 2 + 1] = _bitpack_hex_table[byte] & 0xff;
+    }
+
+    string[num_digits] = '\0';
+
+    *str = string;
+
+    return BITPACK_RV_SUCCESS;
+}
+
+int bitpack_to_base64(bitpack_t bp, char **str)
+{
+    unsigned long  i;
+    unsigned long  num_bytes = round8(bp->size) / 8;
+    unsigned long  v;
+    unsigned char *bytes;
+    char          *string;
+    char          *s;
+
+    _bitpack_err_clear(bp);
+
+    string = malloc((num_bytes + 2) / 3 * 4 + 1);
+    bytes  = malloc(num_bytes + 2);
+
+    if (string == NULL || bytes == NULL) {
+        free(string);
+        free(bytes);
+        *str = NULL;
+        _bitpack_err_set(bp, BITPACK_ERR_MALLOC_FAILED, 0, 0);
+        return BITPACK_RV_ERROR;
+    }
+
+    /* work from a zero padded copy so the last group needs no special reads */
+    bitpack_to_bytes_into(bp, bytes, NULL);
+    bytes[num_bytes] = bytes[num_bytes + 1] = 0;
+
+    s = string;
+
+    for (i = 0; i < num_bytes; i += 3) {
+        v = ((unsigned long)bytes[i] << 16) | ((unsigned long)bytes[i + 1] << 8) | bytes[i + 2];
+
+        *s++ = _bitpack_base64_alphabet[(v >> 18) & 0x3f];
+        *s++ = _bitpack_base64_alphabet[(v >> 12) & 0x3f];
+        *s++ = (i + 1 < num_bytes) ? _bitpack_base64_alphabet[(v >> 6) & 0x3f] : '=';
+        *s++ = (i + 2 < num_bytes) ? _bitpack_base64_alphabet[v & 0x3f] : '=';
+    }
+
+    *s = '\0';
+
+    free(bytes);
+
+    *str = string;
 
     return BITPACK_RV_SUCCESS;
 }
 
 int bitpack_to_bytes(bitpack_t bp, unsigned char **value, unsigned long *num_bytes)
 {
-    unsigned char *bytes;
-    unsigned long  bytes_size = round8(bp->size) / 8;
+    unsigned char *bytes;
+    unsigned long  bytes_size = round8(bp->size) / 8;
+
+    _bitpack_err_clear(bp);
+
+    bytes = malloc(bytes_size);
+
+    if (bytes == NULL) {
+        _bitpack_err_set(bp, BITPACK_ERR_MALLOC_FAILED, 0, 0);
+        return BITPACK_RV_ERROR;
+    }
+
+    bitpack_to_bytes_into(bp, bytes, num_bytes);
+
+    *value = bytes;
+
+    return BITPACK_RV_SUCCESS;
+}
+
+int bitpack_to_bytes_into(bitpack_t bp, unsigned char *value, unsigned long *num_bytes)
+{
+    unsigned long bytes_size = round8(bp->size) / 8;
+
+    _bitpack_err_clear(bp);
+
+    memcpy(value, bp->data, bytes_size);
+
+    /* a view may have stray bits after the end, but the padding must be 0s */
+    if (bp->size % 8 != 0) {
+        value[bytes_size - 1] &= bp->ops->head_mask[bp->size % 8];
+    }
+
+    if (num_bytes) {
+        *num_bytes = bytes_size;
+    }
+
+    return BITPACK_RV_SUCCESS;
+}
+
+/*
+ * A compiled schema is a list of ops.  Each op is either a group of adjacent
+ * integer fields, packed together as one word of at most 64 bits, or a byte
+ * run.  The bit offset of each op is fixed relative to the start of its
+ * segment, i.e. the start of the record or the end of the previous VARBYTES
+ * run, so packing never has to track a running position field by field.
+ */
+struct _bitpack_schema_op
+{
+    bitpack_field_type_t type;      /* BITPACK_FIELD_UINT for an integer group */
+    unsigned long        first;     /* index of the first field of the op */
+    unsigned long        count;     /* number of fields in the op */
+    unsigned long        bits;      /* width of an integer group */
+    unsigned long        offset;    /* bit offset from the start of the segment */
+};
+
+struct _bitpack_schema_t
+{
+    unsigned long              num_fields;
+    bitpack_field_t           *fields;
+    unsigned char             *shifts[2];   /* shift of each integer field within its group, per bit order */
+    unsigned long              num_ops;
+    struct _bitpack_schema_op *ops;
+    unsigned long              fixed_bits;  /* record size, not counting VARBYTES runs */
+    unsigned long              tail_bits;   /* size of the last segment */
+};
+
+/* load an integer struct member as 64 bits, sign extending signed members */
+static uint64_t _bitpack_member_load(const unsigned char *p, size_t size, int is_signed)
+{
+    uint8_t  u8;
+    uint16_t u16;
+    uint32_t u32;
+    uint64_t u64;
+
+    switch (size) {
+    case 1:
+        memcpy(&u8, p, 1);
+        return is_signed ? (uint64_t)(int8_t)u8 : u8;
+    case 2:
+        memcpy(&u16, p, 2);
+        return is_signed ? (uint64_t)(int16_t)u16 : u16;
+    case 4:
+        memcpy(&u32, p, 4);
+        return is_signed ? (uint64_t)(int32_t)u32 : u32;
+    default:
+        memcpy(&u64, p, 8);
+        return u64;
+    }
+}
+
+/* store the low bits of value into an integer struct member */
+static void _bitpack_member_store(unsigned char *p, size_t size, uint64_t value)
+{
+    uint8_t  u8  = (uint8_t)value;
+    uint16_t u16 = (uint16_t)value;
+    uint32_t u32 = (uint32_t)value;
+
+    switch (size) {
+    case 1:  memcpy(p, &u8, 1);    break;
+    case 2:  memcpy(p, &u16, 2);   break;
+    case 4:  memcpy(p, &u32, 4);   break;
+    default: memcpy(p, &value, 8); break;
+    }
+}
+
+/* check a single field descriptor, given the ones before it */
+static int _bitpack_field_valid(const bitpack_field_t *fields, unsigned long i)
+{
+    const bitpack_field_t *f = &fields[i];
+
+    switch (f->type) {
+    case BITPACK_FIELD_UINT:
+    case BITPACK_FIELD_SINT:
+        if (f->size != 1 && f->size != 2 && f->size != 4 && f->size != 8) {
+            return 0;
+        }
+        return f->bits >= 1 && f->bits <= 64 && f->bits <= f->size * 8;
+    case BITPACK_FIELD_BYTES:
+        return 1;
+    case BITPACK_FIELD_VARBYTES:
+        return f->len_field < i && fields[f->len_field].type == BITPACK_FIELD_UINT;
+    default:
+        return 0;
+    }
+}
+
+bitpack_schema_t bitpack_schema_compile(const bitpack_field_t *fields, unsigned long num_fields)
+{
+    bitpack_schema_t           schema;
+    struct _bitpack_schema_op *op = NULL;
+    const bitpack_field_t     *f;
+    unsigned long              seg_bits = 0;
+    unsigned long              i, j;
+
+    for (i = 0; i < num_fields; i++) {
+        if (!_bitpack_field_valid(fields, i)) {
+            return NULL;
+        }
+    }
+
+    schema = calloc(1, sizeof(struct _bitpack_schema_t));
+    if (schema == NULL) return NULL;
+
+    /* at most one op per field, and one byte of padding for empty schemas */
+    schema->fields = malloc(num_fields * sizeof(bitpack_field_t) + 1);
+    schema->shifts[BITPACK_MSB_FIRST] = calloc(num_fields + 1, 1);
+    schema->shifts[BITPACK_LSB_FIRST] = calloc(num_fields + 1, 1);
+    schema->ops    = malloc(num_fields * sizeof(struct _bitpack_schema_op) + 1);
+
+    if (schema->fields == NULL || schema->shifts[BITPACK_MSB_FIRST] == NULL ||
+            schema->shifts[BITPACK_LSB_FIRST] == NULL || schema->ops == NULL) {
+        bitpack_schema_destroy(schema);
+        return NULL;
+    }
+
+    memcpy(schema->fields, fields, num_fields * sizeof(bitpack_field_t));
+    schema->num_fields = num_fields;
+
+    for (i = 0; i < num_fields; i++) {
+        f = &fields[i];
+
+        if (f->type == BITPACK_FIELD_UINT || f->type == BITPACK_FIELD_SINT) {
+            /* extend the current integer group, or start a new one */
+            if (op == NULL || op->type != BITPACK_FIELD_UINT || op->bits + f->bits > 64) {
+                op = &schema->ops[schema->num_ops++];
+                op->type   = BITPACK_FIELD_UINT;
+                op->first  = i;
+                op->count  = 0;
+                op->bits   = 0;
+                op->offset = seg_bits;
+            }
+
+            /* LSB first, each field sits above the earlier ones */
+            schema->shifts[BITPACK_LSB_FIRST][i] = op->bits;
+
+            op->count++;
+            op->bits += f->bits;
+            seg_bits += f->bits;
+            schema->fixed_bits += f->bits;
+
+            /* MSB first, the earlier fields shift up */
+            for (j = op->first; j < i; j++) {
+                schema->shifts[BITPACK_MSB_FIRST][j] += f->bits;
+            }
+        }
+        else {
+            op = &schema->ops[schema->num_ops++];
+            op->type   = f->type;
+            op->first  = i;
+            op->count  = 1;
+            op->bits   = 0;
+            op->offset = seg_bits;
+
+            if (f->type == BITPACK_FIELD_BYTES) {
+                seg_bits += f->num_bytes * 8;
+                schema->fixed_bits += f->num_bytes * 8;
+            }
+            else {
+                seg_bits = 0;
+            }
+        }
+    }
+
+    schema->tail_bits = seg_bits;
+
+    return schema;
+}
+
+void bitpack_schema_destroy(bitpack_schema_t schema)
+{
+    free(schema->fields);
+    free(schema->shifts[BITPACK_MSB_FIRST]);
+    free(schema->shifts[BITPACK_LSB_FIRST]);
+    free(schema->ops);
+    free(schema);
+}
+
+int bitpack_append_record(bitpack_t bp, bitpack_schema_t schema, const void *record)
+{
+    const unsigned char             *rec    = record;
+    const unsigned char             *shifts = schema->shifts[bp->ops->order];
+    const struct _bitpack_schema_op *op;
+    const bitpack_field_t           *f;
+    unsigned long                    seg    = bitpack_size(bp);
+    unsigned long                    size   = schema->fixed_bits;
+    unsigned long                    i, j, len;
+    uint64_t                         v, w;
+
+    _bitpack_err_clear(bp);
+
+    if (!_bitpack_writable(bp)) {
+        return BITPACK_RV_ERROR;
+    }
+
+    /* check every value and work out the record size before writing anything */
+    for (i = 0; i < schema->num_fields; i++) {
+        f = &schema->fields[i];
+
+        switch (f->type) {
+        case BITPACK_FIELD_UINT:
+            v = _bitpack_member_load(rec + f->offset, f->size, 0);
+            if (f->bits < 64 && (v >> f->bits) != 0) {
+                _bitpack_err_set(bp, BITPACK_ERR_VALUE_TOO_BIG, v, f->bits);
+                return BITPACK_RV_ERROR;
+            }
+            break;
+        case BITPACK_FIELD_SINT:
+            v = _bitpack_member_load(rec + f->offset, f->size, 1);
+            if (f->bits < 64 && ((v + ((uint64_t)1 << (f->bits - 1))) >> f->bits) != 0) {
+                _bitpack_err_set(bp, BITPACK_ERR_SIGNED_VALUE_TOO_BIG, v, f->bits);
+                return BITPACK_RV_ERROR;
+            }
+            break;
+        case BITPACK_FIELD_VARBYTES:
+            len = _bitpack_member_load(rec + schema->fields[f->len_field].offset,
+                                       schema->fields[f->len_field].size, 0);
+            if (len > f->num_bytes) {
+                _bitpack_err_set(bp, BITPACK_ERR_BUFFER_TOO_SMALL, len, f->num_bytes);
+                return BITPACK_RV_ERROR;
+            }
+            size += len * 8;
+            break;
+        default:
+            break;
+        }
+    }
+
+    if (!_bitpack_resize(bp, seg + size)) {
+        return BITPACK_RV_ERROR;
+    }
+
+    for (i = 0; i < schema->num_ops; i++) {
+        op = &schema->ops[i];
+        f  = &schema->fields[op->first];
+
+        switch (op->type) {
+        case BITPACK_FIELD_UINT:
+            w = 0;
+            for (j = 0; j < op->count; j++, f++) {
+                v  = _bitpack_member_load(rec + f->offset, f->size, 0);
+                w |= (v & (~(uint64_t)0 >> (64 - f->bits))) << shifts[op->first + j];
+            }
+            bp->ops->write_field(bp->data, bp->data_size, seg + op->offset, op->bits, w);
+            break;
+        case BITPACK_FIELD_BYTES:
+            bp->ops->put_bytes(bp->data, seg + op->offset, rec + f->offset, f->num_bytes);
+            break;
+        default:
+            len = _bitpack_member_load(rec + schema->fields[f->len_field].offset,
+                                       schema->fields[f->len_field].size, 0);
+            bp->ops->put_bytes(bp->data, seg + op->offset, rec + f->offset, len);
+            seg += op->offset + len * 8;
+            break;
+        }
+    }
+
+    return BITPACK_RV_SUCCESS;
+}
+
+int bitpack_read_record(bitpack_t bp, bitpack_schema_t schema, void *record)
+{
+    unsigned char                   *rec    = record;
+    const unsigned char             *shifts = schema->shifts[bp->ops->order];
+    const struct _bitpack_schema_op *op;
+    const bitpack_field_t           *f;
+    unsigned long                    seg    = bp->read_pos;
+    unsigned long                    end    = bp->read_pos + schema->fixed_bits;
+    unsigned long                    i, j, len;
+    uint64_t                         v, w;
+
+    _bitpack_err_clear(bp);
+
+    if (end > bitpack_size(bp)) {
+        _bitpack_err_set(bp, BITPACK_ERR_READ_PAST_END, bitpack_size(bp) - 1, 0);
+        return BITPACK_RV_ERROR;
+    }
+
+    for (i = 0; i < schema->num_ops; i++) {
+        op = &schema->ops[i];
+        f  = &schema->fields[op->first];
+
+        switch (op->type) {
+        case BITPACK_FIELD_UINT:
+            w = bp->ops->read_field(bp->data, bp->data_size, seg + op->offset, op->bits);
+            for (j = 0; j < op->count; j++, f++) {
+                v = (w >> shifts[op->first + j]) & (~(uint64_t)0 >> (64 - f->bits));
+                if (f->type == BITPACK_FIELD_SINT) {
+                    v = (uint64_t)((int64_t)(v << (64 - f->bits)) >> (64 - f->bits));
+                }
+                _bitpack_member_store(rec + f->offset, f->size, v);
+            }
+            break;
+        case BITPACK_FIELD_BYTES:
+            bp->ops->take_bytes(bp->data, seg + op->offset, rec + f->offset, f->num_bytes);
+            break;
+        default:
+            /* the length field comes earlier, so it has already been unpacked */
+            len = _bitpack_member_load(rec + schema->fields[f->len_field].offset,
+                                       schema->fields[f->len_field].size, 0);
+            if (len > f->num_bytes) {
+                _bitpack_err_set(bp, BITPACK_ERR_BUFFER_TOO_SMALL, len, f->num_bytes);
+                return BITPACK_RV_ERROR;
+            }
+            end += len * 8;
+            if (end > bitpack_size(bp)) {
+                _bitpack_err_set(bp, BITPACK_ERR_READ_PAST_END, bitpack_size(bp) - 1, 0);
+                return BITPACK_RV_ERROR;
+            }
+            bp->ops->take_bytes(bp->data, seg + op->offset, rec + f->offset, len);
+            seg += op->offset + len * 8;
+            break;
+        }
+    }
+
+    bp->read_pos = seg + schema->tail_bits;
+
+    return BITPACK_RV_SUCCESS;
+}
+
+/*
+ * Integer array kernels.  Every kernel packs or unpacks n values of w bits
+ * (1 to 32), starting s bits (0 to 7) into the byte at p.  The scalar
+ * kernels are instantiated once per width and bit order so that the shifts
+ * and masks are constants, and are picked through a table indexed by bit
+ * order and width.
+ */
+#if defined(__GNUC__)
+#define BITPACK_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define BITPACK_ALWAYS_INLINE inline
+#endif
+
+#define BITPACK_WIDTHS(M) \
+    M(1)  M(2)  M(3)  M(4)  M(5)  M(6)  M(7)  M(8)  \
+    M(9)  M(10) M(11) M(12) M(13) M(14) M(15) M(16) \
+    M(17) M(18) M(19) M(20) M(21) M(22) M(23) M(24) \
+    M(25) M(26) M(27) M(28) M(29) M(30) M(31) M(32)
+
+typedef void (*_bitpack_pack_fn)(unsigned char *p, unsigned int s,
+        const uint32_t *src, unsigned long n);
+
+typedef void (*_bitpack_unpack_fn)(uint32_t *dst, const unsigned char *p,
+        const unsigned char *end, unsigned int s, unsigned long n);
+
+/*
+ * Values are shifted into a 64 bit accumulator, which is flushed 32 bits at
+ * a time.  The final partial byte is written with 0 padding, which keeps the
+ * bits past the end of the bitpack cleared.
+ */
+static BITPACK_ALWAYS_INLINE void _bitpack_pack_kernel(unsigned char *p, unsigned int s,
+        const uint32_t *src, unsigned long n, unsigned int w)
+{
+    uint64_t      acc  = s ? p[0] >> (8 - s) : 0;
+    unsigned int  bits = s;
+    unsigned long i;
+
+    for (i = 0; i < n; i++) {
+        acc   = (acc << w) | src[i];
+        bits += w;
+
+        if (bits >= 32) {
+            bits -= 32;
+            _bitpack_store_be32(p, (uint32_t)(acc >> bits));
+            p += 4;
+        }
+    }
+
+    while (bits >= 8) {
+        bits -= 8;
+        *p++ = (unsigned char)(acc >> bits);
+    }
+
+    if (bits) {
+        *p = (unsigned char)(acc << (8 - bits));
+    }
+}
+
+/*
+ * The counterpart of _bitpack_pack_kernel(), refilling the accumulator 32
+ * bits at a time.  Loads never go past end.
+ */
+static BITPACK_ALWAYS_INLINE void _bitpack_unpack_kernel(uint32_t *dst, const unsigned char *p,
+        const unsigned char *end, unsigned int s, unsigned long n, unsigned int w)
+{
+    uint64_t      acc  = 0;
+    unsigned int  bits = 0;
+    uint32_t      mask = (uint32_t)(~(uint64_t)0 >> (64 - w));
+    unsigned long i;
+
+    if (n == 0) {
+        return;
+    }
+
+    if (s) {
+        acc  = *p++ & (0xff >> s);
+        bits = 8 - s;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (bits < w) {
+            if (end - p >= 4) {
+                acc   = (acc << 32) | _bitpack_load_be32(p);
+                p    += 4;
+                bits += 32;
+            }
+            else {
+                while (bits < w) {
+                    acc   = (acc << 8) | *p++;
+                    bits += 8;
+                }
+            }
+        }
+
+        bits  -= w;
+        dst[i] = (uint32_t)(acc >> bits) & mask;
+    }
+}
+
+/*
+ * The LSB first kernels are the mirror images: values go in at the top of
+ * the accumulator, which is flushed from the bottom as little-endian words.
+ */
+static BITPACK_ALWAYS_INLINE void _bitpack_pack_kernel_lsb(unsigned char *p, unsigned int s,
+        const uint32_t *src, unsigned long n, unsigned int w)
+{
+    uint64_t      acc  = s ? p[0] & (0xff >> (8 - s)) : 0;
+    unsigned int  bits = s;
+    unsigned long i;
+
+    for (i = 0; i < n; i++) {
+        acc  |= (uint64_t)src[i] << bits;
+        bits += w;
+
+        if (bits >= 32) {
+            _bitpack_store_le32(p, (uint32_t)acc);
+            p    += 4;
+            acc >>= 32;
+            bits -= 32;
+        }
+    }
+
+    while (bits >= 8) {
+        *p++  = (unsigned char)acc;
+        acc >>= 8;
+        bits -= 8;
+    }
+
+    if (bits) {
+        *p = (unsigned char)acc;
+    }
+}
+
+static BITPACK_ALWAYS_INLINE void _bitpack_unpack_kernel_lsb(uint32_t *dst, const unsigned char *p,
+        const unsigned char *end, unsigned int s, unsigned long n, unsigned int w)
+{
+    uint64_t      acc  = 0;
+    unsigned int  bits = 0;
+    uint32_t      mask = (uint32_t)(~(uint64_t)0 >> (64 - w));
+    unsigned long i;
+
+    if (n == 0) {
+        return;
+    }
+
+    if (s) {
+        acc  = *p++ >> s;
+        bits = 8 - s;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (bits < w) {
+            if (end - p >= 4) {
+                acc  |= (uint64_t)_bitpack_load_le32(p) << bits;
+                p    += 4;
+                bits += 32;
+            }
+            else {
+                while (bits < w) {
+                    acc  |= (uint64_t)*p++ << bits;
+                    bits += 8;
+                }
+            }
+        }
+
+        dst[i] = (uint32_t)acc & mask;
+        acc  >>= w;
+        bits  -= w;
+    }
+}
+
+#define BITPACK_ARRAY_KERNELS(w) \
+    static void _bitpack_pack_##w(unsigned char *p, unsigned int s, \
+            const uint32_t *src, unsigned long n) \
+    { \
+        _bitpack_pack_kernel(p, s, src, n, w); \
+    } \
+    static void _bitpack_unpack_##w(uint32_t *dst, const unsigned char *p, \
+            const unsigned char *end, unsigned int s, unsigned long n) \
+    { \
+        _bitpack_unpack_kernel(dst, p, end, s, n, w); \
+    } \
+    static void _bitpack_pack_lsb_##w(unsigned char *p, unsigned int s, \
+            const uint32_t *src, unsigned long n) \
+    { \
+        _bitpack_pack_kernel_lsb(p, s, src, n, w); \
+    } \
+    static void _bitpack_unpack_lsb_##w(uint32_t *dst, const unsigned char *p, \
+            const unsigned char *end, unsigned int s, unsigned long n) \
+    { \
+        _bitpack_unpack_kernel_lsb(dst, p, end, s, n, w); \
+    }
+
+BITPACK_WIDTHS(BITPACK_ARRAY_KERNELS)
+
+#define BITPACK_PACK_ENTRY(w)       _bitpack_pack_##w,
+#define BITPACK_UNPACK_ENTRY(w)     _bitpack_unpack_##w,
+#define BITPACK_PACK_LSB_ENTRY(w)   _bitpack_pack_lsb_##w,
+#define BITPACK_UNPACK_LSB_ENTRY(w) _bitpack_unpack_lsb_##w,
+
+static const _bitpack_pack_fn _bitpack_pack_kernels[2][33] = {
+    { NULL, BITPACK_WIDTHS(BITPACK_PACK_ENTRY) },
+    { NULL, BITPACK_WIDTHS(BITPACK_PACK_LSB_ENTRY) }
+};
+
+static const _bitpack_unpack_fn _bitpack_unpack_kernels[2][33] = {
+    { NULL, BITPACK_WIDTHS(BITPACK_UNPACK_ENTRY) },
+    { NULL, BITPACK_WIDTHS(BITPACK_UNPACK_LSB_ENTRY) }
+};
+
+#ifdef BITPACK_X86_SIMD
+/*
+ * SIMD unpacking handles blocks of 8 values, which take up exactly w bytes,
+ * so every block starts s bits into its first byte just like the first one.
+ * For w up to 25 each value lies within the 4 bytes starting at the byte
+ * holding its first bit, so a block is decoded by shuffling those 4 bytes of
+ * every value into a 32 bit lane in big-endian order, shifting left to drop
+ * the bits before the value, then shifting right by 32 - w.
+ *
+ * Values 0-3 are shuffled from the 16 bytes at the start of the block and
+ * values 4-7 from the 16 bytes starting at byte (s + 4w) / 8, which keeps
+ * each half within a 128 bit lane for pshufb.
+ */
+#define BITPACK_SIMD_MAX_WIDTH 25
+
+typedef struct
+{
+    unsigned char shuffle[32];      /* pshufb indices of each half */
+    uint32_t      shift[8];         /* left shift of each value */
+    unsigned long half;             /* byte offset of the second half */
+} _bitpack_unpack_plan;
+
+static void _bitpack_unpack_plan_init(_bitpack_unpack_plan *plan, unsigned int s, unsigned int w)
+{
+    unsigned int h, k, j, o;
+
+    plan->half = (s + 4 * w) / 8;
+
+    for (h = 0; h < 2; h++) {
+        for (k = 0; k < 4; k++) {
+            o = (h ? (s + 4 * w) % 8 : s) + k * w;
+
+            for (j = 0; j < 4; j++) {
+                plan->shuffle[h * 16 + k * 4 + j] = o / 8 + 3 - j;
+            }
+
+            plan->shift[h * 4 + k] = o % 8;
+        }
+    }
+}
+
+/* returns the number of values unpacked, a multiple of 8 */
+__attribute__((target("sse4.1")))
+static unsigned long _bitpack_unpack_sse41(uint32_t *dst, const unsigned char *p,
+        const unsigned char *end, unsigned int s, unsigned long n, unsigned int w)
+{
+    _bitpack_unpack_plan plan;
+    unsigned long        i = 0;
+    __m128i              shuffle_lo, shuffle_hi, mul_lo, mul_hi, lo, hi;
+    __m128i              rshift = _mm_cvtsi32_si128(32 - w);
+
+    _bitpack_unpack_plan_init(&plan, s, w);
+
+    shuffle_lo = _mm_loadu_si128((const __m128i *)plan.shuffle);
+    shuffle_hi = _mm_loadu_si128((const __m128i *)(plan.shuffle + 16));
+    mul_lo     = _mm_setr_epi32(1 << plan.shift[0], 1 << plan.shift[1],
+                                1 << plan.shift[2], 1 << plan.shift[3]);
+    mul_hi     = _mm_setr_epi32(1 << plan.shift[4], 1 << plan.shift[5],
+                                1 << plan.shift[6], 1 << plan.shift[7]);
+
+    for (; i + 8 <= n && end - p >= (long)plan.half + 16; i += 8, p += w) {
+        lo = _mm_loadu_si128((const __m128i *)p);
+        hi = _mm_loadu_si128((const __m128i *)(p + plan.half));
+        lo = _mm_srl_epi32(_mm_mullo_epi32(_mm_shuffle_epi8(lo, shuffle_lo), mul_lo), rshift);
+        hi = _mm_srl_epi32(_mm_mullo_epi32(_mm_shuffle_epi8(hi, shuffle_hi), mul_hi), rshift);
+        _mm_storeu_si128((__m128i *)(dst + i), lo);
+        _mm_storeu_si128((__m128i *)(dst + i + 4), hi);
+    }
+
+    return i;
+}
+
+__attribute__((target("avx2")))
+static unsigned long _bitpack_unpack_avx2(uint32_t *dst, const unsigned char *p,
+        const unsigned char *end, unsigned int s, unsigned long n, unsigned int w)
+{
+    _bitpack_unpack_plan plan;
+    unsigned long        i = 0;
+    __m256i              shuffle, shift, v;
+    __m128i              rshift = _mm_cvtsi32_si128(32 - w);
+
+    _bitpack_unpack_plan_init(&plan, s, w);
+
+    shuffle = _mm256_loadu_si256((const __m256i *)plan.shuffle);
+    shift   = _mm256_loadu_si256((const __m256i *)plan.shift);
+
+    for (; i + 8 <= n && end - p >= (long)plan.half + 16; i += 8, p += w) {
+        v = _mm256_inserti128_si256(
+                _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)p)),
+                _mm_loadu_si128((const __m128i *)(p + plan.half)), 1);
+        v = _mm256_srl_epi32(_mm256_sllv_epi32(_mm256_shuffle_epi8(v, shuffle), shift), rshift);
+        _mm256_storeu_si256((__m256i *)(dst + i), v);
+    }
+
+    return i;
+}
+#endif
+
+typedef unsigned long (*_bitpack_unpack_simd_fn)(uint32_t *dst, const unsigned char *p,
+        const unsigned char *end, unsigned int s, unsigned long n, unsigned int w);
+
+/* pick the best SIMD unpacker for this CPU, NULL if there is none */
+static _bitpack_unpack_simd_fn _bitpack_unpack_simd_select(void)
+{
+#ifdef BITPACK_X86_SIMD
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")) {
+        return _bitpack_unpack_avx2;
+    }
+
+    if (__builtin_cpu_supports("sse4.1")) {
+        return _bitpack_unpack_sse41;
+    }
+#endif
+
+    return NULL;
+}
+
+/* the SIMD kernels are MSB first only, LSB first arrays use the scalar kernels */
+static void _bitpack_unpack_array(uint32_t *dst, const unsigned char *p,
+        const unsigned char *end, unsigned int s, unsigned long n, unsigned int w)
+{
+    static int                     selected = 0;
+    static _bitpack_unpack_simd_fn simd     = NULL;
+    unsigned long                  done     = 0;
+
+    if (!selected) {
+        simd     = _bitpack_unpack_simd_select();
+        selected = 1;
+    }
+
+#ifdef BITPACK_X86_SIMD
+    if (simd != NULL && w <= BITPACK_SIMD_MAX_WIDTH) {
+        done = simd(dst, p, end, s, n, w);
+        p   += done / 8 * w;
+    }
+#endif
+
+    _bitpack_unpack_kernels[BITPACK_MSB_FIRST][w](dst + done, p, end, s, n - done);
+}
+
+int bitpack_append_uint_array(bitpack_t bp, const uint32_t *values, unsigned long n, unsigned int width)
+{
+    unsigned long index = bitpack_size(bp);
+    unsigned long i;
+    uint32_t      all = 0;
+
+    _bitpack_err_clear(bp);
+
+    if (!_bitpack_writable(bp)) {
+        return BITPACK_RV_ERROR;
+    }
+
+    if (width == 0 || width > 32) {
+        _bitpack_err_set(bp, BITPACK_ERR_RANGE_TOO_BIG, width, 32);
+        return BITPACK_RV_ERROR;
+    }
+
+    /* make sure every value fits before writing anything */
+    if (width < 32) {
+        for (i = 0; i < n; i++) {
+            all |= values[i];
+        }
+
+        if (all >> width) {
+            for (i = 0; (values[i] >> width) == 0; i++)
+                ;
+            _bitpack_err_set(bp, BITPACK_ERR_VALUE_TOO_BIG, values[i], width);
+            return BITPACK_RV_ERROR;
+        }
+    }
+
+    if (n == 0) {
+        return BITPACK_RV_SUCCESS;
+    }
+
+    if (!_bitpack_resize(bp, index + n * width)) {
+        return BITPACK_RV_ERROR;
+    }
+
+    _bitpack_pack_kernels[bp->ops->order][width](bp->data + index / 8, index % 8, values, n);
+
+    return BITPACK_RV_SUCCESS;
+}
+
+int bitpack_read_uint_array(bitpack_t bp, uint32_t *values, unsigned long n, unsigned int width)
+{
+    _bitpack_err_clear(bp);
+
+    if (width == 0 || width > 32) {
+        _bitpack_err_set(bp, BITPACK_ERR_RANGE_TOO_BIG, width, 32);
+        return BITPACK_RV_ERROR;
+    }
+
+    if (bp->read_pos > bitpack_size(bp) || n > (bitpack_size(bp) - bp->read_pos) / width) {
+        _bitpack_err_set(bp, BITPACK_ERR_READ_PAST_END, bitpack_size(bp) - 1, 0);
+        return BITPACK_RV_ERROR;
+    }
+
+    if (bp->ops->order == BITPACK_MSB_FIRST) {
+        _bitpack_unpack_array(values, bp->data + bp->read_pos / 8, bp->data + bp->data_size,
+                              bp->read_pos % 8, n, width);
+    }
+    else {
+        _bitpack_unpack_kernels[BITPACK_LSB_FIRST][width](values, bp->data + bp->read_pos / 8,
+                                                          bp->data + bp->data_size, bp->read_pos % 8, n);
+    }
+
+    bp->read_pos += n * width;
+
+    return BITPACK_RV_SUCCESS;
+}
+
+/*
+ * Variable length integer codes.  Each code has a length function, which
+ * returns the number of bits needed to encode a value (0 if it can't be
+ * encoded), and an encoder and decoder working on whole fields: a code is
+ * written with one or two code writes (see _bitpack_read_code_lsb()), and
+ * decoding finds the end of a unary prefix with a single count leading zeros
+ * on a 64 bit window of the bitpack.  The Elias, Exp-Golomb and Rice codes
+ * are bit strings, so they take the same bit indices in either bit order,
+ * while LEB128 groups are bytes and are stored like any byte run.
+ */
+#define BITPACK_VLC_MAX_PARAM 63
+
+/* number of significant bits in v */
+static unsigned int _bitpack_bit_length(uint64_t v)
+{
+#if defined(__GNUC__)
+    return v ? 64 - __builtin_clzll(v) : 0;
+#else
+    unsigned int n = 0;
+
+    while (v) {
+        v >>= 1;
+        n++;
+    }
+
+    return n;
+#endif
+}
+
+/* number of leading 0 bits in v, 64 if v is 0 */
+static unsigned int _bitpack_clz64(uint64_t v)
+{
+    return 64 - _bitpack_bit_length(v);
+}
+
+/* the 64 bits starting at index (at most the size) as a code, with 0s past the end */
+static uint64_t _bitpack_peek64(bitpack_t bp, unsigned long index)
+{
+    uint64_t      w    = bp->ops->read_code(bp->data, bp->data_size, index, 64);
+    unsigned long left = bitpack_size(bp) - index;
+
+    if (left < 64) {
+        w &= ~(~(uint64_t)0 >> left);
+    }
+
+    return w;
+}
+
+static unsigned long _bitpack_vlc_length(bitpack_vlc_t codec, unsigned int param, uint64_t value)
+{
+    unsigned int n;
+
+    switch (codec) {
+    case BITPACK_VLC_LEB128:
+        n = _bitpack_bit_length(value);
+        return n ? (n + 6) / 7 * 8 : 8;
+    case BITPACK_VLC_GAMMA:
+        n = _bitpack_bit_length(value);
+        return n ? 2 * n - 1 : 0;
+    case BITPACK_VLC_DELTA:
+        n = _bitpack_bit_length(value);
+        return n ? 2 * _bitpack_bit_length(n) - 1 + n - 1 : 0;
+    case BITPACK_VLC_EXP_GOLOMB:
+        if (value > ~(uint64_t)0 - ((uint64_t)1 << param)) {
+            return 0;
+        }
+        n = _bitpack_bit_length(value + ((uint64_t)1 << param));
+        return 2 * n - 1 - param;
+    case BITPACK_VLC_RICE:
+        if ((value >> param) >= ~0UL / 2) {
+            return 0;
+        }
+        return (value >> param) + 1 + param;
+    default:
+        return 0;
+    }
+}
+
+/* write num_bits (any number) 0 or 1 bits starting at index */
+static unsigned long _bitpack_write_run(bitpack_t bp, unsigned long index, uint64_t num_bits, int bit)
+{
+    for (; num_bits >= 64; num_bits -= 64, index += 64) {
+        bp->ops->write_code(bp->data, bp->data_size, index, 64, bit ? ~(uint64_t)0 : 0);
+    }
+
+    if (num_bits > 0) {
+        bp->ops->write_code(bp->data, bp->data_size, index, num_bits,
+                            bit ? ~(uint64_t)0 >> (64 - num_bits) : 0);
+    }
+
+    return index + num_bits;
+}
+
+/*
+ * Write the length len code for value at index.  Gamma and Exp-Golomb codes
+ * are n 0 bits followed by an n + 1 bit number, so they are a single code
+ * write when they fit in 64 bits.  LEB128 groups are whole bytes, so they
+ * are assembled into a big-endian word and copied as a byte run.
+ */
+static void _bitpack_vlc_encode(bitpack_t bp, unsigned long index,
+        bitpack_vlc_t codec, unsigned int param, uint64_t value, unsigned long len)
+{
+    unsigned char  buf[16];
+    unsigned char *data      = bp->data;
+    unsigned long  data_size = bp->data_size;
+    uint64_t       w = 0;
+    unsigned int   n, i, groups;
+
+    switch (codec) {
+    case BITPACK_VLC_LEB128:
+        /* 7 bit groups, least significant first, high bit set on all but the last */
+        groups = len / 8;
+        for (i = 0; i < groups && i < 8; i++) {
+            w = (w << 8) | ((value >> (7 * i)) & 0x7f) | (i + 1 < groups ? 0x80 : 0);
+        }
+        _bitpack_store_be64(buf, w << (64 - 8 * i));
+        for (w = 0; i < groups; i++) {
+            w = (w << 8) | ((value >> (7 * i)) & 0x7f) | (i + 1 < groups ? 0x80 : 0);
+        }
+        _bitpack_store_be64(buf + 8, w << (64 - 8 * (groups > 8 ? groups - 8 : 1)));
+        bp->ops->put_bytes(data, index, buf, groups);
+        break;
+    case BITPACK_VLC_GAMMA:
+    case BITPACK_VLC_EXP_GOLOMB:
+        if (codec == BITPACK_VLC_EXP_GOLOMB) {
+            value += (uint64_t)1 << param;
+        }
+        n = _bitpack_bit_length(value);
+        if (len <= 64) {
+            bp->ops->write_code(data, data_size, index, len, value);
+        }
+        else {
+            index = _bitpack_write_run(bp, index, len - n, 0);
+            bp->ops->write_code(data, data_size, index, n, value);
+        }
+        break;
+    case BITPACK_VLC_DELTA:
+        /* the gamma code of the bit length, then the bits after the leading 1 */
+        n = _bitpack_bit_length(value);
+        i = 2 * _bitpack_bit_length(n) - 1;
+        bp->ops->write_code(data, data_size, index, i, n);
+        if (n > 1) {
+            bp->ops->write_code(data, data_size, index + i, n - 1, value);
+        }
+        break;
+    default:
+        /* quotient in unary as 1 bits ended by a 0, then the param bit remainder */
+        if (len <= 64) {
+            n = len - 1 - param;
+            w = n ? (~(uint64_t)0 >> (64 - n)) << (param + 1) : 0;
+            bp->ops->write_code(data, data_size, index, len,
+                                w | (param ? value & (~(uint64_t)0 >> (64 - param)) : 0));
+        }
+        else {
+            index = _bitpack_write_run(bp, index, len - 1 - param, 1);
+            bp->ops->write_code(data, data_size, index, param + 1,
+                                param ? value & (~(uint64_t)0 >> (64 - param)) : 0);
+        }
+        break;
+    }
+}
+
+/*
+ * Decode the code starting at index, returning its length in bits, or 0 if
+ * it runs past the end of the bitpack or is malformed.
+ */
+static unsigned long _bitpack_vlc_decode(bitpack_t bp, unsigned long index,
+        bitpack_vlc_t codec, unsigned int param, unsigned long *value)
+{
+    unsigned long size = bitpack_size(bp);
+    unsigned long len;
+    unsigned long q;
+    unsigned char buf[16];
+    uint64_t      w, stop;
+    unsigned int  n, z, i;
+
+    if (index > size) {
+        _bitpack_err_set(bp, BITPACK_ERR_READ_PAST_END, size - 1, 0);
+        return 0;
+    }
+
+    switch (codec) {
+    case BITPACK_VLC_LEB128:
+        /* up to 10 whole bytes, with 0s past the end */
+        n = (size - index) / 8 < 10 ? (size - index) / 8 : 10;
+        memset(buf, 0, sizeof(buf));
+        bp->ops->take_bytes(bp->data, index, buf, n);
+
+        /* the last group is the first byte with its high bit clear */
+        w    = _bitpack_load_be64(buf);
+        stop = ~w & 0x8080808080808080ULL;
+        if (stop == 0) {
+            /* a 64 bit value takes up to 10 groups */
+            stop = ~_bitpack_load_be64(buf + 8) & 0x8080000000000000ULL;
+            if (stop == 0) {
+                _bitpack_err_set(bp, BITPACK_ERR_INVALID_CODE, index, 0);
+                return 0;
+            }
+            n = 8;
+        }
+        else {
+            n = 0;
+        }
+        n  += _bitpack_clz64(stop) / 8 + 1;
+        len = 8 * n;
+        if (index + len > size) {
+            break;
+        }
+        for (*value = 0, i = 0; i < n && i < 8; i++) {
+            *value |= (unsigned long)((w >> (56 - 8 * i)) & 0x7f) << (7 * i);
+        }
+        if (n > 8) {
+            *value |= (unsigned long)(buf[8] & 0x7f) << 56;
+        }
+        if (n > 9) {
+            /* only the lowest bit of the 10th group is used */
+            if ((buf[9] & 0x7e) != 0) {
+                _bitpack_err_set(bp, BITPACK_ERR_INVALID_CODE, index, 0);
+                return 0;
+            }
+            *value |= (unsigned long)(buf[9] & 1) << 63;
+        }
+        return len;
+    case BITPACK_VLC_GAMMA:
+    case BITPACK_VLC_DELTA:
+    case BITPACK_VLC_EXP_GOLOMB:
+        /* z leading 0s, then a z + 1 (+ param) bit number */
+        w = _bitpack_peek64(bp, index);
+        z = _bitpack_clz64(w);
+        if (z == 64) {
+            if (index + 64 > size) {
+                break;
+            }
+            _bitpack_err_set(bp, BITPACK_ERR_INVALID_CODE, index, 0);
+            return 0;
+        }
+        n = z + 1 + (codec == BITPACK_VLC_EXP_GOLOMB ? param : 0);
+        if (n > 64) {
+            _bitpack_err_set(bp, BITPACK_ERR_INVALID_CODE, index, 0);
+            return 0;
+        }
+        len = z + n;
+        if (index + len > size) {
+            break;
+        }
+        *value = bp->ops->read_code(bp->data, bp->data_size, index + z, n);
+        if (codec == BITPACK_VLC_EXP_GOLOMB) {
+            *value -= 1UL << param;
+        }
+        else if (codec == BITPACK_VLC_DELTA) {
+            /* the gamma code was the bit length n of the value */
+            n = *value;
+            if (n > 64) {
+                _bitpack_err_set(bp, BITPACK_ERR_INVALID_CODE, index, 0);
+                return 0;
+            }
+            if (index + len + n - 1 > size) {
+                break;
+            }
+            *value = n > 1 ? bp->ops->read_code(bp->data, bp->data_size, index + len, n - 1) : 0;
+            *value |= 1UL << (n - 1);
+            len += n - 1;
+        }
+        return len;
+    default:
+        /* count the 1s of the unary quotient a window at a time */
+        w = _bitpack_peek64(bp, index);
+        for (q = 0; (z = _bitpack_clz64(~w)) == 64; w = _bitpack_peek64(bp, index + q)) {
+            q += 64;
+            if (index + q > size) {
+                break;
+            }
+        }
+        q += z;
+        len = q + 1 + param;
+        if (index + q > size || index + len > size) {
+            break;
+        }
+        if (q > (~0UL >> param)) {
+            _bitpack_err_set(bp, BITPACK_ERR_INVALID_CODE, index, 0);
+            return 0;
+        }
+        *value = (q << param) |
+                 (param ? bp->ops->read_code(bp->data, bp->data_size, index + q + 1, param) : 0);
+        return len;
+    }
+
+    _bitpack_err_set(bp, BITPACK_ERR_READ_PAST_END, size - 1, 0);
+    return 0;
+}
+
+/* make sure the codec and its parameter are valid */
+static int _bitpack_vlc_check(bitpack_t bp, bitpack_vlc_t codec, unsigned int param)
+{
+    if ((unsigned int)codec > BITPACK_VLC_RICE) {
+        _bitpack_err_set(bp, BITPACK_ERR_INVALID_CODE, 0, 0);
+        return BITPACK_RV_ERROR;
+    }
+
+    if (param > BITPACK_VLC_MAX_PARAM) {
+        _bitpack_err_set(bp, BITPACK_ERR_RANGE_TOO_BIG, param, BITPACK_VLC_MAX_PARAM);
+        return BITPACK_RV_ERROR;
+    }
+
+    return BITPACK_RV_SUCCESS;
+}
+
+int bitpack_append_vlc(bitpack_t bp, bitpack_vlc_t codec, unsigned int param, unsigned long value)
+{
+    return bitpack_append_vlc_array(bp, codec, param, &value, 1);
+}
+
+int bitpack_read_vlc(bitpack_t bp, bitpack_vlc_t codec, unsigned int param, unsigned long *value)
+{
+    return bitpack_read_vlc_array(bp, codec, param, value, 1);
+}
+
+int bitpack_append_vlc_array(bitpack_t bp, bitpack_vlc_t codec, unsigned int param,
+        const unsigned long *values, unsigned long n)
+{
+    unsigned long index = bitpack_size(bp);
+    unsigned long total = 0;
+    unsigned long len;
+    unsigned long i;
+
+    _bitpack_err_clear(bp);
+
+    if (!_bitpack_writable(bp) || !_bitpack_vlc_check(bp, codec, param)) {
+        return BITPACK_RV_ERROR;
+    }
+
+    /* size the whole run first, so the encoders don't need any checks */
+    for (i = 0; i < n; i++) {
+        len = _bitpack_vlc_length(codec, param, values[i]);
+
+        if (len == 0 || total + len < total) {
+            _bitpack_err_set(bp, BITPACK_ERR_NOT_ENCODABLE, values[i], 0);
+            return BITPACK_RV_ERROR;
+        }
+
+        total += len;
+    }
+
+    if (!_bitpack_resize(bp, index + total)) {
+        return BITPACK_RV_ERROR;
+    }
+
+    for (i = 0; i < n; i++) {
+        len = _bitpack_vlc_length(codec, param, values[i]);
+        _bitpack_vlc_encode(bp, index, codec, param, values[i], len);
+        index += len;
+    }
+
+    return BITPACK_RV_SUCCESS;
+}
+
+int bitpack_read_vlc_array(bitpack_t bp, bitpack_vlc_t codec, unsigned int param,
+        unsigned long *values, unsigned long n)
+{
+    unsigned long index = bp->read_pos;
+    unsigned long len;
+    unsigned long i;
+
+    _bitpack_err_clear(bp);
+
+    if (!_bitpack_vlc_check(bp, codec, param)) {
+        return BITPACK_RV_ERROR;
+    }
+
+    for (i = 0; i < n; i++) {
+        len = _bitpack_vlc_decode(bp, index, codec, param, &values[i]);
+
+        if (len == 0) {
+            return BITPACK_RV_ERROR;
+        }
+
+        index += len;
+    }
+
+    bp->read_pos = index;
+
+    return BITPACK_RV_SUCCESS;
+}
+
+/*
+ * Streaming readers.  The bits of the stream are decoded through an internal
+ * view over a fixed window.  When a read needs more bits than the window
+ * holds, the whole bytes already consumed are moved out of the window, which
+ * keeps the partially read byte, and the space freed is refilled with read().
+ * base is the stream position of the first bit of the window, so the view's
+ * read_pos is relative to the window.  A memory mapped reader's view covers
+ * the whole file and is never refilled.
+ */
+#define BITPACK_READER_MIN_WINDOW 16
+
+struct _bitpack_reader_t
+{
+    bitpack_t      bp;          /* view over the window or the mapping */
+    int            fd;          /* stream being read, -1 for a mapping */
+    int            eof;         /* read() has returned 0 */
+    unsigned char *window;      /* window buffer, NULL for a mapping */
+    unsigned long  window_size; /* size of the window buffer in bytes */
+    unsigned long  base;        /* stream position of the start of the window */
+    void          *map;         /* mapped file, NULL if not mapped */
+    unsigned long  map_size;    /* size of the mapping in bytes */
+};
+
+bitpack_reader_t bitpack_reader_init_fd(int fd, unsigned long window_size)
+{
+    bitpack_reader_t r;
+
+    if (window_size < BITPACK_READER_MIN_WINDOW) {
+        window_size = BITPACK_READER_MIN_WINDOW;
+    }
+
+    r = malloc(sizeof(struct _bitpack_reader_t));
+    if (r == NULL) return NULL;
+
+    r->window = malloc(window_size);
+
+    if (r->window == NULL) {
+        free(r);
+        return NULL;
+    }
+
+    memset(r->window, 0, window_size);
+
+    r->bp = bitpack_view_init(r->window, 0);
+
+    if (r->bp == NULL) {
+        free(r->window);
+        free(r);
+        return NULL;
+    }
+
+    r->bp->data_size = window_size;
+
+    r->fd          = fd;
+    r->eof         = 0;
+    r->window_size = window_size;
+    r->base        = 0;
+    r->map         = NULL;
+    r->map_size    = 0;
+
+    return r;
+}
+
+bitpack_reader_t bitpack_reader_init_mmap(int fd)
+{
+    bitpack_reader_t r;
+    struct stat      st;
+    void            *map = NULL;
+
+    if (fstat(fd, &st) != 0) {
+        return NULL;
+    }
+
+    /* mmap() rejects empty mappings, an empty file is an empty view */
+    if (st.st_size > 0) {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (map == MAP_FAILED) {
+            return NULL;
+        }
+
+        madvise(map, st.st_size, MADV_SEQUENTIAL);
+    }
+
+    r = malloc(sizeof(struct _bitpack_reader_t));
+
+    if (r != NULL) {
+        r->bp = bitpack_view_init(map, (unsigned long)st.st_size * 8);
+    }
+
+    if (r == NULL || r->bp == NULL) {
+        if (map != NULL) munmap(map, st.st_size);
+        free(r);
+        return NULL;
+    }
+
+    r->fd          = -1;
+    r->eof         = 1;
+    r->window      = NULL;
+    r->window_size = 0;
+    r->base        = 0;
+    r->map         = map;
+    r->map_size    = st.st_size;
+
+    return r;
+}
+
+void bitpack_reader_destroy(bitpack_reader_t r)
+{
+    if (r->map != NULL) {
+        munmap(r->map, r->map_size);
+    }
+
+    bitpack_destroy(r->bp);
+    free(r->window);
+    free(r);
+}
+
+void bitpack_reader_set_order(bitpack_reader_t r, bitpack_order_t order)
+{
+    bitpack_set_order(r->bp, order);
+}
+
+unsigned long bitpack_reader_pos(bitpack_reader_t r)
+{
+    return r->base + r->bp->read_pos;
+}
+
+bitpack_err_t bitpack_reader_get_error(bitpack_reader_t r)
+{
+    return bitpack_get_error(r->bp);
+}
+
+char *bitpack_reader_get_error_str(bitpack_reader_t r)
+{
+    return bitpack_get_error_str(r->bp);
+}
+
+/*
+ * make sure the next num_bits bits of the stream are in the window, refilling
+ * it if necessary.  num_bits must be at most 8 bits less than the window.
+ */
+static int _bitpack_reader_fill(bitpack_reader_t r, unsigned long num_bits)
+{
+    bitpack_t     bp = r->bp;
+    unsigned long drop;
+    ssize_t       n;
+
+    if (bp->read_pos + num_bits <= bp->size) {
+        return BITPACK_RV_SUCCESS;
+    }
+
+    if (!r->eof) {
+        drop = bp->read_pos / 8;
+
+        memmove(r->window, r->window + drop, bp->size / 8 - drop);
+        bp->read_pos -= drop * 8;
+        bp->size     -= drop * 8;
+        r->base      += drop * 8;
+
+        while (bp->read_pos + num_bits > bp->size) {
+            n = read(r->fd, r->window + bp->size / 8, r->window_size - bp->size / 8);
+
+            if (n < 0) {
+                if (errno == EINTR) continue;
+
+                _bitpack_err_set(bp, BITPACK_ERR_IO_FAILED, errno, 0);
+                return BITPACK_RV_ERROR;
+            }
+
+            if (n == 0) {
+                r->eof = 1;
+                break;
+            }
+
+            bp->size += n * 8;
+        }
+
+        if (bp->read_pos + num_bits <= bp->size) {
+            return BITPACK_RV_SUCCESS;
+        }
+    }
+
+    _bitpack_err_set(bp, BITPACK_ERR_READ_PAST_END, r->base + bp->size - 1, 0);
+    return BITPACK_RV_ERROR;
+}
+
+int bitpack_reader_read_bits(bitpack_reader_t r, unsigned long num_bits, unsigned long *value)
+{
+    _bitpack_err_clear(r->bp);
+
+    if (num_bits > BITPACK_WORD_BITS) {
+        _bitpack_err_set(r->bp, BITPACK_ERR_RANGE_TOO_BIG, num_bits, BITPACK_WORD_BITS);
+        return BITPACK_RV_ERROR;
+    }
+
+    if (!_bitpack_reader_fill(r, num_bits)) {
+        return BITPACK_RV_ERROR;
+    }
+
+    return bitpack_read_bits(r->bp, num_bits, value);
+}
+
+int bitpack_reader_read_bytes(bitpack_reader_t r, unsigned long num_bytes, unsigned char **value)
+{
+    unsigned char *bytes;
+
+    _bitpack_err_clear(r->bp);
+
+    bytes = malloc(num_bytes ? num_bytes : 1);
+
+    if (bytes == NULL) {
+        _bitpack_err_set(r->bp, BITPACK_ERR_MALLOC_FAILED, 0, 0);
+        return BITPACK_RV_ERROR;
+    }
+
+    if (!bitpack_reader_read_bytes_into(r, num_bytes, bytes)) {
+        free(bytes);
+        return BITPACK_RV_ERROR;
+    }
+
+    *value = bytes;
+
+    return BITPACK_RV_SUCCESS;
+}
+
+int bitpack_reader_read_bytes_into(bitpack_reader_t r, unsigned long num_bytes, unsigned char *value)
+{
+    bitpack_t     bp = r->bp;
+    unsigned long chunk;
+    unsigned long avail;
+
+    _bitpack_err_clear(bp);
+
+    while (num_bytes > 0) {
+        /* leave room for the partially read byte kept at the window start */
+        chunk = num_bytes;
+
+        if (r->window != NULL && chunk > r->window_size - 1) {
+            chunk = r->window_size - 1;
+        }
+
+        if (!_bitpack_reader_fill(r, chunk * 8)) {
+            if (bp->error == BITPACK_ERR_READ_PAST_END) {
+                /* consume the rest of the stream, keeping the error */
+                avail = (bp->size - bp->read_pos) / 8;
+                if (avail > 0) {
+                    bp->ops->take_bytes(bp->data, bp->read_pos, value, avail);
+                    bp->read_pos += avail * 8;
+                }
+
+                _bitpack_err_set(bp, BITPACK_ERR_READ_PAST_END, r->base + bp->size - 1, 0);
+            }
+
+            return BITPACK_RV_ERROR;
+        }
+
+        if (!bitpack_read_bytes_into(bp, chunk, value)) {
+            return BITPACK_RV_ERROR;
+        }
+
+        value     += chunk;
+        num_bytes -= chunk;
+    }
+
+    return BITPACK_RV_SUCCESS;
+}
+
+/*
+ * Streaming writers.  Bits are appended to an internal bitpack whose
+ * allocation is never grown: before an append that wouldn't fit, the full
+ * bytes are written out and the partial trailing byte is moved to the start
+ * of the buffer.  base is the stream position of the first bit of the
+ * buffer.
+ */
+#define BITPACK_WRITER_MIN_BUFFER 16
+
+struct _bitpack_writer_t
+{
+    bitpack_t         bp;       /* the buffer */
+    int               fd;       /* stream being written, -1 for a callback */
+    bitpack_write_fn  fn;       /* output callback, NULL for a stream */
+    void             *ctx;      /* argument of the output callback */
+    unsigned long     base;     /* stream position of the start of the buffer */
+};
+
+static bitpack_writer_t _bitpack_writer_init(int fd, bitpack_write_fn fn, void *ctx,
+        unsigned long buffer_size)
+{
+    bitpack_writer_t w;
+
+    if (buffer_size < BITPACK_WRITER_MIN_BUFFER) {
+        buffer_size = BITPACK_WRITER_MIN_BUFFER;
+    }
+
+    w = malloc(sizeof(struct _bitpack_writer_t));
+    if (w == NULL) return NULL;
+
+    w->bp = bitpack_init(buffer_size);
+
+    if (w->bp == NULL) {
+        free(w);
+        return NULL;
+    }
+
+    w->fd   = fd;
+    w->fn   = fn;
+    w->ctx  = ctx;
+    w->base = 0;
+
+    return w;
+}
+
+bitpack_writer_t bitpack_writer_init_fd(int fd, unsigned long buffer_size)
+{
+    return _bitpack_writer_init(fd, NULL, NULL, buffer_size);
+}
+
+bitpack_writer_t bitpack_writer_init_callback(bitpack_write_fn fn, void *ctx, unsigned long buffer_size)
+{
+    return _bitpack_writer_init(-1, fn, ctx, buffer_size);
+}
+
+void bitpack_writer_destroy(bitpack_writer_t w)
+{
+    bitpack_destroy(w->bp);
+    free(w);
+}
+
+void bitpack_writer_set_order(bitpack_writer_t w, bitpack_order_t order)
+{
+    bitpack_set_order(w->bp, order);
+}
+
+unsigned long bitpack_writer_pos(bitpack_writer_t w)
+{
+    return w->base + w->bp->size;
+}
+
+bitpack_err_t bitpack_writer_get_error(bitpack_writer_t w)
+{
+    return bitpack_get_error(w->bp);
+}
+
+char *bitpack_writer_get_error_str(bitpack_writer_t w)
+{
+    return bitpack_get_error_str(w->bp);
+}
+
+/*
+ * write out a list of byte runs in order, with as few system calls as
+ * possible.  iov is updated as the runs are written.
+ */
+static int _bitpack_writer_output(bitpack_writer_t w, struct iovec *iov, int iovcnt)
+{
+    ssize_t n;
+
+    while (iovcnt > 0) {
+        if (w->fn != NULL) {
+            if (iov->iov_len > 0 && !w->fn(w->ctx, iov->iov_base, iov->iov_len)) {
+                _bitpack_err_set(w->bp, BITPACK_ERR_IO_FAILED, errno, 0);
+                return BITPACK_RV_ERROR;
+            }
+
+            n = iov->iov_len;
+        }
+        else {
+            n = writev(w->fd, iov, iovcnt);
+
+            if (n < 0) {
+                if (errno == EINTR) continue;
+
+                _bitpack_err_set(w->bp, BITPACK_ERR_IO_FAILED, errno, 0);
+                return BITPACK_RV_ERROR;
+            }
+        }
+
+        /* skip the runs that were written, then the written part of the next */
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+
+        if (iovcnt > 0) {
+            iov->iov_base  = (char *)iov->iov_base + n;
+            iov->iov_len  -= n;
+        }
+    }
+
+    return BITPACK_RV_SUCCESS;
+}
+
+/*
+ * write out the full bytes of the buffer followed by num_bytes bytes of
+ * value, which must only be given at a byte boundary
+ */
+static int _bitpack_writer_drain(bitpack_writer_t w, const unsigned char *value, unsigned long num_bytes)
+{
+    bitpack_t     bp   = w->bp;
+    unsigned long full = bp->size / 8;
+    struct iovec  iov[2];
+
+    iov[0].iov_base = bp->data;
+    iov[0].iov_len  = full;
+    iov[1].iov_base = (void *)value;
+    iov[1].iov_len  = num_bytes;
+
+    if (!_bitpack_writer_output(w, iov, num_bytes > 0 ? 2 : 1)) {
+        return BITPACK_RV_ERROR;
+    }
+
+    if (bp->size % 8 != 0) {
+        bp->data[0] = bp->data[full];
+    }
+
+    bp->size %= 8;
+    w->base  += full * 8 + num_bytes * 8;
+
+    return BITPACK_RV_SUCCESS;
+}
+
+int bitpack_writer_append_bits(bitpack_writer_t w, unsigned long value, unsigned long num_bits)
+{
+    bitpack_t bp = w->bp;
+
+    _bitpack_err_clear(bp);
+
+    if (num_bits > BITPACK_WORD_BITS) {
+        _bitpack_err_set(bp, BITPACK_ERR_RANGE_TOO_BIG, num_bits, BITPACK_WORD_BITS);
+        return BITPACK_RV_ERROR;
+    }
+
+    if (bp->size + num_bits > bp->data_size * 8) {
+        if (!_bitpack_writer_drain(w, NULL, 0)) {
+            return BITPACK_RV_ERROR;
+        }
+    }
+
+    return bitpack_append_bits(bp, value, num_bits);
+}
+
+int bitpack_writer_append_bytes(bitpack_writer_t w, const unsigned char *value, unsigned long num_bytes)
+{
+    bitpack_t     bp = w->bp;
+    unsigned long chunk;
+
+    _bitpack_err_clear(bp);
+
+    /* at a byte boundary, a run that doesn't fit goes out with the buffer */
+    if (bp->size % 8 == 0 && bp->size + num_bytes * 8 > bp->data_size * 8) {
+        return _bitpack_writer_drain(w, value, num_bytes);
+    }
+
+    while (num_bytes > 0) {
+        if (bp->size + num_bytes * 8 > bp->data_size * 8) {
+            if (!_bitpack_writer_drain(w, NULL, 0)) {
+                return BITPACK_RV_ERROR;
+            }
+        }
+
+        chunk = (bp->data_size * 8 - bp->size) / 8;
+
+        if (chunk > num_bytes) {
+            chunk = num_bytes;
+        }
+
+        if (!bitpack_append_bytes(bp, (unsigned char *)value, chunk)) {
+            return BITPACK_RV_ERROR;
+        }
+
+        value     += chunk;
+        num_bytes -= chunk;
+    }
+
+    return BITPACK_RV_SUCCESS;
+}
+
+int bitpack_writer_flush(bitpack_writer_t w)
+{
+    _bitpack_err_clear(w->bp);
+
+    return _bitpack_writer_drain(w, NULL, 0);
+}
+
+int bitpack_writer_finish(bitpack_writer_t w)
+{
+    bitpack_t bp = w->bp;
+
+    _bitpack_err_clear(bp);
+
+    if (bp->size % 8 != 0) {
+        bitpack_append_bits(bp, 0, 8 - bp->size % 8);
+    }
+
+    return _bitpack_writer_drain(w, NULL, 0);
+}
+
+/*
+ * Bit buffers.  The accumulator is filled and drained inline (see
+ * bitpack.h), only the setup and the final bounds check are here.
+ */
+void bitpack_bitbuf_init(bitpack_bitbuf_t *b, bitpack_t bp)
+{
+    b->acc       = 0;
+    b->count     = 0;
+    b->data      = bp->data;
+    b->next      = bp->read_pos / 8;
+    b->num_bytes = round8(bp->size) / 8;
+    b->size      = bp->size;
+    b->lsb       = bp->ops->order == BITPACK_LSB_FIRST;
+
+    bitpack_bitbuf_refill(b);
+    bitpack_bitbuf_consume(b, bp->read_pos % 8);
+}
+
+int bitpack_bitbuf_finish(const bitpack_bitbuf_t *b, bitpack_t bp)
+{
+    _bitpack_err_clear(bp);
+
+    if (bitpack_bitbuf_pos(b) > bp->size) {
+        _bitpack_err_set(bp, BITPACK_ERR_READ_PAST_END, bp->size - 1, 0);
+        return BITPACK_RV_ERROR;
+    }
+
+    bp->read_pos = bitpack_bitbuf_pos(b);
+
+    return BITPACK_RV_SUCCESS;
+}
+
+/*
+ * Prefix codes.  Codes are canonical, and are decoded with a primary table
+ * indexed by the next primary_bits bits and one secondary table for each
+ * primary_bits prefix of the longer codes, sized for the longest code with
+ * that prefix.  A table entry holds a symbol and its code length, a link to
+ * a secondary table and its number of index bits, or marks bits that are
+ * not a code.  There is one set of tables per bit order, since the tables
+ * are indexed by the next bits as read by a bit buffer: first bit highest
+ * in MSB first order, first bit lowest in LSB first order.
+ */
+#define BITPACK_HUFFMAN_PRIMARY_BITS 10
+
+#define BITPACK_HUFFMAN_LEN_MASK 0x3f     /* code length, or secondary index bits */
+#define BITPACK_HUFFMAN_LINK     0x40     /* link to a secondary table */
+#define BITPACK_HUFFMAN_INVALID  0x80     /* not a code */
+#define BITPACK_HUFFMAN_SHIFT    8        /* symbol, or secondary table offset */
+
+struct _bitpack_huffman_t
+{
+    unsigned long  num_symbols;
+    unsigned char *lengths;         /* code length of each symbol, 0 if none */
+    uint32_t      *codes;           /* code of each symbol, first bit highest */
+    unsigned int   primary_bits;    /* index bits of the primary table */
+    uint32_t      *tables[2];       /* decoding tables, indexed by bit order */
+};
+
+/* the low num_bits bits of v in reverse order */
+static unsigned long _bitpack_reverse_bits(unsigned long v, unsigned int num_bits)
+{
+    return num_bits ? _bitpack_reverse64(v) >> (64 - num_bits) : 0;
+}
+
+bitpack_huffman_t bitpack_huffman_compile(const unsigned char *lengths, unsigned long num_symbols)
+{
+    bitpack_huffman_t h;
+    unsigned long     count[BITPACK_HUFFMAN_MAX_BITS + 1];
+    unsigned long     next_code[BITPACK_HUFFMAN_MAX_BITS + 1];
+    unsigned char    *sub_bits = NULL;
+    unsigned long    *sub_offset = NULL;
+    unsigned long     code, left, offset, i, j, p, n;
+    unsigned int      len, max_bits = 0, pbits, k;
+    uint32_t         *msb, *lsb;
+
+    /* symbols and table offsets must fit above the entry flags */
+    if (num_symbols >= 1UL << (32 - BITPACK_HUFFMAN_SHIFT)) {
+        return NULL;
+    }
+
+    memset(count, 0, sizeof(count));
+
+    for (i = 0; i < num_symbols; i++) {
+        if (lengths[i] > BITPACK_HUFFMAN_MAX_BITS) {
+            return NULL;
+        }
+        count[lengths[i]]++;
+        if (lengths[i] > max_bits) max_bits = lengths[i];
+    }
+
+    /* Kraft inequality: a code with more codes than fit is oversubscribed */
+    for (len = 1, left = 1; len <= BITPACK_HUFFMAN_MAX_BITS; len++) {
+        left <<= 1;
+        if (count[len] > left) {
+            return NULL;
+        }
+        left -= count[len];
+    }
+
+    /* the first code of each length */
+    for (len = 1, code = 0, next_code[0] = 0; len <= BITPACK_HUFFMAN_MAX_BITS; len++) {
+        code = (code + count[len - 1] * (len > 1)) << 1;
+        next_code[len] = code;
+    }
+
+    h = malloc(sizeof(struct _bitpack_huffman_t));
+    if (h == NULL) return NULL;
+
+    pbits = max_bits < BITPACK_HUFFMAN_PRIMARY_BITS ? max_bits : BITPACK_HUFFMAN_PRIMARY_BITS;
+
+    h->num_symbols  = num_symbols;
+    h->primary_bits = pbits;
+    h->lengths      = malloc(num_symbols ? num_symbols : 1);
+    h->codes        = malloc((num_symbols ? num_symbols : 1) * sizeof(uint32_t));
+    h->tables[0]    = NULL;
+    h->tables[1]    = NULL;
+    sub_bits        = calloc(1UL << pbits, 1);
+    sub_offset      = malloc((1UL << pbits) * sizeof(unsigned long));
+
+    if (h->lengths == NULL || h->codes == NULL || sub_bits == NULL || sub_offset == NULL) {
+        goto fail;
+    }
+
+    memcpy(h->lengths, lengths, num_symbols);
+
+    /* assign the codes, and size the secondary table of each long prefix */
+    for (i = 0; i < num_symbols; i++) {
+        len = lengths[i];
+        h->codes[i] = len ? next_code[len]++ : 0;
+
+        if (len > pbits) {
+            p = h->codes[i] >> (len - pbits);
+            if (len - pbits > sub_bits[p]) sub_bits[p] = len - pbits;
+        }
+    }
+
+    for (p = 0, offset = 1UL << pbits; p < 1UL << pbits; p++) {
+        sub_offset[p] = offset;
+        offset += sub_bits[p] ? 1UL << sub_bits[p] : 0;
+    }
+
+    if (offset > 1UL << (32 - BITPACK_HUFFMAN_SHIFT)) {
+        goto fail;
+    }
+
+    h->tables[0] = malloc(offset * sizeof(uint32_t));
+    h->tables[1] = malloc(offset * sizeof(uint32_t));
+
+    if (h->tables[0] == NULL || h->tables[1] == NULL) {
+        goto fail;
+    }
+
+    msb = h->tables[0];
+    lsb = h->tables[1];
+
+    for (i = 0; i < offset; i++) {
+        msb[i] = BITPACK_HUFFMAN_INVALID;
+    }
+
+    for (p = 0; p < 1UL << pbits; p++) {
+        if (sub_bits[p]) {
+            msb[p] = (sub_offset[p] << BITPACK_HUFFMAN_SHIFT) | BITPACK_HUFFMAN_LINK | sub_bits[p];
+        }
+    }
+
+    /* each code fills every entry whose index starts with it */
+    for (i = 0; i < num_symbols; i++) {
+        len  = lengths[i];
+        code = h->codes[i];
+
+        if (len == 0) {
+            continue;
+        }
+
+        if (len <= pbits) {
+            j = code << (pbits - len);
+            n = 1UL << (pbits - len);
+        }
+        else {
+            p = code >> (len - pbits);
+            k = sub_bits[p];
+            j = sub_offset[p] + ((code & ((1UL << (len - pbits)) - 1)) << (k - (len - pbits)));
+            n = 1UL << (k - (len - pbits));
+        }
+
+        while (n-- > 0) {
+            msb[j++] = ((uint32_t)i << BITPACK_HUFFMAN_SHIFT) | len;
+        }
+    }
+
+    /* the LSB first tables are the same entries at bit reversed indices */
+    for (p = 0; p < 1UL << pbits; p++) {
+        lsb[_bitpack_reverse_bits(p, pbits)] = msb[p];
+
+        if (sub_bits[p]) {
+            k = sub_bits[p];
+            for (j = 0; j < 1UL << k; j++) {
+                lsb[sub_offset[p] + _bitpack_reverse_bits(j, k)] = msb[sub_offset[p] + j];
+            }
+        }
+    }
+
+    free(sub_bits);
+    free(sub_offset);
+
+    return h;
+
+fail:
+    free(sub_bits);
+    free(sub_offset);
+    bitpack_huffman_destroy(h);
+
+    return NULL;
+}
+
+void bitpack_huffman_destroy(bitpack_huffman_t h)
+{
+    free(h->lengths);
+    free(h->codes);
+    free(h->tables[0]);
+    free(h->tables[1]);
+    free(h);
+}
+
+int bitpack_append_huffman(bitpack_t bp, bitpack_huffman_t h, unsigned long symbol)
+{
+    return bitpack_append_huffman_array(bp, h, &symbol, 1);
+}
+
+int bitpack_read_huffman(bitpack_t bp, bitpack_huffman_t h, unsigned long *symbol)
+{
+    return bitpack_read_huffman_array(bp, h, symbol, 1);
+}
+
+int bitpack_append_huffman_array(bitpack_t bp, bitpack_huffman_t h,
+        const unsigned long *symbols, unsigned long n)
+{
+    unsigned long index = bitpack_size(bp);
+    unsigned long total = 0;
+    unsigned long i;
+    unsigned int  len;
+
+    _bitpack_err_clear(bp);
+
+    if (!_bitpack_writable(bp)) {
+        return BITPACK_RV_ERROR;
+    }
+
+    /* size the whole run first, so nothing is written if a symbol has no code */
+    for (i = 0; i < n; i++) {
+        if (symbols[i] >= h->num_symbols || h->lengths[symbols[i]] == 0) {
+            _bitpack_err_set(bp, BITPACK_ERR_NOT_ENCODABLE, symbols[i], 0);
+            return BITPACK_RV_ERROR;
+        }
+
+        total += h->lengths[symbols[i]];
+    }
+
+    if (!_bitpack_resize(bp, index + total)) {
+        return BITPACK_RV_ERROR;
+    }
+
+    for (i = 0; i < n; i++) {
+        len = h->lengths[symbols[i]];
+        bp->ops->write_code(bp->data, bp->data_size, index, len, h->codes[symbols[i]]);
+        index += len;
+    }
+
+    return BITPACK_RV_SUCCESS;
+}
+
+int bitpack_read_huffman_array(bitpack_t bp, bitpack_huffman_t h,
+        unsigned long *symbols, unsigned long n)
+{
+    int               lsb   = bp->ops->order == BITPACK_LSB_FIRST;
+    const uint32_t   *table = h->tables[lsb];
+    unsigned int      pbits = h->primary_bits;
+    unsigned int      seen;
+    uint64_t          bits;
+    unsigned long     i;
+    uint32_t          e;
+    bitpack_bitbuf_t  b;
+
+    _bitpack_err_clear(bp);
+
+    bitpack_bitbuf_init(&b, bp);
+
+    for (i = 0; i < n; i++) {
+        bitpack_bitbuf_refill(&b);
+
+        e    = table[bitpack_bitbuf_peek(&b, pbits)];
+        seen = pbits;
+
+        /* the secondary index is the bits after the primary index */
+        if (e & BITPACK_HUFFMAN_LINK) {
+            seen += e & BITPACK_HUFFMAN_LEN_MASK;
+            bits  = bitpack_bitbuf_peek(&b, seen);
+            bits  = lsb ? bits >> pbits : bits & ((1UL << (seen - pbits)) - 1);
+            e     = table[(e >> BITPACK_HUFFMAN_SHIFT) + bits];
+        }
+
+        if (e & BITPACK_HUFFMAN_INVALID) {
+            /* bits past the end read as 0, so they can't prove a code invalid */
+            if (bitpack_bitbuf_pos(&b) + seen > bitpack_size(bp)) {
+                _bitpack_err_set(bp, BITPACK_ERR_READ_PAST_END, bitpack_size(bp) - 1, 0);
+            }
+            else {
+                _bitpack_err_set(bp, BITPACK_ERR_INVALID_CODE, bitpack_bitbuf_pos(&b), 0);
+            }
+            return BITPACK_RV_ERROR;
+        }
+
+        bitpack_bitbuf_consume(&b, e & BITPACK_HUFFMAN_LEN_MASK);
+        symbols[i] = e >> BITPACK_HUFFMAN_SHIFT;
+    }
+
+    return bitpack_bitbuf_finish(&b, bp);
+}
+
+/*
+ * Rank/select.  The index is built on demand from 64 bit words of the
+ * bitpack read as codes, so bit index i is bit 63 - i % 64 of word i / 64
+ * in either bit order.
+ */
+static unsigned int _bitpack_popcount64(uint64_t w)
+{
+#if defined(__GNUC__)
+    return __builtin_popcountll(w);
+#else
+    w = w - ((w >> 1) & 0x5555555555555555ULL);
+    w = (w & 0x3333333333333333ULL) + ((w >> 2) & 0x3333333333333333ULL);
+    w = (w + (w >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    return (w * 0x0101010101010101ULL) >> 56;
+#endif
+}
+
+/* index of the set bit of w (first bit highest) with n set bits before it */
+static unsigned int _bitpack_select64(uint64_t w, unsigned int n)
+{
+    unsigned int pos = 0;
+    unsigned int c;
+
+    /* whole bytes, then bits */
+    while ((c = _bitpack_popcount64(w >> 56)) <= n) {
+        n   -= c;
+        w  <<= 8;
+        pos += 8;
+    }
+
+    for (;; w <<= 1, pos++) {
+        if (w >> 63) {
+            if (n == 0) return pos;
+            n--;
+        }
+    }
+}
+
+/* the number of set bits in word w of the bitpack */
+static unsigned int _bitpack_rank_word(bitpack_t bp, unsigned long w)
+{
+    return _bitpack_popcount64(_bitpack_peek64(bp, w * 64));
+}
+
+int bitpack_build_rank_index(bitpack_t bp)
+{
+    struct _bitpack_rank_t *r;
+    unsigned long           num_words = (bp->size + 63) / 64;
+    unsigned long           total = 0;
+    unsigned long           b, s, w, end, next;
+    uint64_t                sub;
+
+    _bitpack_err_clear(bp);
+
+    if (bp->rank != NULL) {
+        return BITPACK_RV_SUCCESS;
+    }
+
+    r = malloc(sizeof(struct _bitpack_rank_t));
+
+    if (r == NULL) {
+        _bitpack_err_set(bp, BITPACK_ERR_MALLOC_FAILED, 0, 0);
+        return BITPACK_RV_ERROR;
+    }
+
+    r->num_blocks = bp->size / BITPACK_RANK_BLOCK_BITS + 1;
+    r->counts     = malloc(2 * r->num_blocks * sizeof(uint64_t));
+    r->samples    = NULL;
+
+    if (r->counts == NULL) {
+        free(r);
+        _bitpack_err_set(bp, BITPACK_ERR_MALLOC_FAILED, 0, 0);
+        return BITPACK_RV_ERROR;
+    }
+
+    for (b = 0, w = 0; b < r->num_blocks; b++) {
+        r->counts[2 * b] = total;
+
+        for (s = 0, sub = 0; s < 4; s++) {
+            if (s > 0) {
+                sub |= (total - r->counts[2 * b]) << (11 * (s - 1));
+            }
+
+            end = w + BITPACK_RANK_SUB_BITS / 64;
+
+            for (; w < end && w < num_words; w++) {
+                total += _bitpack_rank_word(bp, w);
+            }
+
+            w = end;
+        }
+
+        r->counts[2 * b + 1] = sub;
+    }
+
+    r->num_ones    = total;
+    r->num_samples = total / BITPACK_SELECT_SAMPLE + 1;
+    r->samples     = malloc(r->num_samples * sizeof(unsigned long));
+
+    if (r->samples == NULL) {
+        free(r->counts);
+        free(r);
+        _bitpack_err_set(bp, BITPACK_ERR_MALLOC_FAILED, 0, 0);
+        return BITPACK_RV_ERROR;
+    }
+
+    /* the block holding set bit number next * BITPACK_SELECT_SAMPLE */
+    r->samples[0] = 0;
+
+    for (b = 0, next = 0; b < r->num_blocks; b++) {
+        end = b + 1 < r->num_blocks ? r->counts[2 * (b + 1)] : total;
+
+        while (next < r->num_samples && next * BITPACK_SELECT_SAMPLE < end) {
+            r->samples[next++] = b;
+        }
+    }
+
+    bp->rank = r;
+
+    return BITPACK_RV_SUCCESS;
+}
+
+int bitpack_rank(bitpack_t bp, unsigned long index, unsigned long *count)
+{
+    const uint64_t *c;
+    unsigned long   b, s, w, n;
+
+    _bitpack_err_clear(bp);
+
+    if (index > bp->size) {
+        _bitpack_err_set(bp, BITPACK_ERR_INVALID_INDEX, index, bp->size);
+        return BITPACK_RV_ERROR;
+    }
+
+    if (!bitpack_build_rank_index(bp)) {
+        return BITPACK_RV_ERROR;
+    }
+
+    c = bp->rank->counts;
+    b = index / BITPACK_RANK_BLOCK_BITS;
+    s = index % BITPACK_RANK_BLOCK_BITS / BITPACK_RANK_SUB_BITS;
+    n = c[2 * b] + (s ? (c[2 * b + 1] >> (11 * (s - 1))) & 0x7ff : 0);
+
+    for (w = index / BITPACK_RANK_SUB_BITS * (BITPACK_RANK_SUB_BITS / 64); w < index / 64; w++) {
+        n += _bitpack_rank_word(bp, w);
+    }
+
+    if (index % 64 != 0) {
+        n += _bitpack_popcount64(_bitpack_peek64(bp, w * 64) >> (64 - index % 64));
+    }
+
+    *count = n;
+
+    return BITPACK_RV_SUCCESS;
+}
+
+int bitpack_select(bitpack_t bp, unsigned long n, unsigned long *index)
+{
+    const struct _bitpack_rank_t *r;
+    unsigned long                 lo, hi, mid, s, w, k;
+    uint64_t                      word;
+
+    _bitpack_err_clear(bp);
+
+    if (!bitpack_build_rank_index(bp)) {
+        return BITPACK_RV_ERROR;
+    }
+
+    r = bp->rank;
+
+    if (n >= r->num_ones) {
+        _bitpack_err_set(bp, BITPACK_ERR_INVALID_INDEX, n, r->num_ones - 1);
+        return BITPACK_RV_ERROR;
+    }
+
+    /* the last block with at most n set bits before it, between two samples */
+    k  = n / BITPACK_SELECT_SAMPLE;
+    lo = r->samples[k];
+    hi = k + 1 < r->num_samples ? r->samples[k + 1] : r->num_blocks - 1;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo + 1) / 2;
+
+        if (r->counts[2 * mid] <= n) {
+            lo = mid;
+        }
+        else {
+            hi = mid - 1;
+        }
+    }
+
+    n -= r->counts[2 * lo];
+
+    /* then the sub-block, the word and the bit */
+    s = 0;
+    while (s < 3 && ((r->counts[2 * lo + 1] >> (11 * s)) & 0x7ff) <= n) {
+        s++;
+    }
+
+    if (s > 0) {
+        n -= (r->counts[2 * lo + 1] >> (11 * (s - 1))) & 0x7ff;
+    }
+
+    w = lo * (BITPACK_RANK_BLOCK_BITS / 64) + s * (BITPACK_RANK_SUB_BITS / 64);
+
+    for (;; w++) {
+        word = _bitpack_peek64(bp, w * 64);
+        k    = _bitpack_popcount64(word);
+
+        if (k > n) break;
+
+        n -= k;
+    }
+
+    *index = w * 64 + _bitpack_select64(word, n);
+
+    return BITPACK_RV_SUCCESS;
+}
+
+/*
+ * Bulk bitwise operations.  Byte aligned ranges of bitpacks with the same
+ * bit order line up byte for byte, so they are combined a word or a SIMD
+ * register at a time whatever the bit order.  Anything else, and the last
+ * few bits, is read and written 64 bits at a time as codes.
+ */
+#define BITPACK_OP_COPY (BITPACK_OP_NOT + 1)     /* internal, dst = src */
+
+typedef void (*_bitpack_bitop_fn)(unsigned char *dst, const unsigned char *src,
+        unsigned long n, int op);
+
+static BITPACK_ALWAYS_INLINE uint64_t _bitpack_bitop_word(uint64_t x, uint64_t y, int op)
+{
+    switch (op) {
+        case BITPACK_OP_AND:    return x & y;
+        case BITPACK_OP_OR:     return x | y;
+        case BITPACK_OP_XOR:    return x ^ y;
+        case BITPACK_OP_ANDNOT: return x & ~y;
+        case BITPACK_OP_NOT:    return ~y;
+        default:                return y;
+    }
+}
+
+/* instantiated once per operation so that the switch goes away */
+static BITPACK_ALWAYS_INLINE void _bitpack_bitop_words(unsigned char *dst, const unsigned char *src,
+        unsigned long n, int op)
+{
+    unsigned long k = 0;
+    uint64_t      x, y;
+
+    for (; k + 8 <= n; k += 8) {
+        memcpy(&x, dst + k, 8);
+        memcpy(&y, src + k, 8);
+        x = _bitpack_bitop_word(x, y, op);
+        memcpy(dst + k, &x, 8);
+    }
+
+    for (; k < n; k++) {
+        dst[k] = (unsigned char)_bitpack_bitop_word(dst[k], src[k], op);
+    }
+}
+
+static void _bitpack_bitop_scalar(unsigned char *dst, const unsigned char *src,
+        unsigned long n, int op)
+{
+    switch (op) {
+        case BITPACK_OP_AND:    _bitpack_bitop_words(dst, src, n, BITPACK_OP_AND);    break;
+        case BITPACK_OP_OR:     _bitpack_bitop_words(dst, src, n, BITPACK_OP_OR);     break;
+        case BITPACK_OP_XOR:    _bitpack_bitop_words(dst, src, n, BITPACK_OP_XOR);    break;
+        case BITPACK_OP_ANDNOT: _bitpack_bitop_words(dst, src, n, BITPACK_OP_ANDNOT); break;
+        case BITPACK_OP_NOT:    _bitpack_bitop_words(dst, src, n, BITPACK_OP_NOT);    break;
+        default:                memcpy(dst, src, n);                                  break;
+    }
+}
+
+#ifdef BITPACK_X86_SIMD
+__attribute__((target("sse2")))
+static BITPACK_ALWAYS_INLINE __m128i _bitpack_bitop_xmm(__m128i x, __m128i y, int op)
+{
+    switch (op) {
+        case BITPACK_OP_AND:    return _mm_and_si128(x, y);
+        case BITPACK_OP_OR:     return _mm_or_si128(x, y);
+        case BITPACK_OP_XOR:    return _mm_xor_si128(x, y);
+        case BITPACK_OP_ANDNOT: return _mm_andnot_si128(y, x);
+        case BITPACK_OP_NOT:    return _mm_xor_si128(y, _mm_set1_epi32(-1));
+        default:                return y;
+    }
+}
+
+__attribute__((target("sse2")))
+static BITPACK_ALWAYS_INLINE unsigned long _bitpack_bitop_xmms(unsigned char *dst,
+        const unsigned char *src, unsigned long n, int op)
+{
+    unsigned long k = 0;
+    __m128i       x, y;
+
+    for (; k + 16 <= n; k += 16) {
+        x = _mm_loadu_si128((const __m128i *)(dst + k));
+        y = _mm_loadu_si128((const __m128i *)(src + k));
+        _mm_storeu_si128((__m128i *)(dst + k), _bitpack_bitop_xmm(x, y, op));
+    }
+
+    return k;
+}
+
+__attribute__((target("sse2")))
+static void _bitpack_bitop_sse2(unsigned char *dst, const unsigned char *src,
+        unsigned long n, int op)
+{
+    unsigned long k;
+
+    switch (op) {
+        case BITPACK_OP_AND:    k = _bitpack_bitop_xmms(dst, src, n, BITPACK_OP_AND);    break;
+        case BITPACK_OP_OR:     k = _bitpack_bitop_xmms(dst, src, n, BITPACK_OP_OR);     break;
+        case BITPACK_OP_XOR:    k = _bitpack_bitop_xmms(dst, src, n, BITPACK_OP_XOR);    break;
+        case BITPACK_OP_ANDNOT: k = _bitpack_bitop_xmms(dst, src, n, BITPACK_OP_ANDNOT); break;
+        case BITPACK_OP_NOT:    k = _bitpack_bitop_xmms(dst, src, n, BITPACK_OP_NOT);    break;
+        default:                k = 0;                                                   break;
+    }
+
+    _bitpack_bitop_scalar(dst + k, src + k, n - k, op);
+}
+
+__attribute__((target("avx2")))
+static BITPACK_ALWAYS_INLINE __m256i _bitpack_bitop_ymm(__m256i x, __m256i y, int op)
+{
+    switch (op) {
+        case BITPACK_OP_AND:    return _mm256_and_si256(x, y);
+        case BITPACK_OP_OR:     return _mm256_or_si256(x, y);
+        case BITPACK_OP_XOR:    return _mm256_xor_si256(x, y);
+        case BITPACK_OP_ANDNOT: return _mm256_andnot_si256(y, x);
+        case BITPACK_OP_NOT:    return _mm256_xor_si256(y, _mm256_set1_epi32(-1));
+        default:                return y;
+    }
+}
+
+/* two registers per iteration to keep both load ports busy */
+__attribute__((target("avx2")))
+static BITPACK_ALWAYS_INLINE unsigned long _bitpack_bitop_ymms(unsigned char *dst,
+        const unsigned char *src, unsigned long n, int op)
+{
+    unsigned long k = 0;
+    __m256i       x0, x1, y0, y1;
+
+    for (; k + 64 <= n; k += 64) {
+        x0 = _mm256_loadu_si256((const __m256i *)(dst + k));
+        x1 = _mm256_loadu_si256((const __m256i *)(dst + k + 32));
+        y0 = _mm256_loadu_si256((const __m256i *)(src + k));
+        y1 = _mm256_loadu_si256((const __m256i *)(src + k + 32));
+        _mm256_storeu_si256((__m256i *)(dst + k), _bitpack_bitop_ymm(x0, y0, op));
+        _mm256_storeu_si256((__m256i *)(dst + k + 32), _bitpack_bitop_ymm(x1, y1, op));
+    }
+
+    return k;
+}
+
+__attribute__((target("avx2")))
+static void _bitpack_bitop_avx2(unsigned char *dst, const unsigned char *src,
+        unsigned long n, int op)
+{
+    unsigned long k;
+
+    switch (op) {
+        case BITPACK_OP_AND:    k = _bitpack_bitop_ymms(dst, src, n, BITPACK_OP_AND);    break;
+        case BITPACK_OP_OR:     k = _bitpack_bitop_ymms(dst, src, n, BITPACK_OP_OR);     break;
+        case BITPACK_OP_XOR:    k = _bitpack_bitop_ymms(dst, src, n, BITPACK_OP_XOR);    break;
+        case BITPACK_OP_ANDNOT: k = _bitpack_bitop_ymms(dst, src, n, BITPACK_OP_ANDNOT); break;
+        case BITPACK_OP_NOT:    k = _bitpack_bitop_ymms(dst, src, n, BITPACK_OP_NOT);    break;
+        default:                k = 0;                                                   break;
+    }
+
+    _bitpack_bitop_scalar(dst + k, src + k, n - k, op);
+}
+#endif
+
+/* pick the best bulk bitwise operation for this CPU */
+static _bitpack_bitop_fn _bitpack_bitop_select(void)
+{
+#ifdef BITPACK_X86_SIMD
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")) {
+        return _bitpack_bitop_avx2;
+    }
+
+    if (__builtin_cpu_supports("sse2")) {
+        return _bitpack_bitop_sse2;
+    }
+#endif
+
+    return _bitpack_bitop_scalar;
+}
+
+static void _bitpack_bitop_bytes(unsigned char *dst, const unsigned char *src,
+        unsigned long n, int op)
+{
+    static _bitpack_bitop_fn bitop = NULL;
+
+    if (bitop == NULL) {
+        bitop = _bitpack_bitop_select();
+    }
+
+    bitop(dst, src, n, op);
+}
+
+/* dst = dst op src over n bits, the ranges are already known to be valid */
+static void _bitpack_bitop_bits(bitpack_t dst, unsigned long dst_index, bitpack_t src,
+        unsigned long src_index, unsigned long n, int op)
+{
+    unsigned long k = 0;
+    unsigned long c;
+    uint64_t      x, y;
+
+    if (dst_index % 8 == 0 && src_index % 8 == 0 && dst->ops == src->ops) {
+        _bitpack_bitop_bytes(dst->data + dst_index / 8, src->data + src_index / 8, n / 8, op);
+        k = n / 8 * 8;
+    }
+
+    for (; k < n; k += c) {
+        c = n - k < 64 ? n - k : 64;
+        x = dst->ops->read_code(dst->data, dst->data_size, dst_index + k, c);
+        y = src->ops->read_code(src->data, src->data_size, src_index + k, c);
+        x = _bitpack_bitop_word(x, y, op) & (~(uint64_t)0 >> (64 - c));
+        dst->ops->write_code(dst->data, dst->data_size, dst_index + k, c, x);
+    }
+}
+
+/*
+ * set n bits to bit: the bits up to a byte boundary, a memset of the whole
+ * bytes, then the last few bits
+ */
+static void _bitpack_fill_bits(bitpack_t bp, unsigned long index, unsigned long n, int bit)
+{
+    uint64_t      ones = bit ? ~(uint64_t)0 : 0;
+    unsigned long c    = (8 - index % 8) % 8;
+
+    if (c > n) c = n;
+
+    if (c > 0) {
+        bp->ops->write_code(bp->data, bp->data_size, index, c, ones >> (64 - c));
+        index += c;
+        n     -= c;
+    }
+
+    memset(bp->data + index / 8, bit ? 0xff : 0, n / 8);
+
+    if (n % 8 > 0) {
+        bp->ops->write_code(bp->data, bp->data_size, index + n / 8 * 8, n % 8, ones >> (64 - n % 8));
+    }
+}
+
+int bitpack_bitop(bitpack_t dst, bitpack_t a, bitpack_t b, bitpack_op_t op)
+{
+    unsigned long n;
+
+    _bitpack_err_clear(dst);
+
+    if (!_bitpack_writable(dst)) {
+        return BITPACK_RV_ERROR;
+    }
+
+    if (op == BITPACK_OP_NOT) {
+        if (!_bitpack_resize(dst, a->size)) {
+            return BITPACK_RV_ERROR;
+        }
+
+        _bitpack_bitop_bits(dst, 0, a, 0, a->size, BITPACK_OP_NOT);
+        return BITPACK_RV_SUCCESS;
+    }
+
+    if (dst == b && dst != a) {
+        /* the operations commute except a & ~b, which becomes ~b & a */
+        if (op == BITPACK_OP_ANDNOT) {
+            if (!_bitpack_resize(dst, a->size > b->size ? a->size : b->size)) {
+                return BITPACK_RV_ERROR;
+            }
+
+            _bitpack_bitop_bits(dst, 0, dst, 0, dst->size, BITPACK_OP_NOT);
+            op = BITPACK_OP_AND;
+        }
+
+        b = a;
+    }
+    else if (dst != a) {
+        /* start from a copy of a, then it's an in-place operation */
+        if (!_bitpack_resize(dst, a->size)) {
+            return BITPACK_RV_ERROR;
+        }
+
+        _bitpack_bitop_bits(dst, 0, a, 0, a->size, BITPACK_OP_COPY);
+    }
+
+    n = dst->size > b->size ? dst->size : b->size;
+
+    if (!_bitpack_resize(dst, n)) {
+        return BITPACK_RV_ERROR;
+    }
+
+    _bitpack_bitop_bits(dst, 0, b, 0, b->size, op);
+
+    /* b reads as 0 past its end */
+    if (op == BITPACK_OP_AND && b->size < n) {
+        _bitpack_fill_bits(dst, b->size, n - b->size, 0);
+    }
+
+    return BITPACK_RV_SUCCESS;
+}
+
+int bitpack_bitop_range(bitpack_t dst, unsigned long dst_index, bitpack_t src,
+        unsigned long src_index, unsigned long num_bits, bitpack_op_t op)
+{
+    _bitpack_err_clear(dst);
+
+    if (!_bitpack_range_fits(dst, dst_index, num_bits) || !_bitpack_range_fits(dst, src_index, num_bits)) {
+        return BITPACK_RV_ERROR;
+    }
+
+    if (!_bitpack_writable(dst)) {
+        return BITPACK_RV_ERROR;
+    }
+
+    if (dst_index > bitpack_size(dst)) {
+        _bitpack_err_set(dst, BITPACK_ERR_INVALID_INDEX, dst_index, bitpack_size(dst));
+        return BITPACK_RV_ERROR;
+    }
+
+    if (src_index + num_bits > bitpack_size(src)) {
+        _bitpack_err_set(dst, BITPACK_ERR_READ_PAST_END, bitpack_size(src) - 1, 0);
+        return BITPACK_RV_ERROR;
+    }
+
+    if (dst_index + num_bits > bitpack_size(dst)) {
+        if (!_bitpack_resize(dst, dst_index + num_bits)) {
+            return BITPACK_RV_ERROR;
+        }
+    }
+
+    _bitpack_bitop_bits(dst, dst_index, src, src_index, num_bits, op);
+
+    return BITPACK_RV_SUCCESS;
+}
+
+/*
+ * Range fill and copy.  Whole bytes are set with memset and copied with
+ * memmove when the source and destination start at the same offset within
+ * a byte, and through the funnel shifted byte runs of bp->ops otherwise,
+ * so only the bits at either end are written one code at a time.
+ */
+#define BITPACK_COPY_CHUNK 4096
+
+int bitpack_fill_range(bitpack_t bp, unsigned long index, unsigned long num_bits, unsigned char bit)
+{
+    _bitpack_err_clear(bp);
+
+    if (!_bitpack_range_fits(bp, index, num_bits)) {
+        return BITPACK_RV_ERROR;
+    }
+
+    if (!_bitpack_writable(bp)) {
+        return BITPACK_RV_ERROR;
+    }
+
+    if (bitpack_size(bp) < index + num_bits) {
+        if (!_bitpack_resize(bp, index + num_bits)) {
+            return BITPACK_RV_ERROR;
+        }
+    }
+
+    _bitpack_fill_bits(bp, index, num_bits, bit);
+
+    return BITPACK_RV_SUCCESS;
+}
+
+/* copy n bits between bitpacks of different bit orders, 64 at a time as codes */
+static void _bitpack_copy_codes(bitpack_t dst, unsigned long dst_index, bitpack_t src,
+        unsigned long src_index, unsigned long n)
+{
+    unsigned long k, c;
+    uint64_t      v;
+
+    for (k = 0; k < n; k += c) {
+        c = n - k < 64 ? n - k : 64;
+        v = src->ops->read_code(src->data, src->data_size, src_index + k, c);
+        dst->ops->write_code(dst->data, dst->data_size, dst_index + k, c, v);
+    }
+}
+
+/*
+ * copy n bits between bitpacks of the same bit order.  The bits at the ends
+ * are read before and written after the bytes in between, and the bytes are
+ * moved in chunks in the direction that is safe when the ranges overlap.
+ */
+static void _bitpack_copy_bits(bitpack_t dst, unsigned long dst_index, bitpack_t src,
+        unsigned long src_index, unsigned long n)
+{
+    const struct _bitpack_ops *ops = dst->ops;
+    unsigned char              buf[BITPACK_COPY_CHUNK];
+    unsigned long              head, tail, num_bytes, k, c;
+    uint64_t                   head_bits = 0;
+    uint64_t                   tail_bits = 0;
+
+    if (dst_index % 8 == src_index % 8) {
+        head = (8 - dst_index % 8) % 8;
+        if (head > n) head = n;
+    }
+    else {
+        head = 0;
+    }
+
+    num_bytes = (n - head) / 8;
+    tail      = (n - head) % 8;
+
+    if (head > 0) {
+        head_bits = ops->read_code(src->data, src->data_size, src_index, head);
+    }
+
+    if (tail > 0) {
+        tail_bits = ops->read_code(src->data, src->data_size, src_index + n - tail, tail);
+    }
+
+    if (dst_index % 8 == src_index % 8) {
+        memmove(dst->data + (dst_index + head) / 8, src->data + (src_index + head) / 8, num_bytes);
+    }
+    else if (dst == src && dst_index > src_index) {
+        for (k = num_bytes; k > 0; k -= c) {
+            c = k < BITPACK_COPY_CHUNK ? k : BITPACK_COPY_CHUNK;
+            ops->take_bytes(src->data, src_index + (k - c) * 8, buf, c);
+            ops->put_bytes(dst->data, dst_index + (k - c) * 8, buf, c);
+        }
+    }
+    else {
+        for (k = 0; k < num_bytes; k += c) {
+            c = num_bytes - k < BITPACK_COPY_CHUNK ? num_bytes - k : BITPACK_COPY_CHUNK;
+            ops->take_bytes(src->data, src_index + k * 8, buf, c);
+            ops->put_bytes(dst->data, dst_index + k * 8, buf, c);
+        }
+    }
+
+    if (head > 0) {
+        ops->write_code(dst->data, dst->data_size, dst_index, head, head_bits);
+    }
+
+    if (tail > 0) {
+        ops->write_code(dst->data, dst->data_size, dst_index + n - tail, tail, tail_bits);
+    }
+}
+
+int bitpack_copy_range(bitpack_t dst, unsigned long dst_index, bitpack_t src,
+        unsigned long src_index, unsigned long num_bits)
+{
+    _bitpack_err_clear(dst);
+
+    if (!_bitpack_range_fits(dst, dst_index, num_bits) || !_bitpack_range_fits(dst, src_index, num_bits)) {
+        return BITPACK_RV_ERROR;
+    }
+
+    if (!_bitpack_writable(dst)) {
+        return BITPACK_RV_ERROR;
+    }
+
+    if (src_index + num_bits > bitpack_size(src)) {
+        _bitpack_err_set(dst, BITPACK_ERR_READ_PAST_END, bitpack_size(src) - 1, 0);
+        return BITPACK_RV_ERROR;
+    }
+
+    if (bitpack_size(dst) < dst_index + num_bits) {
+        if (!_bitpack_resize(dst, dst_index + num_bits)) {
+            return BITPACK_RV_ERROR;
+        }
+    }
+
+    if (dst->ops == src->ops) {
+        _bitpack_copy_bits(dst, dst_index, src, src_index, num_bits);
+    }
+    else {
+        _bitpack_copy_codes(dst, dst_index, src, src_index, num_bits);
+    }
+
+    return BITPACK_RV_SUCCESS;
+}
+
+/*
+ * Insert, delete and shift.  These all move the bits after some index up or
+ * down within the same bitpack, which is an overlapping range copy, so the
+ * tail is moved in a single pass of memmove or funnel shifted byte runs.
+ */
+int bitpack_insert_bits(bitpack_t bp, unsigned long value, unsigned long num_bits, unsigned long index)
+{
+    unsigned long size = bitpack_size(bp);
 
     _bitpack_err_clear(bp);
 
-    bytes = malloc(bytes_size);
+    if (!_bitpack_writable(bp)) {
+        return BITPACK_RV_ERROR;
+    }
 
-    if (bytes == NULL) {
-        bp->error = BITPACK_ERR_MALLOC_FAILED;
-        strncpy(bp->error_str, "memory allocation failed", BITPACK_ERR_BUF_SIZE);
+    if (index > size) {
+        _bitpack_err_set(bp, BITPACK_ERR_INVALID_INDEX, index, size);
         return BITPACK_RV_ERROR;
     }
 
-    memcpy(bytes, bp->data, bytes_size);
+    if (num_bits > sizeof(unsigned long) * 8) {
+        _bitpack_err_set(bp, BITPACK_ERR_RANGE_TOO_BIG, num_bits, sizeof(unsigned long) * 8);
+        return BITPACK_RV_ERROR;
+    }
 
-    *value = bytes;
+    if (num_bits < sizeof(unsigned long) * 8 && (value >> num_bits) != 0) {
+        _bitpack_err_set(bp, BITPACK_ERR_VALUE_TOO_BIG, value, num_bits);
+        return BITPACK_RV_ERROR;
+    }
 
-    if (num_bytes) {
-        *num_bytes = bytes_size;
+    if (num_bits == 0) {
+        return BITPACK_RV_SUCCESS;
+    }
+
+    if (!_bitpack_resize(bp, size + num_bits)) {
+        return BITPACK_RV_ERROR;
+    }
+
+    _bitpack_copy_bits(bp, index + num_bits, bp, index, size - index);
+    bp->ops->write_field(bp->data, bp->data_size, index, num_bits, value);
+
+    return BITPACK_RV_SUCCESS;
+}
+
+int bitpack_delete_range(bitpack_t bp, unsigned long index, unsigned long num_bits)
+{
+    unsigned long size = bitpack_size(bp);
+
+    _bitpack_err_clear(bp);
+
+    if (!_bitpack_writable(bp)) {
+        return BITPACK_RV_ERROR;
+    }
+
+    if (index > size) {
+        _bitpack_err_set(bp, BITPACK_ERR_INVALID_INDEX, index, size);
+        return BITPACK_RV_ERROR;
+    }
+
+    if (num_bits > size - index) {
+        _bitpack_err_set(bp, BITPACK_ERR_READ_PAST_END, size - 1, 0);
+        return BITPACK_RV_ERROR;
+    }
+
+    _bitpack_copy_bits(bp, index, bp, index + num_bits, size - index - num_bits);
+
+    return _bitpack_resize(bp, size - num_bits);
+}
+
+/* move every bit n places towards index 0 (left) or away from it, filling with 0s */
+static int _bitpack_shift(bitpack_t bp, unsigned long n, int left)
+{
+    unsigned long size = bitpack_size(bp);
+
+    _bitpack_err_clear(bp);
+
+    if (!_bitpack_writable(bp)) {
+        return BITPACK_RV_ERROR;
+    }
+
+    if (n > size) {
+        n = size;
+    }
+
+    if (left) {
+        _bitpack_copy_bits(bp, 0, bp, n, size - n);
+        _bitpack_fill_bits(bp, size - n, n, 0);
+    }
+    else {
+        _bitpack_copy_bits(bp, n, bp, 0, size - n);
+        _bitpack_fill_bits(bp, 0, n, 0);
+    }
+
+    return BITPACK_RV_SUCCESS;
+}
+
+int bitpack_shift_left(bitpack_t bp, unsigned long n)
+{
+    return _bitpack_shift(bp, n, 1);
+}
+
+int bitpack_shift_right(bitpack_t bp, unsigned long n)
+{
+    return _bitpack_shift(bp, n, 0);
+}
+
+/*
+ * Counting and scanning.  Whether a byte has any or how many set bits does
+ * not depend on the bit order, so whole bytes are counted and skipped
+ * straight from the data, and only the bits at either end are read as codes
+ * (first bit highest) to find positions.
+ */
+typedef unsigned long (*_bitpack_popcount_fn)(const unsigned char *p, unsigned long n);
+
+/* number of trailing 0 bits in v, 64 if v is 0 */
+static unsigned int _bitpack_ctz64(uint64_t v)
+{
+#if defined(__GNUC__)
+    return v ? __builtin_ctzll(v) : 64;
+#else
+    unsigned int n = 0;
+
+    if (v == 0) return 64;
+
+    while (!(v & 1)) {
+        v >>= 1;
+        n++;
+    }
+
+    return n;
+#endif
+}
+
+static unsigned long _bitpack_popcount_scalar(const unsigned char *p, unsigned long n)
+{
+    unsigned long k     = 0;
+    unsigned long count = 0;
+    uint64_t      w;
+
+    for (; k + 8 <= n; k += 8) {
+        memcpy(&w, p + k, 8);
+        count += _bitpack_popcount64(w);
+    }
+
+    for (; k < n; k++) {
+        count += _bitpack_popcount64(p[k]);
+    }
+
+    return count;
+}
+
+#ifdef BITPACK_X86_SIMD
+/* the same, but with the popcnt instruction rather than a bit trick */
+__attribute__((target("popcnt")))
+static unsigned long _bitpack_popcount_popcnt(const unsigned char *p, unsigned long n)
+{
+    unsigned long k     = 0;
+    unsigned long count = 0;
+    uint64_t      w;
+
+    for (; k + 8 <= n; k += 8) {
+        memcpy(&w, p + k, 8);
+        count += __builtin_popcountll(w);
+    }
+
+    for (; k < n; k++) {
+        count += __builtin_popcountll(p[k]);
+    }
+
+    return count;
+}
+
+/* the number of set bits of each 64 bit lane, by looking up each nibble */
+__attribute__((target("avx2")))
+static BITPACK_ALWAYS_INLINE __m256i _bitpack_popcount_ymm(__m256i v)
+{
+    const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    __m256i       lo     = _mm256_and_si256(v, nibble);
+    __m256i       hi     = _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble);
+
+    return _mm256_sad_epu8(_mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo),
+                                           _mm256_shuffle_epi8(lookup, hi)),
+                           _mm256_setzero_si256());
+}
+
+/* carry save adder, the bits of a + b + c are *h * 2 + *l */
+__attribute__((target("avx2")))
+static BITPACK_ALWAYS_INLINE void _bitpack_csa(__m256i *h, __m256i *l, __m256i a, __m256i b, __m256i c)
+{
+    __m256i u = _mm256_xor_si256(a, b);
+
+    *h = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(u, c));
+    *l = _mm256_xor_si256(u, c);
+}
+
+/*
+ * Harley-Seal population count.  Blocks of 16 registers are added bitwise
+ * into ones, twos, fours and eights with carry save adders, so only the
+ * carry out into sixteens needs a real population count per block.
+ */
+#define BITPACK_HS_LOAD(k) _mm256_loadu_si256((const __m256i *)(p + 32 * (k)))
+
+__attribute__((target("avx2,popcnt")))
+static unsigned long _bitpack_popcount_avx2(const unsigned char *p, unsigned long n)
+{
+    const unsigned char *end    = p + n / 512 * 512;
+    __m256i              total  = _mm256_setzero_si256();
+    __m256i              ones   = _mm256_setzero_si256();
+    __m256i              twos   = _mm256_setzero_si256();
+    __m256i              fours  = _mm256_setzero_si256();
+    __m256i              eights = _mm256_setzero_si256();
+    __m256i              sixteens, twos_a, twos_b, fours_a, fours_b, eights_a, eights_b;
+    uint64_t             lanes[4];
+
+    for (; p < end; p += 512) {
+        _bitpack_csa(&twos_a, &ones, ones, BITPACK_HS_LOAD(0), BITPACK_HS_LOAD(1));
+        _bitpack_csa(&twos_b, &ones, ones, BITPACK_HS_LOAD(2), BITPACK_HS_LOAD(3));
+        _bitpack_csa(&fours_a, &twos, twos, twos_a, twos_b);
+        _bitpack_csa(&twos_a, &ones, ones, BITPACK_HS_LOAD(4), BITPACK_HS_LOAD(5));
+        _bitpack_csa(&twos_b, &ones, ones, BITPACK_HS_LOAD(6), BITPACK_HS_LOAD(7));
+        _bitpack_csa(&fours_b, &twos, twos, twos_a, twos_b);
+        _bitpack_csa(&eights_a, &fours, fours, fours_a, fours_b);
+        _bitpack_csa(&twos_a, &ones, ones, BITPACK_HS_LOAD(8), BITPACK_HS_LOAD(9));
+        _bitpack_csa(&twos_b, &ones, ones, BITPACK_HS_LOAD(10), BITPACK_HS_LOAD(11));
+        _bitpack_csa(&fours_a, &twos, twos, twos_a, twos_b);
+        _bitpack_csa(&twos_a, &ones, ones, BITPACK_HS_LOAD(12), BITPACK_HS_LOAD(13));
+        _bitpack_csa(&twos_b, &ones, ones, BITPACK_HS_LOAD(14), BITPACK_HS_LOAD(15));
+        _bitpack_csa(&fours_b, &twos, twos, twos_a, twos_b);
+        _bitpack_csa(&eights_b, &fours, fours, fours_a, fours_b);
+        _bitpack_csa(&sixteens, &eights, eights, eights_a, eights_b);
+
+        total = _mm256_add_epi64(total, _bitpack_popcount_ymm(sixteens));
+    }
+
+    total = _mm256_slli_epi64(total, 4);
+    total = _mm256_add_epi64(total, _mm256_slli_epi64(_bitpack_popcount_ymm(eights), 3));
+    total = _mm256_add_epi64(total, _mm256_slli_epi64(_bitpack_popcount_ymm(fours), 2));
+    total = _mm256_add_epi64(total, _mm256_slli_epi64(_bitpack_popcount_ymm(twos), 1));
+    total = _mm256_add_epi64(total, _bitpack_popcount_ymm(ones));
+
+    _mm256_storeu_si256((__m256i *)lanes, total);
+
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + _bitpack_popcount_popcnt(p, n % 512);
+}
+
+#undef BITPACK_HS_LOAD
+#endif
+
+/* pick the best population count for this CPU */
+static _bitpack_popcount_fn _bitpack_popcount_select(void)
+{
+#ifdef BITPACK_X86_SIMD
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+        return _bitpack_popcount_avx2;
+    }
+
+    if (__builtin_cpu_supports("popcnt")) {
+        return _bitpack_popcount_popcnt;
+    }
+#endif
+
+    return _bitpack_popcount_scalar;
+}
+
+static unsigned long _bitpack_popcount_bytes(const unsigned char *p, unsigned long n)
+{
+    static _bitpack_popcount_fn popcount = NULL;
+
+    if (popcount == NULL) {
+        popcount = _bitpack_popcount_select();
+    }
+
+    return popcount(p, n);
+}
+
+int bitpack_popcount(bitpack_t bp, unsigned long index, unsigned long num_bits, unsigned long *count)
+{
+    unsigned long head, tail;
+    unsigned long n = 0;
+
+    _bitpack_err_clear(bp);
+
+    if (index > bitpack_size(bp)) {
+        _bitpack_err_set(bp, BITPACK_ERR_INVALID_INDEX, index, bitpack_size(bp));
+        return BITPACK_RV_ERROR;
+    }
+
+    if (index + num_bits > bitpack_size(bp)) {
+        _bitpack_err_set(bp, BITPACK_ERR_READ_PAST_END, bitpack_size(bp) - 1, 0);
+        return BITPACK_RV_ERROR;
     }
 
+    /* bits up to a byte boundary, whole bytes, then the last few bits */
+    head = (8 - index % 8) % 8;
+    if (head > num_bits) head = num_bits;
+
+    if (head > 0) {
+        n += _bitpack_popcount64(_bitpack_peek64(bp, index) >> (64 - head));
+    }
+
+    n += _bitpack_popcount_bytes(bp->data + (index + head) / 8, (num_bits - head) / 8);
+
+    tail = (num_bits - head) % 8;
+
+    if (tail > 0) {
+        n += _bitpack_popcount64(_bitpack_peek64(bp, index + num_bits - tail) >> (64 - tail));
+    }
+
+    *count = n;
+
+    return BITPACK_RV_SUCCESS;
+}
+
+/* index of the first bit equal to bit at or after from, the size if none */
+static unsigned long _bitpack_find_next(bitpack_t bp, unsigned long from, unsigned char bit)
+{
+    unsigned long size = bitpack_size(bp);
+    uint64_t      skip = bit ? 0 : ~(uint64_t)0;
+    unsigned long i    = from;
+    uint64_t      w;
+
+    while (i < size) {
+        w = _bitpack_peek64(bp, i) ^ skip;
+
+        if (size - i < 64) {
+            w &= ~(~(uint64_t)0 >> (size - i));
+        }
+
+        if (w != 0) {
+            return i + _bitpack_clz64(w);
+        }
+
+        /* back to a byte boundary, then skip whole words of the wrong bit */
+        i = (i + 64) / 8 * 8;
+
+        while (i + 64 <= size && _bitpack_load_le64(bp->data + i / 8) == skip) {
+            i += 64;
+        }
+    }
+
+    return size;
+}
+
+/* index of the last bit equal to bit before from, the size if none */
+static unsigned long _bitpack_find_prev(bitpack_t bp, unsigned long from, unsigned char bit)
+{
+    uint64_t      skip = bit ? 0 : ~(uint64_t)0;
+    unsigned long i    = from;
+    unsigned long k;
+    uint64_t      w;
+
+    while (i > 0) {
+        k = i < 64 ? i : 64;
+        w = (_bitpack_peek64(bp, i - k) ^ skip) >> (64 - k);
+
+        if (w != 0) {
+            return i - 1 - _bitpack_ctz64(w);
+        }
+
+        /* forward to a byte boundary, then skip whole words of the wrong bit */
+        i = (i - k + 7) / 8 * 8;
+
+        while (i >= 64 && _bitpack_load_le64(bp->data + i / 8 - 8) == skip) {
+            i -= 64;
+        }
+    }
+
+    return bitpack_size(bp);
+}
+
+static int _bitpack_find(bitpack_t bp, unsigned long from, unsigned long *index,
+        unsigned char bit, int forward)
+{
+    _bitpack_err_clear(bp);
+
+    if (from > bitpack_size(bp)) {
+        _bitpack_err_set(bp, BITPACK_ERR_INVALID_INDEX, from, bitpack_size(bp));
+        return BITPACK_RV_ERROR;
+    }
+
+    *index = forward ? _bitpack_find_next(bp, from, bit) : _bitpack_find_prev(bp, from, bit);
+
     return BITPACK_RV_SUCCESS;
 }
 
+int bitpack_find_next_set(bitpack_t bp, unsigned long from, unsigned long *index)
+{
+    return _bitpack_find(bp, from, index, 1, 1);
+}
+
+int bitpack_find_next_clear(bitpack_t bp, unsigned long from, unsigned long *index)
+{
+    return _bitpack_find(bp, from, index, 0, 1);
+}
+
+int bitpack_find_prev_set(bitpack_t bp, unsigned long from, unsigned long *index)
+{
+    return _bitpack_find(bp, from, index, 1, 0);
+}
+
+int bitpack_find_prev_clear(bitpack_t bp, unsigned long from, unsigned long *index)
+{
+    return _bitpack_find(bp, from, index, 0, 0);
+}
+
+int bitpack_next_run(bitpack_t bp, unsigned long index, unsigned char *bit, unsigned long *length)
+{
+    _bitpack_err_clear(bp);
+
+    if (index >= bitpack_size(bp)) {
+        _bitpack_err_set(bp, BITPACK_ERR_INVALID_INDEX, index, bitpack_size(bp) - 1);
+        return BITPACK_RV_ERROR;
+    }
+
+    *bit    = _bitpack_peek64(bp, index) >> 63;
+    *length = _bitpack_find_next(bp, index, !*bit) - index;
+
+    return BITPACK_RV_SUCCESS;
+}
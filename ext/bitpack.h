@@ -1,6 +1,9 @@
 #ifndef _BITPACK_H
 #define _BITPACK_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 /**
  * @file bitpack.h
  * @brief bitpack typedefs, defines, and exported function prototypes
@@ -18,33 +21,157 @@
  */
 #define BITPACK_DEFAULT_MEM_SIZE 32
 
+/**
+ * The number of bytes stored inside the bitpack object itself.  A bitpack
+ * whose data fits is a single allocation, and its data only moves to the
+ * heap once it grows past this.
+ */
+#define BITPACK_INLINE_DATA_SIZE 64
+
+/** Defined when the compiler has a native 128 bit integer type. */
+#if defined(__SIZEOF_INT128__)
+#define BITPACK_HAVE_INT128 1
+#endif
+
 /** The maximum size of a bitpack error string. */
 #define BITPACK_ERR_BUF_SIZE 100
 
 /** The various bitpack error types. */
 typedef enum {
-    BITPACK_ERR_CLEAR         = 0,
-    BITPACK_ERR_MALLOC_FAILED = 1,
-    BITPACK_ERR_INVALID_INDEX = 2,
-    BITPACK_ERR_VALUE_TOO_BIG = 3,
-    BITPACK_ERR_RANGE_TOO_BIG = 4,
-    BITPACK_ERR_READ_PAST_END = 5,
-    BITPACK_ERR_EMPTY         = 6
+    BITPACK_ERR_CLEAR                = 0,
+    BITPACK_ERR_MALLOC_FAILED        = 1,
+    BITPACK_ERR_INVALID_INDEX        = 2,
+    BITPACK_ERR_VALUE_TOO_BIG        = 3,
+    BITPACK_ERR_RANGE_TOO_BIG        = 4,
+    BITPACK_ERR_READ_PAST_END        = 5,
+    BITPACK_ERR_EMPTY                = 6,
+    BITPACK_ERR_READ_ONLY            = 7,
+    BITPACK_ERR_BUFFER_TOO_SMALL     = 8,
+    BITPACK_ERR_WIDE_VALUE_TOO_BIG   = 9,
+    BITPACK_ERR_SIGNED_VALUE_TOO_BIG = 10,
+    BITPACK_ERR_NOT_ENCODABLE        = 11,
+    BITPACK_ERR_INVALID_CODE         = 12,
+    BITPACK_ERR_IO_FAILED            = 13
 } bitpack_err_t;
 
+/** The bit orders of a bitpack object. */
+typedef enum {
+    BITPACK_MSB_FIRST = 0,          /** bit 0 is the high bit of the first byte, fields are stored MSB first */
+    BITPACK_LSB_FIRST = 1           /** bit 0 is the low bit of the first byte, fields are stored LSB first */
+} bitpack_order_t;
+
+struct _bitpack_ops;
+struct _bitpack_rank_t;
+struct _bitpack_arena_t;
+
+/*
+ * The fields used by every access come first, followed by the inline data,
+ * so that a small bitpack sits in as few cache lines as possible.
+ */
 struct _bitpack_t
 {
     unsigned long  size;                            /** size of bitpack in bits */
     unsigned long  read_pos;                        /** current position for reading */
     unsigned long  data_size;                       /** amount of allocated memory */
     unsigned char *data;                            /** pointer to the acutal data */
+    const struct _bitpack_ops *ops;                 /** bit order specific primitives */
+    unsigned int   flags;                           /** internal flags, e.g. read-only view */
     bitpack_err_t  error;                           /** error status of last operation */
-    char           error_str[BITPACK_ERR_BUF_SIZE]; /** error string of last operation */
+    unsigned char  inline_data[BITPACK_INLINE_DATA_SIZE]; /** data of a small bitpack */
+    unsigned long  error_args[2];                   /** arguments of the error message */
+    char          *error_str;                       /** error string, formatted on demand */
+    struct _bitpack_rank_t    *rank;                /** rank/select index, built on demand */
+    struct _bitpack_arena_t   *arena;               /** arena holding the object and its data, or NULL */
 };
 
 /** The Bitpack object type. */
 typedef struct _bitpack_t *bitpack_t;
 
+/** The types of the fields of a record schema. */
+typedef enum {
+    BITPACK_FIELD_UINT     = 0,     /** unsigned integer, 1 to 64 bits */
+    BITPACK_FIELD_SINT     = 1,     /** two's complement signed integer, 1 to 64 bits */
+    BITPACK_FIELD_BYTES    = 2,     /** fixed length byte run */
+    BITPACK_FIELD_VARBYTES = 3      /** byte run whose length is an earlier UINT field */
+} bitpack_field_type_t;
+
+/**
+ * Describes one field of a record schema and the member of the C struct it
+ * is packed from and unpacked to.  Use the BITPACK_*_FIELD() macros below
+ * to fill these in.
+ */
+typedef struct
+{
+    bitpack_field_type_t type;      /** type of the field */
+    unsigned long        bits;      /** width of an integer field in bits */
+    unsigned long        num_bytes; /** length of a BYTES field, capacity of a VARBYTES field */
+    unsigned long        len_field; /** index of the UINT field holding the length of a VARBYTES field */
+    size_t               offset;    /** offset of the struct member */
+    size_t               size;      /** size of the struct member of an integer field (1, 2, 4 or 8) */
+} bitpack_field_t;
+
+/** Unsigned integer field of @c bits bits, stored in an integer member. */
+#define BITPACK_UINT_FIELD(type, member, bits) \
+    { BITPACK_FIELD_UINT, (bits), 0, 0, offsetof(type, member), sizeof(((type *)0)->member) }
+
+/** Signed integer field of @c bits bits, stored in an integer member. */
+#define BITPACK_SINT_FIELD(type, member, bits) \
+    { BITPACK_FIELD_SINT, (bits), 0, 0, offsetof(type, member), sizeof(((type *)0)->member) }
+
+/** Byte run the size of an unsigned char array member. */
+#define BITPACK_BYTES_FIELD(type, member) \
+    { BITPACK_FIELD_BYTES, 0, sizeof(((type *)0)->member), 0, offsetof(type, member), 0 }
+
+/**
+ * Byte run stored in an unsigned char array member, whose length in bytes is
+ * the value of the UINT field with index @c len_field.
+ */
+#define BITPACK_VARBYTES_FIELD(type, member, len_field) \
+    { BITPACK_FIELD_VARBYTES, 0, sizeof(((type *)0)->member), (len_field), offsetof(type, member), 0 }
+
+/** The variable length integer codes. */
+typedef enum {
+    BITPACK_VLC_LEB128     = 0,     /** LEB128 varint, 7 bit groups least significant first */
+    BITPACK_VLC_GAMMA      = 1,     /** Elias gamma, values from 1 */
+    BITPACK_VLC_DELTA      = 2,     /** Elias delta, values from 1 */
+    BITPACK_VLC_EXP_GOLOMB = 3,     /** Exp-Golomb of order k, values from 0 */
+    BITPACK_VLC_RICE       = 4      /** Golomb-Rice with divisor 2^k, values from 0 */
+} bitpack_vlc_t;
+
+/** The bulk bitwise operations, see bitpack_bitop(). */
+typedef enum {
+    BITPACK_OP_AND    = 0,          /** a & b */
+    BITPACK_OP_OR     = 1,          /** a | b */
+    BITPACK_OP_XOR    = 2,          /** a ^ b */
+    BITPACK_OP_ANDNOT = 3,          /** a & ~b */
+    BITPACK_OP_NOT    = 4           /** ~a, b is ignored */
+} bitpack_op_t;
+
+/** The compiled record schema type. */
+typedef struct _bitpack_schema_t *bitpack_schema_t;
+
+/** The streaming reader type. */
+typedef struct _bitpack_reader_t *bitpack_reader_t;
+
+/** The streaming writer type. */
+typedef struct _bitpack_writer_t *bitpack_writer_t;
+
+/**
+ * Output callback of a streaming writer, called with each run of bytes to
+ * write.  Returns @c BITPACK_RV_SUCCESS once all @c num_bytes bytes are
+ * written, or @c BITPACK_RV_ERROR, with @c errno set, if they can't be.
+ */
+typedef int (*bitpack_write_fn)(void *ctx, const unsigned char *bytes, unsigned long num_bytes);
+
+/** The prefix code type. */
+typedef struct _bitpack_huffman_t *bitpack_huffman_t;
+
+/** The arena type, see bitpack_init_in(). */
+typedef struct _bitpack_arena_t *bitpack_arena_t;
+
+/** default size of the blocks an arena allocates from the heap */
+#define BITPACK_ARENA_DEFAULT_BLOCK_SIZE 65536
+
 /**
  * @brief Default bitpack constructor.
  *
@@ -60,13 +187,37 @@ typedef struct _bitpack_t *bitpack_t;
  * @brief Bitpack constructor.
  *
  * Allocates and returns a new bitpack object.  The number of bytes allocated
- * to store the bits is specified by the num_bytes parameter.
+ * to store the bits is specified by the num_bytes parameter.  Up to
+ * @c BITPACK_INLINE_DATA_SIZE bytes are stored inside the object rather than
+ * allocated separately.
  *
  * @param[in] num_bytes number of bytes to allocate for bit storage
  * @return the newly allocated bitpack object
  */
 bitpack_t bitpack_init(unsigned long num_bytes);
 
+/**
+ * @brief Bitpack constructor with a bit order.
+ *
+ * Same as bitpack_init(), but the bitpack object uses the bit order
+ * @c order instead of the default @c BITPACK_MSB_FIRST.
+ *
+ * In @c BITPACK_LSB_FIRST order, as used by DEFLATE streams, bit index @c i
+ * is the bit of value <tt>1 << (i % 8)</tt> of byte <tt>i / 8</tt>, and
+ * multi-bit values are stored least significant bit first, so that the
+ * first bit of a value is its low bit.  Byte runs (bitpack_set_bytes() and
+ * friends) store each byte as an 8 bit value in the same order.
+ *
+ * The Elias, Exp-Golomb and Golomb-Rice codes of bitpack_append_vlc() are
+ * bit strings and take the same bit indices in either order, LEB128 groups
+ * are stored like byte runs.
+ *
+ * @param[in] num_bytes number of bytes to allocate for bit storage
+ * @param[in] order the bit order
+ * @return the newly allocated bitpack object
+ */
+bitpack_t bitpack_init_order(unsigned long num_bytes, bitpack_order_t order);
+
 /**
  * @brief Bitpack constructor.
  *
@@ -80,6 +231,111 @@ bitpack_t bitpack_init(unsigned long num_bytes);
  */
 bitpack_t bitpack_init_from_bytes(unsigned char *bytes, unsigned long num_bytes);
 
+/**
+ * @brief Bitpack constructor.
+ *
+ * Allocates and returns a new bitpack object whose contents are parsed from
+ * a string of 1s and 0s, such as the one produced by bitpack_to_bin().  The
+ * size of the bitpack object is the length of the string.
+ *
+ * @param[in] str NUL terminated string of '0' and '1' characters
+ * @return the newly allocated bitpack object, or @c NULL if @c str contains
+ * any other character or memory allocation failed
+ */
+bitpack_t bitpack_init_from_bin(const char *str);
+
+/**
+ * @brief Bitpack constructor.
+ *
+ * Allocates and returns a new bitpack object whose contents are parsed from
+ * a string of hex digits, such as the one produced by bitpack_to_hex().  Each
+ * digit holds 4 bits, so the size of the bitpack object is 4 times the length
+ * of the string.
+ *
+ * @param[in] str NUL terminated string of hex digits (either case)
+ * @return the newly allocated bitpack object, or @c NULL if @c str contains
+ * any other character or memory allocation failed
+ */
+bitpack_t bitpack_init_from_hex(const char *str);
+
+/**
+ * @brief Read-only bitpack view constructor.
+ *
+ * Allocates and returns a new bitpack object that refers directly to the
+ * first @c num_bits bits of an external byte array instead of copying it.
+ * The external byte array must stay valid and unchanged for the lifetime of
+ * the bitpack object and is not freed by bitpack_destroy().
+ *
+ * All of the functions that access or read bits work as usual on a view.
+ * Functions that would modify the bitpack object fail with
+ * @c BITPACK_ERR_READ_ONLY.
+ *
+ * @param[in] bytes pointer to the external byte array
+ * @param[in] num_bits number of bits in the external byte array to use
+ * @return the newly allocated bitpack object
+ */
+bitpack_t bitpack_view_init(const unsigned char *bytes, unsigned long num_bits);
+
+/**
+ * @brief Arena constructor.
+ *
+ * Allocates and returns a new arena for bitpack objects created with
+ * bitpack_init_in().  The arena takes memory from the heap in blocks of
+ * @c block_size bytes, or larger for bigger requests, and hands it out by
+ * bumping a pointer.
+ *
+ * @param[in] block_size size of the blocks to allocate, in bytes
+ * @return the newly allocated arena, or @c NULL if memory allocation failed
+ */
+bitpack_arena_t bitpack_arena_init(unsigned long block_size);
+
+/** Arena constructor with @c BITPACK_ARENA_DEFAULT_BLOCK_SIZE byte blocks. */
+#define bitpack_arena_init_default() bitpack_arena_init(BITPACK_ARENA_DEFAULT_BLOCK_SIZE)
+
+/**
+ * @brief Release everything allocated from an arena at once.
+ *
+ * Every bitpack object created in the arena becomes invalid and must not
+ * be used or destroyed.  The blocks are kept and reused by later
+ * allocations, so an arena that is reset after each message stops touching
+ * the heap once it has grown to the size of the largest one.
+ *
+ * @param[in] arena the arena
+ */
+void bitpack_arena_reset(bitpack_arena_t arena);
+
+/**
+ * @brief Arena destructor.
+ *
+ * Frees the arena and all of its blocks.  Every bitpack object created in
+ * the arena becomes invalid.
+ *
+ * @param[in] arena the arena
+ */
+void bitpack_arena_destroy(bitpack_arena_t arena);
+
+/**
+ * @brief Bitpack constructor using an arena.
+ *
+ * The same as bitpack_init(), except that the object and its @c num_bytes
+ * bytes of data are a single allocation from @c arena, the data inside the
+ * object if it fits in @c BITPACK_INLINE_DATA_SIZE bytes and straight after
+ * it otherwise, so creating it does not touch the heap.  If the
+ * bitpack outgrows its data, the new data also comes from the arena, and
+ * grows in place if nothing was allocated from the arena since.
+ *
+ * The memory is released by bitpack_arena_reset() or
+ * bitpack_arena_destroy().  bitpack_destroy() leaves the arena memory
+ * alone and only frees what the object allocated from the heap, i.e. a
+ * rank/select index or an error string, so it can be skipped for objects
+ * that have neither.
+ *
+ * @param[in] arena the arena to allocate from
+ * @param[in] num_bytes number of bytes to allocate for bit storage
+ * @return the new bitpack object, or @c NULL if memory allocation failed
+ */
+bitpack_t bitpack_init_in(bitpack_arena_t arena, unsigned long num_bytes);
+
 /**
  * @brief Bitpack destructor.
  *
@@ -100,11 +356,57 @@ unsigned long bitpack_size(bitpack_t bp);
 /**
  * @brief Access the amount of data currently allocated to this bitpack object.
  *
+ * The allocation grows geometrically as bits are added, so this is usually
+ * larger than the number of bytes needed to hold bitpack_size() bits.  See
+ * bitpack_reserve() and bitpack_shrink_to_fit() to control it explicitly.
+ *
  * @param[in] bp the bitpack object
  * @return the number of bytes allocated
  */
 unsigned long bitpack_data_size(bitpack_t bp);
 
+/**
+ * @brief Check whether a bitpack object is read-only.
+ *
+ * @param[in] bp the bitpack object
+ * @return non-zero if the bitpack object is a view created by
+ * bitpack_view_init() or was made read-only by bitpack_set_read_only(),
+ * zero otherwise
+ */
+int bitpack_read_only(bitpack_t bp);
+
+/**
+ * @brief Make a bitpack object read-only.
+ *
+ * From then on the bitpack object behaves like a view: functions that
+ * would modify it fail with @c BITPACK_ERR_READ_ONLY.  Unlike a view, it
+ * still owns its data and bitpack_destroy() frees it.
+ *
+ * @param[in] bp the bitpack object
+ */
+void bitpack_set_read_only(bitpack_t bp);
+
+/**
+ * @brief Access the bit order of a bitpack object.
+ *
+ * @param[in] bp the bitpack object
+ * @return the bit order, see bitpack_init_order()
+ */
+bitpack_order_t bitpack_get_order(bitpack_t bp);
+
+/**
+ * @brief Change the bit order of a bitpack object.
+ *
+ * The bytes of the bitpack object are not changed, they are just
+ * interpreted in the new bit order from then on.  This is how a bitpack
+ * object created by bitpack_init_from_bytes() or bitpack_view_init() is
+ * made to read an LSB first format.  It also works on views.
+ *
+ * @param[in] bp the bitpack object
+ * @param[in] order the new bit order
+ */
+void bitpack_set_order(bitpack_t bp, bitpack_order_t order);
+
 /**
  * @brief Access the current read position of the bitpack object.
  *
@@ -123,6 +425,32 @@ unsigned long bitpack_read_pos(bitpack_t bp);
  */
 void bitpack_reset_read_pos(bitpack_t bp);
 
+/**
+ * @brief Reserve memory for a number of bits in a bitpack object.
+ *
+ * Makes sure that at least enough memory to hold @c num_bits bits is
+ * allocated, so that growing the bitpack object up to that size will not need
+ * to allocate again.  The size of the bitpack object is not changed.
+ *
+ * @param[in] bp the bitpack object
+ * @param[in] num_bits the number of bits to reserve memory for
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_reserve(bitpack_t bp, unsigned long num_bits);
+
+/**
+ * @brief Release any unused memory held by a bitpack object.
+ *
+ * Reduces the memory allocated to the bitpack object to the number of bytes
+ * needed to hold its current size (but never less than one byte).  The data
+ * of a bitpack object in an arena only shrinks if it is the last allocation
+ * from the arena.
+ *
+ * @param[in] bp the bitpack object
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_shrink_to_fit(bitpack_t bp);
+
 /**
  * @brief Access the error type from a bitpack object.
  *
@@ -137,15 +465,18 @@ bitpack_err_t bitpack_get_error(bitpack_t bp);
 /**
  * @brief Access the error string from a bitpack object.
  *
- * Returns a static character pointer containing the error string set in the
+ * Returns a character pointer containing the error string set in the
  * bitpack object.  This function should be called anytime a bitpack function
  * returns @c BITPACK_RV_ERROR.  The error status inside a bitpack object is
  * always reset when a subsequent bitpack function is called on the object.
  *
- * Note that the returned string is static and should NOT be passed to @c free().
+ * The string is only formatted when this function is called, into a buffer
+ * owned by the bitpack object.  It stays valid until the next call to this
+ * function or until the object is destroyed, and should NOT be passed to
+ * @c free().
  *
  * @param[in] bp the bitpack object
- * @return the static error string or @c NULL if the last operation on this
+ * @return the error string, or an empty string if the last operation on this
  * bitpack object did not fail
  */
 char *bitpack_get_error_str(bitpack_t bp);
@@ -192,159 +523,1627 @@ int bitpack_off(bitpack_t bp, unsigned long index);
 int bitpack_get(bitpack_t bp, unsigned long index, unsigned char *bit);
 
 /**
- * @brief Set the specified range of bits in a bitpack object.
+ * @brief Count the set bits before an index.
  *
- * Packs @c value into @c num_bits bits starting at @c index.  The number of bits
- * required to represent @c value is checked against the size of the range.  If
- * @c index + @c num_bits is greater than the current size of the bitpack, then the
- * size is adjusted appropriately.
+ * Returns the number of 1 bits at indices less than @c index, in constant
+ * time using a rank/select index.  The index is built by the first call to
+ * bitpack_rank(), bitpack_select() or bitpack_build_rank_index() after the
+ * bitpack object is created or modified, or its bit order is changed, and
+ * takes about 6% of the size of the bitpack.
+ *
+ * @param[in]  bp the bitpack object
+ * @param[in]  index the bit index, at most the size of the bitpack
+ * @param[out] count the number of set bits before @c index
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_rank(bitpack_t bp, unsigned long index, unsigned long *count);
+
+/**
+ * @brief Find the index of the n-th set bit.
+ *
+ * Returns the index of the 1 bit with @c n 1 bits before it, so that
+ * <tt>bitpack_rank(bp, index) == n</tt> and bit @c index is set, using the
+ * rank/select index (see bitpack_rank()).  Fails with
+ * @c BITPACK_ERR_INVALID_INDEX if there are @c n or fewer set bits.
+ *
+ * @param[in]  bp the bitpack object
+ * @param[in]  n the number of set bits before the bit to find
+ * @param[out] index the index of the bit
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_select(bitpack_t bp, unsigned long n, unsigned long *index);
+
+/**
+ * @brief Build the rank/select index of a bitpack object.
+ *
+ * Builds the index used by bitpack_rank() and bitpack_select() if it is
+ * not already up to date, e.g. to keep the cost out of the first query.
  *
  * @param[in] bp the bitpack object
- * @param[in] value the value to set
- * @param[in] num_bits the number of bits to pack the value into
- * @param[in] index the bit index to start packing value
  * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
  */
-int bitpack_set_bits(bitpack_t bp, unsigned long value, unsigned long num_bits, unsigned long index);
+int bitpack_build_rank_index(bitpack_t bp);
 
 /**
- * @brief Set the specified range of bytes in a bitpack object.
+ * @brief Set a range of bits to the same value.
  *
- * Packs the byte array @c value into @c num_bytes starting at @c index.  The size of
- * the bitpack object is adjust appropriately if necessary.
+ * Sets the @c num_bits bits starting at @c index to @c bit, writing the
+ * whole bytes in the middle of the range with memset.  The bitpack grows
+ * if the range goes past its end, with any new bits before @c index set
+ * to 0.
  *
  * @param[in] bp the bitpack object
- * @param[in] value the byte array to set
- * @param[in] num_bytes the number of bytes in @c value
- * @param[in] index the bit index to start packing @c value
+ * @param[in] index the first bit of the range
+ * @param[in] num_bits the length of the range
+ * @param[in] bit the value to set the bits to, 0 or 1
  * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
  */
-int bitpack_set_bytes(bitpack_t bp, unsigned char *value, unsigned long num_bytes, unsigned long index);
+int bitpack_fill_range(bitpack_t bp, unsigned long index, unsigned long num_bits, unsigned char bit);
+
+/** Set the @c num_bits bits starting at @c index to 1.  See bitpack_fill_range(). */
+#define bitpack_set_range(bp, index, num_bits)   bitpack_fill_range(bp, index, num_bits, 1)
+
+/** Set the @c num_bits bits starting at @c index to 0.  See bitpack_fill_range(). */
+#define bitpack_clear_range(bp, index, num_bits) bitpack_fill_range(bp, index, num_bits, 0)
 
 /**
- * @brief Access the value of a range of bits.
+ * @brief Copy a range of bits from one bitpack object to another.
  *
- * Unpacks @c num_bits bits at index @c index and sets the value to @c value.
+ * Copies the @c num_bits bits of @c src starting at @c src_index to
+ * @c dst starting at @c dst_index.  The whole bytes of the range are moved
+ * with memmove when both indices are at the same offset within a byte and
+ * with shifted byte runs otherwise.  @c dst and @c src may be the same
+ * bitpack object and the ranges may overlap.  @c dst grows if the range
+ * goes past its end, with any new bits before @c dst_index set to 0.
  *
- * @param[in]  bp the bitpack object
- * @param[in]  num_bits the number of bits to unpack
- * @param[in]  index the bit index to start unpacking from
- * @param[out] value pointer to the location to write the value of the unpacked bits to
+ * @param[in] dst the bitpack object to copy to
+ * @param[in] dst_index the first bit of the range of @c dst
+ * @param[in] src the bitpack object to copy from
+ * @param[in] src_index the first bit of the range of @c src
+ * @param[in] num_bits the length of the range
  * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
  */
-int bitpack_get_bits(bitpack_t bp, unsigned long num_bits, unsigned long index, unsigned long *value);
+int bitpack_copy_range(bitpack_t dst, unsigned long dst_index, bitpack_t src,
+        unsigned long src_index, unsigned long num_bits);
 
 /**
- * @brief Access the value of a range of bytes.
+ * @brief Insert bits at an index.
  *
- * Unpacks @c num_bytes bytes at index @c index and sets the value to @c value.
+ * Packs @c value into @c num_bits bits, as bitpack_set_bits() does, and
+ * inserts them before the bit at @c index, moving that bit and the ones
+ * after it up by @c num_bits.  The read position is not changed.
  *
- * Allocates @c num_bytes bytes to write the unpacked bytes to and sets the
- * pointer pointed to by @c value to the unpacked bytes.  The unpacked bytes
- * should be freed by the caller.
+ * @param[in] bp the bitpack object
+ * @param[in] value the value to insert
+ * @param[in] num_bits the number of bits to pack @c value into
+ * @param[in] index the index to insert at, at most the size of the bitpack
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_insert_bits(bitpack_t bp, unsigned long value, unsigned long num_bits, unsigned long index);
+
+/**
+ * @brief Remove a range of bits.
  *
- * @param[in]  bp the bitpack object
- * @param[in]  num_bytes the number of bytes to unpack
- * @param[in]  index the bit index to start unpacking from
- * @param[out] value pointer to the location to write the unpacked byte array
- *             pointer to, will be set to @c NULL on failure
+ * Removes the @c num_bits bits starting at @c index, moving the bits after
+ * them down by @c num_bits, so the bitpack gets @c num_bits bits shorter.
+ * The read position is not changed.
+ *
+ * @param[in] bp the bitpack object
+ * @param[in] index the first bit to remove
+ * @param[in] num_bits the number of bits to remove
  * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
  */
-int bitpack_get_bytes(bitpack_t bp, unsigned long num_bytes, unsigned long index, unsigned char **value);
+int bitpack_delete_range(bitpack_t bp, unsigned long index, unsigned long num_bits);
 
 /**
- * @brief Append a particular value to the end of a bitpack object.
+ * @brief Shift every bit towards index 0.
  *
- * Packs @c value into @c num_bits bits at the end of the bitpack object.  On
- * success, the size of the bitpack object is increased by @c num_bits.
+ * Bit @c i becomes the bit that was at <tt>i + n</tt>, and the last @c n
+ * bits become 0.  The size of the bitpack is unchanged, so with MSB first
+ * order this is a left shift of the bitpack read as one big number.
  *
  * @param[in] bp the bitpack object
- * @param[in] value the value to set
- * @param[in] num_bits the number of bits to pack the value into
+ * @param[in] n the number of places to shift by
  * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
  */
-#define bitpack_append_bits(bp, value, num_bits) bitpack_set_bits(bp, value, num_bits, bitpack_size(bp))
+int bitpack_shift_left(bitpack_t bp, unsigned long n);
 
 /**
- * @brief Append the specified range of bytes to the end of a bitpack object.
+ * @brief Shift every bit away from index 0.
  *
- * Packs the byte array @c value into @c num_bytes starting at then end of the
- * bitpack object.  On success, the size of the bitpack object is increased by
- * @c num_bytes * 8 bits.
+ * Bit @c i becomes the bit that was at <tt>i - n</tt>, and the first @c n
+ * bits become 0.  The size of the bitpack is unchanged.
  *
  * @param[in] bp the bitpack object
- * @param[in] value the byte array to set
- * @param[in] num_bytes the number of bytes in @c value
+ * @param[in] n the number of places to shift by
  * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
  */
-#define bitpack_append_bytes(bp, value, num_bytes) bitpack_set_bytes(bp, value, num_bytes, bitpack_size(bp))
+int bitpack_shift_right(bitpack_t bp, unsigned long n);
 
 /**
- * @brief Access the value of a range of bits at the current read position.
+ * @brief Bitwise operation between two bitpack objects.
  *
- * Unpacks @c num_bits bits at the current read position (see bitpack_read_pos())
- * and sets the value to @c value.  The current read position is advanced by
- * @c num_bits bits.
+ * Sets @c dst to <tt>a op b</tt>, working on whole 64 bit words (or wider
+ * SIMD registers where available) rather than bit by bit.  The result is as
+ * long as the longer of @c a and @c b, the shorter one reading as 0 past its
+ * end, and keeps the bit order of @c dst.  @c dst may be @c a or @c b for an
+ * in-place operation.  For @c BITPACK_OP_NOT the result is as long as @c a
+ * and @c b is ignored.
  *
- * @param[in]  bp the bitpack object
- * @param[in]  num_bits the number of bits to unpack
- * @param[out] value pointer to the location to write the value of the unpacked bits to
+ * @param[in] dst the bitpack object to store the result in
+ * @param[in] a the first operand
+ * @param[in] b the second operand
+ * @param[in] op the operation
  * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
  */
-int bitpack_read_bits(bitpack_t bp, unsigned long num_bits, unsigned long *value);
+int bitpack_bitop(bitpack_t dst, bitpack_t a, bitpack_t b, bitpack_op_t op);
 
 /**
- * @brief Access the value of a range of bytes at the current read position.
+ * @brief Bitwise operation between two ranges of bits.
  *
- * Unpacks @c num_bytes bytes at the current read position (see bitpack_read_pos())
- * and sets the value to @c value.  The current read position is advanced by
- * @c num_bytes * 8 bits.
+ * Sets the @c num_bits bits of @c dst starting at @c dst_index to
+ * <tt>dst op src</tt>, where @c src is the @c num_bits bits of @c src
+ * starting at @c src_index, or to <tt>~src</tt> for @c BITPACK_OP_NOT.
+ * The indices need not be byte aligned and the bit orders may differ, but
+ * the fast path is for byte aligned ranges of bitpacks with the same bit
+ * order.  @c dst grows if the range goes past its end.  The two ranges may
+ * be the same but must not otherwise overlap.
  *
- * The unpacked bytes are allocated on the heap and should be freed by the
- * caller.
+ * @param[in] dst the bitpack object to update
+ * @param[in] dst_index the first bit of the range of @c dst
+ * @param[in] src the bitpack object holding the other operand
+ * @param[in] src_index the first bit of the range of @c src
+ * @param[in] num_bits the length of the ranges
+ * @param[in] op the operation
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_bitop_range(bitpack_t dst, unsigned long dst_index, bitpack_t src,
+        unsigned long src_index, unsigned long num_bits, bitpack_op_t op);
+
+/** In-place AND, @c a becomes <tt>a & b</tt>.  See bitpack_bitop(). */
+#define bitpack_and(a, b)              bitpack_bitop(a, a, b, BITPACK_OP_AND)
+
+/** In-place OR, @c a becomes <tt>a | b</tt>.  See bitpack_bitop(). */
+#define bitpack_or(a, b)               bitpack_bitop(a, a, b, BITPACK_OP_OR)
+
+/** In-place XOR, @c a becomes <tt>a ^ b</tt>.  See bitpack_bitop(). */
+#define bitpack_xor(a, b)              bitpack_bitop(a, a, b, BITPACK_OP_XOR)
+
+/** In-place AND NOT, @c a becomes <tt>a & ~b</tt>.  See bitpack_bitop(). */
+#define bitpack_andnot(a, b)           bitpack_bitop(a, a, b, BITPACK_OP_ANDNOT)
+
+/** In-place NOT, @c bp becomes <tt>~bp</tt>.  See bitpack_bitop(). */
+#define bitpack_not(bp)                bitpack_bitop(bp, bp, bp, BITPACK_OP_NOT)
+
+/** Sets @c dst to <tt>a & b</tt>.  See bitpack_bitop(). */
+#define bitpack_and_into(dst, a, b)    bitpack_bitop(dst, a, b, BITPACK_OP_AND)
+
+/** Sets @c dst to <tt>a | b</tt>.  See bitpack_bitop(). */
+#define bitpack_or_into(dst, a, b)     bitpack_bitop(dst, a, b, BITPACK_OP_OR)
+
+/** Sets @c dst to <tt>a ^ b</tt>.  See bitpack_bitop(). */
+#define bitpack_xor_into(dst, a, b)    bitpack_bitop(dst, a, b, BITPACK_OP_XOR)
+
+/** Sets @c dst to <tt>a & ~b</tt>.  See bitpack_bitop(). */
+#define bitpack_andnot_into(dst, a, b) bitpack_bitop(dst, a, b, BITPACK_OP_ANDNOT)
+
+/** Sets @c dst to <tt>~bp</tt>.  See bitpack_bitop(). */
+#define bitpack_not_into(dst, bp)      bitpack_bitop(dst, bp, bp, BITPACK_OP_NOT)
+
+/**
+ * @brief Count the set bits in a range.
+ *
+ * Counts the 1 bits among the @c num_bits bits starting at @c index using
+ * the hardware population count where available.  Unlike bitpack_rank()
+ * this needs no index, so it suits one-off counts and changing bitpacks.
  *
  * @param[in]  bp the bitpack object
- * @param[in]  num_bytes the number of bytes to unpack
- * @param[out] value pointer to the location to write the unpacked byte array
- *             pointer to, will be set to @c NULL on failure
+ * @param[in]  index the first bit of the range
+ * @param[in]  num_bits the length of the range
+ * @param[out] count the number of set bits in the range
  * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
  */
-int bitpack_read_bytes(bitpack_t bp, unsigned long num_bytes, unsigned char **value);
+int bitpack_popcount(bitpack_t bp, unsigned long index, unsigned long num_bits, unsigned long *count);
 
 /**
- * @brief Convert the bitpack object to a string of 1s and 0s.
+ * @brief Find the first set bit at or after an index.
  *
- * Converts the bitpack object to its binary representation.
+ * Scans 64 bits at a time for the first 1 bit at an index of at least
+ * @c from, which may be the size of the bitpack.  If there is none
+ * @c index is set to the size of the bitpack.
  *
- * The output string @c str is allocated on the heap and should be freed by the
- * caller.
+ * @param[in]  bp the bitpack object
+ * @param[in]  from the index to start from
+ * @param[out] index the index of the bit found, or the size of the bitpack
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_find_next_set(bitpack_t bp, unsigned long from, unsigned long *index);
+
+/**
+ * @brief Find the first clear bit at or after an index.
+ *
+ * The same as bitpack_find_next_set(), for a 0 bit.
  *
  * @param[in]  bp the bitpack object
- * @param[out] str pointer to the location to write the binary string to
+ * @param[in]  from the index to start from
+ * @param[out] index the index of the bit found, or the size of the bitpack
  * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
  */
-int bitpack_to_bin(bitpack_t bp, char **str);
+int bitpack_find_next_clear(bitpack_t bp, unsigned long from, unsigned long *index);
 
 /**
- * @brief Convert the bitpack object to a byte array.
+ * @brief Find the last set bit before an index.
  *
- * Converts the bitpack object to an array of bytes.  If the current size of
- * the bitpack object is not a multiple of 8, the last byte in the returned
- * byte array will be padded with the appropriate number of 0 bits.
+ * Scans backwards 64 bits at a time for the last 1 bit at an index less
+ * than @c from, which may be the size of the bitpack to search all of it.
+ * If there is none @c index is set to the size of the bitpack.
  *
- * The output string @c bytes is allocated on the heap and should be freed by the
- * caller.
+ * @param[in]  bp the bitpack object
+ * @param[in]  from the index to search before
+ * @param[out] index the index of the bit found, or the size of the bitpack
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_find_prev_set(bitpack_t bp, unsigned long from, unsigned long *index);
+
+/**
+ * @brief Find the last clear bit before an index.
  *
- * The number of bytes returned is the current size in bits of the bitpack,
- * divided by 8 and rounded up to the nearest byte.  The output parameter
- * @c num_bytes will tell you the exact value.
+ * The same as bitpack_find_prev_set(), for a 0 bit.
  *
  * @param[in]  bp the bitpack object
- * @param[out] value pointer to the location to write the byte array to
- * @param[out] num_bytes pointer to the location to write the number of bytes returned
+ * @param[in]  from the index to search before
+ * @param[out] index the index of the bit found, or the size of the bitpack
  * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
  */
-int bitpack_to_bytes(bitpack_t bp, unsigned char **value, unsigned long *num_bytes);
+int bitpack_find_prev_clear(bitpack_t bp, unsigned long from, unsigned long *index);
+
+/**
+ * @brief Get the run of equal bits starting at an index.
+ *
+ * Gets the value of the bit at @c index and the number of bits from
+ * @c index up to the next bit with the other value, or the end of the
+ * bitpack.  The runs of a bitpack can be walked with:
+ *
+ * <pre>
+ * for (i = 0; i < bitpack_size(bp); i += length) {
+ *     bitpack_next_run(bp, i, &bit, &length);
+ *     ...
+ * }
+ * </pre>
+ *
+ * @param[in]  bp the bitpack object
+ * @param[in]  index the first bit of the run
+ * @param[out] bit the value of the bits of the run
+ * @param[out] length the length of the run
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_next_run(bitpack_t bp, unsigned long index, unsigned char *bit, unsigned long *length);
+
+/**
+ * @brief Set the specified range of bits in a bitpack object.
+ *
+ * Packs @c value into @c num_bits bits starting at @c index.  The number of bits
+ * required to represent @c value is checked against the size of the range.  If
+ * @c index + @c num_bits is greater than the current size of the bitpack, then the
+ * size is adjusted appropriately.
+ *
+ * @param[in] bp the bitpack object
+ * @param[in] value the value to set
+ * @param[in] num_bits the number of bits to pack the value into
+ * @param[in] index the bit index to start packing value
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_set_bits(bitpack_t bp, unsigned long value, unsigned long num_bits, unsigned long index);
+
+/**
+ * @brief Set the specified range of bits in a bitpack object without
+ * validating the arguments.
+ *
+ * Same as bitpack_set_bits(), but for callers that already guarantee that
+ * @c num_bits is between 1 and the number of bits in an unsigned long.  Any
+ * bits of @c value above the low @c num_bits bits are ignored rather than
+ * reported as an error.  The only failures left are running out of memory
+ * and writing to a read-only bitpack.
+ *
+ * @param[in] bp the bitpack object
+ * @param[in] value the value to set
+ * @param[in] num_bits the number of bits to pack the value into
+ * @param[in] index the bit index to start packing value
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_set_bits_unchecked(bitpack_t bp, unsigned long value, unsigned long num_bits, unsigned long index);
+
+/**
+ * @brief Set the specified range of bytes in a bitpack object.
+ *
+ * Packs the byte array @c value into @c num_bytes starting at @c index.  The size of
+ * the bitpack object is adjust appropriately if necessary.
+ *
+ * @param[in] bp the bitpack object
+ * @param[in] value the byte array to set
+ * @param[in] num_bytes the number of bytes in @c value
+ * @param[in] index the bit index to start packing @c value
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_set_bytes(bitpack_t bp, unsigned char *value, unsigned long num_bytes, unsigned long index);
+
+/**
+ * @brief Access the value of a range of bits.
+ *
+ * Unpacks @c num_bits bits at index @c index and sets the value to @c value.
+ *
+ * @param[in]  bp the bitpack object
+ * @param[in]  num_bits the number of bits to unpack
+ * @param[in]  index the bit index to start unpacking from
+ * @param[out] value pointer to the location to write the value of the unpacked bits to
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_get_bits(bitpack_t bp, unsigned long num_bits, unsigned long index, unsigned long *value);
+
+/**
+ * @brief Access the value of a range of bytes.
+ *
+ * Unpacks @c num_bytes bytes at index @c index and sets the value to @c value.
+ *
+ * Allocates @c num_bytes bytes to write the unpacked bytes to and sets the
+ * pointer pointed to by @c value to the unpacked bytes.  The unpacked bytes
+ * should be freed by the caller.
+ *
+ * @param[in]  bp the bitpack object
+ * @param[in]  num_bytes the number of bytes to unpack
+ * @param[in]  index the bit index to start unpacking from
+ * @param[out] value pointer to the location to write the unpacked byte array
+ *             pointer to, will be set to @c NULL on failure
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_get_bytes(bitpack_t bp, unsigned long num_bytes, unsigned long index, unsigned char **value);
+
+/**
+ * @brief Access the value of a range of bytes without allocating.
+ *
+ * Same as bitpack_get_bytes(), except that the unpacked bytes are written to
+ * the caller-provided buffer @c value, which must have room for at least
+ * @c num_bytes bytes.
+ *
+ * @param[in]  bp the bitpack object
+ * @param[in]  num_bytes the number of bytes to unpack
+ * @param[in]  index the bit index to start unpacking from
+ * @param[out] value buffer to write the unpacked bytes to
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_get_bytes_into(bitpack_t bp, unsigned long num_bytes, unsigned long index, unsigned char *value);
+
+/**
+ * @brief Append a particular value to the end of a bitpack object.
+ *
+ * Packs @c value into @c num_bits bits at the end of the bitpack object.  On
+ * success, the size of the bitpack object is increased by @c num_bits.
+ *
+ * @param[in] bp the bitpack object
+ * @param[in] value the value to set
+ * @param[in] num_bits the number of bits to pack the value into
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+#define bitpack_append_bits(bp, value, num_bits) bitpack_set_bits(bp, value, num_bits, bitpack_size(bp))
+
+/**
+ * @brief Append a particular value to the end of a bitpack object without
+ * validating the arguments.
+ *
+ * See bitpack_set_bits_unchecked() for the conditions the caller must
+ * guarantee.
+ *
+ * @param[in] bp the bitpack object
+ * @param[in] value the value to set
+ * @param[in] num_bits the number of bits to pack the value into
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+#define bitpack_append_bits_unchecked(bp, value, num_bits) bitpack_set_bits_unchecked(bp, value, num_bits, bitpack_size(bp))
+
+/**
+ * @brief Append the specified range of bytes to the end of a bitpack object.
+ *
+ * Packs the byte array @c value into @c num_bytes starting at then end of the
+ * bitpack object.  On success, the size of the bitpack object is increased by
+ * @c num_bytes * 8 bits.
+ *
+ * @param[in] bp the bitpack object
+ * @param[in] value the byte array to set
+ * @param[in] num_bytes the number of bytes in @c value
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+#define bitpack_append_bytes(bp, value, num_bytes) bitpack_set_bytes(bp, value, num_bytes, bitpack_size(bp))
+
+/**
+ * @brief Access the value of a range of bits at the current read position.
+ *
+ * Unpacks @c num_bits bits at the current read position (see bitpack_read_pos())
+ * and sets the value to @c value.  The current read position is advanced by
+ * @c num_bits bits.
+ *
+ * @param[in]  bp the bitpack object
+ * @param[in]  num_bits the number of bits to unpack
+ * @param[out] value pointer to the location to write the value of the unpacked bits to
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_read_bits(bitpack_t bp, unsigned long num_bits, unsigned long *value);
+
+/**
+ * @brief Access the value of a range of bytes at the current read position.
+ *
+ * Unpacks @c num_bytes bytes at the current read position (see bitpack_read_pos())
+ * and sets the value to @c value.  The current read position is advanced by
+ * @c num_bytes * 8 bits.
+ *
+ * The unpacked bytes are allocated on the heap and should be freed by the
+ * caller.
+ *
+ * @param[in]  bp the bitpack object
+ * @param[in]  num_bytes the number of bytes to unpack
+ * @param[out] value pointer to the location to write the unpacked byte array
+ *             pointer to, will be set to @c NULL on failure
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_read_bytes(bitpack_t bp, unsigned long num_bytes, unsigned char **value);
+
+/**
+ * @brief Access the value of a range of bytes at the current read position
+ * without allocating.
+ *
+ * Same as bitpack_read_bytes(), except that the unpacked bytes are written to
+ * the caller-provided buffer @c value, which must have room for at least
+ * @c num_bytes bytes.
+ *
+ * @param[in]  bp the bitpack object
+ * @param[in]  num_bytes the number of bytes to unpack
+ * @param[out] value buffer to write the unpacked bytes to
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_read_bytes_into(bitpack_t bp, unsigned long num_bytes, unsigned char *value);
+
+/**
+ * @brief Set the specified range of bits to a signed value.
+ *
+ * Packs @c value into @c num_bits bits starting at index @c index in two's
+ * complement, so @c value must be in the range -2^(num_bits - 1) to
+ * 2^(num_bits - 1) - 1.  Otherwise the same as bitpack_set_bits().
+ *
+ * @param[in] bp the bitpack object
+ * @param[in] value the value to set
+ * @param[in] num_bits the number of bits to pack the value into
+ * @param[in] index the bit index to start packing value
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_set_sbits(bitpack_t bp, long value, unsigned long num_bits, unsigned long index);
+
+/**
+ * @brief Access the signed value of a range of bits.
+ *
+ * Unpacks @c num_bits bits at index @c index as a two's complement value,
+ * sign extended to a long.
+ *
+ * @param[in]  bp the bitpack object
+ * @param[in]  num_bits the number of bits to unpack
+ * @param[in]  index the bit index to start unpacking from
+ * @param[out] value pointer to the location to write the value of the unpacked bits to
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_get_sbits(bitpack_t bp, unsigned long num_bits, unsigned long index, long *value);
+
+/**
+ * @brief Access the signed value of a range of bits at the current read
+ * position.
+ *
+ * Same as bitpack_get_sbits() at the current read position (see
+ * bitpack_read_pos()).  The current read position is advanced by
+ * @c num_bits bits.
+ *
+ * @param[in]  bp the bitpack object
+ * @param[in]  num_bits the number of bits to unpack
+ * @param[out] value pointer to the location to write the value of the unpacked bits to
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_read_sbits(bitpack_t bp, unsigned long num_bits, long *value);
+
+/**
+ * @brief Append a signed value to the end of a bitpack object.
+ *
+ * See bitpack_set_sbits().
+ *
+ * @param[in] bp the bitpack object
+ * @param[in] value the value to set
+ * @param[in] num_bits the number of bits to pack the value into
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+#define bitpack_append_sbits(bp, value, num_bits) bitpack_set_sbits(bp, value, num_bits, bitpack_size(bp))
+
+/**
+ * @brief Set the specified range of bits to a zigzag encoded signed value.
+ *
+ * Packs @c value into @c num_bits bits starting at index @c index using
+ * zigzag encoding, which maps 0, -1, 1, -2, 2, ... to 0, 1, 2, 3, 4, ...
+ * Like two's complement, @c value must be in the range -2^(num_bits - 1)
+ * to 2^(num_bits - 1) - 1, but values of small magnitude have their high
+ * bits clear, which suits variable length codes.
+ *
+ * @param[in] bp the bitpack object
+ * @param[in] value the value to set
+ * @param[in] num_bits the number of bits to pack the value into
+ * @param[in] index the bit index to start packing value
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_set_zigzag_bits(bitpack_t bp, long value, unsigned long num_bits, unsigned long index);
+
+/**
+ * @brief Access the zigzag encoded signed value of a range of bits.
+ *
+ * @param[in]  bp the bitpack object
+ * @param[in]  num_bits the number of bits to unpack
+ * @param[in]  index the bit index to start unpacking from
+ * @param[out] value pointer to the location to write the value of the unpacked bits to
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_get_zigzag_bits(bitpack_t bp, unsigned long num_bits, unsigned long index, long *value);
+
+/**
+ * @brief Access the zigzag encoded signed value of a range of bits at the
+ * current read position.
+ *
+ * The current read position is advanced by @c num_bits bits.
+ *
+ * @param[in]  bp the bitpack object
+ * @param[in]  num_bits the number of bits to unpack
+ * @param[out] value pointer to the location to write the value of the unpacked bits to
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_read_zigzag_bits(bitpack_t bp, unsigned long num_bits, long *value);
+
+/**
+ * @brief Append a zigzag encoded signed value to the end of a bitpack object.
+ *
+ * See bitpack_set_zigzag_bits().
+ *
+ * @param[in] bp the bitpack object
+ * @param[in] value the value to set
+ * @param[in] num_bits the number of bits to pack the value into
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+#define bitpack_append_zigzag_bits(bp, value, num_bits) bitpack_set_zigzag_bits(bp, value, num_bits, bitpack_size(bp))
+
+/**
+ * @brief Pack a little-endian multi-byte integer into a bitpack object.
+ *
+ * Packs the low @c num_bytes bytes (0 to 8) of @c value starting at bit
+ * @c index, least significant byte first, each byte being stored like
+ * bitpack_set_bytes() stores it.  In @c BITPACK_LSB_FIRST order this is the
+ * same as bitpack_set_bits() with <tt>8 * num_bytes</tt> bits.  The
+ * bitpack object is grown if necessary.
+ *
+ * @param[in] bp the bitpack object
+ * @param[in] value the value to pack
+ * @param[in] num_bytes the size of the integer in bytes
+ * @param[in] index the bit index to start packing at
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_set_le(bitpack_t bp, unsigned long value, unsigned long num_bytes, unsigned long index);
+
+/**
+ * @brief Access a little-endian multi-byte integer in a bitpack object.
+ *
+ * The counterpart of bitpack_set_le().
+ *
+ * @param[in]  bp the bitpack object
+ * @param[in]  num_bytes the size of the integer in bytes
+ * @param[in]  index the bit index to start unpacking at
+ * @param[out] value pointer to the location to write the unpacked value to
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_get_le(bitpack_t bp, unsigned long num_bytes, unsigned long index, unsigned long *value);
+
+/**
+ * @brief Access a little-endian multi-byte integer at the current read
+ * position.
+ *
+ * See bitpack_get_le().  The current read position is advanced by
+ * <tt>8 * num_bytes</tt> bits.
+ *
+ * @param[in]  bp the bitpack object
+ * @param[in]  num_bytes the size of the integer in bytes
+ * @param[out] value pointer to the location to write the unpacked value to
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_read_le(bitpack_t bp, unsigned long num_bytes, unsigned long *value);
+
+/**
+ * @brief Append a little-endian multi-byte integer to the end of a bitpack
+ * object.
+ *
+ * See bitpack_set_le().
+ *
+ * @param[in] bp the bitpack object
+ * @param[in] value the value to pack
+ * @param[in] num_bytes the size of the integer in bytes
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+#define bitpack_append_le(bp, value, num_bytes) bitpack_set_le(bp, value, num_bytes, bitpack_size(bp))
+
+/**
+ * @brief Pack a big-endian multi-byte integer into a bitpack object.
+ *
+ * Like bitpack_set_le(), but most significant byte first.  In
+ * @c BITPACK_MSB_FIRST order this is the same as bitpack_set_bits() with
+ * <tt>8 * num_bytes</tt> bits.
+ *
+ * @param[in] bp the bitpack object
+ * @param[in] value the value to pack
+ * @param[in] num_bytes the size of the integer in bytes
+ * @param[in] index the bit index to start packing at
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_set_be(bitpack_t bp, unsigned long value, unsigned long num_bytes, unsigned long index);
+
+/**
+ * @brief Access a big-endian multi-byte integer in a bitpack object.
+ *
+ * The counterpart of bitpack_set_be().
+ *
+ * @param[in]  bp the bitpack object
+ * @param[in]  num_bytes the size of the integer in bytes
+ * @param[in]  index the bit index to start unpacking at
+ * @param[out] value pointer to the location to write the unpacked value to
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_get_be(bitpack_t bp, unsigned long num_bytes, unsigned long index, unsigned long *value);
+
+/**
+ * @brief Access a big-endian multi-byte integer at the current read
+ * position.
+ *
+ * See bitpack_get_be().  The current read position is advanced by
+ * <tt>8 * num_bytes</tt> bits.
+ *
+ * @param[in]  bp the bitpack object
+ * @param[in]  num_bytes the size of the integer in bytes
+ * @param[out] value pointer to the location to write the unpacked value to
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_read_be(bitpack_t bp, unsigned long num_bytes, unsigned long *value);
+
+/**
+ * @brief Append a big-endian multi-byte integer to the end of a bitpack
+ * object.
+ *
+ * See bitpack_set_be().
+ *
+ * @param[in] bp the bitpack object
+ * @param[in] value the value to pack
+ * @param[in] num_bytes the size of the integer in bytes
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+#define bitpack_append_be(bp, value, num_bytes) bitpack_set_be(bp, value, num_bytes, bitpack_size(bp))
+
+/**
+ * @brief Set a range of bits wider than an unsigned long.
+ *
+ * Packs a non-negative integer of any size into @c num_bits bits starting at
+ * index @c index.  The integer is given as an array of @c num_words words,
+ * least significant word first, the layout used by Ruby's rb_big_pack().  If
+ * @c num_bits is greater than the current size of the bitpack object, then
+ * the size is adjusted appropriately.
+ *
+ * @param[in] bp the bitpack object
+ * @param[in] words the words of the value to set, least significant first
+ * @param[in] num_words the number of words in @c words
+ * @param[in] num_bits the number of bits to pack the value into
+ * @param[in] index the bit index to start packing value
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_set_wide_bits(bitpack_t bp, const unsigned long *words, unsigned long num_words,
+        unsigned long num_bits, unsigned long index);
+
+/**
+ * @brief Access the value of a range of bits wider than an unsigned long.
+ *
+ * Unpacks @c num_bits bits at index @c index into the array @c words, least
+ * significant word first.  Words past the value are set to 0.
+ *
+ * @param[in]  bp the bitpack object
+ * @param[in]  num_bits the number of bits to unpack
+ * @param[in]  index the bit index to start unpacking from
+ * @param[out] words the array to write the words of the value to
+ * @param[in]  num_words the number of words in @c words, at least
+ *             @c num_bits divided by the number of bits in an unsigned long,
+ *             rounded up
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_get_wide_bits(bitpack_t bp, unsigned long num_bits, unsigned long index,
+        unsigned long *words, unsigned long num_words);
+
+/**
+ * @brief Access the value of a range of bits wider than an unsigned long at
+ * the current read position.
+ *
+ * Same as bitpack_get_wide_bits() at the current read position (see
+ * bitpack_read_pos()).  The current read position is advanced by
+ * @c num_bits bits.
+ *
+ * @param[in]  bp the bitpack object
+ * @param[in]  num_bits the number of bits to unpack
+ * @param[out] words the array to write the words of the value to
+ * @param[in]  num_words the number of words in @c words
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_read_wide_bits(bitpack_t bp, unsigned long num_bits, unsigned long *words, unsigned long num_words);
+
+/**
+ * @brief Append a range of bits wider than an unsigned long to the end of a
+ * bitpack object.
+ *
+ * See bitpack_set_wide_bits().
+ *
+ * @param[in] bp the bitpack object
+ * @param[in] words the words of the value to set, least significant first
+ * @param[in] num_words the number of words in @c words
+ * @param[in] num_bits the number of bits to pack the value into
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+#define bitpack_append_wide_bits(bp, words, num_words, num_bits) \
+    bitpack_set_wide_bits(bp, words, num_words, num_bits, bitpack_size(bp))
+
+#ifdef BITPACK_HAVE_INT128
+/**
+ * @brief Set a range of up to 128 bits.
+ *
+ * Same as bitpack_set_bits(), but for values and ranges of up to 128 bits.
+ *
+ * @param[in] bp the bitpack object
+ * @param[in] value the value to set
+ * @param[in] num_bits the number of bits to pack the value into (0 to 128)
+ * @param[in] index the bit index to start packing value
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_set_bits128(bitpack_t bp, unsigned __int128 value, unsigned long num_bits, unsigned long index);
+
+/**
+ * @brief Access the value of a range of up to 128 bits.
+ *
+ * Same as bitpack_get_bits(), but for ranges of up to 128 bits.
+ *
+ * @param[in]  bp the bitpack object
+ * @param[in]  num_bits the number of bits to unpack (0 to 128)
+ * @param[in]  index the bit index to start unpacking from
+ * @param[out] value pointer to the location to write the value of the unpacked bits to
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_get_bits128(bitpack_t bp, unsigned long num_bits, unsigned long index, unsigned __int128 *value);
+
+/**
+ * @brief Append a value of up to 128 bits to the end of a bitpack object.
+ *
+ * @param[in] bp the bitpack object
+ * @param[in] value the value to set
+ * @param[in] num_bits the number of bits to pack the value into (0 to 128)
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+#define bitpack_append_bits128(bp, value, num_bits) bitpack_set_bits128(bp, value, num_bits, bitpack_size(bp))
+#endif
+
+/**
+ * @brief Convert the bitpack object to a string of 1s and 0s.
+ *
+ * Converts the bitpack object to its binary representation.
+ *
+ * The output string @c str is allocated on the heap and should be freed by the
+ * caller.
+ *
+ * @param[in]  bp the bitpack object
+ * @param[out] str pointer to the location to write the binary string to
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_to_bin(bitpack_t bp, char **str);
+
+/**
+ * @brief Convert the bitpack object to a string of hex digits.
+ *
+ * Converts the bitpack object to lowercase hex, 4 bits per digit.  If the
+ * current size of the bitpack object is not a multiple of 4, the last digit
+ * is padded with the appropriate number of 0 bits.
+ *
+ * The bits are taken in bit order, the first one being the high bit of the
+ * first digit, so the digits spell out the same bits as bitpack_to_bin() in
+ * either bit order and bitpack_init_from_hex() parses them back.  In LSB
+ * first order this is not the hex of the bytes.
+ *
+ * The output string @c str is allocated on the heap and should be freed by the
+ * caller.
+ *
+ * @param[in]  bp the bitpack object
+ * @param[out] str pointer to the location to write the hex string to
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_to_hex(bitpack_t bp, char **str);
+
+/**
+ * @brief Convert the bitpack object to base64.
+ *
+ * Converts the byte array returned by bitpack_to_bytes() to standard padded
+ * base64 (RFC 4648).
+ *
+ * The output string @c str is allocated on the heap and should be freed by the
+ * caller.
+ *
+ * @param[in]  bp the bitpack object
+ * @param[out] str pointer to the location to write the base64 string to
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_to_base64(bitpack_t bp, char **str);
+
+/**
+ * @brief Convert the bitpack object to a byte array.
+ *
+ * Converts the bitpack object to an array of bytes.  If the current size of
+ * the bitpack object is not a multiple of 8, the last byte in the returned
+ * byte array will be padded with the appropriate number of 0 bits.
+ *
+ * The output string @c bytes is allocated on the heap and should be freed by the
+ * caller.
+ *
+ * The number of bytes returned is the current size in bits of the bitpack,
+ * divided by 8 and rounded up to the nearest byte.  The output parameter
+ * @c num_bytes will tell you the exact value.
+ *
+ * @param[in]  bp the bitpack object
+ * @param[out] value pointer to the location to write the byte array to
+ * @param[out] num_bytes pointer to the location to write the number of bytes returned
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_to_bytes(bitpack_t bp, unsigned char **value, unsigned long *num_bytes);
+
+/**
+ * @brief Convert the bitpack object to a byte array without allocating.
+ *
+ * Same as bitpack_to_bytes(), except that the bytes are written to the
+ * caller-provided buffer @c value, which must have room for at least
+ * (bitpack_size() + 7) / 8 bytes.
+ *
+ * @param[in]  bp the bitpack object
+ * @param[out] value buffer to write the bytes to
+ * @param[out] num_bytes pointer to the location to write the number of bytes
+ *             written, may be @c NULL
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_to_bytes_into(bitpack_t bp, unsigned char *value, unsigned long *num_bytes);
+
+/**
+ * @brief Append an array of integers to the end of a bitpack object.
+ *
+ * Packs each of the @c n values in @c values into @c width bits, one after
+ * another, starting at the end of the bitpack object.  This is equivalent to
+ * calling bitpack_append_bits() once per value, but uses a packing loop
+ * specialized for @c width.  All values are checked before anything is
+ * written, so on failure the bitpack object is unchanged.  On success, the
+ * size of the bitpack object is increased by @c n * @c width bits.
+ *
+ * @param[in] bp the bitpack object
+ * @param[in] values the values to pack
+ * @param[in] n the number of values
+ * @param[in] width the number of bits to pack each value into (1 to 32)
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_append_uint_array(bitpack_t bp, const uint32_t *values, unsigned long n, unsigned int width);
+
+/**
+ * @brief Access an array of integers at the current read position.
+ *
+ * Unpacks @c n values of @c width bits each starting at the current read
+ * position into @c values, which must have room for @c n values.  The
+ * current read position is advanced by @c n * @c width bits.  SSE4.1 or
+ * AVX2 is used when the CPU supports it.
+ *
+ * @param[in]  bp the bitpack object
+ * @param[out] values buffer to write the unpacked values to
+ * @param[in]  n the number of values
+ * @param[in]  width the number of bits each value is packed into (1 to 32)
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_read_uint_array(bitpack_t bp, uint32_t *values, unsigned long n, unsigned int width);
+
+/**
+ * @brief Append a value in a variable length code to the end of a bitpack
+ * object.
+ *
+ * Packs @c value using the variable length integer code @c codec:
+ *
+ * - @c BITPACK_VLC_LEB128: groups of 7 bits, least significant first, each
+ *   in a byte whose high bit is set on all but the last group
+ * - @c BITPACK_VLC_GAMMA: Elias gamma, n 0 bits followed by the n + 1 bit
+ *   value; @c value must be at least 1
+ * - @c BITPACK_VLC_DELTA: Elias delta, the gamma code of the bit length of
+ *   the value followed by the value without its leading 1 bit; @c value
+ *   must be at least 1
+ * - @c BITPACK_VLC_EXP_GOLOMB: Exp-Golomb of order @c param, the gamma code
+ *   of @c value + 2^param without its @c param leading 0 bits
+ * - @c BITPACK_VLC_RICE: Golomb-Rice with divisor 2^param, @c value >> param
+ *   1 bits and a 0 bit, followed by the low @c param bits of @c value
+ *
+ * @c param (0 to 63) is only used by the Exp-Golomb and Golomb-Rice codes.
+ *
+ * @param[in] bp the bitpack object
+ * @param[in] codec the code to use
+ * @param[in] param the parameter of the code
+ * @param[in] value the value to pack
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_append_vlc(bitpack_t bp, bitpack_vlc_t codec, unsigned int param, unsigned long value);
+
+/**
+ * @brief Access a value in a variable length code at the current read
+ * position.
+ *
+ * Unpacks one value encoded with @c codec and @c param (see
+ * bitpack_append_vlc()).  The current read position is advanced past the
+ * code.
+ *
+ * @param[in]  bp the bitpack object
+ * @param[in]  codec the code to use
+ * @param[in]  param the parameter of the code
+ * @param[out] value pointer to the location to write the unpacked value to
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_read_vlc(bitpack_t bp, bitpack_vlc_t codec, unsigned int param, unsigned long *value);
+
+/**
+ * @brief Append an array of values in a variable length code to the end of
+ * a bitpack object.
+ *
+ * Same as calling bitpack_append_vlc() for each of the @c n values, except
+ * that the bitpack object is resized once and, if any value can't be
+ * encoded, nothing is written.
+ *
+ * @param[in] bp the bitpack object
+ * @param[in] codec the code to use
+ * @param[in] param the parameter of the code
+ * @param[in] values the values to pack
+ * @param[in] n the number of values
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_append_vlc_array(bitpack_t bp, bitpack_vlc_t codec, unsigned int param,
+        const unsigned long *values, unsigned long n);
+
+/**
+ * @brief Access an array of values in a variable length code at the current
+ * read position.
+ *
+ * Unpacks @c n values encoded with @c codec and @c param into @c values.  On
+ * failure the read position is unchanged, but @c values may have been
+ * partially written.
+ *
+ * @param[in]  bp the bitpack object
+ * @param[in]  codec the code to use
+ * @param[in]  param the parameter of the code
+ * @param[out] values buffer to write the unpacked values to
+ * @param[in]  n the number of values
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_read_vlc_array(bitpack_t bp, bitpack_vlc_t codec, unsigned int param,
+        unsigned long *values, unsigned long n);
+
+/** Append an LEB128 varint, see bitpack_append_vlc(). */
+#define bitpack_append_leb128(bp, value)        bitpack_append_vlc(bp, BITPACK_VLC_LEB128, 0, value)
+/** Read an LEB128 varint, see bitpack_read_vlc(). */
+#define bitpack_read_leb128(bp, value)          bitpack_read_vlc(bp, BITPACK_VLC_LEB128, 0, value)
+/** Append an Elias gamma code, see bitpack_append_vlc(). */
+#define bitpack_append_gamma(bp, value)         bitpack_append_vlc(bp, BITPACK_VLC_GAMMA, 0, value)
+/** Read an Elias gamma code, see bitpack_read_vlc(). */
+#define bitpack_read_gamma(bp, value)           bitpack_read_vlc(bp, BITPACK_VLC_GAMMA, 0, value)
+/** Append an Elias delta code, see bitpack_append_vlc(). */
+#define bitpack_append_delta(bp, value)         bitpack_append_vlc(bp, BITPACK_VLC_DELTA, 0, value)
+/** Read an Elias delta code, see bitpack_read_vlc(). */
+#define bitpack_read_delta(bp, value)           bitpack_read_vlc(bp, BITPACK_VLC_DELTA, 0, value)
+/** Append an Exp-Golomb code of order k, see bitpack_append_vlc(). */
+#define bitpack_append_exp_golomb(bp, value, k) bitpack_append_vlc(bp, BITPACK_VLC_EXP_GOLOMB, k, value)
+/** Read an Exp-Golomb code of order k, see bitpack_read_vlc(). */
+#define bitpack_read_exp_golomb(bp, value, k)   bitpack_read_vlc(bp, BITPACK_VLC_EXP_GOLOMB, k, value)
+/** Append a Golomb-Rice code with divisor 2^k, see bitpack_append_vlc(). */
+#define bitpack_append_rice(bp, value, k)       bitpack_append_vlc(bp, BITPACK_VLC_RICE, k, value)
+/** Read a Golomb-Rice code with divisor 2^k, see bitpack_read_vlc(). */
+#define bitpack_read_rice(bp, value, k)         bitpack_read_vlc(bp, BITPACK_VLC_RICE, k, value)
+
+/**
+ * @brief Record schema constructor.
+ *
+ * Compiles a list of field descriptors into a schema that packs and unpacks
+ * whole records with bitpack_append_record() and bitpack_read_record().  The
+ * bit offset of every field from the start of the record (or from the end of
+ * the previous VARBYTES field) is worked out once here, and runs of adjacent
+ * integer fields that fit in 64 bits are packed as a single word.
+ *
+ * The field descriptors are copied, so @c fields need not outlive the
+ * schema.
+ *
+ * @param[in] fields array of field descriptors, in packing order
+ * @param[in] num_fields number of field descriptors
+ * @return the newly allocated schema, or @c NULL if a field descriptor is
+ * invalid or memory allocation failed
+ */
+bitpack_schema_t bitpack_schema_compile(const bitpack_field_t *fields, unsigned long num_fields);
+
+/**
+ * @brief Record schema destructor.
+ *
+ * Frees the memory used by a schema.
+ *
+ * @param[in] schema the schema
+ */
+void bitpack_schema_destroy(bitpack_schema_t schema);
+
+/**
+ * @brief Append a record to the end of a bitpack object.
+ *
+ * Packs the members of the struct @c record described by @c schema.  All
+ * values are checked before anything is written, so on failure the bitpack
+ * object is unchanged.  On success, the size of the bitpack object is
+ * increased by the size of the record.
+ *
+ * @param[in] bp the bitpack object
+ * @param[in] schema the compiled record schema
+ * @param[in] record pointer to the struct to pack
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_append_record(bitpack_t bp, bitpack_schema_t schema, const void *record);
+
+/**
+ * @brief Access a record at the current read position.
+ *
+ * Unpacks a record described by @c schema at the current read position
+ * into the members of the struct @c record, and advances the read position
+ * past the record.  On failure the read position is unchanged, but
+ * @c record may have been partially written.
+ *
+ * @param[in]  bp the bitpack object
+ * @param[in]  schema the compiled record schema
+ * @param[out] record pointer to the struct to unpack into
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_read_record(bitpack_t bp, bitpack_schema_t schema, void *record);
+
+/**
+ * @brief Streaming reader constructor.
+ *
+ * Allocates and returns a reader that decodes the bits of a stream read
+ * from the file descriptor @c fd with read(), in order, without holding the
+ * whole stream in memory.  The bits are read through a window of
+ * @c window_size bytes (at least 16) that is refilled as it is consumed, so
+ * memory use is constant whatever the size of the stream.
+ *
+ * The reader does not own @c fd, which is not closed by
+ * bitpack_reader_destroy().  Nothing else should read from @c fd while the
+ * reader is in use.
+ *
+ * @param[in] fd the file descriptor to read from
+ * @param[in] window_size the size of the window in bytes
+ * @return the newly allocated reader, or @c NULL if memory allocation failed
+ */
+bitpack_reader_t bitpack_reader_init_fd(int fd, unsigned long window_size);
+
+/**
+ * @brief Memory mapped streaming reader constructor.
+ *
+ * Same as bitpack_reader_init_fd(), but the whole file open as @c fd is
+ * mapped into memory with mmap() instead of being read through a window.
+ * The pages are loaded and dropped by the OS as the stream is decoded.  The
+ * reader does not own @c fd, which can be closed once the reader is created.
+ *
+ * @param[in] fd the file descriptor of a regular file
+ * @return the newly allocated reader, or @c NULL with @c errno set if the
+ * file can't be mapped or memory allocation failed
+ */
+bitpack_reader_t bitpack_reader_init_mmap(int fd);
+
+/**
+ * @brief Streaming reader destructor.
+ *
+ * Destroys a reader, freeing its window or unmapping its file.
+ *
+ * @param[in] r the reader
+ */
+void bitpack_reader_destroy(bitpack_reader_t r);
+
+/**
+ * @brief Change the bit order of a streaming reader.
+ *
+ * See bitpack_set_order().  Readers start in @c BITPACK_MSB_FIRST order.
+ *
+ * @param[in] r the reader
+ * @param[in] order the new bit order
+ */
+void bitpack_reader_set_order(bitpack_reader_t r, bitpack_order_t order);
+
+/**
+ * @brief Access the position of a streaming reader.
+ *
+ * @param[in] r the reader
+ * @return the number of bits read from the start of the stream
+ */
+unsigned long bitpack_reader_pos(bitpack_reader_t r);
+
+/**
+ * @brief Access the error status of the last operation on a streaming
+ * reader.
+ *
+ * See bitpack_get_error().  A failed read() is reported as
+ * @c BITPACK_ERR_IO_FAILED, with its @c errno.
+ *
+ * @param[in] r the reader
+ * @return the error status
+ */
+bitpack_err_t bitpack_reader_get_error(bitpack_reader_t r);
+
+/**
+ * @brief Access the error string of the last operation on a streaming
+ * reader.
+ *
+ * See bitpack_get_error_str().
+ *
+ * @param[in] r the reader
+ * @return the error string
+ */
+char *bitpack_reader_get_error_str(bitpack_reader_t r);
+
+/**
+ * @brief Access a range of bits at the current position of a streaming
+ * reader.
+ *
+ * Same as bitpack_read_bits().  If the stream ends before @c num_bits bits,
+ * the read fails with @c BITPACK_ERR_READ_PAST_END and the position is
+ * unchanged.
+ *
+ * @param[in]  r the reader
+ * @param[in]  num_bits the number of bits to unpack
+ * @param[out] value pointer to the location to write the unpacked value to
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_reader_read_bits(bitpack_reader_t r, unsigned long num_bits, unsigned long *value);
+
+/**
+ * @brief Access a range of bytes at the current position of a streaming
+ * reader.
+ *
+ * Same as bitpack_read_bytes().  The result must be freed by the caller.
+ *
+ * @param[in]  r the reader
+ * @param[in]  num_bytes the number of bytes to unpack
+ * @param[out] value pointer to the newly allocated unpacked bytes
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_reader_read_bytes(bitpack_reader_t r, unsigned long num_bytes, unsigned char **value);
+
+/**
+ * @brief Access a range of bytes at the current position of a streaming
+ * reader into a buffer.
+ *
+ * Same as bitpack_read_bytes_into().  @c num_bytes may be larger than the
+ * window.  If the stream ends first, the read fails with
+ * @c BITPACK_ERR_READ_PAST_END after copying the whole bytes left in the
+ * stream to @c value, leaving less than a byte to read.
+ *
+ * @param[in]  r the reader
+ * @param[in]  num_bytes the number of bytes to unpack
+ * @param[out] value buffer of at least @c num_bytes bytes
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_reader_read_bytes_into(bitpack_reader_t r, unsigned long num_bytes, unsigned char *value);
+
+/**
+ * @brief Streaming writer constructor.
+ *
+ * Allocates and returns a writer that packs bits into a buffer of
+ * @c buffer_size bytes (at least 16) and writes the full bytes of the
+ * buffer to the file descriptor @c fd whenever it fills up, carrying the
+ * partial trailing byte over, so memory use is constant whatever the size
+ * of the output.  Byte runs larger than the buffer are written directly
+ * with writev() when the writer is at a byte boundary.
+ *
+ * The writer does not own @c fd, which is not closed by
+ * bitpack_writer_destroy().
+ *
+ * @param[in] fd the file descriptor to write to
+ * @param[in] buffer_size the size of the buffer in bytes
+ * @return the newly allocated writer, or @c NULL if memory allocation failed
+ */
+bitpack_writer_t bitpack_writer_init_fd(int fd, unsigned long buffer_size);
+
+/**
+ * @brief Streaming writer constructor with an output callback.
+ *
+ * Same as bitpack_writer_init_fd(), but full bytes are passed to
+ * @c fn with @c ctx instead of being written to a file descriptor.
+ *
+ * @param[in] fn the output callback
+ * @param[in] ctx the first argument of every call to @c fn
+ * @param[in] buffer_size the size of the buffer in bytes
+ * @return the newly allocated writer, or @c NULL if memory allocation failed
+ */
+bitpack_writer_t bitpack_writer_init_callback(bitpack_write_fn fn, void *ctx, unsigned long buffer_size);
+
+/**
+ * @brief Streaming writer destructor.
+ *
+ * Destroys a writer.  Bits that have not been written out are discarded, so
+ * call bitpack_writer_finish() first.
+ *
+ * @param[in] w the writer
+ */
+void bitpack_writer_destroy(bitpack_writer_t w);
+
+/**
+ * @brief Change the bit order of a streaming writer.
+ *
+ * See bitpack_set_order().  Writers start in @c BITPACK_MSB_FIRST order.
+ * The order should only be changed at a byte boundary.
+ *
+ * @param[in] w the writer
+ * @param[in] order the new bit order
+ */
+void bitpack_writer_set_order(bitpack_writer_t w, bitpack_order_t order);
+
+/**
+ * @brief Access the position of a streaming writer.
+ *
+ * @param[in] w the writer
+ * @return the number of bits appended since the start of the stream
+ */
+unsigned long bitpack_writer_pos(bitpack_writer_t w);
+
+/**
+ * @brief Access the error status of the last operation on a streaming
+ * writer.
+ *
+ * See bitpack_get_error().  A failed write is reported as
+ * @c BITPACK_ERR_IO_FAILED, with its @c errno.  After a failed write, the
+ * bytes that reached the output are unknown and the writer should not be
+ * used any further.
+ *
+ * @param[in] w the writer
+ * @return the error status
+ */
+bitpack_err_t bitpack_writer_get_error(bitpack_writer_t w);
+
+/**
+ * @brief Access the error string of the last operation on a streaming
+ * writer.
+ *
+ * See bitpack_get_error_str().
+ *
+ * @param[in] w the writer
+ * @return the error string
+ */
+char *bitpack_writer_get_error_str(bitpack_writer_t w);
+
+/**
+ * @brief Append a value to a streaming writer.
+ *
+ * Same as bitpack_append_bits(), writing out the full bytes of the buffer
+ * first if the value doesn't fit in it.
+ *
+ * @param[in] w the writer
+ * @param[in] value the value to pack
+ * @param[in] num_bits the number of bits to pack the value into
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_writer_append_bits(bitpack_writer_t w, unsigned long value, unsigned long num_bits);
+
+/**
+ * @brief Append a range of bytes to a streaming writer.
+ *
+ * Same as bitpack_append_bytes().  @c num_bytes may be larger than the
+ * buffer.
+ *
+ * @param[in] w the writer
+ * @param[in] value the bytes to pack
+ * @param[in] num_bytes the number of bytes to pack
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_writer_append_bytes(bitpack_writer_t w, const unsigned char *value, unsigned long num_bytes);
+
+/**
+ * @brief Write out the full bytes of a streaming writer's buffer.
+ *
+ * The partial trailing byte, if any, stays in the buffer.
+ *
+ * @param[in] w the writer
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_writer_flush(bitpack_writer_t w);
+
+/**
+ * @brief Pad a streaming writer to a byte boundary and write out its
+ * buffer.
+ *
+ * The partial trailing byte, if any, is padded with 0 bits, which advances
+ * the position to the next byte boundary.  More bits may be appended
+ * afterwards.
+ *
+ * @param[in] w the writer
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_writer_finish(bitpack_writer_t w);
+
+/*
+ * Bit buffer.  A bit buffer decodes the fields of a bitpack through a
+ * cached 64 bit accumulator, for decoders that need to look at the next
+ * bits before knowing how many to consume, e.g. table driven Huffman
+ * decoding.  Bounds are not checked per field: the bytes past the end of
+ * the bitpack read as 0, and bitpack_bitbuf_finish() reports reading past
+ * the end once, when decoding is done.
+ *
+ *     bitpack_bitbuf_t b;
+ *
+ *     bitpack_bitbuf_init(&b, bp);
+ *     while (...) {
+ *         bitpack_bitbuf_refill(&b);
+ *         code = table[bitpack_bitbuf_peek(&b, 9)];
+ *         bitpack_bitbuf_consume(&b, code.len);
+ *         ...
+ *     }
+ *     if (!bitpack_bitbuf_finish(&b, bp)) ...
+ */
+
+#if defined(__GNUC__) || (defined(__STDC_VERSION__) && __STDC_VERSION__ >= 199901L)
+#define BITPACK_INLINE static inline
+#else
+#define BITPACK_INLINE static
+#endif
+
+/** The maximum number of bits that may be consumed between refills. */
+#define BITPACK_BITBUF_MAX_BITS 56
+
+/**
+ * The state of a bit buffer.  The members are private, use the
+ * bitpack_bitbuf_*() functions below.
+ */
+typedef struct
+{
+    uint64_t             acc;       /** buffered bits, the next bit is the high (MSB) or low (LSB) bit */
+    unsigned long        count;     /** number of bits in acc */
+    const unsigned char *data;      /** the bytes of the bitpack */
+    unsigned long        next;      /** index of the next byte to load into acc */
+    unsigned long        num_bytes; /** number of bytes of the bitpack */
+    unsigned long        size;      /** size of the bitpack in bits */
+    int                  lsb;       /** nonzero for BITPACK_LSB_FIRST order */
+} bitpack_bitbuf_t;
+
+/**
+ * @brief Top up a bit buffer.
+ *
+ * Loads bytes into the accumulator until it holds at least
+ * @c BITPACK_BITBUF_MAX_BITS bits.  Away from the end of the bitpack this
+ * is a single unaligned load with no branches.
+ *
+ * @param[in] b the bit buffer
+ */
+BITPACK_INLINE void bitpack_bitbuf_refill(bitpack_bitbuf_t *b)
+{
+    const unsigned char *p = b->data + b->next;
+    uint64_t             w;
+
+    if (b->next + 8 <= b->num_bytes) {
+        if (b->lsb) {
+            w = ((uint64_t)p[7] << 56) | ((uint64_t)p[6] << 48) |
+                ((uint64_t)p[5] << 40) | ((uint64_t)p[4] << 32) |
+                ((uint64_t)p[3] << 24) | ((uint64_t)p[2] << 16) |
+                ((uint64_t)p[1] << 8)  |  (uint64_t)p[0];
+            b->acc |= w << b->count;
+        }
+        else {
+            w = ((uint64_t)p[0] << 56) | ((uint64_t)p[1] << 48) |
+                ((uint64_t)p[2] << 40) | ((uint64_t)p[3] << 32) |
+                ((uint64_t)p[4] << 24) | ((uint64_t)p[5] << 16) |
+                ((uint64_t)p[6] << 8)  |  (uint64_t)p[7];
+            b->acc |= w >> b->count;
+        }
+
+        /* whole bytes that fit below the buffered bits */
+        b->next  += (63 - b->count) >> 3;
+        b->count |= 56;
+        return;
+    }
+
+    /* near the end, one byte at a time, with 0 bytes past the end */
+    while (b->count <= 56) {
+        w = b->next < b->num_bytes ? b->data[b->next] : 0;
+        b->acc   |= b->lsb ? w << b->count : w << (56 - b->count);
+        b->count += 8;
+        b->next++;
+    }
+}
+
+/**
+ * @brief Look at the next bits of a bit buffer without consuming them.
+ *
+ * @param[in] b the bit buffer
+ * @param[in] num_bits the number of bits, at most the number buffered
+ * @return the value of the next @c num_bits bits
+ */
+BITPACK_INLINE uint64_t bitpack_bitbuf_peek(const bitpack_bitbuf_t *b, unsigned long num_bits)
+{
+    if (b->lsb) {
+        return b->acc & (((uint64_t)1 << num_bits) - 1);
+    }
+
+    /* two shifts so that num_bits == 0 doesn't shift by 64 */
+    return (b->acc >> (63 - num_bits)) >> 1;
+}
+
+/**
+ * @brief Consume bits of a bit buffer.
+ *
+ * @param[in] b the bit buffer
+ * @param[in] num_bits the number of bits, at most the number buffered
+ */
+BITPACK_INLINE void bitpack_bitbuf_consume(bitpack_bitbuf_t *b, unsigned long num_bits)
+{
+    if (b->lsb) {
+        b->acc >>= num_bits;
+    }
+    else {
+        b->acc <<= num_bits;
+    }
+
+    b->count -= num_bits;
+}
+
+/**
+ * @brief Read bits from a bit buffer.
+ *
+ * Same as bitpack_bitbuf_peek() followed by bitpack_bitbuf_consume().
+ *
+ * @param[in] b the bit buffer
+ * @param[in] num_bits the number of bits, at most the number buffered
+ * @return the value of the bits read
+ */
+BITPACK_INLINE uint64_t bitpack_bitbuf_read(bitpack_bitbuf_t *b, unsigned long num_bits)
+{
+    uint64_t value = bitpack_bitbuf_peek(b, num_bits);
+
+    bitpack_bitbuf_consume(b, num_bits);
+
+    return value;
+}
+
+/**
+ * @brief Access the position of a bit buffer.
+ *
+ * @param[in] b the bit buffer
+ * @return the index of the next bit to read, which is past the end of the
+ * bitpack if the buffer has read past its end
+ */
+BITPACK_INLINE unsigned long bitpack_bitbuf_pos(const bitpack_bitbuf_t *b)
+{
+    return b->next * 8 - b->count;
+}
+
+/**
+ * @brief Bit buffer constructor.
+ *
+ * Starts reading the bitpack at its current read position (see
+ * bitpack_read_pos()), in its bit order.  The bitpack must not be modified
+ * until bitpack_bitbuf_finish() is called.
+ *
+ * @param[out] b the bit buffer
+ * @param[in]  bp the bitpack to read
+ */
+void bitpack_bitbuf_init(bitpack_bitbuf_t *b, bitpack_t bp);
+
+/**
+ * @brief Finish reading a bitpack with a bit buffer.
+ *
+ * Checks that the bit buffer did not read past the end of the bitpack and
+ * moves the read position of the bitpack to the position of the bit
+ * buffer.  Otherwise the read position is unchanged and the error is
+ * @c BITPACK_ERR_READ_PAST_END.
+ *
+ * @param[in] b the bit buffer
+ * @param[in] bp the bitpack the bit buffer was initialized with
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_bitbuf_finish(const bitpack_bitbuf_t *b, bitpack_t bp);
+
+/** The longest code length of a prefix code. */
+#define BITPACK_HUFFMAN_MAX_BITS 24
+
+/**
+ * @brief Prefix code constructor.
+ *
+ * Builds the canonical prefix code (as used by DEFLATE) for the code
+ * lengths of a set of symbols: codes are assigned in order of length, then
+ * of symbol, so the code lengths are all that need to be stored.  Symbols
+ * with a code length of 0 have no code.  The code may be incomplete, e.g.
+ * a single symbol with a 1 bit code.
+ *
+ * Decoding uses a primary table indexed by the next 10 bits (fewer if all
+ * codes are shorter), whose entries are either a symbol and its code length
+ * or a link to a secondary table for the longer codes sharing that prefix,
+ * so each symbol costs one or two table lookups.
+ *
+ * @param[in] lengths the code length of each symbol, 0 to
+ * @c BITPACK_HUFFMAN_MAX_BITS
+ * @param[in] num_symbols the number of symbols
+ * @return the newly allocated prefix code, or @c NULL if a code length is
+ * too long, the code lengths are oversubscribed, or memory allocation failed
+ */
+bitpack_huffman_t bitpack_huffman_compile(const unsigned char *lengths, unsigned long num_symbols);
+
+/**
+ * @brief Prefix code destructor.
+ *
+ * Frees the memory used by a prefix code.
+ *
+ * @param[in] h the prefix code
+ */
+void bitpack_huffman_destroy(bitpack_huffman_t h);
+
+/**
+ * @brief Append a symbol to the end of a bitpack object in a prefix code.
+ *
+ * Codes are bit strings, stored with their first bit at the lowest index in
+ * either bit order.  Fails with @c BITPACK_ERR_NOT_ENCODABLE if the symbol
+ * has no code.
+ *
+ * @param[in] bp the bitpack object
+ * @param[in] h the prefix code
+ * @param[in] symbol the symbol to pack
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_append_huffman(bitpack_t bp, bitpack_huffman_t h, unsigned long symbol);
+
+/**
+ * @brief Access a symbol in a prefix code at the current read position.
+ *
+ * Decodes a symbol and advances the read position past its code.  Fails
+ * with @c BITPACK_ERR_INVALID_CODE if the bits at the read position are not
+ * the code of any symbol.
+ *
+ * @param[in]  bp the bitpack object
+ * @param[in]  h the prefix code
+ * @param[out] symbol pointer to the location to write the decoded symbol to
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_read_huffman(bitpack_t bp, bitpack_huffman_t h, unsigned long *symbol);
+
+/**
+ * @brief Append an array of symbols to the end of a bitpack object in a
+ * prefix code.
+ *
+ * Same as calling bitpack_append_huffman() for each of the @c n symbols,
+ * except that the bitpack object is resized once and, if any symbol has no
+ * code, nothing is written.
+ *
+ * @param[in] bp the bitpack object
+ * @param[in] h the prefix code
+ * @param[in] symbols the symbols to pack
+ * @param[in] n the number of symbols
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_append_huffman_array(bitpack_t bp, bitpack_huffman_t h,
+        const unsigned long *symbols, unsigned long n);
+
+/**
+ * @brief Access an array of symbols in a prefix code at the current read
+ * position.
+ *
+ * Decodes @c n symbols into @c symbols through a bit buffer (see
+ * bitpack_bitbuf_init()).  On failure the read position is unchanged, but
+ * @c symbols may have been partially written.
+ *
+ * @param[in]  bp the bitpack object
+ * @param[in]  h the prefix code
+ * @param[out] symbols buffer to write the decoded symbols to
+ * @param[in]  n the number of symbols
+ * @return @c BITPACK_RV_SUCCESS on success, @c BITPACK_RV_ERROR on failure
+ */
+int bitpack_read_huffman_array(bitpack_t bp, bitpack_huffman_t h,
+        unsigned long *symbols, unsigned long n);
 
 #endif
 
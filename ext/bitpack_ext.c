@@ -5,29 +5,200 @@
  /* the BitPack class object */
 static VALUE cBitPack;
 
+/* the BitPack::Schema class object */
+static VALUE cSchema;
+
+/* the BitPack::Reader class object */
+static VALUE cReader;
+
+/* the BitPack::Writer class object */
+static VALUE cWriter;
+
+/* the BitPack::Huffman class object */
+static VALUE cHuffman;
+
 /* mapping of BitPack error codes to ruby exceptions */
-static VALUE bp_exceptions[6];
+static VALUE bp_exceptions[BITPACK_ERR_IO_FAILED + 1];
+
+/*
+ * strings shorter than this are copied by BitPack.view instead of being
+ * referenced, since small strings may be embedded in (and move with) their
+ * String object
+ */
+#define BP_VIEW_MIN_BYTES 1024
+
+/*
+ * maximum width of the length field of a :varbytes schema field, which
+ * bounds the size of the scratch record buffer
+ */
+#define BP_SCHEMA_MAX_LEN_BITS 16
+
+/*
+ * first chunk of BitPack::Reader#read_bytes, which reads in doubling chunks
+ * so that the String only grows as the stream turns out to hold the bytes
+ */
+#define BP_READER_MIN_CHUNK 65536
+
+/*
+ * A compiled BitPack::Schema.  Ruby records are packed through a scratch C
+ * record with an 8 byte slot for each integer field and an inline buffer
+ * for each byte run.
+ */
+typedef struct {
+    bitpack_schema_t  schema;       /* the compiled schema */
+    unsigned long     num_fields;   /* number of fields */
+    bitpack_field_t  *fields;       /* field descriptors of the scratch record */
+    unsigned char    *record;       /* the scratch record */
+} bp_schema_t;
+
+/*
+ * raise TypeError unless obj is a klass, since Data_Get_Struct() takes the
+ * data of any wrapped object
+ */
+static void bp_check_class(VALUE obj, VALUE klass)
+{
+    if (!rb_obj_is_kind_of(obj, klass)) {
+        rb_raise(rb_eTypeError, "wrong argument type %s (expected %s)",
+                rb_obj_classname(obj), rb_class2name(klass));
+    }
+}
+
+/* number of unsigned long words needed to hold num_bits bits */
+#define BP_NUM_WORDS(num_bits) (((num_bits) + sizeof(unsigned long) * 8 - 1) / (sizeof(unsigned long) * 8))
+
+/*
+ * Pack the Ruby Integer value into num_bits bits at index.  Ranges that fit
+ * in an unsigned long go through bitpack_set_bits(), wider ones are
+ * converted with rb_big_pack() for bitpack_set_wide_bits(), which fills the
+ * rest of the range past the words of the value with 0s.
+ */
+static void bp_set_integer(bitpack_t bp, VALUE value, unsigned long num_bits, unsigned long index)
+{
+    unsigned long *words;
+    unsigned long  num_words;
+    unsigned long  value_bits;
+    int            rv;
+    VALUE          tmp;
+
+    if (num_bits <= sizeof(unsigned long) * 8) {
+        rv = bitpack_set_bits(bp, NUM2ULONG(value), num_bits, index);
+    }
+    else {
+        value = rb_to_int(value);
+
+        if (FIXNUM_P(value) ? FIX2LONG(value) < 0 : RBIGNUM_NEGATIVE_P(value)) {
+            rb_raise(bp_exceptions[BITPACK_ERR_VALUE_TOO_BIG],
+                    "negative value does not fit in %lu bits", num_bits);
+        }
+
+        value_bits = rb_absint_numwords(value, 1, NULL);
+
+        if (value_bits > num_bits) {
+            rb_raise(bp_exceptions[BITPACK_ERR_WIDE_VALUE_TOO_BIG],
+                    "value of %lu bits does not fit in %lu bits", value_bits, num_bits);
+        }
+
+        num_words = BP_NUM_WORDS(value_bits) + 1;
+        words     = ALLOCV_N(unsigned long, tmp, num_words);
+
+        rb_big_pack(value, words, num_words);
+        rv = bitpack_set_wide_bits(bp, words, num_words, num_bits, index);
+
+        ALLOCV_END(tmp);
+    }
+
+    if (!rv) {
+        rb_raise(bp_exceptions[bitpack_get_error(bp)],
+                "%s", bitpack_get_error_str(bp));
+    }
+}
+
+/*
+ * Unpack num_bits bits at index, or at the read position if advance is set,
+ * as a Ruby Integer.  Ranges wider than an unsigned long are converted with
+ * rb_big_unpack().
+ */
+static VALUE bp_get_integer(bitpack_t bp, unsigned long num_bits, unsigned long index, int advance)
+{
+    unsigned long *words;
+    unsigned long  num_words;
+    unsigned long  value;
+    VALUE          result;
+    VALUE          tmp;
+    int            rv;
+
+    if (num_bits <= sizeof(unsigned long) * 8) {
+        if (advance) {
+            rv = bitpack_read_bits(bp, num_bits, &value);
+        }
+        else {
+            rv = bitpack_get_bits(bp, num_bits, index, &value);
+        }
+
+        result = ULONG2NUM(value);
+    }
+    else {
+        /* a range longer than the bitpack fails before the words are touched */
+        num_words = num_bits > bitpack_size(bp) ? 0 : BP_NUM_WORDS(num_bits) + 1;
+
+        /* one extra 0 word, rb_big_unpack() reads two's complement */
+        words = ALLOCV_N(unsigned long, tmp, num_words);
+
+        if (advance) {
+            rv = bitpack_read_wide_bits(bp, num_bits, words, num_words);
+        }
+        else {
+            rv = bitpack_get_wide_bits(bp, num_bits, index, words, num_words);
+        }
+
+        result = rv ? rb_big_unpack(words, num_words) : Qnil;
+
+        ALLOCV_END(tmp);
+    }
+
+    if (!rv) {
+        rb_raise(bp_exceptions[bitpack_get_error(bp)],
+                "%s", bitpack_get_error_str(bp));
+    }
+
+    return result;
+}
+
+/* map a bit order Symbol, :msb or :lsb, to its bitpack_order_t */
+static bitpack_order_t bp_order(VALUE name)
+{
+    ID id = SYM2ID(name);
+
+    if (id == rb_intern("msb")) return BITPACK_MSB_FIRST;
+    if (id == rb_intern("lsb")) return BITPACK_LSB_FIRST;
+
+    rb_raise(rb_eArgError, "unknown bit order :%s", rb_id2name(id));
+
+    return BITPACK_MSB_FIRST;
+}
 
 /*
  * call-seq:
- *   BitPack.new    -> a new BitPack object
- *   BitPack.new(n) -> a new BitPack object
+ *   BitPack.new           -> a new BitPack object
+ *   BitPack.new(n)        -> a new BitPack object
+ *   BitPack.new(n, order) -> a new BitPack object
  *
  * Creates a new BitPack object.  The number of bytes used internally
- * to store the bit string can optionally be set to +n+.
+ * to store the bit string can optionally be set to +n+.  The bit order,
+ * :msb (the default) or :lsb, can optionally be set to +order+, see
+ * BitPack#order=.
  *
  */
 static VALUE bp_new(int argc, VALUE *argv, VALUE class)
 {
     VALUE     bp_obj;
+    VALUE     num_bytes, order;
     bitpack_t bp;
 
-    if (argc == 0) {
-        bp = bitpack_init_default();
-    }
-    else {
-        bp = bitpack_init(NUM2ULONG(argv[0]));
-    }
+    rb_scan_args(argc, argv, "02", &num_bytes, &order);
+
+    bp = bitpack_init_order(NIL_P(num_bytes) ? BITPACK_DEFAULT_MEM_SIZE : NUM2ULONG(num_bytes),
+                            NIL_P(order) ? BITPACK_MSB_FIRST : bp_order(order));
 
     if (bp == NULL) {
         rb_raise(bp_exceptions[BITPACK_ERR_MALLOC_FAILED], "malloc() failed");
@@ -75,6 +246,186 @@ static VALUE bp_from_bytes(VALUE class, VALUE bytes_str)
     return bp_obj;
 }
 
+/*
+ * call-seq:
+ *   BitPack.from_bin(string) -> a new BitPack object
+ *
+ * Creates a new BitPack object from a String of 1s and 0s, such as the
+ * one returned by BitPack#to_bin.  Raises ArgumentError if +string+
+ * contains any other character.
+ *
+ * === Example
+ *
+ *   >> bp = BitPack.from_bin("0111001001110101")
+ *   => 0111001001110101
+ *   >> bp.to_bytes
+ *   => "ru"
+ */
+static VALUE bp_from_bin(VALUE class, VALUE bin_str)
+{
+    VALUE     bp_obj;
+    bitpack_t bp;
+
+    bp = bitpack_init_from_bin(StringValueCStr(bin_str));
+
+    if (bp == NULL) {
+        rb_raise(rb_eArgError, "invalid binary string");
+    }
+
+    bp_obj = Data_Wrap_Struct(class, 0, bitpack_destroy, bp);
+
+    return bp_obj;
+}
+
+/*
+ * call-seq:
+ *   BitPack.from_hex(string) -> a new BitPack object
+ *
+ * Creates a new BitPack object from a String of hex digits, such as the
+ * one returned by BitPack#to_hex.  Each digit adds 4 bits.  Raises
+ * ArgumentError if +string+ contains any other character.
+ *
+ * === Example
+ *
+ *   >> bp = BitPack.from_hex("7275627")
+ *   => 0111001001110101011000100111
+ *   >> bp.size
+ *   => 28
+ */
+static VALUE bp_from_hex(VALUE class, VALUE hex_str)
+{
+    VALUE     bp_obj;
+    bitpack_t bp;
+
+    bp = bitpack_init_from_hex(StringValueCStr(hex_str));
+
+    if (bp == NULL) {
+        rb_raise(rb_eArgError, "invalid hex string");
+    }
+
+    bp_obj = Data_Wrap_Struct(class, 0, bitpack_destroy, bp);
+
+    return bp_obj;
+}
+
+/*
+ * call-seq:
+ *   BitPack.view(string) -> a new read-only BitPack object
+ *
+ * Creates a new BitPack object that reads directly from the contents of
+ * +string+ without copying them.  A frozen reference to +string+ is kept
+ * for the lifetime of the BitPack object, so later changes to +string+
+ * are not seen by it.
+ *
+ * The returned BitPack object supports all of the methods that access or
+ * read bits, but raises RuntimeError from methods that would modify it.
+ * Strings shorter than 1 KB are copied, as with BitPack.from_bytes, but the
+ * copy is read-only all the same.
+ *
+ * === Example
+ *
+ *   >> bp = BitPack.view("ruby" * 1024)
+ *   >> bp.read_bytes(4)
+ *   => "ruby"
+ *   >> bp.read_only?
+ *   => true
+ */
+static VALUE bp_view(VALUE class, VALUE bytes_str)
+{
+    VALUE     bp_obj;
+    VALUE     str;
+    bitpack_t bp;
+
+    str = StringValue(bytes_str);
+
+    if (RSTRING_LEN(str) < BP_VIEW_MIN_BYTES) {
+        bp_obj = bp_from_bytes(class, str);
+
+        Data_Get_Struct(bp_obj, struct _bitpack_t, bp);
+        bitpack_set_read_only(bp);
+
+        return bp_obj;
+    }
+
+    str = rb_str_new_frozen(str);
+
+    bp = bitpack_view_init((unsigned char *)RSTRING_PTR(str), RSTRING_LEN(str) * 8);
+
+    if (bp == NULL) {
+        rb_raise(bp_exceptions[BITPACK_ERR_MALLOC_FAILED], "malloc() failed");
+    }
+
+    bp_obj = Data_Wrap_Struct(class, 0, bitpack_destroy, bp);
+
+    /* hidden instance variable that keeps the viewed string alive */
+    rb_ivar_set(bp_obj, rb_intern("__view_source__"), str);
+
+    return bp_obj;
+}
+
+/*
+ * call-seq:
+ *   bp.order -> :msb or :lsb
+ *
+ * Returns the bit order of the BitPack object, see BitPack#order=.
+ */
+static VALUE bp_get_order(VALUE self)
+{
+    bitpack_t bp;
+
+    Data_Get_Struct(self, struct _bitpack_t, bp);
+
+    return ID2SYM(rb_intern(bitpack_get_order(bp) == BITPACK_LSB_FIRST ? "lsb" : "msb"));
+}
+
+/*
+ * call-seq:
+ *   bp.order = order
+ *
+ * Sets the bit order of the BitPack object.  With :msb, the default, bit 0
+ * is the high bit of the first byte and values are packed most significant
+ * bit first.  With :lsb, as in DEFLATE streams, bit 0 is the low bit of
+ * the first byte and values are packed least significant bit first.  The
+ * bytes are not changed, just interpreted in the new order.
+ *
+ * === Example
+ *
+ *   >> bp = BitPack.from_bytes("\x03")
+ *   => 00000011
+ *   >> bp.order = :lsb
+ *   => :lsb
+ *   >> bp.read_bits(1)
+ *   => 1
+ *   >> bp.read_bits(2)
+ *   => 1
+ */
+static VALUE bp_set_order(VALUE self, VALUE order)
+{
+    bitpack_t bp;
+
+    Data_Get_Struct(self, struct _bitpack_t, bp);
+
+    bitpack_set_order(bp, bp_order(order));
+
+    return order;
+}
+
+/*
+ * call-seq:
+ *   bp.read_only? -> true or false
+ *
+ * Returns +true+ if the BitPack object was created by BitPack.view and so
+ * is read-only.
+ */
+static VALUE bp_read_only(VALUE self)
+{
+    bitpack_t bp;
+
+    Data_Get_Struct(self, struct _bitpack_t, bp);
+
+    return bitpack_read_only(bp) ? Qtrue : Qfalse;
+}
+
 /*
  * call-seq:
  *   bp.size -> Integer
@@ -112,6 +463,58 @@ static VALUE bp_data_size(VALUE self)
     return ULONG2NUM(data_size);
 }
 
+/*
+ * call-seq:
+ *   bp.reserve(num_bits) -> self
+ *
+ * Makes sure enough memory is allocated to hold +num_bits+ bits, so that
+ * the BitPack object can grow to that size without allocating again.  The
+ * size of the BitPack object is not changed.
+ *
+ * === Example
+ *
+ *   >> bp = BitPack.new
+ *   => 
+ *   >> bp.reserve(1000)
+ *   => 
+ *   >> bp.data_size
+ *   => 125
+ */
+static VALUE bp_reserve(VALUE self, VALUE num_bits)
+{
+    bitpack_t bp;
+
+    Data_Get_Struct(self, struct _bitpack_t, bp);
+
+    if (!bitpack_reserve(bp, NUM2ULONG(num_bits))) {
+        rb_raise(bp_exceptions[bitpack_get_error(bp)],
+                "%s", bitpack_get_error_str(bp));
+    }
+
+    return self;
+}
+
+/*
+ * call-seq:
+ *   bp.shrink_to_fit -> self
+ *
+ * Releases any memory allocated to the BitPack object beyond what is
+ * needed to hold its current size.
+ */
+static VALUE bp_shrink_to_fit(VALUE self)
+{
+    bitpack_t bp;
+
+    Data_Get_Struct(self, struct _bitpack_t, bp);
+
+    if (!bitpack_shrink_to_fit(bp)) {
+        rb_raise(bp_exceptions[bitpack_get_error(bp)],
+                "%s", bitpack_get_error_str(bp));
+    }
+
+    return self;
+}
+
 /*
  * call-seq:
  *   bp.read_pos -> Integer
@@ -239,187 +642,146 @@ static VALUE bp_get(VALUE self, VALUE index)
 
 /*
  * call-seq:
- *   bp.set_bits(value, num_bits, i) -> self
+ *   bp.rank(i) -> Integer
  *
- * Sets the specified range of bits in a BitPack object.
- *
- * Packs the Integer +value+ into +num_bits+ bits starting at index
- * +i+.  The number of bits required to represent +value+ is checked
- * against the size of the range.  If <tt>i + num_bits</tt> is greater
- * than the current size of the BitPack, then the size is adjusted
- * appropriately.
+ * Returns the number of set bits before index +i+, which may be the size
+ * of the BitPack object.  Uses an index that is built on the first call
+ * after the BitPack object is changed, so later calls take constant time.
  *
  * === Example
  *
- *   >> bp = BitPack.new
- *   => 
- *   >> bp.set_bits(0xff, 8, 0)
- *   => 11111111
- *   >> bp.set_bits(0xaa, 8, 8)
- *   => 1111111110101010
+ *   >> bp = BitPack.from_bin("0110100")
+ *   => 0110100
+ *   >> bp.rank(4)
+ *   => 2
  */
-static VALUE bp_set_bits(VALUE self, VALUE value, VALUE num_bits, VALUE index)
+static VALUE bp_rank(VALUE self, VALUE index)
 {
-    bitpack_t bp;
+    bitpack_t     bp;
+    unsigned long count;
 
     Data_Get_Struct(self, struct _bitpack_t, bp);
 
-    if (!bitpack_set_bits(bp, NUM2ULONG(value), NUM2ULONG(num_bits), NUM2ULONG(index))) {
+    if (!bitpack_rank(bp, NUM2ULONG(index), &count)) {
         rb_raise(bp_exceptions[bitpack_get_error(bp)],
                 "%s", bitpack_get_error_str(bp));
     }
 
-    return self;
+    return ULONG2NUM(count);
 }
 
 /*
  * call-seq:
- *   bp.set_bytes(string, i)
- *
- * Sets the specified range of bytes in a BitPack object.
+ *   bp.select(n) -> Integer
  *
- * Packs +string+ into the BitPack object starting at index +i+.  The
- * size of the BitPack object is adjusted appropriately if necessary.
+ * Returns the index of the set bit with +n+ set bits before it, using the
+ * same index as BitPack#rank.  Raises RangeError if there are +n+ or fewer
+ * set bits.
  *
  * === Example
  *
- *   >> bp = BitPack.new
- *   => 
- *   >> bp.set_bytes("ruby", 0)
- *   => 01110010011101010110001001111001
- *   >> 4.times { p bp.read_bits(8).chr }
- *   "r"
- *   "u"
- *   "b"
- *   "y"
+ *   >> bp = BitPack.from_bin("0110100")
+ *   => 0110100
+ *   >> bp.select(2)
  *   => 4
  */
-static VALUE bp_set_bytes(VALUE self, VALUE bytes, VALUE index)
+static VALUE bp_select(VALUE self, VALUE n)
 {
-    bitpack_t bp;
-    VALUE     str;
+    bitpack_t     bp;
+    unsigned long index;
 
     Data_Get_Struct(self, struct _bitpack_t, bp);
 
-    str = StringValue(bytes);
-
-    if (!bitpack_set_bytes(bp, (unsigned char *)RSTRING_PTR(str),
-          RSTRING_LEN(str), NUM2ULONG(index))) {
+    if (!bitpack_select(bp, NUM2ULONG(n), &index)) {
         rb_raise(bp_exceptions[bitpack_get_error(bp)],
                 "%s", bitpack_get_error_str(bp));
     }
 
-    return self;
+    return ULONG2NUM(index);
 }
 
 /*
  * call-seq:
- *   bp.get_bits(num_bits, i) -> Integer
- *
- * Access the value stored in a range of bits starting at index +i+.
+ *   bp.fill_range(i, n, bit) -> self
  *
- * Unpacks +num_bits+ starting from index +i+ and returns the Integer
- * value.
+ * Sets the +n+ bits starting at index +i+ to +bit+, 0 or 1.  The size of
+ * the BitPack object is expanded if the range goes past its end.
  *
  * === Example
  *
- *   >> bp = BitPack.new
- *   => 
- *   >> bp.append_bits(1, 4)
- *   => 0001
- *   >> bp.append_bits(2, 4)
- *   => 00010010
- *   >> bp.append_bits(3, 4)
- *   => 000100100011
- *   >> bp.append_bits(4, 4)
- *   => 0001001000110100
- *   >> bp.get_bits(4, 0)
- *   => 1
- *   >> bp.get_bits(4, 4)
- *   => 2
- *   >> bp.get_bits(4, 8)
- *   => 3
- *   >> bp.get_bits(4, 12)
- *   => 4
+ *   >> bp = BitPack.from_bin("0000")
+ *   => 0000
+ *   >> bp.fill_range(1, 5, 1)
+ *   => 011111
  */
-static VALUE bp_get_bits(VALUE self, VALUE num_bits, VALUE index)
+static VALUE bp_fill_range(VALUE self, VALUE index, VALUE num_bits, VALUE bit)
 {
-    bitpack_t     bp;
-    unsigned long value;
+    bitpack_t bp;
 
     Data_Get_Struct(self, struct _bitpack_t, bp);
 
-    if (!bitpack_get_bits(bp, NUM2ULONG(num_bits), NUM2ULONG(index), &value)) {
+    if (!bitpack_fill_range(bp, NUM2ULONG(index), NUM2ULONG(num_bits), NUM2ULONG(bit) != 0)) {
         rb_raise(bp_exceptions[bitpack_get_error(bp)],
                 "%s", bitpack_get_error_str(bp));
     }
 
-    return ULONG2NUM(value);
+    return self;
 }
 
 /*
  * call-seq:
- *   bp.get_bytes(num_bytes, i) -> String
- *
- * Access the value stored in a range of bytes starting at index +i+.
+ *   bp.copy_range(i, src, src_i, n) -> self
  *
- * Unpacks +num_bytes+ starting from bit index +i+ and returns the String
- * value.
+ * Copies the +n+ bits of the BitPack object +src+ starting at index
+ * +src_i+ to this one starting at index +i+.  +src+ may be +bp+ itself,
+ * even if the ranges overlap.  The size of the BitPack object is expanded
+ * if the range goes past its end.
  *
  * === Example
  *
- *   >> bp =  BitPack.from_bytes("foobar")
- *   => 011001100110111101101111011000100110000101110010
- *   >> bp.get_bytes(3, 24)
- *   => "bar"
+ *   >> bp = BitPack.from_bin("110000")
+ *   => 110000
+ *   >> bp.copy_range(3, bp, 0, 3)
+ *   => 110110
  */
-static VALUE bp_get_bytes(VALUE self, VALUE num_bytes, VALUE index)
+static VALUE bp_copy_range(VALUE self, VALUE index, VALUE src_obj, VALUE src_index, VALUE num_bits)
 {
-    bitpack_t      bp;
-    unsigned char *bytes;
-    VALUE          str;
+    bitpack_t bp, src;
 
     Data_Get_Struct(self, struct _bitpack_t, bp);
+    bp_check_class(src_obj, cBitPack);
+    Data_Get_Struct(src_obj, struct _bitpack_t, src);
 
-    if (!bitpack_get_bytes(bp, NUM2ULONG(num_bytes), NUM2ULONG(index), &bytes)) {
+    if (!bitpack_copy_range(bp, NUM2ULONG(index), src, NUM2ULONG(src_index), NUM2ULONG(num_bits))) {
         rb_raise(bp_exceptions[bitpack_get_error(bp)],
                 "%s", bitpack_get_error_str(bp));
     }
 
-    str = rb_str_new((char *)bytes, NUM2ULONG(num_bytes));
-
-    free(bytes);
-
-    return str;
+    return self;
 }
 
 /*
  * call-seq:
- *   bp.append_bits(value, num_bits)
- *
- * Append the Integer +value+ to the end of a BitPack object.
+ *   bp.insert_bits(value, num_bits, i) -> self
  *
- * Packs +num_bits+ bits at the end of a BitPack object.  The size of
- * the BitPack object is increased by +num_bits+ as a result.
+ * Packs the Integer +value+ into +num_bits+ bits, as BitPack#set_bits
+ * does, and inserts them before the bit at index +i+.  The bits from
+ * index +i+ on move up by +num_bits+.
  *
  * === Example
  *
- *   >> bp = BitPack.new
- *   => 
- *   >> bp.append_bits(1, 3)
- *   => 001
- *   >> bp.append_bits(3, 3)
- *   => 001011
- *   >> bp.append_bits(7, 3)
- *   => 001011111
+ *   >> bp = BitPack.from_bin("1111")
+ *   => 1111
+ *   >> bp.insert_bits(2, 3, 2)
+ *   => 1101011
  */
-static VALUE bp_append_bits(VALUE self, VALUE value, VALUE num_bits)
+static VALUE bp_insert_bits(VALUE self, VALUE value, VALUE num_bits, VALUE index)
 {
     bitpack_t bp;
 
     Data_Get_Struct(self, struct _bitpack_t, bp);
 
-    if (!bitpack_append_bits(bp, NUM2ULONG(value), NUM2ULONG(num_bits))) {
+    if (!bitpack_insert_bits(bp, NUM2ULONG(value), NUM2ULONG(num_bits), NUM2ULONG(index))) {
         rb_raise(bp_exceptions[bitpack_get_error(bp)],
                 "%s", bitpack_get_error_str(bp));
     }
@@ -429,42 +791,25 @@ static VALUE bp_append_bits(VALUE self, VALUE value, VALUE num_bits)
 
 /*
  * call-seq:
- *   bp.append_bytes(string)
- *
- * Append +string+ to the end of a BitPack object.
+ *   bp.delete_range(i, n) -> self
  *
- * Packs +string+ at the end of a BitPack object.  The size of the
- * BitPack object is increased by the length of +string+ as a result.
+ * Removes the +n+ bits starting at index +i+.  The bits after them move
+ * down by +n+.
  *
  * === Example
  *
- *   >> bp = BitPack.new
- *   => 
- *   >> bp.append_bytes("bit")
- *   => 011000100110100101110100
- *   >> bp.append_bytes("pack")
- *   => 01100010011010010111010001110000011000010110001101101011
- *   >> 7.times { p bp.read_bits(8).chr }
- *   "b"
- *   "i"
- *   "t"
- *   "p"
- *   "a"
- *   "c"
- *   "k"
- *   => 7
+ *   >> bp = BitPack.from_bin("1101011")
+ *   => 1101011
+ *   >> bp.delete_range(1, 4)
+ *   => 111
  */
-static VALUE bp_append_bytes(VALUE self, VALUE value)
+static VALUE bp_delete_range(VALUE self, VALUE index, VALUE num_bits)
 {
     bitpack_t bp;
-    VALUE     str;
 
     Data_Get_Struct(self, struct _bitpack_t, bp);
 
-    str = StringValue(value);
-
-    if (!bitpack_append_bytes(bp, (unsigned char *)RSTRING_PTR(str),
-          RSTRING_LEN(str))) {
+    if (!bitpack_delete_range(bp, NUM2ULONG(index), NUM2ULONG(num_bits))) {
         rb_raise(bp_exceptions[bitpack_get_error(bp)],
                 "%s", bitpack_get_error_str(bp));
     }
@@ -474,148 +819,2128 @@ static VALUE bp_append_bytes(VALUE self, VALUE value)
 
 /*
  * call-seq:
- *   bp.read_bits(num_bits) -> Integer
- *
- * Access the value of a range of bits at the current read position.
+ *   bp.shift_left(n) -> self
  *
- * Unpacks +num_bits+ bits starting at the current read position (see
- * Bitpack#read_pos) and returns the integer value.  The current read
- * position is advanced by +num_bits+ bits.
+ * Moves every bit +n+ places towards index 0, dropping the first +n+ bits
+ * and setting the last +n+ bits to 0.  The size is unchanged.
  *
  * === Example
  *
- *   >> bp = BitPack.from_bytes("ruby")
- *   => 01110010011101010110001001111001
- *   >> 4.times { p bp.read_bits(8).chr }
- *   "r"
- *   "u"
- *   "b"
- *   "y"
- *   => 4
+ *   >> bp = BitPack.from_bin("110101")
+ *   => 110101
+ *   >> bp.shift_left(2)
+ *   => 010100
  */
-static VALUE bp_read_bits(VALUE self, VALUE num_bits)
+static VALUE bp_shift_left(VALUE self, VALUE n)
 {
-    bitpack_t     bp;
-    unsigned long value;
+    bitpack_t bp;
 
     Data_Get_Struct(self, struct _bitpack_t, bp);
 
-    if (!bitpack_read_bits(bp, NUM2ULONG(num_bits), &value)) {
+    if (!bitpack_shift_left(bp, NUM2ULONG(n))) {
         rb_raise(bp_exceptions[bitpack_get_error(bp)],
                 "%s", bitpack_get_error_str(bp));
     }
 
-    return ULONG2NUM(value);
+    return self;
 }
 
 /*
  * call-seq:
- *   bp.read_bytes(num_bytes) -> String
- *
- * Access the value of a range of bytes at the current read position.
+ *   bp.shift_right(n) -> self
  *
- * Unpacks +num_bytes+ bytes starting at the current read position (see
- * Bitpack#read_pos) and returns the String value.  The current read
- * position is advanced by <tt>num_bytes * 8</tt> bits.
+ * Moves every bit +n+ places away from index 0, dropping the last +n+
+ * bits and setting the first +n+ bits to 0.  The size is unchanged.
  *
  * === Example
  *
- *   >> bp = BitPack.from_bytes("foobar")
- *   => 011001100110111101101111011000100110000101110010
- *   >> bp.read_bytes(3)
- *   => "foo"
- *   >> bp.read_bytes(3)
- *   => "bar"
+ *   >> bp = BitPack.from_bin("110101")
+ *   => 110101
+ *   >> bp.shift_right(2)
+ *   => 001101
  */
-static VALUE bp_read_bytes(VALUE self, VALUE num_bytes)
+static VALUE bp_shift_right(VALUE self, VALUE n)
 {
-    bitpack_t      bp;
-    unsigned char *value;
-    VALUE          str;
+    bitpack_t bp;
 
     Data_Get_Struct(self, struct _bitpack_t, bp);
 
-    if (!bitpack_read_bytes(bp, NUM2ULONG(num_bytes), &value)) {
+    if (!bitpack_shift_right(bp, NUM2ULONG(n))) {
         rb_raise(bp_exceptions[bitpack_get_error(bp)],
                 "%s", bitpack_get_error_str(bp));
     }
 
-    str = rb_str_new((char *)value, NUM2ULONG(num_bytes));
-
-    free(value);
-
-    return str;
+    return self;
 }
 
 /*
  * call-seq:
- *   bp.to_bin -> String
+ *   bp.count       -> Integer
+ *   bp.count(i)    -> Integer
+ *   bp.count(i, n) -> Integer
  *
- * Converts the BitPack object to a string of 1s and 0s.
+ * Returns the number of set bits in the BitPack object, from index +i+
+ * on, or in the +n+ bits starting at index +i+.
+ *
+ * === Example
+ *
+ *   >> bp = BitPack.from_bin("0110100")
+ *   => 0110100
+ *   >> bp.count
+ *   => 3
+ *   >> bp.count(2, 3)
+ *   => 2
  */
-static VALUE bp_to_bin(VALUE self)
+static VALUE bp_count(int argc, VALUE *argv, VALUE self)
 {
-    bitpack_t  bp;
-    char      *s;
-    VALUE      str;
+    bitpack_t     bp;
+    VALUE         index, num_bits;
+    unsigned long i = 0;
+    unsigned long n, count;
 
     Data_Get_Struct(self, struct _bitpack_t, bp);
 
-    if (!bitpack_to_bin(bp, &s)) {
-        rb_raise(bp_exceptions[bitpack_get_error(bp)],
-                "%s", bitpack_get_error_str(bp));
+    rb_scan_args(argc, argv, "02", &index, &num_bits);
+
+    if (!NIL_P(index)) {
+        i = NUM2ULONG(index);
     }
 
-    str = rb_str_new2(s);
+    n = NIL_P(num_bits) ? bitpack_size(bp) - i : NUM2ULONG(num_bits);
 
-    free(s);
+    if (!bitpack_popcount(bp, i, n, &count)) {
+        rb_raise(bp_exceptions[bitpack_get_error(bp)],
+                "%s", bitpack_get_error_str(bp));
+    }
 
-    return str;
+    return ULONG2NUM(count);
 }
 
 /*
  * call-seq:
- *   bp.to_bytes -> String
+ *   bp.next_set    -> Integer or nil
+ *   bp.next_set(i) -> Integer or nil
  *
- * Converts the BitPack object to a string of bytes.  If the current
- * size of the BitPack object is not a multiple of 8, the last byte
- * in the returned String will be padded with the appropriate number
- * of 0 bits.
+ * Returns the index of the first set bit at or after index +i+, or at or
+ * after the start if +i+ is not given, or nil if there is none.
  *
  * === Example
  *
- *   >> bp = BitPack.new
- *   => 
- *   >> bp.append_bits(?r, 8)
- *   => 01110010
- *   >> bp.append_bits(?u, 8)
- *   => 0111001001110101
- *   >> bp.append_bits(?b, 8)
- *   => 011100100111010101100010
- *   >> bp.append_bits(?y, 8)
- *   => 01110010011101010110001001111001
- *   >> bp.to_bytes
- *   => "ruby"
+ *   >> bp = BitPack.from_bin("0110100")
+ *   => 0110100
+ *   >> bp.next_set(3)
+ *   => 4
+ *   >> bp.next_set(5)
+ *   => nil
  */
-static VALUE bp_to_bytes(VALUE self)
+static VALUE bp_next_set(int argc, VALUE *argv, VALUE self)
 {
-    bitpack_t      bp;
-    unsigned char *s;
-    unsigned long  num_bytes;
-    VALUE          str;
+    bitpack_t     bp;
+    VALUE         from;
+    unsigned long index;
 
     Data_Get_Struct(self, struct _bitpack_t, bp);
 
-    if (!bitpack_to_bytes(bp, &s, &num_bytes)) {
+    rb_scan_args(argc, argv, "01", &from);
+
+    if (!bitpack_find_next_set(bp, NIL_P(from) ? 0 : NUM2ULONG(from), &index)) {
         rb_raise(bp_exceptions[bitpack_get_error(bp)],
                 "%s", bitpack_get_error_str(bp));
     }
 
-    str = rb_str_new((char *)s, num_bytes);
+    return index < bitpack_size(bp) ? ULONG2NUM(index) : Qnil;
+}
 
-    free(s);
+/*
+ * call-seq:
+ *   bp.each_set_bit { |i| block } -> bp
+ *   bp.each_set_bit               -> an Enumerator
+ *
+ * Calls the block with the index of each set bit in turn.
+ *
+ * === Example
+ *
+ *   >> BitPack.from_bin("0110100").each_set_bit.to_a
+ *   => [1, 2, 4]
+ */
+static VALUE bp_each_set_bit(VALUE self)
+{
+    bitpack_t     bp;
+    unsigned long index = 0;
 
-    return str;
+    RETURN_ENUMERATOR(self, 0, 0);
+
+    Data_Get_Struct(self, struct _bitpack_t, bp);
+
+    /* the block may change the size, so stop at the first index past it */
+    while (index <= bitpack_size(bp) && bitpack_find_next_set(bp, index, &index) &&
+           index < bitpack_size(bp)) {
+        rb_yield(ULONG2NUM(index));
+        index++;
+    }
+
+    return self;
+}
+
+/* a new BitPack object holding self op other, in the bit order of self */
+static VALUE bp_bitop(VALUE self, VALUE other, bitpack_op_t op)
+{
+    bitpack_t a, b, dst;
+    VALUE     dst_obj;
+
+    Data_Get_Struct(self, struct _bitpack_t, a);
+    bp_check_class(other, cBitPack);
+    Data_Get_Struct(other, struct _bitpack_t, b);
+
+    dst = bitpack_init_order(BITPACK_DEFAULT_MEM_SIZE, bitpack_get_order(a));
+
+    if (dst == NULL) {
+        rb_raise(bp_exceptions[BITPACK_ERR_MALLOC_FAILED], "malloc() failed");
+    }
+
+    dst_obj = Data_Wrap_Struct(cBitPack, 0, bitpack_destroy, dst);
+
+    if (!bitpack_bitop(dst, a, b, op)) {
+        rb_raise(bp_exceptions[bitpack_get_error(dst)],
+                "%s", bitpack_get_error_str(dst));
+    }
+
+    return dst_obj;
+}
+
+/*
+ * call-seq:
+ *   bp & other -> a new BitPack object
+ *
+ * Returns the bitwise AND of two BitPack objects.  The result is as long
+ * as the longer of the two, the shorter one reading as 0 past its end, and
+ * has the bit order of +bp+.
+ *
+ * === Example
+ *
+ *   >> BitPack.from_bin("1100") & BitPack.from_bin("101010")
+ *   => 100000
+ */
+static VALUE bp_and(VALUE self, VALUE other)
+{
+    return bp_bitop(self, other, BITPACK_OP_AND);
+}
+
+/*
+ * call-seq:
+ *   bp | other -> a new BitPack object
+ *
+ * Returns the bitwise OR of two BitPack objects, see BitPack#&.
+ *
+ * === Example
+ *
+ *   >> BitPack.from_bin("1100") | BitPack.from_bin("101010")
+ *   => 111010
+ */
+static VALUE bp_or(VALUE self, VALUE other)
+{
+    return bp_bitop(self, other, BITPACK_OP_OR);
+}
+
+/*
+ * call-seq:
+ *   bp ^ other -> a new BitPack object
+ *
+ * Returns the bitwise XOR of two BitPack objects, see BitPack#&.
+ *
+ * === Example
+ *
+ *   >> BitPack.from_bin("1100") ^ BitPack.from_bin("101010")
+ *   => 011010
+ */
+static VALUE bp_xor(VALUE self, VALUE other)
+{
+    return bp_bitop(self, other, BITPACK_OP_XOR);
+}
+
+/*
+ * call-seq:
+ *   ~bp -> a new BitPack object
+ *
+ * Returns a BitPack object of the same size with every bit flipped.
+ *
+ * === Example
+ *
+ *   >> ~BitPack.from_bin("1100")
+ *   => 0011
+ */
+static VALUE bp_not(VALUE self)
+{
+    return bp_bitop(self, self, BITPACK_OP_NOT);
+}
+
+/*
+ * call-seq:
+ *   bp.set_bits(value, num_bits, i) -> self
+ *
+ * Sets the specified range of bits in a BitPack object.
+ *
+ * Packs the Integer +value+ into +num_bits+ bits starting at index
+ * +i+.  The number of bits required to represent +value+ is checked
+ * against the size of the range.  If <tt>i + num_bits</tt> is greater
+ * than the current size of the BitPack, then the size is adjusted
+ * appropriately.  The range may be wider than 64 bits, in which case
+ * +value+ may be a Bignum.
+ *
+ * === Example
+ *
+ *   >> bp = BitPack.new
+ *   => 
+ *   >> bp.set_bits(0xff, 8, 0)
+ *   => 11111111
+ *   >> bp.set_bits(0xaa, 8, 8)
+ *   => 1111111110101010
+ */
+static VALUE bp_set_bits(VALUE self, VALUE value, VALUE num_bits, VALUE index)
+{
+    bitpack_t bp;
+
+    Data_Get_Struct(self, struct _bitpack_t, bp);
+
+    bp_set_integer(bp, value, NUM2ULONG(num_bits), NUM2ULONG(index));
+
+    return self;
+}
+
+/*
+ * call-seq:
+ *   bp.set_bytes(string, i)
+ *
+ * Sets the specified range of bytes in a BitPack object.
+ *
+ * Packs +string+ into the BitPack object starting at index +i+.  The
+ * size of the BitPack object is adjusted appropriately if necessary.
+ *
+ * === Example
+ *
+ *   >> bp = BitPack.new
+ *   => 
+ *   >> bp.set_bytes("ruby", 0)
+ *   => 01110010011101010110001001111001
+ *   >> 4.times { p bp.read_bits(8).chr }
+ *   "r"
+ *   "u"
+ *   "b"
+ *   "y"
+ *   => 4
+ */
+static VALUE bp_set_bytes(VALUE self, VALUE bytes, VALUE index)
+{
+    bitpack_t bp;
+    VALUE     str;
+
+    Data_Get_Struct(self, struct _bitpack_t, bp);
+
+    str = StringValue(bytes);
+
+    if (!bitpack_set_bytes(bp, (unsigned char *)RSTRING_PTR(str),
+          RSTRING_LEN(str), NUM2ULONG(index))) {
+        rb_raise(bp_exceptions[bitpack_get_error(bp)],
+                "%s", bitpack_get_error_str(bp));
+    }
+
+    return self;
+}
+
+/*
+ * call-seq:
+ *   bp.get_bits(num_bits, i) -> Integer
+ *
+ * Access the value stored in a range of bits starting at index +i+.
+ *
+ * Unpacks +num_bits+ starting from index +i+ and returns the Integer
+ * value.  Ranges wider than 64 bits are returned as a Bignum.
+ *
+ * === Example
+ *
+ *   >> bp = BitPack.new
+ *   => 
+ *   >> bp.append_bits(1, 4)
+ *   => 0001
+ *   >> bp.append_bits(2, 4)
+ *   => 00010010
+ *   >> bp.append_bits(3, 4)
+ *   => 000100100011
+ *   >> bp.append_bits(4, 4)
+ *   => 0001001000110100
+ *   >> bp.get_bits(4, 0)
+ *   => 1
+ *   >> bp.get_bits(4, 4)
+ *   => 2
+ *   >> bp.get_bits(4, 8)
+ *   => 3
+ *   >> bp.get_bits(4, 12)
+ *   => 4
+ */
+static VALUE bp_get_bits(VALUE self, VALUE num_bits, VALUE index)
+{
+    bitpack_t bp;
+
+    Data_Get_Struct(self, struct _bitpack_t, bp);
+
+    return bp_get_integer(bp, NUM2ULONG(num_bits), NUM2ULONG(index), 0);
+}
+
+/*
+ * call-seq:
+ *   bp.get_bytes(num_bytes, i) -> String
+ *
+ * Access the value stored in a range of bytes starting at index +i+.
+ *
+ * Unpacks +num_bytes+ starting from bit index +i+ and returns the String
+ * value.
+ *
+ * === Example
+ *
+ *   >> bp =  BitPack.from_bytes("foobar")
+ *   => 011001100110111101101111011000100110000101110010
+ *   >> bp.get_bytes(3, 24)
+ *   => "bar"
+ */
+static VALUE bp_get_bytes(VALUE self, VALUE num_bytes, VALUE index)
+{
+    bitpack_t     bp;
+    unsigned long n;
+    VALUE         str;
+
+    Data_Get_Struct(self, struct _bitpack_t, bp);
+
+    n = NUM2ULONG(num_bytes);
+
+    /* more bytes than the bitpack holds fail before the buffer is touched */
+    if (n > bitpack_size(bp) / 8) {
+        bitpack_get_bytes_into(bp, n, NUM2ULONG(index), NULL);
+        rb_raise(bp_exceptions[bitpack_get_error(bp)],
+                "%s", bitpack_get_error_str(bp));
+    }
+
+    str = rb_str_new(NULL, n);
+
+    if (!bitpack_get_bytes_into(bp, n, NUM2ULONG(index), (unsigned char *)RSTRING_PTR(str))) {
+        rb_raise(bp_exceptions[bitpack_get_error(bp)],
+                "%s", bitpack_get_error_str(bp));
+    }
+
+    return str;
+}
+
+/*
+ * call-seq:
+ *   bp.append_bits(value, num_bits)
+ *
+ * Append the Integer +value+ to the end of a BitPack object.
+ *
+ * Packs +num_bits+ bits at the end of a BitPack object.  The size of
+ * the BitPack object is increased by +num_bits+ as a result.
+ *
+ * === Example
+ *
+ *   >> bp = BitPack.new
+ *   => 
+ *   >> bp.append_bits(1, 3)
+ *   => 001
+ *   >> bp.append_bits(3, 3)
+ *   => 001011
+ *   >> bp.append_bits(7, 3)
+ *   => 001011111
+ */
+static VALUE bp_append_bits(VALUE self, VALUE value, VALUE num_bits)
+{
+    bitpack_t bp;
+
+    Data_Get_Struct(self, struct _bitpack_t, bp);
+
+    bp_set_integer(bp, value, NUM2ULONG(num_bits), bitpack_size(bp));
+
+    return self;
+}
+
+/*
+ * call-seq:
+ *   bp.append_bytes(string)
+ *
+ * Append +string+ to the end of a BitPack object.
+ *
+ * Packs +string+ at the end of a BitPack object.  The size of the
+ * BitPack object is increased by the length of +string+ as a result.
+ *
+ * === Example
+ *
+ *   >> bp = BitPack.new
+ *   => 
+ *   >> bp.append_bytes("bit")
+ *   => 011000100110100101110100
+ *   >> bp.append_bytes("pack")
+ *   => 01100010011010010111010001110000011000010110001101101011
+ *   >> 7.times { p bp.read_bits(8).chr }
+ *   "b"
+ *   "i"
+ *   "t"
+ *   "p"
+ *   "a"
+ *   "c"
+ *   "k"
+ *   => 7
+ */
+static VALUE bp_append_bytes(VALUE self, VALUE value)
+{
+    bitpack_t bp;
+    VALUE     str;
+
+    Data_Get_Struct(self, struct _bitpack_t, bp);
+
+    str = StringValue(value);
+
+    if (!bitpack_append_bytes(bp, (unsigned char *)RSTRING_PTR(str),
+          RSTRING_LEN(str))) {
+        rb_raise(bp_exceptions[bitpack_get_error(bp)],
+                "%s", bitpack_get_error_str(bp));
+    }
+
+    return self;
+}
+
+/*
+ * call-seq:
+ *   bp.read_bits(num_bits) -> Integer
+ *
+ * Access the value of a range of bits at the current read position.
+ *
+ * Unpacks +num_bits+ bits starting at the current read position (see
+ * Bitpack#read_pos) and returns the integer value.  The current read
+ * position is advanced by +num_bits+ bits.
+ *
+ * === Example
+ *
+ *   >> bp = BitPack.from_bytes("ruby")
+ *   => 01110010011101010110001001111001
+ *   >> 4.times { p bp.read_bits(8).chr }
+ *   "r"
+ *   "u"
+ *   "b"
+ *   "y"
+ *   => 4
+ */
+static VALUE bp_read_bits(VALUE self, VALUE num_bits)
+{
+    bitpack_t bp;
+
+    Data_Get_Struct(self, struct _bitpack_t, bp);
+
+    return bp_get_integer(bp, NUM2ULONG(num_bits), 0, 1);
+}
+
+/*
+ * call-seq:
+ *   bp.read_bytes(num_bytes) -> String
+ *
+ * Access the value of a range of bytes at the current read position.
+ *
+ * Unpacks +num_bytes+ bytes starting at the current read position (see
+ * Bitpack#read_pos) and returns the String value.  The current read
+ * position is advanced by <tt>num_bytes * 8</tt> bits.
+ *
+ * === Example
+ *
+ *   >> bp = BitPack.from_bytes("foobar")
+ *   => 011001100110111101101111011000100110000101110010
+ *   >> bp.read_bytes(3)
+ *   => "foo"
+ *   >> bp.read_bytes(3)
+ *   => "bar"
+ */
+static VALUE bp_read_bytes(VALUE self, VALUE num_bytes)
+{
+    bitpack_t     bp;
+    unsigned long n;
+    VALUE         str;
+
+    Data_Get_Struct(self, struct _bitpack_t, bp);
+
+    n = NUM2ULONG(num_bytes);
+
+    /* more bytes than the bitpack holds fail before the buffer is touched */
+    if (n > bitpack_size(bp) / 8) {
+        bitpack_read_bytes_into(bp, n, NULL);
+        rb_raise(bp_exceptions[bitpack_get_error(bp)],
+                "%s", bitpack_get_error_str(bp));
+    }
+
+    str = rb_str_new(NULL, n);
+
+    if (!bitpack_read_bytes_into(bp, n, (unsigned char *)RSTRING_PTR(str))) {
+        rb_raise(bp_exceptions[bitpack_get_error(bp)],
+                "%s", bitpack_get_error_str(bp));
+    }
+
+    return str;
+}
+
+/*
+ * call-seq:
+ *   bp.to_bin -> String
+ *
+ * Converts the BitPack object to a string of 1s and 0s.
+ */
+static VALUE bp_to_bin(VALUE self)
+{
+    bitpack_t  bp;
+    char      *s;
+    VALUE      str;
+
+    Data_Get_Struct(self, struct _bitpack_t, bp);
+
+    if (!bitpack_to_bin(bp, &s)) {
+        rb_raise(bp_exceptions[bitpack_get_error(bp)],
+                "%s", bitpack_get_error_str(bp));
+    }
+
+    str = rb_str_new2(s);
+
+    free(s);
+
+    return str;
+}
+
+/*
+ * call-seq:
+ *   bp.to_hex -> String
+ *
+ * Converts the BitPack object to a String of lowercase hex digits, 4
+ * bits per digit.  If the current size of the BitPack object is not a
+ * multiple of 4, the last digit is padded with the appropriate number
+ * of 0 bits.  The digits follow the bits in bit order, as in to_bin, so
+ * for an :lsb BitPack object they are not the hex of the bytes.
+ *
+ * === Example
+ *
+ *   >> bp = BitPack.from_bytes("ruby")
+ *   => 01110010011101010110001001111001
+ *   >> bp.to_hex
+ *   => "72756279"
+ *   >> bp.append_bits(1, 1)
+ *   => 011100100111010101100010011110011
+ *   >> bp.to_hex
+ *   => "727562798"
+ */
+static VALUE bp_to_hex(VALUE self)
+{
+    bitpack_t  bp;
+    char      *s;
+    VALUE      str;
+
+    Data_Get_Struct(self, struct _bitpack_t, bp);
+
+    if (!bitpack_to_hex(bp, &s)) {
+        rb_raise(bp_exceptions[bitpack_get_error(bp)],
+                "%s", bitpack_get_error_str(bp));
+    }
+
+    str = rb_str_new2(s);
+
+    free(s);
+
+    return str;
+}
+
+/*
+ * call-seq:
+ *   bp.to_base64 -> String
+ *
+ * Converts the String returned by BitPack#to_bytes to padded base64.
+ *
+ * === Example
+ *
+ *   >> bp = BitPack.from_bytes("ruby")
+ *   => 01110010011101010110001001111001
+ *   >> bp.to_base64
+ *   => "cnVieQ=="
+ */
+static VALUE bp_to_base64(VALUE self)
+{
+    bitpack_t  bp;
+    char      *s;
+    VALUE      str;
+
+    Data_Get_Struct(self, struct _bitpack_t, bp);
+
+    if (!bitpack_to_base64(bp, &s)) {
+        rb_raise(bp_exceptions[bitpack_get_error(bp)],
+                "%s", bitpack_get_error_str(bp));
+    }
+
+    str = rb_str_new2(s);
+
+    free(s);
+
+    return str;
+}
+
+/*
+ * call-seq:
+ *   bp.to_bytes -> String
+ *
+ * Converts the BitPack object to a string of bytes.  If the current
+ * size of the BitPack object is not a multiple of 8, the last byte
+ * in the returned String will be padded with the appropriate number
+ * of 0 bits.
+ *
+ * === Example
+ *
+ *   >> bp = BitPack.new
+ *   => 
+ *   >> bp.append_bits(?r, 8)
+ *   => 01110010
+ *   >> bp.append_bits(?u, 8)
+ *   => 0111001001110101
+ *   >> bp.append_bits(?b, 8)
+ *   => 011100100111010101100010
+ *   >> bp.append_bits(?y, 8)
+ *   => 01110010011101010110001001111001
+ *   >> bp.to_bytes
+ *   => "ruby"
+ */
+static VALUE bp_to_bytes(VALUE self)
+{
+    bitpack_t bp;
+    VALUE     str;
+
+    Data_Get_Struct(self, struct _bitpack_t, bp);
+
+    str = rb_str_new(NULL, (bitpack_size(bp) + 7) / 8);
+
+    if (!bitpack_to_bytes_into(bp, (unsigned char *)RSTRING_PTR(str), NULL)) {
+        rb_raise(bp_exceptions[bitpack_get_error(bp)],
+                "%s", bitpack_get_error_str(bp));
+    }
+
+    return str;
+}
+
+/*
+ * call-seq:
+ *   bp.set_sbits(value, num_bits, i) -> self
+ *
+ * Sets the specified range of bits to a signed value.
+ *
+ * Same as BitPack#set_bits, but packs the Integer +value+ in two's
+ * complement, so +value+ may be negative.
+ *
+ * === Example
+ *
+ *   >> bp = BitPack.new
+ *   => 
+ *   >> bp.set_sbits(-2, 4, 0)
+ *   => 1110
+ */
+static VALUE bp_set_sbits(VALUE self, VALUE value, VALUE num_bits, VALUE index)
+{
+    bitpack_t bp;
+
+    Data_Get_Struct(self, struct _bitpack_t, bp);
+
+    if (!bitpack_set_sbits(bp, NUM2LONG(value), NUM2ULONG(num_bits), NUM2ULONG(index))) {
+        rb_raise(bp_exceptions[bitpack_get_error(bp)],
+                "%s", bitpack_get_error_str(bp));
+    }
+
+    return self;
+}
+
+/*
+ * call-seq:
+ *   bp.get_sbits(num_bits, i) -> Integer
+ *
+ * Access the signed value stored in a range of bits starting at index +i+.
+ *
+ * Unpacks +num_bits+ starting from index +i+ as a two's complement value.
+ *
+ * === Example
+ *
+ *   >> bp = BitPack.from_bin("1110")
+ *   => 1110
+ *   >> bp.get_sbits(4, 0)
+ *   => -2
+ *   >> bp.get_bits(4, 0)
+ *   => 14
+ */
+static VALUE bp_get_sbits(VALUE self, VALUE num_bits, VALUE index)
+{
+    bitpack_t bp;
+    long      value;
+
+    Data_Get_Struct(self, struct _bitpack_t, bp);
+
+    if (!bitpack_get_sbits(bp, NUM2ULONG(num_bits), NUM2ULONG(index), &value)) {
+        rb_raise(bp_exceptions[bitpack_get_error(bp)],
+                "%s", bitpack_get_error_str(bp));
+    }
+
+    return LONG2NUM(value);
+}
+
+/*
+ * call-seq:
+ *   bp.append_sbits(value, num_bits) -> self
+ *
+ * Append a signed value to the end of a BitPack object.
+ *
+ * Packs the Integer +value+ in two's complement into +num_bits+ bits at
+ * the end of the BitPack object.
+ *
+ * === Example
+ *
+ *   >> bp = BitPack.new
+ *   => 
+ *   >> bp.append_sbits(-1, 3)
+ *   => 111
+ *   >> bp.append_sbits(3, 3)
+ *   => 111011
+ */
+static VALUE bp_append_sbits(VALUE self, VALUE value, VALUE num_bits)
+{
+    bitpack_t bp;
+
+    Data_Get_Struct(self, struct _bitpack_t, bp);
+
+    if (!bitpack_append_sbits(bp, NUM2LONG(value), NUM2ULONG(num_bits))) {
+        rb_raise(bp_exceptions[bitpack_get_error(bp)],
+                "%s", bitpack_get_error_str(bp));
+    }
+
+    return self;
+}
+
+/*
+ * call-seq:
+ *   bp.read_sbits(num_bits) -> Integer
+ *
+ * Access the signed value of a range of bits at the current read position.
+ *
+ * Unpacks +num_bits+ bits as a two's complement value.  The current read
+ * position is advanced by +num_bits+ bits.
+ *
+ * === Example
+ *
+ *   >> bp = BitPack.from_bin("111011")
+ *   => 111011
+ *   >> bp.read_sbits(3)
+ *   => -1
+ *   >> bp.read_sbits(3)
+ *   => 3
+ */
+static VALUE bp_read_sbits(VALUE self, VALUE num_bits)
+{
+    bitpack_t bp;
+    long      value;
+
+    Data_Get_Struct(self, struct _bitpack_t, bp);
+
+    if (!bitpack_read_sbits(bp, NUM2ULONG(num_bits), &value)) {
+        rb_raise(bp_exceptions[bitpack_get_error(bp)],
+                "%s", bitpack_get_error_str(bp));
+    }
+
+    return LONG2NUM(value);
+}
+
+/*
+ * call-seq:
+ *   bp.append_zigzag(value, num_bits) -> self
+ *
+ * Append a zigzag encoded signed value to the end of a BitPack object.
+ *
+ * Zigzag encoding maps 0, -1, 1, -2, 2, ... to 0, 1, 2, 3, 4, ... so
+ * values of small magnitude have their high bits clear whatever their
+ * sign.
+ *
+ * === Example
+ *
+ *   >> bp = BitPack.new
+ *   => 
+ *   >> bp.append_zigzag(-2, 4)
+ *   => 0011
+ *   >> bp.append_zigzag(2, 4)
+ *   => 00110100
+ */
+static VALUE bp_append_zigzag(VALUE self, VALUE value, VALUE num_bits)
+{
+    bitpack_t bp;
+
+    Data_Get_Struct(self, struct _bitpack_t, bp);
+
+    if (!bitpack_append_zigzag_bits(bp, NUM2LONG(value), NUM2ULONG(num_bits))) {
+        rb_raise(bp_exceptions[bitpack_get_error(bp)],
+                "%s", bitpack_get_error_str(bp));
+    }
+
+    return self;
+}
+
+/*
+ * call-seq:
+ *   bp.read_zigzag(num_bits) -> Integer
+ *
+ * Access the zigzag encoded signed value of a range of bits at the current
+ * read position.  The current read position is advanced by +num_bits+
+ * bits.
+ *
+ * === Example
+ *
+ *   >> bp = BitPack.from_bin("00110100")
+ *   => 00110100
+ *   >> bp.read_zigzag(4)
+ *   => -2
+ *   >> bp.read_zigzag(4)
+ *   => 2
+ */
+static VALUE bp_read_zigzag(VALUE self, VALUE num_bits)
+{
+    bitpack_t bp;
+    long      value;
+
+    Data_Get_Struct(self, struct _bitpack_t, bp);
+
+    if (!bitpack_read_zigzag_bits(bp, NUM2ULONG(num_bits), &value)) {
+        rb_raise(bp_exceptions[bitpack_get_error(bp)],
+                "%s", bitpack_get_error_str(bp));
+    }
+
+    return LONG2NUM(value);
+}
+
+typedef int (*bp_set_int_fn)(bitpack_t, unsigned long, unsigned long, unsigned long);
+typedef int (*bp_get_int_fn)(bitpack_t, unsigned long, unsigned long, unsigned long *);
+typedef int (*bp_read_int_fn)(bitpack_t, unsigned long, unsigned long *);
+
+static VALUE bp_set_int(VALUE self, VALUE value, VALUE num_bytes, unsigned long index, bp_set_int_fn set)
+{
+    bitpack_t bp;
+
+    Data_Get_Struct(self, struct _bitpack_t, bp);
+
+    if (!set(bp, NUM2ULONG(value), NUM2ULONG(num_bytes), index)) {
+        rb_raise(bp_exceptions[bitpack_get_error(bp)],
+                "%s", bitpack_get_error_str(bp));
+    }
+
+    return self;
+}
+
+static VALUE bp_get_int(VALUE self, VALUE num_bytes, VALUE index, bp_get_int_fn get)
+{
+    bitpack_t     bp;
+    unsigned long value;
+
+    Data_Get_Struct(self, struct _bitpack_t, bp);
+
+    if (!get(bp, NUM2ULONG(num_bytes), NUM2ULONG(index), &value)) {
+        rb_raise(bp_exceptions[bitpack_get_error(bp)],
+                "%s", bitpack_get_error_str(bp));
+    }
+
+    return ULONG2NUM(value);
+}
+
+static VALUE bp_read_int(VALUE self, VALUE num_bytes, bp_read_int_fn read)
+{
+    bitpack_t     bp;
+    unsigned long value;
+
+    Data_Get_Struct(self, struct _bitpack_t, bp);
+
+    if (!read(bp, NUM2ULONG(num_bytes), &value)) {
+        rb_raise(bp_exceptions[bitpack_get_error(bp)],
+                "%s", bitpack_get_error_str(bp));
+    }
+
+    return ULONG2NUM(value);
+}
+
+/*
+ * call-seq:
+ *   bp.set_le(value, num_bytes, index)
+ *
+ * Sets +num_bytes+ bytes (0 to 8) starting at bit +index+ to the
+ * little-endian representation of +value+.  Each byte is stored like
+ * BitPack#set_bytes stores it, so the bytes are the same in either bit
+ * order.
+ *
+ * === Example
+ *
+ *   >> bp = BitPack.new
+ *   => 
+ *   >> bp.set_le(0x1234, 2, 0)
+ *   => 0011010000010010
+ */
+static VALUE bp_set_le(VALUE self, VALUE value, VALUE num_bytes, VALUE index)
+{
+    return bp_set_int(self, value, num_bytes, NUM2ULONG(index), bitpack_set_le);
+}
+
+/*
+ * call-seq:
+ *   bp.get_le(num_bytes, index) -> Integer
+ *
+ * Access the little-endian integer of +num_bytes+ bytes starting at bit
+ * +index+, see BitPack#set_le.
+ */
+static VALUE bp_get_le(VALUE self, VALUE num_bytes, VALUE index)
+{
+    return bp_get_int(self, num_bytes, index, bitpack_get_le);
+}
+
+/*
+ * call-seq:
+ *   bp.append_le(value, num_bytes)
+ *
+ * Append the little-endian representation of +value+ in +num_bytes+ bytes
+ * to the end of a BitPack object, see BitPack#set_le.
+ */
+static VALUE bp_append_le(VALUE self, VALUE value, VALUE num_bytes)
+{
+    bitpack_t bp;
+
+    Data_Get_Struct(self, struct _bitpack_t, bp);
+
+    return bp_set_int(self, value, num_bytes, bitpack_size(bp), bitpack_set_le);
+}
+
+/*
+ * call-seq:
+ *   bp.read_le(num_bytes) -> Integer
+ *
+ * Access the little-endian integer of +num_bytes+ bytes at the current read
+ * position, see BitPack#set_le.  The current read position is advanced by
+ * 8 * +num_bytes+ bits.
+ */
+static VALUE bp_read_le(VALUE self, VALUE num_bytes)
+{
+    return bp_read_int(self, num_bytes, bitpack_read_le);
+}
+
+/*
+ * call-seq:
+ *   bp.set_be(value, num_bytes, index)
+ *
+ * Like BitPack#set_le, but most significant byte first.
+ */
+static VALUE bp_set_be(VALUE self, VALUE value, VALUE num_bytes, VALUE index)
+{
+    return bp_set_int(self, value, num_bytes, NUM2ULONG(index), bitpack_set_be);
+}
+
+/*
+ * call-seq:
+ *   bp.get_be(num_bytes, index) -> Integer
+ *
+ * Like BitPack#get_le, but most significant byte first.
+ */
+static VALUE bp_get_be(VALUE self, VALUE num_bytes, VALUE index)
+{
+    return bp_get_int(self, num_bytes, index, bitpack_get_be);
+}
+
+/*
+ * call-seq:
+ *   bp.append_be(value, num_bytes)
+ *
+ * Like BitPack#append_le, but most significant byte first.
+ */
+static VALUE bp_append_be(VALUE self, VALUE value, VALUE num_bytes)
+{
+    bitpack_t bp;
+
+    Data_Get_Struct(self, struct _bitpack_t, bp);
+
+    return bp_set_int(self, value, num_bytes, bitpack_size(bp), bitpack_set_be);
+}
+
+/*
+ * call-seq:
+ *   bp.read_be(num_bytes) -> Integer
+ *
+ * Like BitPack#read_le, but most significant byte first.
+ */
+static VALUE bp_read_be(VALUE self, VALUE num_bytes)
+{
+    return bp_read_int(self, num_bytes, bitpack_read_be);
+}
+
+/*
+ * call-seq:
+ *   bp.append_array(values, num_bits)
+ *
+ * Append an Array of Integers to the end of a BitPack object.
+ *
+ * Packs each Integer in +values+ into +num_bits+ bits (1 to 32), one after
+ * another.  This is the same as calling BitPack#append_bits for every
+ * element, but in a single call.  Every value is checked before anything
+ * is packed, so the BitPack object is unchanged if an exception is raised.
+ *
+ * === Example
+ *
+ *   >> bp = BitPack.new
+ *   => 
+ *   >> bp.append_array([1, 2, 3, 4], 3)
+ *   => 001010011100
+ */
+static VALUE bp_append_array(VALUE self, VALUE values, VALUE num_bits)
+{
+    bitpack_t      bp;
+    uint32_t      *buf;
+    unsigned long  n, i, v;
+    unsigned int   width;
+    VALUE          tmp;
+
+    Data_Get_Struct(self, struct _bitpack_t, bp);
+
+    Check_Type(values, T_ARRAY);
+
+    n     = RARRAY_LEN(values);
+    width = NUM2UINT(num_bits);
+
+    /* a temporary buffer the GC reclaims if a conversion raises */
+    buf = ALLOCV_N(uint32_t, tmp, n + 1);
+
+    for (i = 0; i < n; i++) {
+        v = NUM2ULONG(rb_ary_entry(values, i));
+
+        if (v > 0xffffffffUL) {
+            ALLOCV_END(tmp);
+            rb_raise(bp_exceptions[BITPACK_ERR_VALUE_TOO_BIG],
+                    "value %lu does not fit in %u bits", v, width);
+        }
+
+        buf[i] = (uint32_t)v;
+    }
+
+    if (!bitpack_append_uint_array(bp, buf, n, width)) {
+        ALLOCV_END(tmp);
+        rb_raise(bp_exceptions[bitpack_get_error(bp)],
+                "%s", bitpack_get_error_str(bp));
+    }
+
+    ALLOCV_END(tmp);
+
+    return self;
+}
+
+/*
+ * call-seq:
+ *   bp.read_array(n, num_bits) -> Array
+ *
+ * Access an Array of Integers at the current read position.
+ *
+ * Unpacks +n+ Integers of +num_bits+ bits (1 to 32) each, starting at the
+ * current read position.  The current read position is advanced by
+ * +n+ * +num_bits+ bits.
+ *
+ * === Example
+ *
+ *   >> bp = BitPack.from_bin("001010011100")
+ *   => 001010011100
+ *   >> bp.read_array(4, 3)
+ *   => [1, 2, 3, 4]
+ */
+static VALUE bp_read_array(VALUE self, VALUE num_values, VALUE num_bits)
+{
+    bitpack_t      bp;
+    uint32_t      *buf;
+    unsigned long  n, i;
+    unsigned int   width;
+    VALUE          values;
+
+    Data_Get_Struct(self, struct _bitpack_t, bp);
+
+    n     = NUM2ULONG(num_values);
+    width = NUM2UINT(num_bits);
+
+    /* more values than bits fail before the buffer is touched */
+    if (n > bitpack_size(bp)) {
+        bitpack_read_uint_array(bp, NULL, n, width);
+        rb_raise(bp_exceptions[bitpack_get_error(bp)],
+                "%s", bitpack_get_error_str(bp));
+    }
+
+    buf = ALLOC_N(uint32_t, n + 1);
+
+    if (!bitpack_read_uint_array(bp, buf, n, width)) {
+        xfree(buf);
+        rb_raise(bp_exceptions[bitpack_get_error(bp)],
+                "%s", bitpack_get_error_str(bp));
+    }
+
+    values = rb_ary_new2(n);
+
+    for (i = 0; i < n; i++) {
+        rb_ary_push(values, UINT2NUM(buf[i]));
+    }
+
+    xfree(buf);
+
+    return values;
+}
+
+/* map a code name Symbol to its bitpack_vlc_t */
+static bitpack_vlc_t bp_vlc_codec(VALUE name)
+{
+    ID id = SYM2ID(name);
+
+    if (id == rb_intern("leb128"))     return BITPACK_VLC_LEB128;
+    if (id == rb_intern("gamma"))      return BITPACK_VLC_GAMMA;
+    if (id == rb_intern("delta"))      return BITPACK_VLC_DELTA;
+    if (id == rb_intern("exp_golomb")) return BITPACK_VLC_EXP_GOLOMB;
+    if (id == rb_intern("rice"))       return BITPACK_VLC_RICE;
+
+    rb_raise(rb_eArgError, "unknown code :%s", rb_id2name(id));
+
+    return BITPACK_VLC_LEB128;
+}
+
+/*
+ * call-seq:
+ *   bp.append_vlc(code, value, k = 0)
+ *
+ * Append an Integer in a variable length code to the end of a BitPack
+ * object.
+ *
+ * +code+ is one of:
+ *
+ * [:leb128]     LEB128 varint, 7 bits per byte, least significant first
+ * [:gamma]      Elias gamma, +value+ must be at least 1
+ * [:delta]      Elias delta, +value+ must be at least 1
+ * [:exp_golomb] Exp-Golomb of order +k+
+ * [:rice]       Golomb-Rice with divisor 2**+k+
+ *
+ * === Example
+ *
+ *   >> bp = BitPack.new
+ *   => 
+ *   >> bp.append_vlc(:gamma, 5)
+ *   => 00101
+ *   >> bp.append_vlc(:rice, 9, 2)
+ *   => 0010111001
+ */
+static VALUE bp_append_vlc(int argc, VALUE *argv, VALUE self)
+{
+    bitpack_t bp;
+    VALUE     code, value, k;
+
+    Data_Get_Struct(self, struct _bitpack_t, bp);
+
+    rb_scan_args(argc, argv, "21", &code, &value, &k);
+
+    if (!bitpack_append_vlc(bp, bp_vlc_codec(code), NIL_P(k) ? 0 : NUM2UINT(k), NUM2ULONG(value))) {
+        rb_raise(bp_exceptions[bitpack_get_error(bp)],
+                "%s", bitpack_get_error_str(bp));
+    }
+
+    return self;
+}
+
+/*
+ * call-seq:
+ *   bp.read_vlc(code, k = 0) -> Integer
+ *
+ * Access an Integer in a variable length code at the current read position.
+ *
+ * +code+ and +k+ are the same as for BitPack#append_vlc.  The current read
+ * position is advanced past the code.
+ *
+ * === Example
+ *
+ *   >> bp = BitPack.from_bin("0010111001")
+ *   => 0010111001
+ *   >> bp.read_vlc(:gamma)
+ *   => 5
+ *   >> bp.read_vlc(:rice, 2)
+ *   => 9
+ */
+static VALUE bp_read_vlc(int argc, VALUE *argv, VALUE self)
+{
+    bitpack_t     bp;
+    unsigned long value;
+    VALUE         code, k;
+
+    Data_Get_Struct(self, struct _bitpack_t, bp);
+
+    rb_scan_args(argc, argv, "11", &code, &k);
+
+    if (!bitpack_read_vlc(bp, bp_vlc_codec(code), NIL_P(k) ? 0 : NUM2UINT(k), &value)) {
+        rb_raise(bp_exceptions[bitpack_get_error(bp)],
+                "%s", bitpack_get_error_str(bp));
+    }
+
+    return ULONG2NUM(value);
+}
+
+/*
+ * call-seq:
+ *   bp.append_vlc_array(code, values, k = 0)
+ *
+ * Append an Array of Integers in a variable length code to the end of a
+ * BitPack object.
+ *
+ * The same as calling BitPack#append_vlc for every element, but the
+ * BitPack object is unchanged if any of them can't be encoded.
+ *
+ * === Example
+ *
+ *   >> bp = BitPack.new
+ *   => 
+ *   >> bp.append_vlc_array(:exp_golomb, [0, 1, 2])
+ *   => 1010011
+ */
+static VALUE bp_append_vlc_array(int argc, VALUE *argv, VALUE self)
+{
+    bitpack_t      bp;
+    unsigned long *buf;
+    unsigned long  n, i;
+    VALUE          code, values, k;
+
+    Data_Get_Struct(self, struct _bitpack_t, bp);
+
+    rb_scan_args(argc, argv, "21", &code, &values, &k);
+
+    Check_Type(values, T_ARRAY);
+
+    n   = RARRAY_LEN(values);
+    buf = ALLOC_N(unsigned long, n + 1);
+
+    for (i = 0; i < n; i++) {
+        buf[i] = NUM2ULONG(rb_ary_entry(values, i));
+    }
+
+    if (!bitpack_append_vlc_array(bp, bp_vlc_codec(code), NIL_P(k) ? 0 : NUM2UINT(k), buf, n)) {
+        xfree(buf);
+        rb_raise(bp_exceptions[bitpack_get_error(bp)],
+                "%s", bitpack_get_error_str(bp));
+    }
+
+    xfree(buf);
+
+    return self;
+}
+
+/*
+ * call-seq:
+ *   bp.read_vlc_array(code, n, k = 0) -> Array
+ *
+ * Access an Array of +n+ Integers in a variable length code at the current
+ * read position.
+ *
+ * The current read position is advanced past the codes, or left unchanged
+ * if an exception is raised.
+ *
+ * === Example
+ *
+ *   >> bp = BitPack.from_bin("1010011")
+ *   => 1010011
+ *   >> bp.read_vlc_array(:exp_golomb, 3)
+ *   => [0, 1, 2]
+ */
+static VALUE bp_read_vlc_array(int argc, VALUE *argv, VALUE self)
+{
+    bitpack_t      bp;
+    unsigned long *buf;
+    unsigned long  n, i;
+    VALUE          code, num_values, k, values;
+
+    Data_Get_Struct(self, struct _bitpack_t, bp);
+
+    rb_scan_args(argc, argv, "21", &code, &num_values, &k);
+
+    n   = NUM2ULONG(num_values);
+    buf = ALLOC_N(unsigned long, n + 1);
+
+    if (!bitpack_read_vlc_array(bp, bp_vlc_codec(code), NIL_P(k) ? 0 : NUM2UINT(k), buf, n)) {
+        xfree(buf);
+        rb_raise(bp_exceptions[bitpack_get_error(bp)],
+                "%s", bitpack_get_error_str(bp));
+    }
+
+    values = rb_ary_new2(n);
+
+    for (i = 0; i < n; i++) {
+        rb_ary_push(values, ULONG2NUM(buf[i]));
+    }
+
+    xfree(buf);
+
+    return values;
+}
+
+static void bp_schema_free(bp_schema_t *s)
+{
+    if (s->schema) bitpack_schema_destroy(s->schema);
+    xfree(s->fields);
+    xfree(s->record);
+    xfree(s);
+}
+
+/*
+ * call-seq:
+ *   BitPack::Schema.new(fields) -> a new BitPack::Schema object
+ *
+ * Compiles a record layout for BitPack#append_record and
+ * BitPack#read_record.  +fields+ is an Array of field specifications, in
+ * packing order:
+ *
+ * [:uint, n]     unsigned integer of +n+ bits (1 to 64)
+ * [:sint, n]     two's complement signed integer of +n+ bits (1 to 64)
+ * [:bytes, n]    String of exactly +n+ bytes
+ * [:varbytes, i] String whose length in bytes is the value of the earlier
+ *                :uint field with index +i+, which may be at most 16 bits
+ *
+ * === Example
+ *
+ *   >> s = BitPack::Schema.new([[:uint, 3], [:uint, 13], [:varbytes, 1]])
+ *   >> bp = BitPack.new
+ *   >> bp.append_record(s, [5, 4, "ruby"])
+ *   => 101000000000010001110010011101010110001001111001
+ *   >> bp.read_record(s)
+ *   => [5, 4, "ruby"]
+ */
+static VALUE bp_schema_new(VALUE class, VALUE spec)
+{
+    bp_schema_t     *s;
+    bitpack_field_t *f;
+    VALUE            s_obj;
+    VALUE            entry;
+    ID               type;
+    unsigned long    i, n, offset = 0;
+
+    Check_Type(spec, T_ARRAY);
+
+    s = ALLOC(bp_schema_t);
+    s->schema     = NULL;
+    s->num_fields = RARRAY_LEN(spec);
+    s->fields     = ALLOC_N(bitpack_field_t, s->num_fields + 1);
+    s->record     = NULL;
+
+    s_obj = Data_Wrap_Struct(class, 0, bp_schema_free, s);
+
+    for (i = 0; i < s->num_fields; i++) {
+        entry = rb_ary_entry(spec, i);
+        Check_Type(entry, T_ARRAY);
+
+        if (RARRAY_LEN(entry) != 2) {
+            rb_raise(rb_eArgError, "field %lu: expected [type, size]", i);
+        }
+
+        type = SYM2ID(rb_ary_entry(entry, 0));
+        n    = NUM2ULONG(rb_ary_entry(entry, 1));
+        f    = &s->fields[i];
+
+        memset(f, 0, sizeof(*f));
+        f->offset = offset;
+
+        if (type == rb_intern("uint") || type == rb_intern("sint")) {
+            f->type = type == rb_intern("uint") ? BITPACK_FIELD_UINT : BITPACK_FIELD_SINT;
+            f->bits = n;
+            f->size = 8;
+        }
+        else if (type == rb_intern("bytes")) {
+            f->type      = BITPACK_FIELD_BYTES;
+            f->num_bytes = n;
+        }
+        else if (type == rb_intern("varbytes")) {
+            if (n >= i || s->fields[n].type != BITPACK_FIELD_UINT ||
+                    s->fields[n].bits > BP_SCHEMA_MAX_LEN_BITS) {
+                rb_raise(rb_eArgError,
+                        "field %lu: length must be an earlier :uint field of at most %d bits",
+                        i, BP_SCHEMA_MAX_LEN_BITS);
+            }
+            f->type      = BITPACK_FIELD_VARBYTES;
+            f->len_field = n;
+            f->num_bytes = (1UL << s->fields[n].bits) - 1;
+        }
+        else {
+            rb_raise(rb_eArgError, "field %lu: unknown type :%s", i, rb_id2name(type));
+        }
+
+        offset += f->size + f->num_bytes;
+        offset += (8 - offset % 8) % 8;
+    }
+
+    s->record = ALLOC_N(unsigned char, offset + 1);
+    memset(s->record, 0, offset + 1);
+
+    s->schema = bitpack_schema_compile(s->fields, s->num_fields);
+
+    if (s->schema == NULL) {
+        rb_raise(rb_eArgError, "invalid schema");
+    }
+
+    return s_obj;
+}
+
+/*
+ * call-seq:
+ *   bp.append_record(schema, values)
+ *
+ * Append a record to the end of a BitPack object.
+ *
+ * Packs the Array +values+, one element per field of the BitPack::Schema
+ * +schema+.  Every value is checked before anything is packed, so the
+ * BitPack object is unchanged if an exception is raised.
+ *
+ * === Example
+ *
+ *   >> s = BitPack::Schema.new([[:uint, 3], [:sint, 5], [:bytes, 2]])
+ *   >> bp = BitPack.new
+ *   >> bp.append_record(s, [5, -1, "hi"])
+ *   => 101111110110100001101001
+ */
+static VALUE bp_append_record(VALUE self, VALUE schema, VALUE values)
+{
+    bitpack_t              bp;
+    bp_schema_t           *s;
+    const bitpack_field_t *f;
+    VALUE                  v;
+    unsigned long          i, len;
+    uint64_t               n;
+
+    Data_Get_Struct(self, struct _bitpack_t, bp);
+    bp_check_class(schema, cSchema);
+    Data_Get_Struct(schema, bp_schema_t, s);
+
+    Check_Type(values, T_ARRAY);
+
+    if ((unsigned long)RARRAY_LEN(values) != s->num_fields) {
+        rb_raise(rb_eArgError, "expected %lu values, got %ld",
+                s->num_fields, RARRAY_LEN(values));
+    }
+
+    for (i = 0; i < s->num_fields; i++) {
+        f = &s->fields[i];
+        v = rb_ary_entry(values, i);
+
+        switch (f->type) {
+        case BITPACK_FIELD_UINT:
+            n = NUM2ULL(v);
+            memcpy(s->record + f->offset, &n, 8);
+            break;
+        case BITPACK_FIELD_SINT:
+            n = (uint64_t)NUM2LL(v);
+            memcpy(s->record + f->offset, &n, 8);
+            break;
+        default:
+            StringValue(v);
+            if (f->type == BITPACK_FIELD_BYTES) {
+                len = f->num_bytes;
+            }
+            else {
+                memcpy(&n, s->record + s->fields[f->len_field].offset, 8);
+                if (n > f->num_bytes) {
+                    rb_raise(rb_eArgError, "field %lu: length %llu does not fit in %lu bits",
+                            i, (unsigned long long)n, s->fields[f->len_field].bits);
+                }
+                len = (unsigned long)n;
+            }
+            if ((unsigned long)RSTRING_LEN(v) != len) {
+                rb_raise(rb_eArgError, "field %lu: expected %lu bytes, got %ld",
+                        i, len, RSTRING_LEN(v));
+            }
+            memcpy(s->record + f->offset, RSTRING_PTR(v), len);
+            break;
+        }
+    }
+
+    if (!bitpack_append_record(bp, s->schema, s->record)) {
+        rb_raise(bp_exceptions[bitpack_get_error(bp)],
+                "%s", bitpack_get_error_str(bp));
+    }
+
+    return self;
+}
+
+/*
+ * call-seq:
+ *   bp.read_record(schema) -> Array
+ *
+ * Access a record at the current read position.
+ *
+ * Unpacks a record laid out by the BitPack::Schema +schema+ starting at
+ * the current read position and returns its fields as an Array.  The
+ * current read position is advanced past the record.
+ *
+ * === Example
+ *
+ *   >> s = BitPack::Schema.new([[:uint, 3], [:sint, 5], [:bytes, 2]])
+ *   >> bp = BitPack.from_bin("101111110110100001101001")
+ *   >> bp.read_record(s)
+ *   => [5, -1, "hi"]
+ */
+static VALUE bp_read_record(VALUE self, VALUE schema)
+{
+    bitpack_t              bp;
+    bp_schema_t           *s;
+    const bitpack_field_t *f;
+    VALUE                  values;
+    unsigned long          i;
+    uint64_t               n;
+
+    Data_Get_Struct(self, struct _bitpack_t, bp);
+    bp_check_class(schema, cSchema);
+    Data_Get_Struct(schema, bp_schema_t, s);
+
+    if (!bitpack_read_record(bp, s->schema, s->record)) {
+        rb_raise(bp_exceptions[bitpack_get_error(bp)],
+                "%s", bitpack_get_error_str(bp));
+    }
+
+    values = rb_ary_new2(s->num_fields);
+
+    for (i = 0; i < s->num_fields; i++) {
+        f = &s->fields[i];
+
+        switch (f->type) {
+        case BITPACK_FIELD_UINT:
+            memcpy(&n, s->record + f->offset, 8);
+            rb_ary_push(values, ULL2NUM(n));
+            break;
+        case BITPACK_FIELD_SINT:
+            memcpy(&n, s->record + f->offset, 8);
+            rb_ary_push(values, LL2NUM((long long)n));
+            break;
+        case BITPACK_FIELD_BYTES:
+            rb_ary_push(values, rb_str_new((char *)s->record + f->offset, f->num_bytes));
+            break;
+        default:
+            memcpy(&n, s->record + s->fields[f->len_field].offset, 8);
+            rb_ary_push(values, rb_str_new((char *)s->record + f->offset, (long)n));
+            break;
+        }
+    }
+
+    return values;
+}
+
+/* raise the error of the last operation on a streaming reader */
+static void bp_reader_raise(bitpack_reader_t r)
+{
+    rb_raise(bp_exceptions[bitpack_reader_get_error(r)],
+            "%s", bitpack_reader_get_error_str(r));
+}
+
+/* file descriptor of an IO object */
+static int bp_fileno(VALUE io)
+{
+    return NUM2INT(rb_funcall(io, rb_intern("fileno"), 0));
+}
+
+/* wrap a new reader, keeping a reference to the IO object it reads */
+static VALUE bp_reader_wrap(VALUE class, bitpack_reader_t r, VALUE io)
+{
+    VALUE r_obj;
+
+    if (r == NULL) {
+        rb_raise(bp_exceptions[BITPACK_ERR_MALLOC_FAILED], "failed to create reader");
+    }
+
+    r_obj = Data_Wrap_Struct(class, 0, bitpack_reader_destroy, r);
+
+    /* hidden instance variable that keeps the IO object alive */
+    rb_ivar_set(r_obj, rb_intern("__io__"), io);
+
+    return r_obj;
+}
+
+/*
+ * call-seq:
+ *   BitPack::Reader.new(io)         -> a new BitPack::Reader object
+ *   BitPack::Reader.new(io, window) -> a new BitPack::Reader object
+ *
+ * Creates a reader that decodes the bits of +io+ as they are read, through
+ * a window of +window+ bytes (4096 by default), so that streams of any size
+ * are read in constant memory.  The reader reads the file descriptor of
+ * +io+ directly, so +io+ should not be read from while the reader is in
+ * use, and any data already buffered by +io+ is not seen by the reader.
+ *
+ * === Example
+ *
+ *   >> r = BitPack::Reader.new(File.open("data.bin"))
+ *   >> r.read_bits(3)
+ *   => 5
+ *   >> r.pos
+ *   => 3
+ */
+static VALUE bp_reader_new(int argc, VALUE *argv, VALUE class)
+{
+    VALUE io;
+    VALUE window;
+
+    rb_scan_args(argc, argv, "11", &io, &window);
+
+    return bp_reader_wrap(class,
+            bitpack_reader_init_fd(bp_fileno(io), NIL_P(window) ? 4096 : NUM2ULONG(window)), io);
+}
+
+/*
+ * call-seq:
+ *   BitPack::Reader.mmap(file) -> a new BitPack::Reader object
+ *
+ * Creates a reader that decodes the bits of the File +file+ by mapping it
+ * into memory rather than reading it through a window.
+ */
+static VALUE bp_reader_mmap(VALUE class, VALUE io)
+{
+    bitpack_reader_t r;
+
+    r = bitpack_reader_init_mmap(bp_fileno(io));
+
+    if (r == NULL) {
+        rb_sys_fail("mmap");
+    }
+
+    return bp_reader_wrap(class, r, io);
+}
+
+/*
+ * call-seq:
+ *   r.pos -> Integer
+ *
+ * Returns the number of bits read from the start of the stream.
+ */
+static VALUE bp_reader_pos(VALUE self)
+{
+    bitpack_reader_t r;
+
+    Data_Get_Struct(self, struct _bitpack_reader_t, r);
+
+    return ULONG2NUM(bitpack_reader_pos(r));
+}
+
+/*
+ * call-seq:
+ *   r.order = order
+ *
+ * Sets the bit order the stream is decoded in, see BitPack#order=.
+ */
+static VALUE bp_reader_set_order(VALUE self, VALUE order)
+{
+    bitpack_reader_t r;
+
+    Data_Get_Struct(self, struct _bitpack_reader_t, r);
+
+    bitpack_reader_set_order(r, bp_order(order));
+
+    return order;
+}
+
+/*
+ * call-seq:
+ *   r.read_bits(num_bits) -> Integer
+ *
+ * Reads the next +num_bits+ bits of the stream, see BitPack#read_bits.
+ * Raises RangeError, without moving the position, if the stream ends
+ * first.
+ */
+static VALUE bp_reader_read_bits(VALUE self, VALUE num_bits)
+{
+    bitpack_reader_t r;
+    unsigned long    value;
+
+    Data_Get_Struct(self, struct _bitpack_reader_t, r);
+
+    if (!bitpack_reader_read_bits(r, NUM2ULONG(num_bits), &value)) {
+        bp_reader_raise(r);
+    }
+
+    return ULONG2NUM(value);
+}
+
+/*
+ * call-seq:
+ *   r.read_bytes(num_bytes) -> String
+ *
+ * Reads the next +num_bytes+ bytes of the stream, see BitPack#read_bytes.
+ * +num_bytes+ may be larger than the window.
+ */
+static VALUE bp_reader_read_bytes(VALUE self, VALUE num_bytes)
+{
+    bitpack_reader_t r;
+    unsigned long    n, done, chunk;
+    VALUE            str;
+
+    Data_Get_Struct(self, struct _bitpack_reader_t, r);
+
+    n   = NUM2ULONG(num_bytes);
+    str = rb_str_new(NULL, 0);
+
+    for (done = 0; done < n; done += chunk) {
+        chunk = done > BP_READER_MIN_CHUNK ? done : BP_READER_MIN_CHUNK;
+        if (chunk > n - done) {
+            chunk = n - done;
+        }
+
+        rb_str_resize(str, done + chunk);
+
+        if (!bitpack_reader_read_bytes_into(r, chunk, (unsigned char *)RSTRING_PTR(str) + done)) {
+            bp_reader_raise(r);
+        }
+    }
+
+    return str;
+}
+
+/* raise the error of the last operation on a streaming writer */
+static void bp_writer_raise(bitpack_writer_t w)
+{
+    rb_raise(bp_exceptions[bitpack_writer_get_error(w)],
+            "%s", bitpack_writer_get_error_str(w));
+}
+
+/*
+ * call-seq:
+ *   BitPack::Writer.new(io)         -> a new BitPack::Writer object
+ *   BitPack::Writer.new(io, buffer) -> a new BitPack::Writer object
+ *
+ * Creates a writer that packs bits into a buffer of +buffer+ bytes (4096 by
+ * default) and writes them to +io+ as the buffer fills up, so that streams
+ * of any size are written in constant memory.  The writer writes to the
+ * file descriptor of +io+ directly, so +io+ should be flushed before the
+ * writer is created and not written to while it is in use.  Call
+ * BitPack::Writer#finish to write out the last bits.
+ *
+ * === Example
+ *
+ *   >> w = BitPack::Writer.new(File.open("data.bin", "wb"))
+ *   >> w.append_bits(5, 3)
+ *   >> w.append_bytes("ruby")
+ *   >> w.finish
+ *   >> w.pos
+ *   => 40
+ */
+static VALUE bp_writer_new(int argc, VALUE *argv, VALUE class)
+{
+    VALUE            io;
+    VALUE            buffer;
+    VALUE            w_obj;
+    bitpack_writer_t w;
+
+    rb_scan_args(argc, argv, "11", &io, &buffer);
+
+    w = bitpack_writer_init_fd(bp_fileno(io), NIL_P(buffer) ? 4096 : NUM2ULONG(buffer));
+
+    if (w == NULL) {
+        rb_raise(bp_exceptions[BITPACK_ERR_MALLOC_FAILED], "malloc() failed");
+    }
+
+    w_obj = Data_Wrap_Struct(class, 0, bitpack_writer_destroy, w);
+
+    /* hidden instance variable that keeps the IO object alive */
+    rb_ivar_set(w_obj, rb_intern("__io__"), io);
+
+    return w_obj;
+}
+
+/*
+ * call-seq:
+ *   w.pos -> Integer
+ *
+ * Returns the number of bits appended since the start of the stream.
+ */
+static VALUE bp_writer_pos(VALUE self)
+{
+    bitpack_writer_t w;
+
+    Data_Get_Struct(self, struct _bitpack_writer_t, w);
+
+    return ULONG2NUM(bitpack_writer_pos(w));
+}
+
+/*
+ * call-seq:
+ *   w.order = order
+ *
+ * Sets the bit order the stream is encoded in, see BitPack#order=.
+ */
+static VALUE bp_writer_set_order(VALUE self, VALUE order)
+{
+    bitpack_writer_t w;
+
+    Data_Get_Struct(self, struct _bitpack_writer_t, w);
+
+    bitpack_writer_set_order(w, bp_order(order));
+
+    return order;
+}
+
+/*
+ * call-seq:
+ *   w.append_bits(value, num_bits)
+ *
+ * Appends +value+ to the stream in +num_bits+ bits, see
+ * BitPack#append_bits.
+ */
+static VALUE bp_writer_append_bits(VALUE self, VALUE value, VALUE num_bits)
+{
+    bitpack_writer_t w;
+
+    Data_Get_Struct(self, struct _bitpack_writer_t, w);
+
+    if (!bitpack_writer_append_bits(w, NUM2ULONG(value), NUM2ULONG(num_bits))) {
+        bp_writer_raise(w);
+    }
+
+    return self;
+}
+
+/*
+ * call-seq:
+ *   w.append_bytes(string)
+ *
+ * Appends the bytes of +string+ to the stream, see BitPack#append_bytes.
+ */
+static VALUE bp_writer_append_bytes(VALUE self, VALUE value)
+{
+    bitpack_writer_t w;
+    VALUE            str;
+
+    Data_Get_Struct(self, struct _bitpack_writer_t, w);
+
+    str = StringValue(value);
+
+    if (!bitpack_writer_append_bytes(w, (unsigned char *)RSTRING_PTR(str), RSTRING_LEN(str))) {
+        bp_writer_raise(w);
+    }
+
+    return self;
+}
+
+/*
+ * call-seq:
+ *   w.flush
+ *
+ * Writes out the full bytes appended so far.
+ */
+static VALUE bp_writer_flush(VALUE self)
+{
+    bitpack_writer_t w;
+
+    Data_Get_Struct(self, struct _bitpack_writer_t, w);
+
+    if (!bitpack_writer_flush(w)) {
+        bp_writer_raise(w);
+    }
+
+    return self;
+}
+
+/*
+ * call-seq:
+ *   w.finish
+ *
+ * Pads the stream with 0 bits to a byte boundary and writes out everything
+ * appended so far.
+ */
+static VALUE bp_writer_finish(VALUE self)
+{
+    bitpack_writer_t w;
+
+    Data_Get_Struct(self, struct _bitpack_writer_t, w);
+
+    if (!bitpack_writer_finish(w)) {
+        bp_writer_raise(w);
+    }
+
+    return self;
+}
+
+/*
+ * call-seq:
+ *   BitPack::Huffman.new(lengths) -> a new BitPack::Huffman object
+ *
+ * Builds the canonical prefix code, as used by DEFLATE, for the code
+ * lengths +lengths+ of the symbols 0, 1, ...  Symbols with a code length of
+ * 0 have no code.  Raises ArgumentError if a code length is longer than 24
+ * bits or there are more codes of some lengths than fit.
+ *
+ * === Example
+ *
+ *   >> h = BitPack::Huffman.new([2, 1, 3, 3])
+ *   >> bp = BitPack.new
+ *   >> bp.append_huffman_array(h, [0, 1, 2, 3])
+ *   => 100110111
+ */
+static VALUE bp_huffman_new(VALUE class, VALUE lengths)
+{
+    bitpack_huffman_t h;
+    unsigned char    *buf;
+    unsigned long     n, i, len;
+    VALUE             tmp;
+
+    Check_Type(lengths, T_ARRAY);
+
+    n = RARRAY_LEN(lengths);
+
+    /* a temporary buffer the GC reclaims if a conversion raises */
+    buf = ALLOCV_N(unsigned char, tmp, n + 1);
+
+    for (i = 0; i < n; i++) {
+        len    = NUM2ULONG(rb_ary_entry(lengths, i));
+        buf[i] = len < 255 ? len : 255;
+    }
+
+    h = bitpack_huffman_compile(buf, n);
+
+    ALLOCV_END(tmp);
+
+    if (h == NULL) {
+        rb_raise(rb_eArgError, "invalid code lengths");
+    }
+
+    return Data_Wrap_Struct(class, 0, bitpack_huffman_destroy, h);
+}
+
+/*
+ * call-seq:
+ *   bp.append_huffman(huffman, symbol)
+ *
+ * Append the code of +symbol+ in the prefix code +huffman+ (see
+ * BitPack::Huffman.new) to the end of a BitPack object.  Codes are stored
+ * with their first bit first in either bit order.
+ */
+static VALUE bp_append_huffman(VALUE self, VALUE huffman, VALUE symbol)
+{
+    bitpack_t         bp;
+    bitpack_huffman_t h;
+
+    Data_Get_Struct(self, struct _bitpack_t, bp);
+    bp_check_class(huffman, cHuffman);
+    Data_Get_Struct(huffman, struct _bitpack_huffman_t, h);
+
+    if (!bitpack_append_huffman(bp, h, NUM2ULONG(symbol))) {
+        rb_raise(bp_exceptions[bitpack_get_error(bp)],
+                "%s", bitpack_get_error_str(bp));
+    }
+
+    return self;
+}
+
+/*
+ * call-seq:
+ *   bp.read_huffman(huffman) -> Integer
+ *
+ * Decode a symbol in the prefix code +huffman+ at the current read
+ * position, and advance the read position past its code.
+ *
+ * === Example
+ *
+ *   >> h = BitPack::Huffman.new([2, 1, 3, 3])
+ *   >> bp = BitPack.from_bin("1110")
+ *   => 1110
+ *   >> bp.read_huffman(h)
+ *   => 3
+ *   >> bp.read_huffman(h)
+ *   => 1
+ */
+static VALUE bp_read_huffman(VALUE self, VALUE huffman)
+{
+    bitpack_t         bp;
+    bitpack_huffman_t h;
+    unsigned long     symbol;
+
+    Data_Get_Struct(self, struct _bitpack_t, bp);
+    bp_check_class(huffman, cHuffman);
+    Data_Get_Struct(huffman, struct _bitpack_huffman_t, h);
+
+    if (!bitpack_read_huffman(bp, h, &symbol)) {
+        rb_raise(bp_exceptions[bitpack_get_error(bp)],
+                "%s", bitpack_get_error_str(bp));
+    }
+
+    return ULONG2NUM(symbol);
+}
+
+/*
+ * call-seq:
+ *   bp.append_huffman_array(huffman, symbols)
+ *
+ * The same as calling BitPack#append_huffman for every element of
+ * +symbols+, but the BitPack object is unchanged if any of them has no
+ * code.
+ */
+static VALUE bp_append_huffman_array(VALUE self, VALUE huffman, VALUE symbols)
+{
+    bitpack_t         bp;
+    bitpack_huffman_t h;
+    unsigned long    *buf;
+    unsigned long     n, i;
+    VALUE             tmp;
+
+    Data_Get_Struct(self, struct _bitpack_t, bp);
+    bp_check_class(huffman, cHuffman);
+    Data_Get_Struct(huffman, struct _bitpack_huffman_t, h);
+
+    Check_Type(symbols, T_ARRAY);
+
+    n = RARRAY_LEN(symbols);
+
+    /* a temporary buffer the GC reclaims if a conversion raises */
+    buf = ALLOCV_N(unsigned long, tmp, n + 1);
+
+    for (i = 0; i < n; i++) {
+        buf[i] = NUM2ULONG(rb_ary_entry(symbols, i));
+    }
+
+    if (!bitpack_append_huffman_array(bp, h, buf, n)) {
+        ALLOCV_END(tmp);
+        rb_raise(bp_exceptions[bitpack_get_error(bp)],
+                "%s", bitpack_get_error_str(bp));
+    }
+
+    ALLOCV_END(tmp);
+
+    return self;
+}
+
+/*
+ * call-seq:
+ *   bp.read_huffman_array(huffman, n) -> Array
+ *
+ * Decode +n+ symbols in the prefix code +huffman+ at the current read
+ * position.  The current read position is advanced past the codes, or left
+ * unchanged if an exception is raised.
+ */
+static VALUE bp_read_huffman_array(VALUE self, VALUE huffman, VALUE num_symbols)
+{
+    bitpack_t         bp;
+    bitpack_huffman_t h;
+    unsigned long    *buf;
+    unsigned long     n, i;
+    VALUE             symbols;
+
+    Data_Get_Struct(self, struct _bitpack_t, bp);
+    bp_check_class(huffman, cHuffman);
+    Data_Get_Struct(huffman, struct _bitpack_huffman_t, h);
+
+    n   = NUM2ULONG(num_symbols);
+    buf = ALLOC_N(unsigned long, n + 1);
+
+    if (!bitpack_read_huffman_array(bp, h, buf, n)) {
+        xfree(buf);
+        rb_raise(bp_exceptions[bitpack_get_error(bp)],
+                "%s", bitpack_get_error_str(bp));
+    }
+
+    symbols = rb_ary_new2(n);
+
+    for (i = 0; i < n; i++) {
+        rb_ary_push(symbols, ULONG2NUM(buf[i]));
+    }
+
+    xfree(buf);
+
+    return symbols;
 }
 
 /*
@@ -628,15 +2953,38 @@ void Init_bitpack()
 
     rb_define_singleton_method(cBitPack, "new",        bp_new,        -1);
     rb_define_singleton_method(cBitPack, "from_bytes", bp_from_bytes,  1);
+    rb_define_singleton_method(cBitPack, "from_bin",   bp_from_bin,    1);
+    rb_define_singleton_method(cBitPack, "from_hex",   bp_from_hex,    1);
+    rb_define_singleton_method(cBitPack, "view",       bp_view,        1);
 
     rb_define_method(cBitPack, "size",            bp_size,             0);
     rb_define_method(cBitPack, "data_size",       bp_data_size,        0);
+    rb_define_method(cBitPack, "read_only?",      bp_read_only,        0);
+    rb_define_method(cBitPack, "order",           bp_get_order,        0);
+    rb_define_method(cBitPack, "order=",          bp_set_order,        1);
+    rb_define_method(cBitPack, "reserve",         bp_reserve,          1);
+    rb_define_method(cBitPack, "shrink_to_fit",   bp_shrink_to_fit,    0);
     rb_define_method(cBitPack, "read_pos",        bp_read_pos,         0);
     rb_define_method(cBitPack, "reset_read_pos",  bp_reset_read_pos,   0);
     rb_define_method(cBitPack, "on",              bp_on,               1);
     rb_define_method(cBitPack, "off",             bp_off,              1);
     rb_define_method(cBitPack, "get",             bp_get,              1);
     rb_define_method(cBitPack, "[]",              bp_get,              1);
+    rb_define_method(cBitPack, "rank",            bp_rank,             1);
+    rb_define_method(cBitPack, "select",          bp_select,           1);
+    rb_define_method(cBitPack, "fill_range",      bp_fill_range,       3);
+    rb_define_method(cBitPack, "copy_range",      bp_copy_range,       4);
+    rb_define_method(cBitPack, "insert_bits",     bp_insert_bits,      3);
+    rb_define_method(cBitPack, "delete_range",    bp_delete_range,     2);
+    rb_define_method(cBitPack, "shift_left",      bp_shift_left,       1);
+    rb_define_method(cBitPack, "shift_right",     bp_shift_right,      1);
+    rb_define_method(cBitPack, "count",           bp_count,           -1);
+    rb_define_method(cBitPack, "next_set",        bp_next_set,        -1);
+    rb_define_method(cBitPack, "each_set_bit",    bp_each_set_bit,     0);
+    rb_define_method(cBitPack, "&",               bp_and,              1);
+    rb_define_method(cBitPack, "|",               bp_or,               1);
+    rb_define_method(cBitPack, "^",               bp_xor,              1);
+    rb_define_method(cBitPack, "~",               bp_not,              0);
     rb_define_method(cBitPack, "set_bits",        bp_set_bits,         3);
     rb_define_method(cBitPack, "get_bits",        bp_get_bits,         2);
     rb_define_method(cBitPack, "set_bytes",       bp_set_bytes,        2);
@@ -647,7 +2995,64 @@ void Init_bitpack()
     rb_define_method(cBitPack, "read_bytes",      bp_read_bytes,       1);
     rb_define_method(cBitPack, "to_bin",          bp_to_bin,           0);
     rb_define_method(cBitPack, "to_s",            bp_to_bin,           0);
+    rb_define_method(cBitPack, "to_hex",          bp_to_hex,           0);
+    rb_define_method(cBitPack, "to_base64",       bp_to_base64,        0);
     rb_define_method(cBitPack, "to_bytes",        bp_to_bytes,         0);
+    rb_define_method(cBitPack, "set_sbits",       bp_set_sbits,        3);
+    rb_define_method(cBitPack, "get_sbits",       bp_get_sbits,        2);
+    rb_define_method(cBitPack, "append_sbits",    bp_append_sbits,     2);
+    rb_define_method(cBitPack, "read_sbits",      bp_read_sbits,       1);
+    rb_define_method(cBitPack, "append_zigzag",   bp_append_zigzag,    2);
+    rb_define_method(cBitPack, "read_zigzag",     bp_read_zigzag,      1);
+    rb_define_method(cBitPack, "set_le",          bp_set_le,           3);
+    rb_define_method(cBitPack, "get_le",          bp_get_le,           2);
+    rb_define_method(cBitPack, "append_le",       bp_append_le,        2);
+    rb_define_method(cBitPack, "read_le",         bp_read_le,          1);
+    rb_define_method(cBitPack, "set_be",          bp_set_be,           3);
+    rb_define_method(cBitPack, "get_be",          bp_get_be,           2);
+    rb_define_method(cBitPack, "append_be",       bp_append_be,        2);
+    rb_define_method(cBitPack, "read_be",         bp_read_be,          1);
+    rb_define_method(cBitPack, "append_array",    bp_append_array,     2);
+    rb_define_method(cBitPack, "read_array",      bp_read_array,       2);
+    rb_define_method(cBitPack, "append_vlc",      bp_append_vlc,      -1);
+    rb_define_method(cBitPack, "read_vlc",        bp_read_vlc,        -1);
+    rb_define_method(cBitPack, "append_vlc_array", bp_append_vlc_array, -1);
+    rb_define_method(cBitPack, "read_vlc_array",  bp_read_vlc_array,  -1);
+    rb_define_method(cBitPack, "append_huffman",  bp_append_huffman,   2);
+    rb_define_method(cBitPack, "read_huffman",    bp_read_huffman,     1);
+    rb_define_method(cBitPack, "append_huffman_array", bp_append_huffman_array, 2);
+    rb_define_method(cBitPack, "read_huffman_array", bp_read_huffman_array, 2);
+    rb_define_method(cBitPack, "append_record",   bp_append_record,    2);
+    rb_define_method(cBitPack, "read_record",     bp_read_record,      1);
+
+    cSchema = rb_define_class_under(cBitPack, "Schema", rb_cObject);
+
+    rb_define_singleton_method(cSchema, "new", bp_schema_new, 1);
+
+    cHuffman = rb_define_class_under(cBitPack, "Huffman", rb_cObject);
+
+    rb_define_singleton_method(cHuffman, "new", bp_huffman_new, 1);
+
+    cReader = rb_define_class_under(cBitPack, "Reader", rb_cObject);
+
+    rb_define_singleton_method(cReader, "new",  bp_reader_new,  -1);
+    rb_define_singleton_method(cReader, "mmap", bp_reader_mmap,  1);
+
+    rb_define_method(cReader, "pos",        bp_reader_pos,        0);
+    rb_define_method(cReader, "order=",     bp_reader_set_order,  1);
+    rb_define_method(cReader, "read_bits",  bp_reader_read_bits,  1);
+    rb_define_method(cReader, "read_bytes", bp_reader_read_bytes, 1);
+
+    cWriter = rb_define_class_under(cBitPack, "Writer", rb_cObject);
+
+    rb_define_singleton_method(cWriter, "new", bp_writer_new, -1);
+
+    rb_define_method(cWriter, "pos",          bp_writer_pos,          0);
+    rb_define_method(cWriter, "order=",       bp_writer_set_order,    1);
+    rb_define_method(cWriter, "append_bits",  bp_writer_append_bits,  2);
+    rb_define_method(cWriter, "append_bytes", bp_writer_append_bytes, 1);
+    rb_define_method(cWriter, "flush",        bp_writer_flush,        0);
+    rb_define_method(cWriter, "finish",       bp_writer_finish,       0);
 
     bp_exceptions[BITPACK_ERR_MALLOC_FAILED] = rb_eNoMemError;
     bp_exceptions[BITPACK_ERR_INVALID_INDEX] = rb_eRangeError;
@@ -655,6 +3060,13 @@ void Init_bitpack()
     bp_exceptions[BITPACK_ERR_RANGE_TOO_BIG] = rb_eRangeError;
     bp_exceptions[BITPACK_ERR_READ_PAST_END] = rb_eRangeError;
     bp_exceptions[BITPACK_ERR_EMPTY]         = rb_eRangeError;
+    bp_exceptions[BITPACK_ERR_READ_ONLY]     = rb_eRuntimeError;
+    bp_exceptions[BITPACK_ERR_BUFFER_TOO_SMALL] = rb_eArgError;
+    bp_exceptions[BITPACK_ERR_WIDE_VALUE_TOO_BIG] = rb_eArgError;
+    bp_exceptions[BITPACK_ERR_SIGNED_VALUE_TOO_BIG] = rb_eArgError;
+    bp_exceptions[BITPACK_ERR_NOT_ENCODABLE] = rb_eArgError;
+    bp_exceptions[BITPACK_ERR_INVALID_CODE]  = rb_eArgError;
+    bp_exceptions[BITPACK_ERR_IO_FAILED]     = rb_eIOError;
 
     /* require the pure ruby methods */
     rb_require("lib/bitpack.rb");
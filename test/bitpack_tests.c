@@ -1,6 +1,8 @@
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "CuTest.h"
 #include "bitpack.h"
@@ -153,7 +155,7 @@ static void test_bitpack_get_set_bits(CuTest *tc)
 
     CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_set_bits(bp, 0xffffffff, 32, 16));
     CuAssertIntEquals(tc, 48, bitpack_size(bp));
-    CuAssertIntEquals(tc, 6, bitpack_data_size(bp));
+    CuAssertIntEquals(tc, 8, bitpack_data_size(bp));
     CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_to_bin(bp, &s));
     CuAssertStrEquals(tc, "111111111011010111111111111111111111111111111111", s);
     free(s);
@@ -162,7 +164,7 @@ static void test_bitpack_get_set_bits(CuTest *tc)
 
     CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_set_bits(bp, 0, 8, 0));
     CuAssertIntEquals(tc, 48, bitpack_size(bp));
-    CuAssertIntEquals(tc, 6, bitpack_data_size(bp));
+    CuAssertIntEquals(tc, 8, bitpack_data_size(bp));
     CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_to_bin(bp, &s));
     CuAssertStrEquals(tc, "000000001011010111111111111111111111111111111111", s);
     free(s);
@@ -178,7 +180,7 @@ static void test_bitpack_get_set_bits(CuTest *tc)
             sizeof(unsigned long) * 8 + 1, sizeof(unsigned long) * 8);
     CuAssertStrEquals(tc, err_str, bitpack_get_error_str(bp));
     CuAssertIntEquals(tc, 48, bitpack_size(bp));
-    CuAssertIntEquals(tc, 6, bitpack_data_size(bp));
+    CuAssertIntEquals(tc, 8, bitpack_data_size(bp));
     CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_to_bin(bp, &s));
     CuAssertStrEquals(tc, "000000001011010111111111111111111111111111111111", s);
     free(s);
@@ -187,7 +189,7 @@ static void test_bitpack_get_set_bits(CuTest *tc)
     CuAssertIntEquals(tc, BITPACK_ERR_VALUE_TOO_BIG, bitpack_get_error(bp));
     CuAssertStrEquals(tc, "value 8 does not fit in 3 bits", bitpack_get_error_str(bp));
     CuAssertIntEquals(tc, 48, bitpack_size(bp));
-    CuAssertIntEquals(tc, 6, bitpack_data_size(bp));
+    CuAssertIntEquals(tc, 8, bitpack_data_size(bp));
     CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_to_bin(bp, &s));
     CuAssertStrEquals(tc, "000000001011010111111111111111111111111111111111", s);
     free(s);
@@ -216,6 +218,42 @@ static void test_bitpack_get_set_bits(CuTest *tc)
     bitpack_destroy(bp);
 }
 
+static void test_bitpack_get_set_wide_bits(CuTest *tc)
+{
+    bitpack_t     bp = NULL;
+    unsigned long value;
+    unsigned long expected;
+    unsigned long num_bits;
+    unsigned long index;
+    unsigned long i;
+    unsigned char bit;
+
+    bp = bitpack_init(4);
+
+    /* fields of every width at every bit offset, including ones that span 9 bytes */
+    for (num_bits = 1; num_bits <= sizeof(unsigned long) * 8; num_bits++) {
+        for (index = 0; index < 8; index++) {
+            expected = 0xa5c3f00fdeadbeefUL >> (sizeof(unsigned long) * 8 - num_bits);
+
+            CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_set_bits(bp, 0, 8, index + num_bits));
+            CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_set_bits(bp, expected, num_bits, index));
+            CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_get_bits(bp, num_bits, index, &value));
+            CuAssertTrue(tc, value == expected);
+
+            for (i = 0; i < num_bits; i++) {
+                CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_get(bp, index + i, &bit));
+                CuAssertIntEquals(tc, (expected >> (num_bits - i - 1)) & 1, bit);
+            }
+
+            /* the neighbouring bits must be left alone */
+            CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_get_bits(bp, 8, index + num_bits, &value));
+            CuAssertIntEquals(tc, 0, value);
+        }
+    }
+
+    bitpack_destroy(bp);
+}
+
 static void test_bitpack_get_set_bytes(CuTest *tc)
 {
     bitpack_t  bp = NULL;
@@ -242,7 +280,7 @@ static void test_bitpack_get_set_bytes(CuTest *tc)
 
     CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_set_bytes(bp, test_bytes2, 3, 24));
     CuAssertIntEquals(tc, 48, bitpack_size(bp));
-    CuAssertIntEquals(tc, 6, bitpack_data_size(bp));
+    CuAssertIntEquals(tc, 8, bitpack_data_size(bp));
     CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_to_bin(bp, &s));
     CuAssertStrEquals(tc, "000000010000001000000011111111111111111011111101", s);
     free(s);
@@ -253,7 +291,7 @@ static void test_bitpack_get_set_bytes(CuTest *tc)
     /* non-byte aligned set */
     CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_set_bytes(bp, test_bytes3, 6, 50));
     CuAssertIntEquals(tc, 98, bitpack_size(bp));
-    CuAssertIntEquals(tc, 13, bitpack_data_size(bp));
+    CuAssertIntEquals(tc, 16, bitpack_data_size(bp));
     CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_to_bin(bp, &s));
     CuAssertStrEquals(tc, "00000001000000100000001111111111111111101111110100101010101011101111001100110111011110111011111111", s);
     free(s);
@@ -278,6 +316,54 @@ static void test_bitpack_get_set_bytes(CuTest *tc)
     bitpack_destroy(bp);
 }
 
+static void test_bitpack_get_set_long_bytes(CuTest *tc)
+{
+    bitpack_t      bp = NULL;
+    unsigned char  test_bytes[300];
+    unsigned char *bytes;
+    unsigned long  value;
+    unsigned long  index;
+    unsigned long  i;
+
+    for (i = 0; i < sizeof(test_bytes); i++) {
+        test_bytes[i] = (unsigned char)(i * 37 + 11);
+    }
+
+    /* runs long enough for the vectorized copies, at every bit offset */
+    for (index = 0; index < 8; index++) {
+        bp = bitpack_init_default();
+
+        CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_set_bits(bp, 0x7f >> (7 - index), index, 0));
+        CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_append_bytes(bp, test_bytes, sizeof(test_bytes)));
+        CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_append_bits(bp, 0x5, 3));
+        CuAssertIntEquals(tc, index + sizeof(test_bytes) * 8 + 3, bitpack_size(bp));
+
+        for (i = 0; i < sizeof(test_bytes); i++) {
+            CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_get_bits(bp, 8, index + i * 8, &value));
+            CuAssertIntEquals(tc, test_bytes[i], value);
+        }
+
+        CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_get_bytes(bp, sizeof(test_bytes), index, &bytes));
+        CuAssertTrue(tc, memcmp(test_bytes, bytes, sizeof(test_bytes)) == 0);
+        free(bytes);
+
+        /* overwriting in the middle leaves the surrounding bits alone */
+        CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_set_bytes(bp, test_bytes + 100, 50, index + 8));
+        CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_get_bits(bp, index + 8, 0, &value));
+        CuAssertIntEquals(tc, ((0x7fUL >> (7 - index)) << 8) | test_bytes[0], value);
+        CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_get_bytes(bp, 50, index + 8, &bytes));
+        CuAssertTrue(tc, memcmp(test_bytes + 100, bytes, 50) == 0);
+        free(bytes);
+        CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_get_bytes(bp, 249, index + 51 * 8, &bytes));
+        CuAssertTrue(tc, memcmp(test_bytes + 51, bytes, 249) == 0);
+        free(bytes);
+        CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_get_bits(bp, 3, index + sizeof(test_bytes) * 8, &value));
+        CuAssertIntEquals(tc, 0x5, value);
+
+        bitpack_destroy(bp);
+    }
+}
+
 static void test_bitpack_append_bits(CuTest *tc)
 {
     bitpack_t  bp = NULL;
@@ -311,7 +397,7 @@ static void test_bitpack_append_bits(CuTest *tc)
 
     CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_append_bits(bp, 0xffffffff, 32));
     CuAssertIntEquals(tc, 48, bitpack_size(bp));
-    CuAssertIntEquals(tc, 6, bitpack_data_size(bp));
+    CuAssertIntEquals(tc, 8, bitpack_data_size(bp));
     CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_to_bin(bp, &s));
     CuAssertStrEquals(tc, "111111111011010111111111111111111111111111111111", s);
     free(s);
@@ -319,6 +405,45 @@ static void test_bitpack_append_bits(CuTest *tc)
     bitpack_destroy(bp);
 }
 
+static void test_bitpack_append_bits_unchecked(CuTest *tc)
+{
+    bitpack_t      bp = NULL;
+    char          *s  = NULL;
+    char           err_str[BITPACK_ERR_BUF_SIZE];
+    unsigned long  value;
+
+    bp = bitpack_init(4);
+
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_append_bits_unchecked(bp, 0xff, 8));
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_append_bits_unchecked(bp, 5, 3));
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_append_bits_unchecked(bp, 21, 5));
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_append_bits_unchecked(bp, 0xffffffff, 32));
+    CuAssertIntEquals(tc, 48, bitpack_size(bp));
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_to_bin(bp, &s));
+    CuAssertStrEquals(tc, "111111111011010111111111111111111111111111111111", s);
+    free(s);
+
+    /* bits above num_bits are dropped instead of being reported */
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_set_bits_unchecked(bp, 0xf2, 4, 8));
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_get_bits(bp, 8, 4, &value));
+    CuAssertIntEquals(tc, 0xf2, value);
+    CuAssertIntEquals(tc, 48, bitpack_size(bp));
+
+    /* the checked version still validates, also at full width */
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_append_bits(bp, 16, 4));
+    CuAssertIntEquals(tc, BITPACK_ERR_VALUE_TOO_BIG, bitpack_get_error(bp));
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_append_bits(bp, 1UL << 40, 40));
+    CuAssertIntEquals(tc, BITPACK_ERR_VALUE_TOO_BIG, bitpack_get_error(bp));
+    snprintf(err_str, sizeof(err_str), "value %lu does not fit in 40 bits", 1UL << 40);
+    CuAssertStrEquals(tc, err_str, bitpack_get_error_str(bp));
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_append_bits(bp, (1UL << 40) - 1, 40));
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_append_bits(bp, ~0UL, sizeof(unsigned long) * 8));
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_get_bits(bp, sizeof(unsigned long) * 8, 88, &value));
+    CuAssertTrue(tc, value == ~0UL);
+
+    bitpack_destroy(bp);
+}
+
 static void test_bitpack_append_bytes(CuTest *tc)
 {
     bitpack_t  bp = NULL;
@@ -341,7 +466,7 @@ static void test_bitpack_append_bytes(CuTest *tc)
 
     CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_append_bytes(bp, test_bytes2, 3));
     CuAssertIntEquals(tc, 48, bitpack_size(bp));
-    CuAssertIntEquals(tc, 6, bitpack_data_size(bp));
+    CuAssertIntEquals(tc, 8, bitpack_data_size(bp));
     CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_to_bin(bp, &s));
     CuAssertStrEquals(tc, "000000010000001000000011111111111111111011111101", s);
     free(s);
@@ -350,7 +475,7 @@ static void test_bitpack_append_bytes(CuTest *tc)
     CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_append_bits(bp, 0, 2));
     CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_append_bytes(bp, test_bytes3, 6));
     CuAssertIntEquals(tc, 98, bitpack_size(bp));
-    CuAssertIntEquals(tc, 13, bitpack_data_size(bp));
+    CuAssertIntEquals(tc, 16, bitpack_data_size(bp));
     CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_to_bin(bp, &s));
     CuAssertStrEquals(tc, "00000001000000100000001111111111111111101111110100101010101011101111001100110111011110111011111111", s);
     free(s);
@@ -561,6 +686,2108 @@ static void test_bitpack_from_bytes(CuTest *tc)
     bitpack_destroy(bp);
 }
 
+static void test_bitpack_reserve(CuTest *tc)
+{
+    bitpack_t     bp = NULL;
+    unsigned long i;
+    unsigned long value;
+
+    bp = bitpack_init(1);
+
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_reserve(bp, 1000));
+    CuAssertIntEquals(tc, 0, bitpack_size(bp));
+    CuAssertIntEquals(tc, 125, bitpack_data_size(bp));
+
+    /* reserving less than what is allocated is a no-op */
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_reserve(bp, 8));
+    CuAssertIntEquals(tc, 125, bitpack_data_size(bp));
+
+    for (i = 0; i < 100; i++) {
+        CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_append_bits(bp, i % 1024, 10));
+    }
+    CuAssertIntEquals(tc, 1000, bitpack_size(bp));
+    CuAssertIntEquals(tc, 125, bitpack_data_size(bp));
+
+    /* the allocation doubles once the reservation is exhausted */
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_append_bits(bp, 1, 1));
+    CuAssertIntEquals(tc, 1001, bitpack_size(bp));
+    CuAssertIntEquals(tc, 250, bitpack_data_size(bp));
+
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_shrink_to_fit(bp));
+    CuAssertIntEquals(tc, 1001, bitpack_size(bp));
+    CuAssertIntEquals(tc, 126, bitpack_data_size(bp));
+
+    for (i = 0; i < 100; i++) {
+        CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_read_bits(bp, 10, &value));
+        CuAssertIntEquals(tc, i % 1024, value);
+    }
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_read_bits(bp, 1, &value));
+    CuAssertIntEquals(tc, 1, value);
+
+    bitpack_destroy(bp);
+
+    bp = bitpack_init_default();
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_shrink_to_fit(bp));
+    CuAssertIntEquals(tc, 1, bitpack_data_size(bp));
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_append_bits(bp, 0xabcd, 16));
+    CuAssertIntEquals(tc, 2, bitpack_data_size(bp));
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_get_bits(bp, 16, 0, &value));
+    CuAssertIntEquals(tc, 0xabcd, value);
+
+    bitpack_destroy(bp);
+}
+
+static void test_bitpack_view(CuTest *tc)
+{
+    bitpack_t      bp = NULL;
+    unsigned char  bytes[] = { 0x1b, 0x91, 0xa2, 0xb3, 0xc0, 0xde, 0xad, 0xbe, 0xef };
+    unsigned char  copy[sizeof(bytes)];
+    unsigned char *value;
+    unsigned long  v;
+    char          *s;
+
+    memcpy(copy, bytes, sizeof(bytes));
+
+    bp = bitpack_view_init(bytes, 70);
+    CuAssertPtrNotNull(tc, bp);
+    CuAssertTrue(tc, bitpack_read_only(bp));
+    CuAssertIntEquals(tc, 70, bitpack_size(bp));
+    CuAssertIntEquals(tc, 9, bitpack_data_size(bp));
+
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_read_bits(bp, 5, &v));
+    CuAssertIntEquals(tc, 3, v);
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_read_bits(bp, 3, &v));
+    CuAssertIntEquals(tc, 3, v);
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_read_bits(bp, 29, &v));
+    CuAssertIntEquals(tc, 0x12345678, v);
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_read_bits(bp, 3, &v));
+    CuAssertIntEquals(tc, 0, v);
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_read_bytes(bp, 3, &value));
+    CuAssertTrue(tc, memcmp(bytes + 5, value, 3) == 0);
+    free(value);
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_read_bits(bp, 6, &v));
+    CuAssertIntEquals(tc, 0x3b, v);
+
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_to_bin(bp, &s));
+    CuAssertStrEquals(tc, "0001101110010001101000101011001111000000110111101010110110111110111011", s);
+    free(s);
+
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_read_bits(bp, 1, &v));
+    CuAssertIntEquals(tc, BITPACK_ERR_READ_PAST_END, bitpack_get_error(bp));
+
+    /* error cases */
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_on(bp, 0));
+    CuAssertIntEquals(tc, BITPACK_ERR_READ_ONLY, bitpack_get_error(bp));
+    CuAssertStrEquals(tc, "bitpack is read-only", bitpack_get_error_str(bp));
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_off(bp, 0));
+    CuAssertIntEquals(tc, BITPACK_ERR_READ_ONLY, bitpack_get_error(bp));
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_set_bits(bp, 1, 1, 3));
+    CuAssertIntEquals(tc, BITPACK_ERR_READ_ONLY, bitpack_get_error(bp));
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_append_bits(bp, 1, 1));
+    CuAssertIntEquals(tc, BITPACK_ERR_READ_ONLY, bitpack_get_error(bp));
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_append_bytes(bp, copy, 1));
+    CuAssertIntEquals(tc, BITPACK_ERR_READ_ONLY, bitpack_get_error(bp));
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_reserve(bp, 1000));
+    CuAssertIntEquals(tc, BITPACK_ERR_READ_ONLY, bitpack_get_error(bp));
+    CuAssertIntEquals(tc, 70, bitpack_size(bp));
+    CuAssertTrue(tc, memcmp(copy, bytes, sizeof(bytes)) == 0);
+
+    bitpack_destroy(bp);
+
+    bp = bitpack_init_default();
+    CuAssertTrue(tc, !bitpack_read_only(bp));
+
+    /* an owned bitpack made read-only */
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_append_bits(bp, 5, 3));
+    bitpack_set_read_only(bp);
+    CuAssertTrue(tc, bitpack_read_only(bp));
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_on(bp, 0));
+    CuAssertIntEquals(tc, BITPACK_ERR_READ_ONLY, bitpack_get_error(bp));
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_append_bits(bp, 1, 1));
+    CuAssertIntEquals(tc, BITPACK_ERR_READ_ONLY, bitpack_get_error(bp));
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_read_bits(bp, 3, &v));
+    CuAssertIntEquals(tc, 5, v);
+    bitpack_destroy(bp);
+}
+
+static void test_bitpack_into(CuTest *tc)
+{
+    bitpack_t      bp = NULL;
+    unsigned char  test_bytes[] = { 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff };
+    unsigned char  exp_bytes[] = { 0xd5, 0x5d, 0xe6, 0x6e, 0xf7, 0x7f, 0xc0 };
+    unsigned char  buf[16];
+    unsigned long  num_bytes;
+
+    bp = bitpack_init_default();
+    bitpack_append_bits(bp, 1, 1);
+    bitpack_append_bytes(bp, test_bytes, sizeof(test_bytes));
+    bitpack_append_bits(bp, 1, 1);
+
+    memset(buf, 0x55, sizeof(buf));
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_get_bytes_into(bp, 6, 1, buf));
+    CuAssertTrue(tc, memcmp(test_bytes, buf, 6) == 0);
+    CuAssertIntEquals(tc, 0x55, buf[6]);
+
+    memset(buf, 0x55, sizeof(buf));
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_to_bytes_into(bp, buf, &num_bytes));
+    CuAssertIntEquals(tc, sizeof(exp_bytes), num_bytes);
+    CuAssertTrue(tc, memcmp(exp_bytes, buf, sizeof(exp_bytes)) == 0);
+    CuAssertIntEquals(tc, 0x55, buf[sizeof(exp_bytes)]);
+
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_read_bits(bp, 1, &num_bytes));
+    memset(buf, 0x55, sizeof(buf));
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_read_bytes_into(bp, 6, buf));
+    CuAssertIntEquals(tc, 49, bitpack_read_pos(bp));
+    CuAssertTrue(tc, memcmp(test_bytes, buf, 6) == 0);
+
+    /* error cases */
+    memset(buf, 0x55, sizeof(buf));
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_read_bytes_into(bp, 1, buf));
+    CuAssertIntEquals(tc, BITPACK_ERR_READ_PAST_END, bitpack_get_error(bp));
+    CuAssertIntEquals(tc, 49, bitpack_read_pos(bp));
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_get_bytes_into(bp, 1, 50, buf));
+    CuAssertIntEquals(tc, BITPACK_ERR_INVALID_INDEX, bitpack_get_error(bp));
+    CuAssertIntEquals(tc, 0x55, buf[0]);
+
+    bitpack_destroy(bp);
+
+    /* stray bits after the end of a view are not copied out */
+    bp = bitpack_view_init(test_bytes, 12);
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_to_bytes_into(bp, buf, &num_bytes));
+    CuAssertIntEquals(tc, 2, num_bytes);
+    CuAssertIntEquals(tc, 0xaa, buf[0]);
+    CuAssertIntEquals(tc, 0xb0, buf[1]);
+    bitpack_destroy(bp);
+}
+
+static void test_bitpack_signed_bits(CuTest *tc)
+{
+    bitpack_t     bp;
+    long          value;
+    unsigned long u;
+    long          values[] = { 0, 1, -1, 2, -2, 63, -64, 1000000, -1000000 };
+    unsigned long i;
+
+    bp = bitpack_init(1);
+
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_append_sbits(bp, -1, 3));
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_append_sbits(bp, -4, 3));
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_append_sbits(bp, 3, 3));
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_append_sbits(bp, -1, 1));
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_append_sbits(bp, 0, 0));
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_append_sbits(bp, -9223372036854775807L - 1, 64));
+    CuAssertIntEquals(tc, 74, bitpack_size(bp));
+
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_get_bits(bp, 10, 0, &u));
+    CuAssertIntEquals(tc, 0x3c7, u);
+
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_read_sbits(bp, 3, &value));
+    CuAssertIntEquals(tc, -1, value);
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_read_sbits(bp, 3, &value));
+    CuAssertIntEquals(tc, -4, value);
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_read_sbits(bp, 3, &value));
+    CuAssertIntEquals(tc, 3, value);
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_read_sbits(bp, 1, &value));
+    CuAssertIntEquals(tc, -1, value);
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_read_sbits(bp, 0, &value));
+    CuAssertIntEquals(tc, 0, value);
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_read_sbits(bp, 64, &value));
+    CuAssertTrue(tc, value == -9223372036854775807L - 1);
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_get_sbits(bp, 3, 3, &value));
+    CuAssertIntEquals(tc, -4, value);
+
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_append_sbits(bp, 4, 3));
+    CuAssertIntEquals(tc, BITPACK_ERR_SIGNED_VALUE_TOO_BIG, bitpack_get_error(bp));
+    CuAssertStrEquals(tc, "value 4 does not fit in 3 bits", bitpack_get_error_str(bp));
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_append_sbits(bp, -5, 3));
+    CuAssertStrEquals(tc, "value -5 does not fit in 3 bits", bitpack_get_error_str(bp));
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_append_sbits(bp, -1, 0));
+    CuAssertIntEquals(tc, BITPACK_ERR_SIGNED_VALUE_TOO_BIG, bitpack_get_error(bp));
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_append_sbits(bp, 0, sizeof(long) * 8 + 1));
+    CuAssertIntEquals(tc, BITPACK_ERR_RANGE_TOO_BIG, bitpack_get_error(bp));
+    CuAssertIntEquals(tc, 74, bitpack_size(bp));
+
+    bitpack_destroy(bp);
+
+    /* zigzag */
+    bp = bitpack_init(1);
+
+    for (i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_append_zigzag_bits(bp, values[i], 21));
+    }
+
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_get_bits(bp, 21, 21 * 2, &u));
+    CuAssertIntEquals(tc, 1, u);
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_get_bits(bp, 21, 21 * 6, &u));
+    CuAssertIntEquals(tc, 127, u);
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_get_zigzag_bits(bp, 21, 21 * 4, &value));
+    CuAssertIntEquals(tc, -2, value);
+
+    for (i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_read_zigzag_bits(bp, 21, &value));
+        CuAssertIntEquals(tc, values[i], value);
+    }
+
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_append_zigzag_bits(bp, 1048576, 21));
+    CuAssertIntEquals(tc, BITPACK_ERR_SIGNED_VALUE_TOO_BIG, bitpack_get_error(bp));
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_append_zigzag_bits(bp, -1048576, 21));
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_append_zigzag_bits(bp, -9223372036854775807L - 1, 64));
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_read_zigzag_bits(bp, 21, &value));
+    CuAssertIntEquals(tc, -1048576, value);
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_read_zigzag_bits(bp, 64, &value));
+    CuAssertTrue(tc, value == -9223372036854775807L - 1);
+
+    bitpack_destroy(bp);
+}
+
+static void test_bitpack_wide_bits(CuTest *tc)
+{
+    bitpack_t     bp;
+    unsigned long words[4] = { 0x0123456789abcdefUL, 0xfedcba9876543210UL, 0x7UL, 0 };
+    unsigned long out[4];
+    unsigned long value;
+
+    bp = bitpack_init(1);
+    bitpack_append_bits(bp, 1, 1);
+
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_append_wide_bits(bp, words, 4, 131));
+    CuAssertIntEquals(tc, 132, bitpack_size(bp));
+
+    /* stored MSB first like a 3 bit field followed by two 64 bit fields */
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_get_bits(bp, 4, 0, &value));
+    CuAssertTrue(tc, value == 0xf);
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_get_bits(bp, 64, 4, &value));
+    CuAssertTrue(tc, value == 0xfedcba9876543210UL);
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_get_bits(bp, 64, 68, &value));
+    CuAssertTrue(tc, value == 0x0123456789abcdefUL);
+
+    memset(out, 0xff, sizeof(out));
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_get_wide_bits(bp, 131, 1, out, 4));
+    CuAssertTrue(tc, memcmp(words, out, sizeof(words)) == 0);
+
+    bitpack_read_bits(bp, 1, &value);
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_read_wide_bits(bp, 131, out, 3));
+    CuAssertTrue(tc, memcmp(words, out, 3 * sizeof(unsigned long)) == 0);
+    CuAssertIntEquals(tc, 132, bitpack_read_pos(bp));
+
+    /* error cases */
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_append_wide_bits(bp, words, 4, 130));
+    CuAssertIntEquals(tc, BITPACK_ERR_WIDE_VALUE_TOO_BIG, bitpack_get_error(bp));
+    CuAssertStrEquals(tc, "value of 131 bits does not fit in 130 bits", bitpack_get_error_str(bp));
+    CuAssertIntEquals(tc, 132, bitpack_size(bp));
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_get_wide_bits(bp, 131, 1, out, 2));
+    CuAssertIntEquals(tc, BITPACK_ERR_RANGE_TOO_BIG, bitpack_get_error(bp));
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_read_wide_bits(bp, 1, out, 1));
+    CuAssertIntEquals(tc, BITPACK_ERR_READ_PAST_END, bitpack_get_error(bp));
+
+    bitpack_destroy(bp);
+
+#ifdef BITPACK_HAVE_INT128
+    {
+        unsigned __int128 v128 = ((unsigned __int128)0xfedcba9876543210UL << 64) | 0x0123456789abcdefUL;
+        unsigned __int128 r128;
+
+        bp = bitpack_init_default();
+        bitpack_append_bits(bp, 1, 1);
+
+        CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_append_bits128(bp, v128, 128));
+        CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_append_bits128(bp, v128 >> 32, 96));
+        CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_append_bits128(bp, 5, 3));
+        CuAssertIntEquals(tc, 1 + 128 + 96 + 3, bitpack_size(bp));
+
+        CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_get_bits128(bp, 128, 1, &r128));
+        CuAssertTrue(tc, r128 == v128);
+        CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_get_bits128(bp, 96, 129, &r128));
+        CuAssertTrue(tc, r128 == v128 >> 32);
+        CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_get_bits128(bp, 3, 225, &r128));
+        CuAssertTrue(tc, r128 == 5);
+
+        CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_append_bits128(bp, v128, 127));
+        CuAssertIntEquals(tc, BITPACK_ERR_WIDE_VALUE_TOO_BIG, bitpack_get_error(bp));
+        CuAssertStrEquals(tc, "value of 128 bits does not fit in 127 bits", bitpack_get_error_str(bp));
+        CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_get_bits128(bp, 129, 0, &r128));
+        CuAssertIntEquals(tc, BITPACK_ERR_RANGE_TOO_BIG, bitpack_get_error(bp));
+
+        bitpack_destroy(bp);
+    }
+#endif
+}
+
+static void test_bitpack_text(CuTest *tc)
+{
+    bitpack_t      bp = NULL;
+    unsigned char  bytes[] = { 0x72, 0x75, 0x62, 0x79, 0xde, 0xad, 0xbe, 0xef, 0x01 };
+    unsigned long  value;
+    unsigned long  i;
+    char          *s;
+    char           bin[1001];
+
+    bp = bitpack_init_from_bytes(bytes, 4);
+
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_to_hex(bp, &s));
+    CuAssertStrEquals(tc, "72756279", s);
+    free(s);
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_to_base64(bp, &s));
+    CuAssertStrEquals(tc, "cnVieQ==", s);
+    free(s);
+
+    bitpack_append_bits(bp, 1, 1);
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_to_bin(bp, &s));
+    CuAssertStrEquals(tc, "011100100111010101100010011110011", s);
+    free(s);
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_to_hex(bp, &s));
+    CuAssertStrEquals(tc, "727562798", s);
+    free(s);
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_to_base64(bp, &s));
+    CuAssertStrEquals(tc, "cnVieYA=", s);
+    free(s);
+
+    bitpack_destroy(bp);
+
+    bp = bitpack_init_from_bytes(bytes, sizeof(bytes));
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_to_base64(bp, &s));
+    CuAssertStrEquals(tc, "cnVied6tvu8B", s);
+    free(s);
+    bitpack_destroy(bp);
+
+    /* stray bits after the end of a view are not dumped */
+    bp = bitpack_view_init(bytes + 4, 13);
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_to_bin(bp, &s));
+    CuAssertStrEquals(tc, "1101111010101", s);
+    free(s);
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_to_hex(bp, &s));
+    CuAssertStrEquals(tc, "dea8", s);
+    free(s);
+    bitpack_destroy(bp);
+
+    /* in LSB first order the digits follow the bits, not the bytes */
+    bp = bitpack_init_order(4, BITPACK_LSB_FIRST);
+    bitpack_append_bits(bp, 0xf, 4);
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_to_bin(bp, &s));
+    CuAssertStrEquals(tc, "1111", s);
+    free(s);
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_to_hex(bp, &s));
+    CuAssertStrEquals(tc, "f", s);
+    free(s);
+    bitpack_append_bits(bp, 0x72, 8);
+    bitpack_append_bits(bp, 1, 1);
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_to_bin(bp, &s));
+    CuAssertStrEquals(tc, "1111010011101", s);
+    free(s);
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_to_hex(bp, &s));
+    CuAssertStrEquals(tc, "f4e8", s);
+    bitpack_destroy(bp);
+    bp = bitpack_init_from_hex(s);
+    free(s);
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_to_bin(bp, &s));
+    CuAssertStrEquals(tc, "1111010011101000", s);
+    free(s);
+    bitpack_destroy(bp);
+
+    /* parsers */
+    bp = bitpack_init_from_bin("011100100111010101100010011110011");
+    CuAssertPtrNotNull(tc, bp);
+    CuAssertIntEquals(tc, 33, bitpack_size(bp));
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_to_hex(bp, &s));
+    CuAssertStrEquals(tc, "727562798", s);
+    free(s);
+    bitpack_destroy(bp);
+
+    bp = bitpack_init_from_hex("DEADbeef0");
+    CuAssertPtrNotNull(tc, bp);
+    CuAssertIntEquals(tc, 36, bitpack_size(bp));
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_get_bits(bp, 32, 0, &value));
+    CuAssertTrue(tc, value == 0xdeadbeef);
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_to_hex(bp, &s));
+    CuAssertStrEquals(tc, "deadbeef0", s);
+    free(s);
+    bitpack_destroy(bp);
+
+    bp = bitpack_init_from_bin("");
+    CuAssertPtrNotNull(tc, bp);
+    CuAssertIntEquals(tc, 0, bitpack_size(bp));
+    bitpack_destroy(bp);
+
+    /* long round trip */
+    for (i = 0; i < 1000; i++) {
+        bin[i] = (i * i / 7) % 3 == 0 ? '1' : '0';
+    }
+    bin[1000] = '\0';
+    bp = bitpack_init_from_bin(bin);
+    CuAssertPtrNotNull(tc, bp);
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_to_bin(bp, &s));
+    CuAssertStrEquals(tc, bin, s);
+    free(s);
+    bitpack_destroy(bp);
+
+    /* error cases */
+    CuAssertPtrEquals(tc, NULL, bitpack_init_from_bin("0101010120101010"));
+    CuAssertPtrEquals(tc, NULL, bitpack_init_from_bin("0101010101010101 "));
+    CuAssertPtrEquals(tc, NULL, bitpack_init_from_hex("abcdefg"));
+}
+
+struct test_record
+{
+    unsigned char  foo;
+    unsigned short bar;
+    unsigned char  baz[64];
+    signed char    temp;
+    long long      big;
+    unsigned long  full;
+    unsigned char  tag[3];
+};
+
+static void test_bitpack_schema(CuTest *tc)
+{
+    bitpack_field_t fields[] = {
+        BITPACK_UINT_FIELD(struct test_record, foo, 3),
+        BITPACK_UINT_FIELD(struct test_record, bar, 13),
+        BITPACK_VARBYTES_FIELD(struct test_record, baz, 1),
+        BITPACK_SINT_FIELD(struct test_record, temp, 7),
+        BITPACK_SINT_FIELD(struct test_record, big, 40),
+        BITPACK_UINT_FIELD(struct test_record, full, 64),
+        BITPACK_BYTES_FIELD(struct test_record, tag)
+    };
+    bitpack_field_t    bad[2];
+    bitpack_schema_t   schema;
+    bitpack_t          bp, expected;
+    struct test_record in, out;
+    unsigned char     *b1, *b2;
+    unsigned long      n1, n2;
+    unsigned long      value;
+
+    schema = bitpack_schema_compile(fields, 7);
+    CuAssertPtrNotNull(tc, schema);
+
+    memset(&in, 0, sizeof(in));
+    in.foo  = 5;
+    in.bar  = 11;
+    memcpy(in.baz, "hello world", 11);
+    in.temp = -64;
+    in.big  = -549755813888LL;
+    in.full = 0xfedcba9876543210UL;
+    memcpy(in.tag, "xyz", 3);
+
+    bp = bitpack_init(1);
+    bitpack_append_bits(bp, 1, 1);
+
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_append_record(bp, schema, &in));
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_append_record(bp, schema, &in));
+    CuAssertIntEquals(tc, 1 + 2 * (3 + 13 + 88 + 7 + 40 + 64 + 24), bitpack_size(bp));
+
+    /* the same record packed field by field */
+    expected = bitpack_init_default();
+    bitpack_append_bits(expected, 1, 1);
+    for (n1 = 0; n1 < 2; n1++) {
+        bitpack_append_bits(expected, 5, 3);
+        bitpack_append_bits(expected, 11, 13);
+        bitpack_append_bytes(expected, (unsigned char *)"hello world", 11);
+        bitpack_append_bits(expected, 0x40, 7);
+        bitpack_append_bits(expected, 0x8000000000UL, 40);
+        bitpack_append_bits(expected, 0xfedcba9876543210UL, 64);
+        bitpack_append_bytes(expected, (unsigned char *)"xyz", 3);
+    }
+
+    bitpack_to_bytes(bp, &b1, &n1);
+    bitpack_to_bytes(expected, &b2, &n2);
+    CuAssertIntEquals(tc, n2, n1);
+    CuAssertTrue(tc, memcmp(b1, b2, n1) == 0);
+    free(b1);
+    free(b2);
+    bitpack_destroy(expected);
+
+    bitpack_read_bits(bp, 1, &value);
+    memset(&out, 0, sizeof(out));
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_read_record(bp, schema, &out));
+    CuAssertIntEquals(tc, 1 + 3 + 13 + 88 + 7 + 40 + 64 + 24, bitpack_read_pos(bp));
+    CuAssertTrue(tc, memcmp(&in, &out, sizeof(in)) == 0);
+    memset(&out, 0, sizeof(out));
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_read_record(bp, schema, &out));
+    CuAssertTrue(tc, memcmp(&in, &out, sizeof(in)) == 0);
+    CuAssertIntEquals(tc, bitpack_size(bp), bitpack_read_pos(bp));
+
+    /* nothing is written if any value is out of range */
+    n1 = bitpack_size(bp);
+    in.temp = 64;
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_append_record(bp, schema, &in));
+    CuAssertIntEquals(tc, BITPACK_ERR_SIGNED_VALUE_TOO_BIG, bitpack_get_error(bp));
+    CuAssertStrEquals(tc, "value 64 does not fit in 7 bits", bitpack_get_error_str(bp));
+    in.temp = 0;
+    in.bar  = 65;
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_append_record(bp, schema, &in));
+    CuAssertIntEquals(tc, BITPACK_ERR_BUFFER_TOO_SMALL, bitpack_get_error(bp));
+    CuAssertStrEquals(tc, "byte run of 65 bytes does not fit in a 64 byte buffer",
+                      bitpack_get_error_str(bp));
+    CuAssertIntEquals(tc, n1, bitpack_size(bp));
+    bitpack_destroy(bp);
+
+    /* a truncated record */
+    bp = bitpack_init_default();
+    in.bar = 40;
+    bitpack_append_record(bp, schema, &in);
+    bitpack_set_bits(bp, 20, 13, 3);
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_read_record(bp, schema, &out));
+    CuAssertIntEquals(tc, 20, out.bar);
+    bitpack_reset_read_pos(bp);
+    bitpack_set_bits(bp, 60, 13, 3);
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_read_record(bp, schema, &out));
+    CuAssertIntEquals(tc, BITPACK_ERR_READ_PAST_END, bitpack_get_error(bp));
+    CuAssertIntEquals(tc, 0, bitpack_read_pos(bp));
+    bitpack_destroy(bp);
+
+    bitpack_schema_destroy(schema);
+
+    /* invalid descriptors */
+    bad[0] = fields[0];
+    bad[0].bits = 9;
+    CuAssertPtrEquals(tc, NULL, bitpack_schema_compile(bad, 1));
+    bad[0].bits = 0;
+    CuAssertPtrEquals(tc, NULL, bitpack_schema_compile(bad, 1));
+    bad[0] = fields[2];
+    bad[1] = fields[1];
+    CuAssertPtrEquals(tc, NULL, bitpack_schema_compile(bad, 2));
+}
+
+static void test_bitpack_uint_array(CuTest *tc)
+{
+    bitpack_t      bp, view;
+    uint32_t       in[100], out[100];
+    unsigned char *bytes;
+    unsigned long  num_bytes;
+    unsigned long  value;
+    unsigned long  i, n;
+    unsigned int   width, s;
+
+    for (width = 1; width <= 32; width++) {
+        for (i = 0; i < 100; i++) {
+            in[i] = (uint32_t)((i * 2654435761UL) >> (32 - width) & (0xffffffffUL >> (32 - width)));
+        }
+
+        for (s = 0; s < 8; s++) {
+            bp = bitpack_init(1);
+            bitpack_append_bits(bp, 0x5a >> (8 - s), s);
+
+            CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_append_uint_array(bp, in, 100, width));
+            CuAssertIntEquals(tc, s + 100 * width, bitpack_size(bp));
+
+            /* packed exactly like one append_bits per value */
+            for (i = 0; i < 100; i++) {
+                bitpack_get_bits(bp, width, s + i * width, &value);
+                CuAssertTrue(tc, value == in[i]);
+            }
+
+            /* unpack from a view so that the data ends exactly at the last byte */
+            bitpack_to_bytes(bp, &bytes, &num_bytes);
+            view = bitpack_view_init(bytes, bitpack_size(bp));
+
+            for (n = 0; n <= 100; n += 33) {
+                bitpack_reset_read_pos(view);
+                bitpack_read_bits(view, s, &value);
+                memset(out, 0, sizeof(out));
+                CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_read_uint_array(view, out, 100 - n, width));
+                CuAssertIntEquals(tc, s + (100 - n) * width, bitpack_read_pos(view));
+                CuAssertTrue(tc, memcmp(in, out, (100 - n) * sizeof(uint32_t)) == 0);
+            }
+
+            bitpack_destroy(view);
+            free(bytes);
+            bitpack_destroy(bp);
+        }
+    }
+
+    bp = bitpack_init_default();
+    in[0] = 7;
+    in[1] = 8;
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_append_uint_array(bp, in, 2, 3));
+    CuAssertIntEquals(tc, BITPACK_ERR_VALUE_TOO_BIG, bitpack_get_error(bp));
+    CuAssertStrEquals(tc, "value 8 does not fit in 3 bits", bitpack_get_error_str(bp));
+    CuAssertIntEquals(tc, 0, bitpack_size(bp));
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_append_uint_array(bp, in, 2, 33));
+    CuAssertIntEquals(tc, BITPACK_ERR_RANGE_TOO_BIG, bitpack_get_error(bp));
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_append_uint_array(bp, in, 2, 4));
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_read_uint_array(bp, out, 3, 4));
+    CuAssertIntEquals(tc, BITPACK_ERR_READ_PAST_END, bitpack_get_error(bp));
+    CuAssertIntEquals(tc, 0, bitpack_read_pos(bp));
+    bitpack_destroy(bp);
+}
+
+static void test_bitpack_vlc(CuTest *tc)
+{
+    static const unsigned long values[] = {
+        0, 1, 2, 3, 5, 127, 128, 300, 65535, 1UL << 31, 0xdeadbeefUL,
+        1UL << 55, (1UL << 56) - 1, 1UL << 62, 1UL << 63, ~0UL - 1, ~0UL
+    };
+    static const unsigned int params[] = {0, 1, 2, 5, 17, 63};
+    unsigned long  n = sizeof(values) / sizeof(values[0]);
+    unsigned long  in[sizeof(values) / sizeof(values[0])];
+    unsigned long  out[sizeof(values) / sizeof(values[0])];
+    bitpack_t      bp, view;
+    unsigned char *bytes, *array_bytes;
+    unsigned long  num_bytes;
+    unsigned long  value;
+    unsigned long  i, m;
+    unsigned int   codec, p, s;
+    char          *str;
+
+    /* known encodings */
+    bp = bitpack_init_default();
+    bitpack_append_gamma(bp, 1);
+    bitpack_append_gamma(bp, 5);
+    bitpack_append_delta(bp, 5);
+    bitpack_append_exp_golomb(bp, 3, 1);
+    bitpack_append_rice(bp, 9, 2);
+    bitpack_to_bin(bp, &str);
+    CuAssertStrEquals(tc, "1" "00101" "01101" "0101" "11001", str);
+    free(str);
+    bitpack_destroy(bp);
+
+    bp = bitpack_init_default();
+    bitpack_append_leb128(bp, 300);
+    bitpack_append_leb128(bp, 0);
+    bitpack_append_leb128(bp, ~0UL);
+    CuAssertIntEquals(tc, 8 * 13, bitpack_size(bp));
+    bitpack_get_bits(bp, 16, 0, &value);
+    CuAssertTrue(tc, value == 0xac02);
+    bitpack_get_bits(bp, 8, 96, &value);
+    CuAssertTrue(tc, value == 0x01);
+    bitpack_destroy(bp);
+
+    /* round trips at every bit offset, one at a time and as an array */
+    for (codec = BITPACK_VLC_LEB128; codec <= BITPACK_VLC_RICE; codec++) {
+        for (p = 0; p < sizeof(params) / sizeof(params[0]); p++) {
+            if (params[p] && codec != BITPACK_VLC_EXP_GOLOMB && codec != BITPACK_VLC_RICE) {
+                continue;
+            }
+
+            for (s = 0; s < 8; s++) {
+                bp = bitpack_init(1);
+                bitpack_append_bits(bp, 0x5a >> (8 - s), s);
+
+                /* keep the unary quotients of the Rice codes short */
+                for (i = 0, m = 0; i < n; i++) {
+                    in[m] = values[i];
+                    if (codec == BITPACK_VLC_RICE && params[p] < 44) {
+                        in[m] &= (1UL << (params[p] + 20)) - 1;
+                    }
+                    if (bitpack_append_vlc(bp, codec, params[p], in[m]) == BITPACK_RV_SUCCESS) {
+                        m++;
+                    }
+                    else {
+                        CuAssertIntEquals(tc, BITPACK_ERR_NOT_ENCODABLE, bitpack_get_error(bp));
+                        CuAssertTrue(tc, in[m] == 0 || codec == BITPACK_VLC_EXP_GOLOMB);
+                    }
+                }
+
+                /* read back from a view so that the data ends exactly at the last byte */
+                bitpack_to_bytes(bp, &bytes, &num_bytes);
+                view = bitpack_view_init(bytes, bitpack_size(bp));
+                bitpack_read_bits(view, s, &value);
+
+                for (i = 0; i < m; i++) {
+                    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_read_vlc(view, codec, params[p], &value));
+                    CuAssertTrue(tc, value == in[i]);
+                }
+                CuAssertIntEquals(tc, bitpack_size(view), bitpack_read_pos(view));
+
+                bitpack_reset_read_pos(view);
+                bitpack_read_bits(view, s, &value);
+                memset(out, 0, sizeof(out));
+                CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_read_vlc_array(view, codec, params[p], out, m));
+                CuAssertTrue(tc, memcmp(in, out, m * sizeof(unsigned long)) == 0);
+
+                /* the array version packs exactly the same bits */
+                bitpack_destroy(bp);
+                bp = bitpack_init(1);
+                bitpack_append_bits(bp, 0x5a >> (8 - s), s);
+                CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_append_vlc_array(bp, codec, params[p], in, m));
+                CuAssertIntEquals(tc, bitpack_size(view), bitpack_size(bp));
+                bitpack_to_bytes(bp, &array_bytes, &num_bytes);
+                CuAssertTrue(tc, memcmp(bytes, array_bytes, num_bytes) == 0);
+
+                free(array_bytes);
+                bitpack_destroy(view);
+                free(bytes);
+                bitpack_destroy(bp);
+            }
+        }
+    }
+
+    /* errors */
+    bp = bitpack_init_default();
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_append_gamma(bp, 0));
+    CuAssertIntEquals(tc, BITPACK_ERR_NOT_ENCODABLE, bitpack_get_error(bp));
+    CuAssertStrEquals(tc, "value 0 cannot be encoded with this code", bitpack_get_error_str(bp));
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_append_rice(bp, 1, 64));
+    CuAssertIntEquals(tc, BITPACK_ERR_RANGE_TOO_BIG, bitpack_get_error(bp));
+    out[0] = 3;
+    out[1] = 0;
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_append_vlc_array(bp, BITPACK_VLC_DELTA, 0, out, 2));
+    CuAssertIntEquals(tc, 0, bitpack_size(bp));
+
+    /* a truncated code doesn't move the read position */
+    bitpack_append_gamma(bp, 9);
+    bitpack_append_gamma(bp, 1000);
+    bitpack_to_bytes(bp, &bytes, &num_bytes);
+    view = bitpack_view_init(bytes, bitpack_size(bp) - 1);
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_read_vlc_array(view, BITPACK_VLC_GAMMA, 0, out, 2));
+    CuAssertIntEquals(tc, BITPACK_ERR_READ_PAST_END, bitpack_get_error(view));
+    CuAssertIntEquals(tc, 0, bitpack_read_pos(view));
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_read_gamma(view, &value));
+    CuAssertTrue(tc, value == 9);
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_read_gamma(view, &value));
+    CuAssertIntEquals(tc, BITPACK_ERR_READ_PAST_END, bitpack_get_error(view));
+    CuAssertIntEquals(tc, 7, bitpack_read_pos(view));
+    bitpack_destroy(view);
+    free(bytes);
+    bitpack_destroy(bp);
+
+    /* a 64 bit run of 0s is too long for a gamma code */
+    bp = bitpack_init_default();
+    bitpack_append_bits(bp, 0, 64);
+    bitpack_append_bits(bp, 1, 1);
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_read_gamma(bp, &value));
+    CuAssertIntEquals(tc, BITPACK_ERR_INVALID_CODE, bitpack_get_error(bp));
+    bitpack_destroy(bp);
+
+    /* and 11 LEB128 groups for a varint */
+    bp = bitpack_init_default();
+    for (i = 0; i < 10; i++) {
+        bitpack_append_bits(bp, 0x80, 8);
+    }
+    bitpack_append_bits(bp, 0, 8);
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_read_leb128(bp, &value));
+    CuAssertIntEquals(tc, BITPACK_ERR_INVALID_CODE, bitpack_get_error(bp));
+    bitpack_destroy(bp);
+}
+
+/* check the bits of a num_bits field at index one bit at a time, LSB first */
+static int lsb_field_matches(bitpack_t bp, unsigned long index, unsigned long num_bits, unsigned long value)
+{
+    unsigned char bit;
+    unsigned long j;
+
+    for (j = 0; j < num_bits; j++) {
+        bitpack_get(bp, index + j, &bit);
+        if (bit != ((value >> j) & 1)) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static void test_bitpack_lsb_order(CuTest *tc)
+{
+    static const unsigned char deflate[] = {0x03, 0x00};
+    struct test_record in, out;
+    bitpack_field_t    fields[] = {
+        BITPACK_UINT_FIELD(struct test_record, foo, 3),
+        BITPACK_UINT_FIELD(struct test_record, bar, 13),
+        BITPACK_VARBYTES_FIELD(struct test_record, baz, 1),
+        BITPACK_SINT_FIELD(struct test_record, temp, 7),
+        BITPACK_UINT_FIELD(struct test_record, full, 64),
+        BITPACK_BYTES_FIELD(struct test_record, tag)
+    };
+    bitpack_schema_t   schema;
+    bitpack_t          bp, expected, view;
+    unsigned char     *b1, *b2;
+    unsigned char      bytes[16];
+    unsigned long      words[2];
+    unsigned long      n1, n2;
+    unsigned long      value, v;
+    unsigned long      i, w;
+    uint32_t           ain[50], aout[50];
+    char              *str;
+
+    bp = bitpack_init_order(1, BITPACK_LSB_FIRST);
+    CuAssertIntEquals(tc, BITPACK_LSB_FIRST, bitpack_get_order(bp));
+
+    /* bit 0 is the low bit of the first byte, fields go in LSB first */
+    bitpack_on(bp, 0);
+    bitpack_append_bits(bp, 2, 2);
+    bitpack_append_bits(bp, 0x1ff, 9);
+    bitpack_to_bytes(bp, &b1, &n1);
+    CuAssertIntEquals(tc, 2, n1);
+    CuAssertIntEquals(tc, 0xfd, b1[0]);
+    CuAssertIntEquals(tc, 0x0f, b1[1]);
+    free(b1);
+    bitpack_to_bin(bp, &str);
+    CuAssertStrEquals(tc, "101111111111", str);
+    free(str);
+    bitpack_get_bits(bp, 5, 1, &value);
+    CuAssertTrue(tc, value == 0x1e);
+    bitpack_off(bp, 3);
+    bitpack_get_bits(bp, 9, 3, &value);
+    CuAssertTrue(tc, value == 0x1fe);
+    bitpack_destroy(bp);
+
+    /* a DEFLATE block header: BFINAL = 1, BTYPE = 01 */
+    bp = bitpack_init_from_bytes((unsigned char *)deflate, 2);
+    bitpack_set_order(bp, BITPACK_LSB_FIRST);
+    bitpack_read_bits(bp, 1, &value);
+    CuAssertTrue(tc, value == 1);
+    bitpack_read_bits(bp, 2, &value);
+    CuAssertTrue(tc, value == 1);
+    bitpack_destroy(bp);
+
+    /* every width at every offset, checked bit by bit */
+    for (w = 1; w <= 64; w++) {
+        bp = bitpack_init_order(1, BITPACK_LSB_FIRST);
+        v  = 0x9e3779b97f4a7c15UL >> (64 - w);
+
+        for (i = 0; i < 9; i++) {
+            bitpack_append_bits(bp, v, w);
+            bitpack_append_bits(bp, 1, i % 3);
+        }
+
+        for (i = 0, n1 = 0; i < 9; n1 += w + i % 3, i++) {
+            CuAssertTrue(tc, lsb_field_matches(bp, n1, w, v));
+            bitpack_get_bits(bp, w, n1, &value);
+            CuAssertTrue(tc, value == v);
+        }
+
+        bitpack_destroy(bp);
+    }
+
+    /* byte runs store each byte as an 8 bit field */
+    bp = bitpack_init_order(1, BITPACK_LSB_FIRST);
+    bitpack_append_bits(bp, 5, 3);
+    bitpack_append_bytes(bp, (unsigned char *)"bitpack, LSB first", 18);
+    for (i = 0; i < 18; i++) {
+        bitpack_get_bits(bp, 8, 3 + i * 8, &value);
+        CuAssertTrue(tc, value == (unsigned char)"bitpack, LSB first"[i]);
+    }
+    bitpack_get_bytes_into(bp, 16, 3, bytes);
+    CuAssertTrue(tc, memcmp(bytes, "bitpack, LSB fir", 16) == 0);
+    bitpack_destroy(bp);
+
+    /* multi-byte integers have the same bytes in either bit order */
+    for (i = 0; i < 2; i++) {
+        bp = bitpack_init_order(1, i ? BITPACK_LSB_FIRST : BITPACK_MSB_FIRST);
+        CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_append_le(bp, 0x123456, 3));
+        CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_append_be(bp, 0x123456, 3));
+        bitpack_to_bytes(bp, &b1, &n1);
+        CuAssertTrue(tc, memcmp(b1, "\x56\x34\x12\x12\x34\x56", 6) == 0);
+        free(b1);
+        CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_read_le(bp, 3, &value));
+        CuAssertTrue(tc, value == 0x123456);
+        CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_get_be(bp, 3, 24, &value));
+        CuAssertTrue(tc, value == 0x123456);
+        CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_get_le(bp, 6, 0, &value));
+        CuAssertTrue(tc, value == 0x563412123456UL);
+
+        CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_append_le(bp, 0x10000, 2));
+        CuAssertIntEquals(tc, BITPACK_ERR_VALUE_TOO_BIG, bitpack_get_error(bp));
+        CuAssertStrEquals(tc, "value 65536 does not fit in 16 bits", bitpack_get_error_str(bp));
+        CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_append_be(bp, 1, 9));
+        CuAssertIntEquals(tc, BITPACK_ERR_RANGE_TOO_BIG, bitpack_get_error(bp));
+        CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_read_le(bp, 4, &value));
+        CuAssertIntEquals(tc, BITPACK_ERR_READ_PAST_END, bitpack_get_error(bp));
+        CuAssertIntEquals(tc, 24, bitpack_read_pos(bp));
+        bitpack_destroy(bp);
+    }
+
+    /* in LSB first order a little-endian integer is just a field */
+    bp = bitpack_init_order(1, BITPACK_LSB_FIRST);
+    bitpack_append_bits(bp, 3, 3);
+    bitpack_append_le(bp, 0xfedcba9876543210UL, 8);
+    bitpack_get_bits(bp, 64, 3, &value);
+    CuAssertTrue(tc, value == 0xfedcba9876543210UL);
+    bitpack_destroy(bp);
+
+    /* wide fields go least significant word first */
+    bp = bitpack_init_order(1, BITPACK_LSB_FIRST);
+    words[0] = 0x0123456789abcdefUL;
+    words[1] = 0xfUL;
+    bitpack_append_bits(bp, 0, 5);
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_append_wide_bits(bp, words, 2, 70));
+    CuAssertTrue(tc, lsb_field_matches(bp, 5, 64, words[0]));
+    CuAssertTrue(tc, lsb_field_matches(bp, 69, 6, words[1]));
+    memset(words, 0, sizeof(words));
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_get_wide_bits(bp, 70, 5, words, 2));
+    CuAssertTrue(tc, words[0] == 0x0123456789abcdefUL && words[1] == 0xfUL);
+#ifdef BITPACK_HAVE_INT128
+    {
+        unsigned __int128 x;
+
+        bitpack_get_bits128(bp, 70, 5, &x);
+        CuAssertTrue(tc, (uint64_t)x == 0x0123456789abcdefUL && (uint64_t)(x >> 64) == 0xf);
+        x = ((unsigned __int128)0x2a << 64) | 7;
+        bitpack_set_bits128(bp, x, 72, 1);
+        CuAssertTrue(tc, lsb_field_matches(bp, 1, 64, 7));
+        CuAssertTrue(tc, lsb_field_matches(bp, 65, 8, 0x2a));
+    }
+#endif
+    bitpack_destroy(bp);
+
+    /* padding is masked in the right half of the last byte */
+    bytes[0] = 0xff;
+    view = bitpack_view_init(bytes, 3);
+    bitpack_set_order(view, BITPACK_LSB_FIRST);
+    bitpack_to_bytes(view, &b1, &n1);
+    CuAssertIntEquals(tc, 0x07, b1[0]);
+    free(b1);
+    bitpack_to_hex(view, &str);
+    CuAssertStrEquals(tc, "e", str);
+    free(str);
+    bitpack_destroy(view);
+
+    /* integer arrays */
+    for (w = 1; w <= 32; w++) {
+        for (i = 0; i < 50; i++) {
+            ain[i] = (uint32_t)((i * 2654435761UL) >> (32 - w) & (0xffffffffUL >> (32 - w)));
+        }
+
+        bp = bitpack_init_order(1, BITPACK_LSB_FIRST);
+        bitpack_append_bits(bp, 0x5a >> (8 - w % 8), w % 8);
+        CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_append_uint_array(bp, ain, 50, w));
+        for (i = 0; i < 50; i++) {
+            CuAssertTrue(tc, lsb_field_matches(bp, w % 8 + i * w, w, ain[i]));
+        }
+        bitpack_read_bits(bp, w % 8, &value);
+        memset(aout, 0, sizeof(aout));
+        CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_read_uint_array(bp, aout, 50, w));
+        CuAssertTrue(tc, memcmp(ain, aout, sizeof(ain)) == 0);
+        bitpack_destroy(bp);
+    }
+
+    /* records, compared with the same fields packed one by one */
+    schema = bitpack_schema_compile(fields, 6);
+    memset(&in, 0, sizeof(in));
+    in.foo  = 5;
+    in.bar  = 5;
+    memcpy(in.baz, "hello", 5);
+    in.temp = -3;
+    in.full = 0xfedcba9876543210UL;
+    memcpy(in.tag, "xyz", 3);
+
+    bp = bitpack_init_order(1, BITPACK_LSB_FIRST);
+    expected = bitpack_init_order(1, BITPACK_LSB_FIRST);
+    bitpack_append_bits(bp, 1, 1);
+    bitpack_append_bits(expected, 1, 1);
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_append_record(bp, schema, &in));
+    bitpack_append_bits(expected, 5, 3);
+    bitpack_append_bits(expected, 5, 13);
+    bitpack_append_bytes(expected, (unsigned char *)"hello", 5);
+    bitpack_append_sbits(expected, -3, 7);
+    bitpack_append_bits(expected, 0xfedcba9876543210UL, 64);
+    bitpack_append_bytes(expected, (unsigned char *)"xyz", 3);
+
+    bitpack_to_bytes(bp, &b1, &n1);
+    bitpack_to_bytes(expected, &b2, &n2);
+    CuAssertIntEquals(tc, n2, n1);
+    CuAssertTrue(tc, memcmp(b1, b2, n1) == 0);
+    free(b1);
+    free(b2);
+
+    bitpack_read_bits(bp, 1, &value);
+    memset(&out, 0, sizeof(out));
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_read_record(bp, schema, &out));
+    CuAssertTrue(tc, memcmp(&in, &out, sizeof(in)) == 0);
+    bitpack_destroy(expected);
+    bitpack_destroy(bp);
+    bitpack_schema_destroy(schema);
+
+    /* variable length codes are the same bit strings in either order */
+    bp = bitpack_init_order(1, BITPACK_LSB_FIRST);
+    bitpack_append_gamma(bp, 5);
+    bitpack_append_rice(bp, 9, 2);
+    bitpack_append_rice(bp, 200, 0);
+    bitpack_to_bin(bp, &str);
+    CuAssertIntEquals(tc, 10 + 201, strlen(str));
+    CuAssertTrue(tc, strncmp(str, "0010111001", 10) == 0);
+    free(str);
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_read_gamma(bp, &value));
+    CuAssertTrue(tc, value == 5);
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_read_rice(bp, &value, 2));
+    CuAssertTrue(tc, value == 9);
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_read_rice(bp, &value, 0));
+    CuAssertTrue(tc, value == 200);
+    bitpack_destroy(bp);
+
+    bp = bitpack_init_order(1, BITPACK_LSB_FIRST);
+    bitpack_append_bits(bp, 0, 4);
+    bitpack_append_leb128(bp, 300);
+    bitpack_append_leb128(bp, ~0UL);
+    bitpack_get_le(bp, 2, 4, &value);
+    CuAssertTrue(tc, value == 0x02ac);
+    bitpack_read_bits(bp, 4, &value);
+    bitpack_read_leb128(bp, &value);
+    CuAssertTrue(tc, value == 300);
+    bitpack_read_leb128(bp, &value);
+    CuAssertTrue(tc, value == ~0UL);
+    bitpack_destroy(bp);
+}
+
+static void test_bitpack_reader(CuTest *tc)
+{
+    bitpack_t        bp;
+    bitpack_reader_t r;
+    FILE            *f;
+    unsigned char   *bytes;
+    unsigned char    run[100];
+    unsigned char    buf[4];
+    unsigned long    value, v, w, i, num_bits, pos;
+    int              order, mmapped;
+    char             err[80];
+
+    for (i = 0; i < sizeof(run); i++) {
+        run[i] = (unsigned char)(i * 7 + 3);
+    }
+
+    for (order = BITPACK_MSB_FIRST; order <= BITPACK_LSB_FIRST; order++) {
+        /* fields of every width around a byte run longer than the window */
+        bp = bitpack_init_order(1, order);
+        for (i = 0; i < 300; i++) {
+            w = i % 64 + 1;
+            bitpack_append_bits(bp, (i * 0x9e3779b97f4a7c15UL) >> (64 - w), w);
+            if (i == 150) bitpack_append_bytes(bp, run, sizeof(run));
+        }
+        bitpack_append_bits(bp, 1, 3);
+        bitpack_to_bytes(bp, &bytes, &num_bits);
+        num_bits *= 8;
+        bitpack_destroy(bp);
+
+        f = tmpfile();
+        CuAssertPtrNotNull(tc, f);
+        fwrite(bytes, 1, num_bits / 8, f);
+        fflush(f);
+        free(bytes);
+
+        for (mmapped = 0; mmapped < 2; mmapped++) {
+            lseek(fileno(f), 0, SEEK_SET);
+            r = mmapped ? bitpack_reader_init_mmap(fileno(f)) : bitpack_reader_init_fd(fileno(f), 1);
+            CuAssertPtrNotNull(tc, r);
+            bitpack_reader_set_order(r, order);
+
+            for (i = 0, pos = 0; i < 300; i++) {
+                w = i % 64 + 1;
+                v = (i * 0x9e3779b97f4a7c15UL) >> (64 - w);
+                CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_reader_read_bits(r, w, &value));
+                CuAssertTrue(tc, value == v);
+                pos += w;
+
+                if (i == 150) {
+                    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS,
+                            bitpack_reader_read_bytes(r, sizeof(run), &bytes));
+                    CuAssertTrue(tc, memcmp(bytes, run, sizeof(run)) == 0);
+                    free(bytes);
+                    pos += sizeof(run) * 8;
+                }
+
+                CuAssertTrue(tc, bitpack_reader_pos(r) == pos);
+            }
+
+            CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_reader_read_bits(r, 65, &value));
+            CuAssertIntEquals(tc, BITPACK_ERR_RANGE_TOO_BIG, bitpack_reader_get_error(r));
+
+            /* the stream ends in the middle of the last byte */
+            v = num_bits - pos;
+            CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_reader_read_bits(r, v + 1, &value));
+            CuAssertIntEquals(tc, BITPACK_ERR_READ_PAST_END, bitpack_reader_get_error(r));
+            sprintf(err, "attempted to read past end of bitpack (last index is %lu)", num_bits - 1);
+            CuAssertStrEquals(tc, err, bitpack_reader_get_error_str(r));
+            CuAssertTrue(tc, bitpack_reader_pos(r) == pos);
+
+            CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_reader_read_bits(r, v, &value));
+            CuAssertTrue(tc, value == (order == BITPACK_MSB_FIRST ? 1UL << (v - 3) : 1));
+            CuAssertIntEquals(tc, BITPACK_ERR_CLEAR, bitpack_reader_get_error(r));
+            CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_reader_read_bytes_into(r, 1, buf));
+            CuAssertIntEquals(tc, BITPACK_ERR_READ_PAST_END, bitpack_reader_get_error(r));
+
+            bitpack_reader_destroy(r);
+        }
+
+        fclose(f);
+    }
+
+    /* byte runs far larger than the window stop at the end of the stream */
+    f = tmpfile();
+    fwrite(run, 1, sizeof(run), f);
+    fflush(f);
+    lseek(fileno(f), 0, SEEK_SET);
+    r = bitpack_reader_init_fd(fileno(f), 16);
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_reader_read_bits(r, 4, &value));
+    bytes = malloc(sizeof(run));
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_reader_read_bytes_into(r, sizeof(run), bytes));
+    CuAssertIntEquals(tc, BITPACK_ERR_READ_PAST_END, bitpack_reader_get_error(r));
+    CuAssertTrue(tc, bitpack_reader_pos(r) == sizeof(run) * 8 - 4);
+    for (i = 0; i < sizeof(run) - 1; i++) {
+        CuAssertIntEquals(tc, ((run[i] << 4) | (run[i + 1] >> 4)) & 0xff, bytes[i]);
+    }
+    free(bytes);
+    bitpack_reader_destroy(r);
+
+    /* an empty file is an empty stream */
+    CuAssertIntEquals(tc, 0, ftruncate(fileno(f), 0));
+    r = bitpack_reader_init_mmap(fileno(f));
+    CuAssertPtrNotNull(tc, r);
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_reader_read_bits(r, 1, &value));
+    CuAssertIntEquals(tc, BITPACK_ERR_READ_PAST_END, bitpack_reader_get_error(r));
+    bitpack_reader_destroy(r);
+    fclose(f);
+}
+
+struct test_sink
+{
+    bitpack_t     bp;
+    unsigned long calls;
+    int           fail;
+};
+
+static int test_sink_write(void *ctx, const unsigned char *bytes, unsigned long num_bytes)
+{
+    struct test_sink *sink = ctx;
+
+    sink->calls++;
+
+    if (sink->fail) {
+        errno = ENOSPC;
+        return BITPACK_RV_ERROR;
+    }
+
+    return bitpack_append_bytes(sink->bp, (unsigned char *)bytes, num_bytes);
+}
+
+static void test_bitpack_writer(CuTest *tc)
+{
+    struct test_sink  sink;
+    bitpack_t         expected;
+    bitpack_writer_t  w;
+    FILE             *f;
+    unsigned char    *b1, *b2;
+    unsigned char     run[100];
+    unsigned long     n1, n2, v, w_bits, i;
+    int               order, to_fd;
+    char              err[80];
+
+    for (i = 0; i < sizeof(run); i++) {
+        run[i] = (unsigned char)(i * 7 + 3);
+    }
+
+    for (order = BITPACK_MSB_FIRST; order <= BITPACK_LSB_FIRST; order++) {
+        for (to_fd = 0; to_fd < 2; to_fd++) {
+            f = tmpfile();
+            CuAssertPtrNotNull(tc, f);
+            sink.bp    = bitpack_init_default();
+            sink.calls = 0;
+            sink.fail  = 0;
+            expected   = bitpack_init_order(1, order);
+
+            w = to_fd ? bitpack_writer_init_fd(fileno(f), 1) : bitpack_writer_init_callback(test_sink_write, &sink, 1);
+            CuAssertPtrNotNull(tc, w);
+            bitpack_writer_set_order(w, order);
+
+            for (i = 0; i < 300; i++) {
+                w_bits = i % 64 + 1;
+                v      = (i * 0x9e3779b97f4a7c15UL) >> (64 - w_bits);
+                CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_writer_append_bits(w, v, w_bits));
+                bitpack_append_bits(expected, v, w_bits);
+
+                /* byte runs longer than the buffer, off and on a byte boundary */
+                if (i == 100 || i == 200) {
+                    if (i == 200) {
+                        CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_writer_finish(w));
+                        if (bitpack_size(expected) % 8) {
+                            bitpack_append_bits(expected, 0, 8 - bitpack_size(expected) % 8);
+                        }
+                    }
+                    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_writer_append_bytes(w, run, sizeof(run)));
+                    bitpack_append_bytes(expected, run, sizeof(run));
+                }
+
+                CuAssertTrue(tc, bitpack_writer_pos(w) == bitpack_size(expected));
+            }
+
+            CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_writer_append_bits(w, 2, 1));
+            CuAssertIntEquals(tc, BITPACK_ERR_VALUE_TOO_BIG, bitpack_writer_get_error(w));
+            CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_writer_append_bits(w, 0, 65));
+            CuAssertIntEquals(tc, BITPACK_ERR_RANGE_TOO_BIG, bitpack_writer_get_error(w));
+
+            CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_writer_append_bits(w, 1, 3));
+            bitpack_append_bits(expected, 1, 3);
+            CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_writer_finish(w));
+            CuAssertIntEquals(tc, BITPACK_ERR_CLEAR, bitpack_writer_get_error(w));
+            CuAssertTrue(tc, bitpack_writer_pos(w) == (bitpack_size(expected) + 7) / 8 * 8);
+            bitpack_writer_destroy(w);
+
+            bitpack_to_bytes(expected, &b1, &n1);
+
+            if (to_fd) {
+                n2 = ftell(f);
+                b2 = malloc(n2);
+                lseek(fileno(f), 0, SEEK_SET);
+                CuAssertTrue(tc, read(fileno(f), b2, n2) == (ssize_t)n2);
+            }
+            else {
+                /* the output went out in buffer sized pieces */
+                CuAssertTrue(tc, sink.calls > 50);
+                bitpack_to_bytes(sink.bp, &b2, &n2);
+            }
+
+            CuAssertTrue(tc, n1 == n2);
+            CuAssertTrue(tc, memcmp(b1, b2, n1) == 0);
+
+            free(b1);
+            free(b2);
+            bitpack_destroy(expected);
+            bitpack_destroy(sink.bp);
+            fclose(f);
+        }
+    }
+
+    /* output errors are reported with their errno */
+    sink.bp   = bitpack_init_default();
+    sink.fail = 1;
+    w = bitpack_writer_init_callback(test_sink_write, &sink, 16);
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_writer_append_bits(w, 1, 1));
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_writer_append_bytes(w, run, sizeof(run)));
+    CuAssertIntEquals(tc, BITPACK_ERR_IO_FAILED, bitpack_writer_get_error(w));
+    sprintf(err, "I/O failed with errno %d", ENOSPC);
+    CuAssertStrEquals(tc, err, bitpack_writer_get_error_str(w));
+    bitpack_writer_destroy(w);
+    bitpack_destroy(sink.bp);
+}
+
+static void test_bitpack_bitbuf(CuTest *tc)
+{
+    bitpack_bitbuf_t b;
+    bitpack_t        bp;
+    unsigned long    value, v, w, i, start;
+    int              order;
+
+    for (order = BITPACK_MSB_FIRST; order <= BITPACK_LSB_FIRST; order++) {
+        bp = bitpack_init_order(1, order);
+        bitpack_append_bits(bp, 5, 3);
+        for (i = 0; i < 200; i++) {
+            w = i % 56 + 1;
+            bitpack_append_bits(bp, (i * 0x9e3779b97f4a7c15UL) >> (64 - w), w);
+        }
+
+        /* start at an odd read position, peek then consume every field */
+        bitpack_read_bits(bp, 3, &value);
+        bitpack_bitbuf_init(&b, bp);
+        CuAssertTrue(tc, bitpack_bitbuf_pos(&b) == 3);
+
+        for (i = 0; i < 200; i++) {
+            w = i % 56 + 1;
+            v = (i * 0x9e3779b97f4a7c15UL) >> (64 - w);
+            bitpack_bitbuf_refill(&b);
+            CuAssertTrue(tc, bitpack_bitbuf_peek(&b, 0) == 0);
+            CuAssertTrue(tc, bitpack_bitbuf_peek(&b, w) == v);
+            if (w > 4) {
+                CuAssertTrue(tc, bitpack_bitbuf_peek(&b, 4) ==
+                        (order == BITPACK_MSB_FIRST ? v >> (w - 4) : v & 0xf));
+            }
+            bitpack_bitbuf_consume(&b, w);
+        }
+
+        CuAssertTrue(tc, bitpack_bitbuf_pos(&b) == bitpack_size(bp));
+        CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_bitbuf_finish(&b, bp));
+        CuAssertTrue(tc, bitpack_read_pos(bp) == bitpack_size(bp));
+
+        /* several fields per refill */
+        bitpack_reset_read_pos(bp);
+        bitpack_bitbuf_init(&b, bp);
+        start = 0;
+        bitpack_bitbuf_refill(&b);
+        CuAssertTrue(tc, bitpack_bitbuf_read(&b, 3) == 5);
+        for (i = 0; i < 30; i += 3) {
+            bitpack_bitbuf_refill(&b);
+            bitpack_get_bits(bp, 1 + i % 16, 3 + start, &v);
+            CuAssertTrue(tc, bitpack_bitbuf_read(&b, 1 + i % 16) == v);
+            bitpack_get_bits(bp, 2 + i % 16, 3 + start + 1 + i % 16, &v);
+            CuAssertTrue(tc, bitpack_bitbuf_read(&b, 2 + i % 16) == v);
+            bitpack_get_bits(bp, 3 + i % 16, 3 + start + 3 + 2 * (i % 16), &v);
+            CuAssertTrue(tc, bitpack_bitbuf_read(&b, 3 + i % 16) == v);
+            start += 6 + 3 * (i % 16);
+        }
+        CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_bitbuf_finish(&b, bp));
+        CuAssertTrue(tc, bitpack_read_pos(bp) == 3 + start);
+
+        /* reading past the end gives 0 bits and is reported by finish */
+        while (bitpack_size(bp) - bitpack_read_pos(bp) > 5) {
+            w = bitpack_size(bp) - bitpack_read_pos(bp) - 5;
+            bitpack_read_bits(bp, w < 64 ? w : 64, &value);
+        }
+        start = bitpack_read_pos(bp);
+        bitpack_bitbuf_init(&b, bp);
+        bitpack_bitbuf_refill(&b);
+        bitpack_get_bits(bp, 5, start, &v);
+        CuAssertTrue(tc, bitpack_bitbuf_read(&b, 5) == v);
+        CuAssertTrue(tc, bitpack_bitbuf_read(&b, 40) == 0);
+        CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_bitbuf_finish(&b, bp));
+        CuAssertIntEquals(tc, BITPACK_ERR_READ_PAST_END, bitpack_get_error(bp));
+        CuAssertTrue(tc, bitpack_read_pos(bp) == start);
+
+        bitpack_destroy(bp);
+    }
+}
+
+static void test_bitpack_huffman(CuTest *tc)
+{
+    static const unsigned char deflate[] = {0x4b, 0x04, 0x00};
+    unsigned char     lengths[288];
+    unsigned long     in[500], out[500];
+    unsigned long     value, i, j;
+    bitpack_huffman_t fixed, deep, h;
+    bitpack_t         bp;
+    int               order;
+
+    /* the DEFLATE fixed literal/length code */
+    for (i = 0; i < 288; i++) {
+        lengths[i] = i < 144 ? 8 : i < 256 ? 9 : i < 280 ? 7 : 8;
+    }
+    fixed = bitpack_huffman_compile(lengths, 288);
+    CuAssertPtrNotNull(tc, fixed);
+
+    bp = bitpack_init_default();
+    bitpack_append_huffman(bp, fixed, 0);
+    bitpack_append_huffman(bp, fixed, 144);
+    bitpack_append_huffman(bp, fixed, 256);
+    bitpack_append_huffman(bp, fixed, 287);
+    CuAssertIntEquals(tc, 32, bitpack_size(bp));
+    bitpack_get_bits(bp, 8, 0, &value);
+    CuAssertTrue(tc, value == 0x30);
+    bitpack_get_bits(bp, 9, 8, &value);
+    CuAssertTrue(tc, value == 0x190);
+    bitpack_get_bits(bp, 7, 17, &value);
+    CuAssertTrue(tc, value == 0);
+    bitpack_get_bits(bp, 8, 24, &value);
+    CuAssertTrue(tc, value == 0xc7);
+    bitpack_destroy(bp);
+
+    /* "a" compressed by zlib as a fixed Huffman DEFLATE block */
+    bp = bitpack_init_from_bytes((unsigned char *)deflate, 3);
+    bitpack_set_order(bp, BITPACK_LSB_FIRST);
+    bitpack_read_bits(bp, 3, &value);
+    CuAssertTrue(tc, value == 3);
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_read_huffman(bp, fixed, &value));
+    CuAssertTrue(tc, value == 'a');
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_read_huffman(bp, fixed, &value));
+    CuAssertTrue(tc, value == 256);
+    CuAssertIntEquals(tc, 18, bitpack_read_pos(bp));
+    bitpack_destroy(bp);
+
+    /* codes of 1 to 20 bits, most of them in secondary tables */
+    for (i = 0; i < 21; i++) {
+        lengths[i] = i < 20 ? i + 1 : 20;
+    }
+    deep = bitpack_huffman_compile(lengths, 21);
+    CuAssertPtrNotNull(tc, deep);
+
+    for (order = BITPACK_MSB_FIRST; order <= BITPACK_LSB_FIRST; order++) {
+        for (h = fixed, j = 0; j < 2; h = deep, j++) {
+            bp = bitpack_init_order(1, order);
+            for (i = 0; i < 500; i++) {
+                in[i] = (i * 2654435761UL >> 7) % (j ? 21 : 288);
+            }
+            bitpack_append_bits(bp, 5, 3);
+            CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_append_huffman_array(bp, h, in, 250));
+            for (i = 250; i < 500; i++) {
+                CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_append_huffman(bp, h, in[i]));
+            }
+
+            bitpack_read_bits(bp, 3, &value);
+            for (i = 0; i < 100; i++) {
+                CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_read_huffman(bp, h, &out[i]));
+                CuAssertTrue(tc, out[i] == in[i]);
+            }
+            memset(out, 0, sizeof(out));
+            CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_read_huffman_array(bp, h, out + 100, 400));
+            CuAssertTrue(tc, memcmp(in + 100, out + 100, 400 * sizeof(unsigned long)) == 0);
+            CuAssertTrue(tc, bitpack_read_pos(bp) == bitpack_size(bp));
+
+            CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_read_huffman(bp, h, &value));
+            CuAssertIntEquals(tc, BITPACK_ERR_READ_PAST_END, bitpack_get_error(bp));
+            bitpack_destroy(bp);
+        }
+    }
+
+    /* truncated codes */
+    bp = bitpack_init_default();
+    bitpack_append_huffman(bp, deep, 19);
+    bitpack_append_huffman(bp, deep, 18);
+    bitpack_append_bits(bp, 0x7ffff, 19);
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_read_huffman_array(bp, deep, out, 3));
+    CuAssertIntEquals(tc, BITPACK_ERR_READ_PAST_END, bitpack_get_error(bp));
+    CuAssertIntEquals(tc, 0, bitpack_read_pos(bp));
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_append_huffman(bp, deep, 21));
+    CuAssertIntEquals(tc, BITPACK_ERR_NOT_ENCODABLE, bitpack_get_error(bp));
+    CuAssertStrEquals(tc, "value 21 cannot be encoded with this code", bitpack_get_error_str(bp));
+    bitpack_destroy(bp);
+
+    /* an incomplete code: 1 bit code 0 only, so 1 is not a code */
+    lengths[0] = 1;
+    lengths[1] = 0;
+    h = bitpack_huffman_compile(lengths, 2);
+    CuAssertPtrNotNull(tc, h);
+    bp = bitpack_init_from_bin("0010");
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_read_huffman_array(bp, h, out, 3));
+    CuAssertIntEquals(tc, BITPACK_ERR_INVALID_CODE, bitpack_get_error(bp));
+    CuAssertStrEquals(tc, "invalid code at index 2", bitpack_get_error_str(bp));
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_append_huffman(bp, h, 1));
+    CuAssertIntEquals(tc, BITPACK_ERR_NOT_ENCODABLE, bitpack_get_error(bp));
+    bitpack_destroy(bp);
+    bitpack_huffman_destroy(h);
+
+    /* oversubscribed or too long code lengths */
+    lengths[0] = lengths[1] = lengths[2] = 1;
+    CuAssertPtrEquals(tc, NULL, bitpack_huffman_compile(lengths, 3));
+    lengths[0] = BITPACK_HUFFMAN_MAX_BITS + 1;
+    CuAssertPtrEquals(tc, NULL, bitpack_huffman_compile(lengths, 1));
+
+    bitpack_huffman_destroy(fixed);
+    bitpack_huffman_destroy(deep);
+}
+
+static void test_bitpack_rank_select(CuTest *tc)
+{
+    bitpack_t      bp;
+    unsigned char  bit;
+    unsigned long *ones;
+    unsigned long  num_ones, count, index, i, x;
+    int            order, density;
+
+    ones = malloc(70000 * sizeof(unsigned long));
+
+    for (order = BITPACK_MSB_FIRST; order <= BITPACK_LSB_FIRST; order++) {
+        for (density = 0; density < 3; density++) {
+            /* sparse, random and dense bitmaps */
+            bp = bitpack_init_order(1, order);
+            for (i = 0, x = 12345; i < 70000; i++) {
+                x = x * 6364136223846793005UL + 1442695040888963407UL;
+                bit = density == 0 ? (x >> 40) % 5000 == 0 : density == 1 ? (x >> 63) : (x >> 40) % 50 != 0;
+                bitpack_append_bits(bp, bit, 1);
+            }
+
+            for (i = 0, num_ones = 0; i < 70000; i++) {
+                bitpack_get(bp, i, &bit);
+                if (bit) ones[num_ones++] = i;
+            }
+
+            for (i = 0, count = 0; i <= 70000; i += 1 + i % 97) {
+                while (count < num_ones && ones[count] < i) count++;
+                CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_rank(bp, i, &x));
+                CuAssertTrue(tc, x == count);
+            }
+            CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_rank(bp, 70000, &x));
+            CuAssertTrue(tc, x == num_ones);
+
+            for (i = 0; i < num_ones; i += 1 + i % 13) {
+                CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_select(bp, i, &index));
+                CuAssertTrue(tc, index == ones[i]);
+            }
+            CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_select(bp, num_ones - 1, &index));
+            CuAssertTrue(tc, index == ones[num_ones - 1]);
+            CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_select(bp, num_ones, &index));
+            CuAssertIntEquals(tc, BITPACK_ERR_INVALID_INDEX, bitpack_get_error(bp));
+            CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_rank(bp, 70001, &x));
+            CuAssertIntEquals(tc, BITPACK_ERR_INVALID_INDEX, bitpack_get_error(bp));
+
+            /* modifications drop the index */
+            bitpack_off(bp, ones[0]);
+            bitpack_rank(bp, 70000, &x);
+            CuAssertTrue(tc, x == num_ones - 1);
+            bitpack_select(bp, 0, &index);
+            CuAssertTrue(tc, index == ones[1]);
+            bitpack_append_bits(bp, 7, 3);
+            bitpack_rank(bp, 70003, &x);
+            CuAssertTrue(tc, x == num_ones + 2);
+
+            bitpack_destroy(bp);
+        }
+    }
+
+    /* the index follows the bit order */
+    bp = bitpack_init_from_bin("0000000100000011");
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_build_rank_index(bp));
+    bitpack_select(bp, 0, &index);
+    CuAssertIntEquals(tc, 7, index);
+    bitpack_set_order(bp, BITPACK_LSB_FIRST);
+    bitpack_select(bp, 0, &index);
+    CuAssertIntEquals(tc, 0, index);
+    bitpack_rank(bp, 9, &x);
+    CuAssertIntEquals(tc, 2, x);
+    bitpack_destroy(bp);
+
+    /* an empty bitpack has no set bits */
+    bp = bitpack_init_default();
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_rank(bp, 0, &x));
+    CuAssertIntEquals(tc, 0, x);
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_select(bp, 0, &index));
+    bitpack_destroy(bp);
+
+    free(ones);
+}
+
+/* random bits of the given length and bit order */
+static bitpack_t bitop_random(unsigned long n, int order, unsigned long seed)
+{
+    bitpack_t     bp = bitpack_init_order(1, order);
+    unsigned long i;
+
+    for (i = 0; i < n; i++) {
+        seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+        bitpack_append_bits(bp, seed >> 63, 1);
+    }
+
+    return bp;
+}
+
+static unsigned char bitop_bit(bitpack_t bp, unsigned long i)
+{
+    unsigned char bit = 0;
+
+    if (i < bitpack_size(bp)) bitpack_get(bp, i, &bit);
+
+    return bit;
+}
+
+static unsigned char bitop_expect(unsigned char x, unsigned char y, bitpack_op_t op)
+{
+    switch (op) {
+        case BITPACK_OP_AND:    return x & y;
+        case BITPACK_OP_OR:     return x | y;
+        case BITPACK_OP_XOR:    return x ^ y;
+        case BITPACK_OP_ANDNOT: return x & !y;
+        default:                return !x;
+    }
+}
+
+static void test_bitpack_bitop(CuTest *tc)
+{
+    static const unsigned long sizes[][2] = {
+        {0, 0}, {1, 1}, {7, 13}, {64, 64}, {1000, 1000}, {1003, 517}, {130, 2049}
+    };
+    static const unsigned long ranges[][3] = {
+        {0, 0, 1000}, {8, 24, 900}, {3, 0, 777}, {0, 5, 513}, {13, 29, 64}, {1, 2, 3}, {999, 0, 100}
+    };
+
+    bitpack_t     a, b, dst, view;
+    unsigned char bytes[2] = {0xff, 0xff};
+    unsigned long i, t, an, bn, n;
+    char         *str;
+    int           op, oa, ob, alias;
+
+    for (op = BITPACK_OP_AND; op <= BITPACK_OP_NOT; op++) {
+        for (t = 0; t < sizeof(sizes) / sizeof(sizes[0]); t++) {
+            for (oa = 0; oa < 2; oa++) {
+                for (ob = 0; ob < 2; ob++) {
+                    /* into a new bitpack, in place in a and in place in b */
+                    for (alias = 0; alias < 3; alias++) {
+                        a   = bitop_random(sizes[t][0], oa, t);
+                        b   = bitop_random(sizes[t][1], ob, t + 100);
+                        an  = bitpack_size(a);
+                        bn  = bitpack_size(b);
+                        n   = op == BITPACK_OP_NOT ? an : an > bn ? an : bn;
+                        dst = alias == 0 ? bitop_random(3000, oa, 7) : alias == 1 ? bitop_random(an, oa, t) : bitop_random(bn, ob, t + 100);
+
+                        CuAssertIntEquals(tc, BITPACK_RV_SUCCESS,
+                            bitpack_bitop(dst, alias == 1 ? dst : a, alias == 2 ? dst : b, op));
+                        CuAssertTrue(tc, bitpack_size(dst) == n);
+
+                        for (i = 0; i < n; i++) {
+                            CuAssertIntEquals(tc, bitop_expect(bitop_bit(a, i), bitop_bit(b, i), op),
+                                              bitop_bit(dst, i));
+                        }
+
+                        bitpack_destroy(a);
+                        bitpack_destroy(b);
+                        bitpack_destroy(dst);
+                    }
+                }
+            }
+        }
+
+        /* ranges at unaligned offsets, in both bit orders */
+        for (t = 0; t < sizeof(ranges) / sizeof(ranges[0]); t++) {
+            for (oa = 0; oa < 2; oa++) {
+                for (ob = 0; ob < 2; ob++) {
+                    a   = bitop_random(1000, oa, t);
+                    b   = bitop_random(1100, ob, t + 100);
+                    dst = bitop_random(1000, oa, t);
+                    n   = ranges[t][2];
+
+                    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS,
+                        bitpack_bitop_range(dst, ranges[t][0], b, ranges[t][1], n, op));
+                    CuAssertTrue(tc, bitpack_size(dst) == (ranges[t][0] + n > 1000 ? ranges[t][0] + n : 1000));
+
+                    for (i = 0; i < bitpack_size(dst); i++) {
+                        if (i < ranges[t][0] || i >= ranges[t][0] + n) {
+                            CuAssertIntEquals(tc, bitop_bit(a, i), bitop_bit(dst, i));
+                        }
+                        else if (op == BITPACK_OP_NOT) {
+                            CuAssertIntEquals(tc, !bitop_bit(b, ranges[t][1] + i - ranges[t][0]), bitop_bit(dst, i));
+                        }
+                        else {
+                            CuAssertIntEquals(tc, bitop_expect(bitop_bit(a, i), bitop_bit(b, ranges[t][1] + i - ranges[t][0]), op),
+                                              bitop_bit(dst, i));
+                        }
+                    }
+
+                    bitpack_destroy(a);
+                    bitpack_destroy(b);
+                    bitpack_destroy(dst);
+                }
+            }
+        }
+    }
+
+    /* a dst that shrinks keeps no stale bits past its new end */
+    for (oa = 0; oa < 2; oa++) {
+        for (t = 0; t < 2; t++) {
+            op  = t == 0 ? BITPACK_OP_NOT : BITPACK_OP_OR;
+            a   = bitpack_init_order(1, oa);
+            dst = bitpack_init_order(2, oa);
+            bitpack_append_bits(a, 0, 4);
+            bitpack_append_bits(dst, 0xffff, 16);
+
+            CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_bitop(dst, a, a, op));
+            CuAssertTrue(tc, bitpack_size(dst) == 4);
+            CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_set_bits(dst, 1, 1, 11));
+            bitpack_to_bin(dst, &str);
+            CuAssertStrEquals(tc, op == BITPACK_OP_NOT ? "111100000001" : "000000000001", str);
+            free(str);
+
+            bitpack_destroy(a);
+            bitpack_destroy(dst);
+        }
+    }
+
+    /* the helper macros */
+    a = bitpack_init_from_bin("1100");
+    b = bitpack_init_from_bin("101010");
+    dst = bitpack_init_default();
+    bitpack_and_into(dst, a, b);
+    bitpack_to_bin(dst, &str);
+    CuAssertStrEquals(tc, "100000", str);
+    free(str);
+    bitpack_xor(a, b);
+    bitpack_to_bin(a, &str);
+    CuAssertStrEquals(tc, "011010", str);
+    free(str);
+    bitpack_not(a);
+    bitpack_to_bin(a, &str);
+    CuAssertStrEquals(tc, "100101", str);
+    free(str);
+
+    /* errors */
+    view = bitpack_view_init(bytes, 16);
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_or(view, a));
+    CuAssertIntEquals(tc, BITPACK_ERR_READ_ONLY, bitpack_get_error(view));
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_or(a, view));
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_bitop_range(dst, 7, b, 0, 1, BITPACK_OP_OR));
+    CuAssertIntEquals(tc, BITPACK_ERR_INVALID_INDEX, bitpack_get_error(dst));
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_bitop_range(dst, 0, b, 3, 4, BITPACK_OP_OR));
+    CuAssertIntEquals(tc, BITPACK_ERR_READ_PAST_END, bitpack_get_error(dst));
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_bitop_range(dst, 0, b, ~0UL - 7, 8, BITPACK_OP_OR));
+    CuAssertIntEquals(tc, BITPACK_ERR_RANGE_TOO_BIG, bitpack_get_error(dst));
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_bitop_range(dst, 6, b, 2, ~0UL - 4, BITPACK_OP_OR));
+    CuAssertIntEquals(tc, BITPACK_ERR_RANGE_TOO_BIG, bitpack_get_error(dst));
+    CuAssertTrue(tc, bitpack_size(dst) == 6);
+
+    bitpack_destroy(view);
+    bitpack_destroy(a);
+    bitpack_destroy(b);
+    bitpack_destroy(dst);
+}
+
+static void test_bitpack_scan(CuTest *tc)
+{
+    bitpack_t      bp;
+    unsigned char *bits;
+    unsigned char  bit;
+    unsigned long  size, count, index, length, i, j, k, x;
+    int            order, density;
+
+    bits = malloc(40000);
+
+    for (order = BITPACK_MSB_FIRST; order <= BITPACK_LSB_FIRST; order++) {
+        for (density = 0; density < 4; density++) {
+            /* sparse, random, dense and long runs */
+            size = 40000 - density * 13;
+            bp   = bitpack_init_order(1, order);
+            for (i = 0, x = 4321; i < size; i++) {
+                x = x * 6364136223846793005UL + 1442695040888963407UL;
+                bits[i] = density == 0 ? (x >> 40) % 3000 == 0 :
+                          density == 1 ? (x >> 63) :
+                          density == 2 ? (x >> 40) % 3000 != 0 : (i / 1500) % 2;
+                bitpack_append_bits(bp, bits[i], 1);
+            }
+
+            for (i = 0; i < size; i += 1 + i % 1013) {
+                for (j = i; j <= size; j += 1 + (j - i) * 3) {
+                    for (k = i, count = 0; k < j; k++) count += bits[k];
+                    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_popcount(bp, i, j - i, &x));
+                    CuAssertTrue(tc, x == count);
+                }
+            }
+            for (i = 0, count = 0; i < size; i++) count += bits[i];
+            bitpack_popcount(bp, 0, size, &x);
+            CuAssertTrue(tc, x == count);
+
+            for (i = 0; i <= size; i += 1 + i % 487) {
+                for (k = i; k < size && !bits[k]; k++);
+                CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_find_next_set(bp, i, &index));
+                CuAssertTrue(tc, index == k);
+
+                for (k = i; k < size && bits[k]; k++);
+                CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_find_next_clear(bp, i, &index));
+                CuAssertTrue(tc, index == k);
+
+                for (k = i; k > 0 && !bits[k - 1]; k--);
+                CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_find_prev_set(bp, i, &index));
+                CuAssertTrue(tc, index == (k ? k - 1 : size));
+
+                for (k = i; k > 0 && bits[k - 1]; k--);
+                CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_find_prev_clear(bp, i, &index));
+                CuAssertTrue(tc, index == (k ? k - 1 : size));
+            }
+
+            /* the runs cover the bitpack and alternate */
+            for (i = 0; i < size; i += length) {
+                CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_next_run(bp, i, &bit, &length));
+                CuAssertTrue(tc, length > 0);
+                for (k = i; k < i + length; k++) {
+                    CuAssertIntEquals(tc, bit, bits[k]);
+                }
+                if (i + length < size) {
+                    CuAssertIntEquals(tc, !bit, bits[i + length]);
+                }
+            }
+            CuAssertTrue(tc, i == size);
+
+            bitpack_destroy(bp);
+        }
+    }
+
+    /* errors */
+    bp = bitpack_init_from_bin("0010");
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_popcount(bp, 2, 3, &x));
+    CuAssertIntEquals(tc, BITPACK_ERR_READ_PAST_END, bitpack_get_error(bp));
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_find_next_set(bp, 5, &index));
+    CuAssertIntEquals(tc, BITPACK_ERR_INVALID_INDEX, bitpack_get_error(bp));
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_next_run(bp, 4, &bit, &length));
+    CuAssertIntEquals(tc, BITPACK_ERR_INVALID_INDEX, bitpack_get_error(bp));
+    bitpack_find_next_set(bp, 3, &index);
+    CuAssertIntEquals(tc, 4, index);
+    bitpack_destroy(bp);
+
+    free(bits);
+}
+
+static void test_bitpack_fill_copy(CuTest *tc)
+{
+    static const unsigned long ranges[][3] = {
+        {0, 0, 70000}, {8, 800, 8000}, {3, 3, 5000}, {5, 0, 4999}, {13, 4100, 64},
+        {1, 2, 3}, {4000, 4003, 3000}, {4003, 4000, 3000}, {69990, 100, 30}, {64, 0, 69936},
+        {3, 5, 69000}, {5, 3, 69000}
+    };
+
+    bitpack_t      bp, src;
+    unsigned char *bits, *src_bits, *expect;
+    unsigned long  size, i, t, di, si, n;
+    char          *str;
+    int            order, src_order;
+
+    bits     = malloc(70100);
+    src_bits = malloc(70100);
+    expect   = malloc(70100);
+
+    for (order = BITPACK_MSB_FIRST; order <= BITPACK_LSB_FIRST; order++) {
+        for (src_order = -1; src_order <= BITPACK_LSB_FIRST; src_order++) {
+            /* src_order -1 copies within the same bitpack */
+            for (t = 0; t < sizeof(ranges) / sizeof(ranges[0]); t++) {
+                bp  = bitop_random(70000, order, t);
+                src = src_order < 0 ? bp : bitop_random(70000, src_order, t + 50);
+                di  = ranges[t][0];
+                si  = ranges[t][1];
+                n   = ranges[t][2];
+
+                for (i = 0; i < 70000; i++) {
+                    bits[i]     = bitop_bit(bp, i);
+                    src_bits[i] = bitop_bit(src, i);
+                }
+
+                memcpy(expect, bits, 70000);
+                memmove(expect + di, src_bits + si, n);
+                size = di + n > 70000 ? di + n : 70000;
+
+                CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_copy_range(bp, di, src, si, n));
+                CuAssertTrue(tc, bitpack_size(bp) == size);
+                for (i = 0; i < size; i++) {
+                    CuAssertIntEquals(tc, expect[i], bitop_bit(bp, i));
+                }
+
+                /* fill the same range with 1s, then part of it with 0s */
+                if (src_order < 0) {
+                    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_set_range(bp, di, n));
+                    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_clear_range(bp, si, n / 2));
+                    memset(expect + di, 1, n);
+                    memset(expect + si, 0, n / 2);
+                    for (i = 0; i < size; i++) {
+                        CuAssertIntEquals(tc, expect[i], bitop_bit(bp, i));
+                    }
+                }
+                else {
+                    bitpack_destroy(src);
+                }
+
+                bitpack_destroy(bp);
+            }
+        }
+    }
+
+    /* growing past the end fills the gap with 0s */
+    bp = bitpack_init_from_bin("11");
+    bitpack_fill_range(bp, 5, 3, 1);
+    bitpack_to_bin(bp, &str);
+    CuAssertStrEquals(tc, "11000111", str);
+    free(str);
+    src = bitpack_init_from_bin("101");
+    bitpack_copy_range(bp, 10, src, 0, 3);
+    bitpack_to_bin(bp, &str);
+    CuAssertStrEquals(tc, "1100011100101", str);
+    free(str);
+
+    /* errors */
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_copy_range(bp, 0, src, 1, 3));
+    CuAssertIntEquals(tc, BITPACK_ERR_READ_PAST_END, bitpack_get_error(bp));
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_copy_range(bp, ~0UL - 7, src, 0, 8));
+    CuAssertIntEquals(tc, BITPACK_ERR_RANGE_TOO_BIG, bitpack_get_error(bp));
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_copy_range(bp, 0, src, ~0UL, 2));
+    CuAssertIntEquals(tc, BITPACK_ERR_RANGE_TOO_BIG, bitpack_get_error(bp));
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_fill_range(bp, 1UL << 63, 1UL << 63, 1));
+    CuAssertIntEquals(tc, BITPACK_ERR_RANGE_TOO_BIG, bitpack_get_error(bp));
+    CuAssertIntEquals(tc, 13, bitpack_size(bp));
+    bitpack_destroy(src);
+    src = bitpack_view_init(bits, 16);
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_fill_range(src, 0, 3, 1));
+    CuAssertIntEquals(tc, BITPACK_ERR_READ_ONLY, bitpack_get_error(src));
+    bitpack_destroy(src);
+    bitpack_destroy(bp);
+
+    free(bits);
+    free(src_bits);
+    free(expect);
+}
+
+static void test_bitpack_insert_delete_shift(CuTest *tc)
+{
+    bitpack_t      bp;
+    unsigned char *bits, *tmp;
+    unsigned long  size, i, k, n, index, value, x;
+    char          *str;
+    int            order, step;
+
+    bits = malloc(40000);
+    tmp  = malloc(40000);
+
+    for (order = BITPACK_MSB_FIRST; order <= BITPACK_LSB_FIRST; order++) {
+        bp   = bitop_random(20000, order, 99);
+        size = 20000;
+        for (i = 0; i < size; i++) bits[i] = bitop_bit(bp, i);
+
+        for (step = 0, x = 777; step < 60; step++) {
+            x     = x * 6364136223846793005UL + 1442695040888963407UL;
+            index = (x >> 20) % (size + 1);
+            n     = (x >> 50) % 65;
+
+            switch (step % 4) {
+                case 0:
+                    value = n ? (x >> 7) >> (64 - n) : 0;
+                    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_insert_bits(bp, value, n, index));
+                    memcpy(tmp, bits + index, size - index);
+                    memcpy(bits + index + n, tmp, size - index);
+                    for (k = 0; k < n; k++) {
+                        /* fields are stored least significant bit first in LSB first order */
+                        bits[index + k] = (value >> (order == BITPACK_LSB_FIRST ? k : n - 1 - k)) & 1;
+                    }
+                    size += n;
+                    break;
+                case 1:
+                    n = n * 40 % (size - index + 1);
+                    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_delete_range(bp, index, n));
+                    memmove(bits + index, bits + index + n, size - index - n);
+                    size -= n;
+                    break;
+                case 2:
+                    n = index / 3;
+                    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_shift_left(bp, n));
+                    memmove(bits, bits + n, size - n);
+                    memset(bits + size - n, 0, n);
+                    break;
+                default:
+                    n = index / 3;
+                    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_shift_right(bp, n));
+                    memmove(bits + n, bits, size - n);
+                    memset(bits, 0, n);
+                    break;
+            }
+
+            CuAssertTrue(tc, bitpack_size(bp) == size);
+            for (i = 0; i < size; i++) {
+                CuAssertIntEquals(tc, bits[i], bitop_bit(bp, i));
+            }
+        }
+
+        bitpack_destroy(bp);
+    }
+
+    bp = bitpack_init_from_bin("1111");
+    bitpack_insert_bits(bp, 2, 3, 2);
+    bitpack_to_bin(bp, &str);
+    CuAssertStrEquals(tc, "1101011", str);
+    free(str);
+    bitpack_delete_range(bp, 1, 4);
+    bitpack_to_bin(bp, &str);
+    CuAssertStrEquals(tc, "111", str);
+    free(str);
+    bitpack_shift_right(bp, 10);
+    bitpack_to_bin(bp, &str);
+    CuAssertStrEquals(tc, "000", str);
+    free(str);
+    bitpack_destroy(bp);
+
+    /* a gap opened after a delete reads as 0s, in both bit orders */
+    for (order = BITPACK_MSB_FIRST; order <= BITPACK_LSB_FIRST; order++) {
+        bp = bitpack_init_order(2, order);
+        bitpack_append_bits(bp, 0xffff, 16);
+        CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_delete_range(bp, 0, 8));
+        CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_on(bp, 15));
+        bitpack_to_bin(bp, &str);
+        CuAssertStrEquals(tc, "1111111100000001", str);
+        free(str);
+        CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_delete_range(bp, 3, 10));
+        CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_set_bits(bp, 1, 1, 20));
+        bitpack_to_bin(bp, &str);
+        CuAssertStrEquals(tc, "111001000000000000001", str);
+        free(str);
+        bitpack_destroy(bp);
+    }
+
+    bp = bitpack_init_from_bin("000");
+
+    /* errors */
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_insert_bits(bp, 1, 1, 4));
+    CuAssertIntEquals(tc, BITPACK_ERR_INVALID_INDEX, bitpack_get_error(bp));
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_insert_bits(bp, 4, 2, 0));
+    CuAssertIntEquals(tc, BITPACK_ERR_VALUE_TOO_BIG, bitpack_get_error(bp));
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_delete_range(bp, 1, 3));
+    CuAssertIntEquals(tc, BITPACK_ERR_READ_PAST_END, bitpack_get_error(bp));
+    CuAssertIntEquals(tc, BITPACK_RV_ERROR, bitpack_delete_range(bp, 2, ~0UL - 1));
+    CuAssertIntEquals(tc, BITPACK_ERR_READ_PAST_END, bitpack_get_error(bp));
+    CuAssertTrue(tc, bitpack_size(bp) == 3);
+    bitpack_destroy(bp);
+
+    free(bits);
+    free(tmp);
+}
+
+static void test_bitpack_arena(CuTest *tc)
+{
+    bitpack_arena_t arena;
+    bitpack_t       bps[20], first, big;
+    unsigned long   i, k, value, count;
+    int             round;
+
+    arena = bitpack_arena_init(256);
+    CuAssertPtrNotNull(tc, arena);
+
+    for (round = 0; round < 3; round++) {
+        for (k = 0; k < 20; k++) {
+            bps[k] = bitpack_init_in(arena, k % 3);
+            CuAssertPtrNotNull(tc, bps[k]);
+        }
+
+        if (round == 0) {
+            first = bps[0];
+        }
+        else {
+            /* a reset arena hands out the same memory again */
+            CuAssertPtrEquals(tc, first, bps[0]);
+        }
+
+        /* interleaved appends, so some grow in place and some move */
+        for (i = 0; i < 300; i++) {
+            for (k = 0; k < 20; k++) {
+                if (i < 20 + k * 10) {
+                    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_append_bits(bps[k], (i * 7 + k) % 32, 5));
+                }
+            }
+        }
+
+        for (k = 0; k < 20; k++) {
+            CuAssertTrue(tc, bitpack_size(bps[k]) == (20 + k * 10) * 5);
+            for (i = 0; i < 20 + k * 10; i++) {
+                bitpack_get_bits(bps[k], 5, i * 5, &value);
+                CuAssertTrue(tc, value == (i * 7 + k) % 32);
+            }
+        }
+
+        /* bigger than a block, then shrunk as the last allocation */
+        big = bitpack_init_in(arena, 1000);
+        CuAssertPtrNotNull(tc, big);
+        bitpack_set_range(big, 0, 7900);
+        bitpack_popcount(big, 0, 7900, &count);
+        CuAssertTrue(tc, count == 7900);
+        CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_shrink_to_fit(big));
+        CuAssertTrue(tc, bitpack_data_size(big) == 988);
+
+        /* destroying an arena object only frees its heap allocations */
+        bitpack_rank(bps[19], 10, &count);
+        bitpack_get_error_str(bps[19]);
+        bitpack_destroy(bps[19]);
+
+        bitpack_arena_reset(arena);
+    }
+
+    bitpack_arena_destroy(arena);
+}
+
+static void test_bitpack_inline_data(CuTest *tc)
+{
+    bitpack_t     bp;
+    unsigned long i, value;
+
+    /* small bitpacks keep their data inside the object until they outgrow it */
+    bp = bitpack_init(4);
+    CuAssertTrue(tc, bp->data == bp->inline_data);
+    CuAssertIntEquals(tc, 4, bitpack_data_size(bp));
+
+    for (i = 0; i < BITPACK_INLINE_DATA_SIZE; i++) {
+        bitpack_append_bits(bp, i, 8);
+    }
+    CuAssertTrue(tc, bp->data == bp->inline_data);
+    CuAssertIntEquals(tc, BITPACK_INLINE_DATA_SIZE, bitpack_data_size(bp));
+
+    bitpack_append_bits(bp, 0x5a, 8);
+    CuAssertTrue(tc, bp->data != bp->inline_data);
+    CuAssertIntEquals(tc, 2 * BITPACK_INLINE_DATA_SIZE, bitpack_data_size(bp));
+
+    for (i = 0; i < BITPACK_INLINE_DATA_SIZE; i++) {
+        bitpack_get_bits(bp, 8, i * 8, &value);
+        CuAssertTrue(tc, value == i);
+    }
+    bitpack_get_bits(bp, 8, BITPACK_INLINE_DATA_SIZE * 8, &value);
+    CuAssertTrue(tc, value == 0x5a);
+
+    /* and move back in when shrunk to fit */
+    bitpack_delete_range(bp, 0, 100);
+    CuAssertIntEquals(tc, BITPACK_RV_SUCCESS, bitpack_shrink_to_fit(bp));
+    CuAssertTrue(tc, bp->data == bp->inline_data);
+    CuAssertIntEquals(tc, 53, bitpack_data_size(bp));
+    bitpack_get_bits(bp, 8, 4, &value);
+    CuAssertTrue(tc, value == 13);
+    bitpack_destroy(bp);
+
+    /* bigger ones are allocated separately */
+    bp = bitpack_init(BITPACK_INLINE_DATA_SIZE + 1);
+    CuAssertTrue(tc, bp->data != bp->inline_data);
+    bitpack_destroy(bp);
+}
+
 static CuSuite *bitpack_get_suite(void)
 {
     CuSuite *suite = CuSuiteNew();
@@ -568,13 +2795,37 @@ static CuSuite *bitpack_get_suite(void)
     SUITE_ADD_TEST(suite, test_bitpack_constructor);
     SUITE_ADD_TEST(suite, test_bitpack_get_on_off);
     SUITE_ADD_TEST(suite, test_bitpack_get_set_bits);
+    SUITE_ADD_TEST(suite, test_bitpack_get_set_wide_bits);
     SUITE_ADD_TEST(suite, test_bitpack_get_set_bytes);
+    SUITE_ADD_TEST(suite, test_bitpack_get_set_long_bytes);
     SUITE_ADD_TEST(suite, test_bitpack_append_bits);
+    SUITE_ADD_TEST(suite, test_bitpack_append_bits_unchecked);
     SUITE_ADD_TEST(suite, test_bitpack_append_bytes);
     SUITE_ADD_TEST(suite, test_bitpack_read_bits);
     SUITE_ADD_TEST(suite, test_bitpack_read_bytes);
     SUITE_ADD_TEST(suite, test_bitpack_to_bytes);
     SUITE_ADD_TEST(suite, test_bitpack_from_bytes);
+    SUITE_ADD_TEST(suite, test_bitpack_reserve);
+    SUITE_ADD_TEST(suite, test_bitpack_view);
+    SUITE_ADD_TEST(suite, test_bitpack_into);
+    SUITE_ADD_TEST(suite, test_bitpack_signed_bits);
+    SUITE_ADD_TEST(suite, test_bitpack_wide_bits);
+    SUITE_ADD_TEST(suite, test_bitpack_text);
+    SUITE_ADD_TEST(suite, test_bitpack_schema);
+    SUITE_ADD_TEST(suite, test_bitpack_uint_array);
+    SUITE_ADD_TEST(suite, test_bitpack_vlc);
+    SUITE_ADD_TEST(suite, test_bitpack_lsb_order);
+    SUITE_ADD_TEST(suite, test_bitpack_reader);
+    SUITE_ADD_TEST(suite, test_bitpack_writer);
+    SUITE_ADD_TEST(suite, test_bitpack_bitbuf);
+    SUITE_ADD_TEST(suite, test_bitpack_huffman);
+    SUITE_ADD_TEST(suite, test_bitpack_rank_select);
+    SUITE_ADD_TEST(suite, test_bitpack_bitop);
+    SUITE_ADD_TEST(suite, test_bitpack_scan);
+    SUITE_ADD_TEST(suite, test_bitpack_fill_copy);
+    SUITE_ADD_TEST(suite, test_bitpack_insert_delete_shift);
+    SUITE_ADD_TEST(suite, test_bitpack_arena);
+    SUITE_ADD_TEST(suite, test_bitpack_inline_data);
 
     return suite;
 }
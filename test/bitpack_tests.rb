@@ -2,6 +2,7 @@
 $:.unshift File.join(File.dirname(__FILE__), '..', 'ext')
 require 'bitpack'
 
+require 'tempfile'
 require 'test/unit'
 
 class TC_BitPack < Test::Unit::TestCase
@@ -93,33 +94,32 @@ class TC_BitPack < Test::Unit::TestCase
 
     bp.set_bits(0xffffffff, 32, 16)
     assert_equal(48, bp.size)
-    assert_equal(6, bp.data_size)
+    assert_equal(8, bp.data_size)
     assert_equal("111111111011010111111111111111111111111111111111", bp.to_bin)
     assert_equal(0xffffffff, bp.get_bits(32, 16))
 
     bp.set_bits(0, 8, 0)
     assert_equal(48, bp.size)
-    assert_equal(6, bp.data_size)
+    assert_equal(8, bp.data_size)
     assert_equal("000000001011010111111111111111111111111111111111", bp.to_bin)
     assert_equal(0, bp.get_bits(8, 0))
 
-    unsigned_long_size = [1].pack("L").size
+    unsigned_long_size = [1].pack("L!").size
 
     # error cases
-    msg = sprintf("range size %d bits is too large (maximum size is %d bits)", unsigned_long_size * 8 + 1, unsigned_long_size * 8)
-    assert_raise RangeError, msg do
-      bp.set_bits(0, unsigned_long_size * 8 + 1, 0)
+    assert_raise ArgumentError, "value of 66 bits does not fit in 65 bits" do
+      bp.set_bits(2**65, unsigned_long_size * 8 + 1, 0)
     end
 
     assert_equal(48, bp.size)
-    assert_equal(6, bp.data_size)
+    assert_equal(8, bp.data_size)
     assert_equal("000000001011010111111111111111111111111111111111", bp.to_bin)
     
     assert_raise ArgumentError, "value 8 does not fit in 3 bits" do
       bp.set_bits(8, 3, 0)
     end
     assert_equal(48, bp.size)
-    assert_equal(6, bp.data_size)
+    assert_equal(8, bp.data_size)
     assert_equal("000000001011010111111111111111111111111111111111", bp.to_bin)
 
     assert_raise RangeError, "invalid index (48), max index is 47" do
@@ -134,11 +134,8 @@ class TC_BitPack < Test::Unit::TestCase
     bp.set_bits(0xffffffff, 32, 80)
     bp.set_bits(0xffffffff, 32, 112)
 
-    msg = sprintf("range size %d bits is too large (maximum size is %d bits)", unsigned_long_size * 8 + 1,
-                  unsigned_long_size * 8)
-    assert_raise RangeError, msg do
-      bp.get_bits(unsigned_long_size * 8 + 1, 0)
-    end
+    assert_equal(0x00b5ffffffffffff_ffffffffffffffff >> (128 - 65),
+                 bp.get_bits(unsigned_long_size * 8 + 1, 0))
   end
 
   def test_get_set_bytes
@@ -160,14 +157,14 @@ class TC_BitPack < Test::Unit::TestCase
 
     bp.set_bytes(test_bytes2, 24)
     assert_equal(48, bp.size)
-    assert_equal(6, bp.data_size)
+    assert_equal(8, bp.data_size)
     assert_equal("000000010000001000000011111111111111111011111101", bp.to_bin)
     assert_equal(test_bytes2, bp.get_bytes(3, 24))
 
     # non-byte aligned set
     bp.set_bytes(test_bytes3, 50)
     assert_equal(98, bp.size)
-    assert_equal(13, bp.data_size)
+    assert_equal(16, bp.data_size)
     assert_equal("00000001000000100000001111111111111111101111110100101010101011101111001100110111011110111011111111", bp.to_bin);
     assert_equal(test_bytes3, bp.get_bytes(6, 50))
 
@@ -179,6 +176,11 @@ class TC_BitPack < Test::Unit::TestCase
     assert_raise RangeError, "attempted to read past end of bitpack (last index is 97)" do
       bp.get_bytes(13, 0)
     end
+
+    # too long to allocate is still just out of range
+    assert_raise RangeError do
+      bp.get_bytes(2**45, 0)
+    end
   end
 
   def test_append_bits
@@ -204,7 +206,7 @@ class TC_BitPack < Test::Unit::TestCase
 
     bp.append_bits(0xffffffff, 32)
     assert_equal(48, bp.size)
-    assert_equal(6, bp.data_size)
+    assert_equal(8, bp.data_size)
     assert_equal("111111111011010111111111111111111111111111111111", bp.to_bin);
   end
 
@@ -225,14 +227,14 @@ class TC_BitPack < Test::Unit::TestCase
 
     bp.append_bytes(test_bytes2)
     assert_equal(48, bp.size)
-    assert_equal(6, bp.data_size)
+    assert_equal(8, bp.data_size)
     assert_equal("000000010000001000000011111111111111111011111101", bp.to_bin)
 
     # non-byte aligned set
     bp.append_bits(0, 2)
     bp.append_bytes(test_bytes3)
     assert_equal(98, bp.size)
-    assert_equal(13, bp.data_size)
+    assert_equal(16, bp.data_size)
     assert_equal("00000001000000100000001111111111111111101111110100101010101011101111001100110111011110111011111111", bp.to_bin);
   end
 
@@ -297,6 +299,11 @@ class TC_BitPack < Test::Unit::TestCase
     end
     assert_equal(98, bp.read_pos)
 
+    assert_raise RangeError do
+      bp.read_bytes(2**45)
+    end
+    assert_equal(98, bp.read_pos)
+
     bp.reset_read_pos
     assert_equal(0, bp.read_pos)
 
@@ -366,6 +373,613 @@ class TC_BitPack < Test::Unit::TestCase
     assert_equal(test_bytes2, bp.read_bytes(test_bytes2.length))
   end
 
+  def test_reserve
+    bp = BitPack.new(1)
+
+    bp.reserve(1000)
+    assert_equal(0, bp.size)
+    assert_equal(125, bp.data_size)
+
+    100.times { |i| bp.append_bits(i, 10) }
+    assert_equal(1000, bp.size)
+    assert_equal(125, bp.data_size)
+
+    bp.append_bits(1, 1)
+    assert_equal(250, bp.data_size)
+
+    bp.shrink_to_fit
+    assert_equal(1001, bp.size)
+    assert_equal(126, bp.data_size)
+
+    100.times { |i| assert_equal(i, bp.read_bits(10)) }
+    assert_equal(1, bp.read_bits(1))
+  end
+
+  def test_view
+    str = "BitPack" * 200
+    bp = BitPack.view(str)
+
+    assert(bp.read_only?)
+    assert_equal(str.size * 8, bp.size)
+    assert_equal("Bit", bp.read_bytes(3))
+    assert_equal(?P.ord, bp.read_bits(8))
+    assert_equal(str[-3..-1], bp.get_bytes(3, bp.size - 24))
+    assert_equal(str, bp.to_bytes)
+
+    # the view keeps its own reference to the original contents
+    str.replace("changed")
+    GC.start
+    assert_equal("BitPack" * 200, bp.to_bytes)
+
+    assert_raise RuntimeError, "bitpack is read-only" do
+      bp.on(0)
+    end
+    assert_raise RuntimeError, "bitpack is read-only" do
+      bp.append_bits(1, 1)
+    end
+
+    # short strings are copied, but the copy is read-only too
+    str = "ruby"
+    bp = BitPack.view(str)
+    assert(bp.read_only?)
+    assert_equal("01110010011101010110001001111001", bp.to_bin)
+    str.replace("changed")
+    assert_equal("ruby", bp.to_bytes)
+
+    assert_raise RuntimeError, "bitpack is read-only" do
+      bp.on(0)
+    end
+    assert_raise RuntimeError, "bitpack is read-only" do
+      bp.append_bits(1, 1)
+    end
+    assert_equal("ruby", bp.to_bytes)
+
+    assert(!BitPack.new.read_only?)
+  end
+
+  def test_signed_bits
+    bp = BitPack.new
+    bp.append_sbits(-1, 3)
+    bp.append_sbits(3, 3)
+    bp.append_sbits(-2**63, 64)
+    bp.set_sbits(-2, 4, 70)
+    assert_equal("111011", bp.to_bin[0, 6])
+    assert_equal(74, bp.size)
+
+    assert_equal(-1, bp.read_sbits(3))
+    assert_equal(3, bp.read_sbits(3))
+    assert_equal(-2**63, bp.read_sbits(64))
+    assert_equal(-2, bp.read_sbits(4))
+    assert_equal(14, bp.get_bits(4, 70))
+    assert_equal(-2, bp.get_sbits(4, 70))
+
+    assert_raise ArgumentError, "value 4 does not fit in 3 bits" do
+      bp.append_sbits(4, 3)
+    end
+    assert_raise ArgumentError, "value -5 does not fit in 3 bits" do
+      bp.append_sbits(-5, 3)
+    end
+
+    bp = BitPack.new
+    [0, -1, 1, -2, 2, -512, 511].each { |v| bp.append_zigzag(v, 10) }
+    assert_equal(3, bp.get_bits(10, 30))
+    assert_equal([0, -1, 1, -2, 2, -512, 511], (0...7).map { bp.read_zigzag(10) })
+
+    assert_raise ArgumentError do
+      bp.append_zigzag(512, 10)
+    end
+  end
+
+  def test_wide_bits
+    id = 0xfedcba98_76543210_0123456789abcdef
+
+    bp = BitPack.new
+    bp.append_bits(1, 3)
+    bp.append_bits(id, 128)
+    bp.append_bits(id >> 32, 96)
+    bp.append_bits(2**200 - 1, 200)
+    bp.set_bits(0x5, 70, 3)
+    assert_equal(3 + 128 + 96 + 200, bp.size)
+
+    assert_equal(1, bp.read_bits(3))
+    assert_equal((id & (2**58 - 1)) | (0x5 << 58), bp.read_bits(128))
+    assert_equal(id >> 32, bp.read_bits(96))
+    assert_equal(2**200 - 1, bp.get_bits(200, 3 + 128 + 96))
+    assert_equal(2**200 - 1, bp.read_bits(200))
+
+    assert_raise ArgumentError do
+      bp.append_bits(2**96, 96)
+    end
+    assert_raise ArgumentError do
+      bp.append_bits(-1, 96)
+    end
+    assert_raise RangeError do
+      bp.get_bits(300, 200)
+    end
+    assert_raise RangeError do
+      bp.get_bits(2**45, 0)
+    end
+    assert_raise RangeError do
+      bp.read_bits(2**45)
+    end
+    assert_raise RangeError do
+      bp.set_bits(1, 2**64 - 1, 2)
+    end
+    assert_equal(3 + 128 + 96 + 200, bp.size)
+  end
+
+  def test_text
+    bp = BitPack.from_bytes("ruby")
+    assert_equal("72756279", bp.to_hex)
+    assert_equal("cnVieQ==", bp.to_base64)
+
+    bp.append_bits(1, 1)
+    assert_equal("727562798", bp.to_hex)
+    assert_equal("cnVieYA=", bp.to_base64)
+
+    bp = BitPack.from_bin("011100100111010101100010011110011")
+    assert_equal(33, bp.size)
+    assert_equal("727562798", bp.to_hex)
+
+    bp = BitPack.from_hex("7275627")
+    assert_equal(28, bp.size)
+    assert_equal("0111001001110101011000100111", bp.to_bin)
+
+    assert_raise ArgumentError do
+      BitPack.from_bin("0120")
+    end
+    assert_raise ArgumentError do
+      BitPack.from_hex("xyz")
+    end
+  end
+
+  def test_array
+    bp = BitPack.new
+    bp.append_bits(1, 1)
+    bp.append_array([1, 2, 3, 4], 3)
+    assert_equal("1001010011100", bp.to_bin)
+
+    values = (0...1000).map { |i| (i * 7919) % 4096 }
+    bp.append_array(values, 12)
+    assert_equal(13 + 12000, bp.size)
+
+    assert_equal(1, bp.read_bits(1))
+    assert_equal([1, 2, 3, 4], bp.read_array(4, 3))
+    assert_equal(values, bp.read_array(1000, 12))
+    assert_equal(bp.size, bp.read_pos)
+
+    bp = BitPack.new
+    bp.append_array([0xffffffff], 32)
+    assert_equal([0xffffffff], BitPack.from_bytes(bp.to_bytes).read_array(1, 32))
+
+    assert_raise ArgumentError do
+      bp.append_array([1, 8], 3)
+    end
+    assert_raise ArgumentError do
+      bp.append_array([2**32], 32)
+    end
+    assert_raise RangeError do
+      bp.append_array([1], 33)
+    end
+    assert_raise RangeError do
+      bp.read_array(2, 32)
+    end
+    assert_raise RangeError do
+      bp.read_array(2**45, 8)
+    end
+    assert_raise RangeError do
+      bp.read_array(2**45, 0)
+    end
+    assert_raise TypeError do
+      bp.append_array([1, 2, "3"], 8)
+    end
+    assert_equal(32, bp.size)
+  end
+
+  def test_vlc
+    bp = BitPack.new
+    bp.append_vlc(:gamma, 5)
+    bp.append_vlc(:rice, 9, 2)
+    bp.append_vlc(:leb128, 300)
+    assert_equal("0010111001" + "1010110000000010", bp.to_bin)
+
+    values = [0, 1, 2, 100, 2**32, 2**63, 2**64 - 1]
+    bp.append_vlc_array(:leb128, values)
+    bp.append_vlc_array(:exp_golomb, values[0..5], 3)
+    bp.append_vlc_array(:delta, values[1..-1])
+
+    assert_equal(5, bp.read_vlc(:gamma))
+    assert_equal(9, bp.read_vlc(:rice, 2))
+    assert_equal(300, bp.read_vlc(:leb128))
+    assert_equal(values, bp.read_vlc_array(:leb128, 7))
+    assert_equal(values[0..5], bp.read_vlc_array(:exp_golomb, 6, 3))
+    assert_equal(values[1..-1], bp.read_vlc_array(:delta, 6))
+    assert_equal(bp.size, bp.read_pos)
+
+    assert_raise ArgumentError do
+      bp.append_vlc(:gamma, 0)
+    end
+    assert_raise ArgumentError do
+      bp.append_vlc_array(:delta, [1, 0])
+    end
+    assert_raise ArgumentError do
+      bp.append_vlc(:unary, 1)
+    end
+    assert_raise RangeError do
+      bp.append_vlc(:rice, 1, 64)
+    end
+
+    bp = BitPack.from_bin("00101001")
+    assert_raise RangeError do
+      bp.read_vlc_array(:gamma, 2)
+    end
+    assert_equal(0, bp.read_pos)
+  end
+
+  def test_bit_order
+    bp = BitPack.new(1, :lsb)
+    assert_equal(:lsb, bp.order)
+    bp.on(0)
+    bp.append_bits(2, 2)
+    bp.append_bits(0x1ff, 9)
+    assert_equal("101111111111", bp.to_bin)
+    assert_equal([0xfd, 0x0f].pack("C*"), bp.to_bytes)
+    assert_equal(0x1e, bp.get_bits(5, 1))
+
+    bp = BitPack.from_bytes([0x03, 0x00].pack("C*"))
+    assert_equal(:msb, bp.order)
+    bp.order = :lsb
+    assert_equal(1, bp.read_bits(1))
+    assert_equal(1, bp.read_bits(2))
+
+    [:msb, :lsb].each do |order|
+      bp = BitPack.new(1, order)
+      bp.append_le(0x123456, 3)
+      bp.append_be(0x123456, 3)
+      assert_equal([0x56, 0x34, 0x12, 0x12, 0x34, 0x56].pack("C*"), bp.to_bytes)
+      assert_equal(0x123456, bp.read_le(3))
+      assert_equal(0x123456, bp.read_be(3))
+      assert_equal(0x1234, bp.get_le(2, 8))
+      bp.set_be(0xabcd, 2, 4)
+      assert_equal(0xabcd, bp.get_be(2, 4))
+
+      assert_raise ArgumentError do
+        bp.append_le(0x10000, 2)
+      end
+      assert_raise RangeError do
+        bp.read_le(1)
+      end
+    end
+
+    assert_raise ArgumentError do
+      BitPack.new(1, :middle)
+    end
+  end
+
+  def test_reader
+    bp = BitPack.new
+    200.times { |i| bp.append_bits(i * 37 % 1024, 10) }
+    bp.append_bytes("ruby" * 50)
+    bp.append_bits(5, 3)
+
+    Tempfile.open("bitpack") do |f|
+      f.binmode
+      f.write(bp.to_bytes)
+      f.flush
+
+      [BitPack::Reader.new(File.open(f.path, "rb"), 16),
+       BitPack::Reader.mmap(File.open(f.path, "rb"))].each do |r|
+        200.times { |i| assert_equal(i * 37 % 1024, r.read_bits(10)) }
+        assert_equal("ruby" * 50, r.read_bytes(200))
+        assert_equal(3600, r.pos)
+
+        assert_raise RangeError do
+          r.read_bits(9)
+        end
+        assert_equal(3600, r.pos)
+        assert_equal(0xa0, r.read_bits(8))
+
+        assert_raise RangeError do
+          r.read_bytes(2**45)
+        end
+      end
+    end
+
+    # long runs are read in growing chunks
+    Tempfile.open("bitpack") do |f|
+      data = (0...300_000).map { |i| (i * 7 % 256).chr }.join
+      f.binmode
+      f.write(data)
+      f.flush
+
+      [BitPack::Reader.new(File.open(f.path, "rb")),
+       BitPack::Reader.mmap(File.open(f.path, "rb"))].each do |r|
+        assert_equal(data[0, 1], r.read_bytes(1))
+        assert_equal(data[1..-1], r.read_bytes(data.size - 1))
+      end
+    end
+
+    assert_raise_kind_of(SystemCallError) do
+      BitPack::Reader.mmap(File.open(Dir.tmpdir))
+    end
+
+    Tempfile.open("bitpack") do |f|
+      f.binmode
+      f.write([0x03].pack("C*"))
+      f.flush
+
+      r = BitPack::Reader.new(File.open(f.path, "rb"))
+      r.order = :lsb
+      assert_equal(1, r.read_bits(1))
+      assert_equal(1, r.read_bits(2))
+    end
+  end
+
+  def test_writer
+    bp = BitPack.new
+
+    Tempfile.open("bitpack") do |f|
+      f.binmode
+      w = BitPack::Writer.new(f, 16)
+
+      200.times do |i|
+        w.append_bits(i * 37 % 1024, 10)
+        bp.append_bits(i * 37 % 1024, 10)
+      end
+      w.append_bytes("ruby" * 50)
+      bp.append_bytes("ruby" * 50)
+      w.append_bits(5, 3)
+      bp.append_bits(5, 3)
+      assert_equal(3603, w.pos)
+
+      assert_raise ArgumentError do
+        w.append_bits(2, 1)
+      end
+
+      w.finish
+      assert_equal(3608, w.pos)
+      assert_equal(bp.to_bytes, File.binread(f.path))
+    end
+  end
+
+  def test_huffman
+    h = BitPack::Huffman.new([2, 1, 3, 3])
+
+    bp = BitPack.new
+    bp.append_huffman_array(h, [0, 1, 2, 3])
+    bp.append_huffman(h, 2)
+    assert_equal("100110111110", bp.to_bin)
+    assert_equal([0, 1, 2, 3], bp.read_huffman_array(h, 4))
+    assert_equal(2, bp.read_huffman(h))
+
+    assert_raise RangeError do
+      bp.read_huffman(h)
+    end
+    assert_raise ArgumentError do
+      bp.append_huffman(h, 4)
+    end
+    assert_raise ArgumentError do
+      BitPack::Huffman.new([1, 1, 1])
+    end
+    assert_raise TypeError do
+      BitPack::Huffman.new([1, "1"])
+    end
+    assert_raise TypeError do
+      bp.append_huffman(bp, 3)
+    end
+    assert_raise TypeError do
+      bp.read_huffman(BitPack::Schema.new([[:uint, 3]]))
+    end
+    assert_raise TypeError do
+      bp.append_huffman_array(h, [0, 1, "2"])
+    end
+
+    # "a" as a fixed Huffman DEFLATE block
+    fixed = BitPack::Huffman.new([8] * 144 + [9] * 112 + [7] * 24 + [8] * 8)
+    bp = BitPack.from_bytes([0x4b, 0x04, 0x00].pack("C*"))
+    bp.order = :lsb
+    assert_equal(3, bp.read_bits(3))
+    assert_equal(["a".ord, 256], bp.read_huffman_array(fixed, 2))
+  end
+
+  def test_rank_select
+    bp = BitPack.new
+    ones = []
+    5000.times do |i|
+      bit = (i * 7919) % 13 < 4 ? 1 : 0
+      bp.append_bits(bit, 1)
+      ones << i if bit == 1
+    end
+
+    assert_equal(0, bp.rank(0))
+    assert_equal(ones.size, bp.rank(5000))
+    assert_equal(ones.index { |i| i >= 2500 }, bp.rank(2500))
+    ones.each_with_index do |i, n|
+      assert_equal(i, bp.select(n)) if n % 37 == 0
+    end
+
+    assert_raise RangeError do
+      bp.select(ones.size)
+    end
+
+    bp.off(ones[0])
+    assert_equal(ones[1], bp.select(0))
+  end
+
+  def test_bitwise_ops
+    a = BitPack.from_bin("1100")
+    b = BitPack.from_bin("101010")
+
+    assert_equal("100000", (a & b).to_bin)
+    assert_equal("111010", (a | b).to_bin)
+    assert_equal("011010", (a ^ b).to_bin)
+    assert_equal("0011", (~a).to_bin)
+    assert_equal("1100", a.to_bin)
+
+    assert_raise TypeError do
+      a & BitPack::Schema.new([[:uint, 3]])
+    end
+
+    x = BitPack.new
+    y = BitPack.new(32, :lsb)
+    1000.times do |i|
+      x.append_bits((i * 7919) % 3 == 0 ? 1 : 0, 1)
+      y.append_bits((i * 104729) % 5 < 2 ? 1 : 0, 1)
+    end
+
+    z = x ^ y
+    assert_equal(:msb, z.order)
+    assert_equal(1000, z.size)
+    1000.times do |i|
+      assert_equal(x[i] ^ y[i], z[i]) if i % 7 == 0
+    end
+    assert_equal(x.to_bin, (z ^ y).to_bin)
+    assert_equal(0, (x & ~x).rank(1000))
+  end
+
+  def test_count_and_scan
+    bp = BitPack.from_bin("0110100")
+    assert_equal(3, bp.count)
+    assert_equal(2, bp.count(2, 3))
+    assert_equal(1, bp.count(3))
+    assert_equal(1, bp.next_set)
+    assert_equal(4, bp.next_set(3))
+    assert_nil(bp.next_set(5))
+    assert_equal([1, 2, 4], bp.each_set_bit.to_a)
+
+    assert_raise RangeError do
+      bp.count(5, 3)
+    end
+
+    bp = BitPack.new(32, :lsb)
+    ones = []
+    5000.times do |i|
+      bit = (i * 7919) % 13 < 4 ? 1 : 0
+      bp.append_bits(bit, 1)
+      ones << i if bit == 1
+    end
+
+    assert_equal(ones.size, bp.count)
+    seen = []
+    assert_same(bp, bp.each_set_bit { |i| seen << i })
+    assert_equal(ones, seen)
+  end
+
+  def test_fill_and_copy_range
+    bp = BitPack.from_bin("0000")
+    assert_same(bp, bp.fill_range(1, 5, 1))
+    assert_equal("011111", bp.to_bin)
+    bp.fill_range(2, 2, 0)
+    assert_equal("010011", bp.to_bin)
+
+    bp = BitPack.from_bin("110000")
+    bp.copy_range(3, bp, 0, 3)
+    assert_equal("110110", bp.to_bin)
+    src = BitPack.new(32, :lsb)
+    [0, 1, 0, 1].each { |b| src.append_bits(b, 1) }
+    bp.copy_range(0, src, 1, 3)
+    assert_equal("101110", bp.to_bin)
+
+    assert_raise RangeError do
+      bp.copy_range(0, bp, 4, 3)
+    end
+    assert_raise RangeError do
+      bp.fill_range(2**63, 2**63, 1)
+    end
+    assert_raise RangeError do
+      bp.copy_range(2**64 - 8, bp, 0, 8)
+    end
+    assert_raise TypeError do
+      bp.copy_range(0, BitPack::Schema.new([[:uint, 3]]), 0, 1)
+    end
+    assert_equal("101110", bp.to_bin)
+  end
+
+  def test_insert_delete_shift
+    bp = BitPack.from_bin("1111")
+    assert_same(bp, bp.insert_bits(2, 3, 2))
+    assert_equal("1101011", bp.to_bin)
+    bp.delete_range(1, 4)
+    assert_equal("111", bp.to_bin)
+
+    bp = BitPack.from_bin("110101")
+    assert_equal("010100", bp.shift_left(2).to_bin)
+    assert_equal("000101", bp.shift_right(2).to_bin)
+
+    assert_raise RangeError do
+      bp.delete_range(4, 3)
+    end
+    assert_raise RangeError do
+      bp.delete_range(4, 2**64 - 2)
+    end
+    assert_equal("000101", bp.to_bin)
+
+    assert_raise RangeError do
+      bp.insert_bits(1, 1, 7)
+    end
+  end
+
+  def test_record
+    s = BitPack::Schema.new([[:uint, 3], [:uint, 13], [:varbytes, 1],
+                             [:sint, 7], [:uint, 64], [:bytes, 2]])
+    m = "BitPack makes packing and unpacking binary strings easy!"
+
+    bp = BitPack.new
+    bp.append_record(s, [5, m.length, m, -3, 2**64 - 1, "ok"])
+    bp.append_record(s, [0, 0, "", 63, 0, "no"])
+
+    assert_equal([5, m.length, m, -3, 2**64 - 1, "ok"], bp.read_record(s))
+    assert_equal([0, 0, "", 63, 0, "no"], bp.read_record(s))
+    assert_equal(bp.size, bp.read_pos)
+
+    bp.reset_read_pos
+    assert_equal(5, bp.read_bits(3))
+    assert_equal(m.length, bp.read_bits(13))
+    assert_equal(m, bp.read_bytes(m.length))
+
+    size = bp.size
+    assert_raise ArgumentError do
+      bp.append_record(s, [8, 0, "", 0, 0, "no"])
+    end
+    assert_raise ArgumentError do
+      bp.append_record(s, [0, 0, "", -65, 0, "no"])
+    end
+    assert_raise ArgumentError do
+      bp.append_record(s, [0, 1, "", 0, 0, "no"])
+    end
+    assert_raise ArgumentError do
+      bp.append_record(s, [0, 0, ""])
+    end
+    assert_raise ArgumentError do
+      bp.append_record(s, [0, 2**13, "x" * 2**13, 0, 0, "no"])
+    end
+    assert_raise ArgumentError do
+      bp.append_record(BitPack::Schema.new([[:uint, 3], [:varbytes, 0]]), [5_000_000, "x" * 5_000_000])
+    end
+    assert_equal(size, bp.size)
+
+    assert_raise TypeError do
+      bp.append_record(BitPack.new, [])
+    end
+    assert_raise TypeError do
+      bp.read_record(BitPack.new(1000))
+    end
+
+    assert_raise RangeError do
+      BitPack.from_bytes("ab").read_record(s)
+    end
+
+    assert_raise ArgumentError do
+      BitPack::Schema.new([[:uint, 65]])
+    end
+    assert_raise ArgumentError do
+      BitPack::Schema.new([[:varbytes, 0]])
+    end
+    assert_raise ArgumentError do
+      BitPack::Schema.new([[:float, 32]])
+    end
+  end
+
   def test_assignment_index
     bp = BitPack.new
 